@@ -30,12 +30,26 @@
 #define ALIGN_SAM_SUB_STRAND_TAG "st"
 #define ALIGN_SAM_SUB_SEQ "su"
 #define ALIGN_SAM_PG_GDF "gd"
+#define ALIGN_SAM_READ_INDEX_TAG "ri" // Index of the read in the input, set with --shard
+#define ALIGN_SAM_PROFILE_SCORE_TAG "a" // Followed by the 1 based index of the profile in --profiles
+#define ALIGN_MAX_PROFILES 9
+
+// Automatic task sizing: aim for this many tasks per thread, with at most this many SIMD vectors per task
+#define ALIGN_TASKS_PER_THREAD 8
+#define ALIGN_MAX_CHUNK_VECTORS 16
 
 #include "cxxopts.hpp"
 #include "sam.h"
+#include "fasta.h"
 #include "graphman.h"
+#include "numa.h"
+#include "scoring.h"
 
+#include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <stdexcept>
+#include <unordered_map>
 
 
 // Forward decl to prevent main.cpp recompilation for alignment.h changes
@@ -44,6 +58,51 @@ namespace vargas {
   struct ScoreProfile;
 }
 
+/**
+ * @brief
+ * Selects one of N slices of the input, so N processes can each align a slice.
+ * Read i belongs to shard i % N.
+ */
+struct Shard {
+    unsigned index = 0;
+    unsigned count = 0; /**< 0 if not sharding: all reads, no read index tags */
+
+    bool contains(uint64_t read) const {
+        return count == 0 || read % count == index;
+    }
+};
+
+/**
+ * @brief
+ * Parse a shard given as "i/N", 0 <= i < N.
+ * @param spec Shard
+ * @return Shard
+ * @throws std::invalid_argument if malformed
+ */
+Shard parse_shard(const std::string &spec);
+
+/**
+ * @brief
+ * Placement of align workers over NUMA nodes. Each node used has its own copy of the graphs,
+ * allocated on that node.
+ */
+struct AlignPlacement {
+    vargas::numa::Placement workers;
+    std::vector<std::unique_ptr<vargas::GraphMan>> graphs; /**< Per node, null to use the shared graphs */
+};
+
+/**
+ * @brief
+ * Extra score profiles that reads are also scored under, see --profiles. Reads are aligned once
+ * more per profile. Profiles with the end to end mode of the main profile reuse the main aligner,
+ * the rest share a second aligner per worker. At most ALIGN_MAX_PROFILES, so tags stay two characters.
+ */
+struct AlignProfiles {
+    vargas::ScoreProfile main; /**< Profile of the main aligners, restored after the extra profiles */
+    std::vector<vargas::ScoreProfile> profs; /**< In order of --profiles */
+    std::vector<std::unique_ptr<vargas::AlignerBase, rg::Deleter>> aligners; /**< Per worker, for the other mode */
+};
+
 /**
  * Align given reads to specified target graphs.
  * @param argc command line argument count
@@ -64,12 +123,46 @@ int align_main(int argc, char *argv[]);
  * @param maxonly
  * @param notraceback
  * @param phred_offset
+ * @param ordered Write the batch in order of read index instead of as tasks finish
+ * @param placement Pin workers and align against the graphs of their node, optional
+ * @param profiles Extra profiles to score reads under, optional
  */
 void align(vargas::GraphMan &gm,
            std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> &task_list,
            vargas::osam &out,
            const std::vector<std::unique_ptr<vargas::AlignerBase, rg::Deleter>> &aligners,
-           bool fwdonly, bool msonly, bool maxonly, bool notraceback, char phred_offset);
+           bool fwdonly, bool msonly, bool maxonly, bool notraceback, char phred_offset, bool ordered = false,
+           const AlignPlacement *placement = nullptr, const AlignProfiles *profiles = nullptr);
+
+/**
+ * @brief
+ * Write records in order of their ALIGN_SAM_READ_INDEX_TAG. Records with the same index keep their order,
+ * which is the task scheduling order rather than the order of the targets.
+ * @param out Output
+ * @param records Records, all tagged
+ */
+void write_by_read_index(vargas::osam &out, const std::vector<const vargas::SAM::Record *> &records);
+
+/**
+ * @brief
+ * Align records to a subgraph and set their position, strand, CIGAR and score tags.
+ * @param gm GraphMan hosting the target graph
+ * @param label Target subgraph. Comma separated targets are aligned in one traversal of the base graph,
+ * and records are replaced by one copy per target, in order of the targets.
+ * @param records Reads, updated in place
+ * @param aligner Aligner constructed for at least the longest read
+ * @param fwdonly Only align to forward strand
+ * @param msonly Only set max score
+ * @param maxonly Do not set second best alignment tags
+ * @param notraceback Skip traceback on linear references
+ * @param phred_offset Quality offset, 33 or 64
+ * @param profiles Extra profiles to score reads under, their scores are set as ALIGN_SAM_PROFILE_SCORE_TAG tags.
+ * Single targets only, aligner must be built with profiles->main.
+ * @param other Aligner for the profiles whose end to end mode differs from profiles->main
+ */
+void align_task(vargas::GraphMan &gm, const std::string &label, std::vector<vargas::SAM::Record> &records,
+                vargas::AlignerBase &aligner, bool fwdonly, bool msonly, bool maxonly, bool notraceback,
+                char phred_offset, const AlignProfiles *profiles = nullptr, vargas::AlignerBase *other = nullptr);
 
 /**
  * @brief
@@ -77,11 +170,125 @@ void align(vargas::GraphMan &gm,
  * @param reads input read SAM stream
  * @param align_targets List of targets : RG:Subgraph
  * @param read_len Max readlen encountered
- * @param chunk_size Limit task size to N alignments
+ * @param chunk_size Limit task size to N alignments, 0 to size automatically
+ * @param threads Number of workers, for automatic sizing
+ * @param shard Only keep reads of this shard
+ * @param onepass Group the targets of a read group into one task, see the batch overload
+ * @return List of jobs of the form <subgraph label, [reads]>
+ */
+std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>>
+create_tasks(vargas::isam &reads, std::string &align_targets, int chunk_size, size_t &read_len, unsigned threads = 1,
+             const Shard &shard = Shard(), bool onepass = false);
+
+/**
+ * @brief
+ * Create a list of alignment jobs from a batch of records.
+ * @param reads_hdr Header of the reads, the ungrouped read group is added if needed
+ * @param records Reads, moved into the tasks
+ * @param align_targets List of targets : RG:Subgraph
+ * @param chunk_size Limit task size to N alignments, 0 to size automatically
+ * @param read_len Max readlen encountered
+ * @param verbose Print a summary of the tasks
+ * @param threads Number of workers, for automatic sizing
+ * @param onepass Group the targets of a read group into one task labeled with the comma separated
+ * targets, aligned in one traversal of the base graph. Up to SubgraphSet::max_size targets per task.
  * @return List of jobs of the form <subgraph label, [reads]>
  */
 std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>>
-create_tasks(vargas::isam &reads, std::string &align_targets, int chunk_size, size_t &read_len);
+create_tasks(vargas::SAM::Header &reads_hdr, std::vector<vargas::SAM::Record> &records,
+             std::string &align_targets, int chunk_size, size_t &read_len, bool verbose = true, unsigned threads = 1,
+             bool onepass = false);
+
+/**
+ * @param gm GraphMan hosting the targets
+ * @param label Target subgraph, or comma separated targets of a one pass task
+ * @return Bases in the target graphs
+ */
+size_t graph_length(vargas::GraphMan &gm, const std::string &label);
+
+/**
+ * @brief
+ * Pick a task size. An explicit size is rounded up to a multiple of the SIMD width so no task
+ * leaves lanes empty except the last of a read group. Otherwise the size targets
+ * ALIGN_TASKS_PER_THREAD tasks per thread, between one and ALIGN_MAX_CHUNK_VECTORS vectors.
+ * @param chunk_size Requested size, 0 for automatic
+ * @param num_reads Number of reads to partition
+ * @param threads Number of workers
+ * @param lanes Reads per SIMD vector
+ * @return Task size in reads
+ */
+size_t chunk_size_for(size_t chunk_size, size_t num_reads, unsigned threads, unsigned lanes);
+
+/**
+ * @brief
+ * Estimated cost of aligning a task: DP cells including empty lanes of the last vector.
+ * @param num_reads Reads in the task
+ * @param rows Longest read in the task
+ * @param graph_len Bases in the target graph
+ * @param lanes Reads per SIMD vector
+ * @return Relative cost
+ */
+inline uint64_t task_cost(size_t num_reads, size_t rows, size_t graph_len, unsigned lanes) {
+    const uint64_t vectors = (num_reads + lanes - 1) / lanes;
+    return vectors * lanes * rows * graph_len;
+}
+
+/**
+ * @brief
+ * Order tasks by decreasing estimated cost. kt_forpool deals tasks to workers round robin and idle
+ * workers steal from the least advanced worker, so the largest tasks start first and the small ones
+ * fill in at the end.
+ * @param task_list Tasks to reorder
+ * @param graph_len Bases in each target graph, by label
+ * @param lanes Reads per SIMD vector
+ */
+void schedule_tasks(std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> &task_list,
+                    const std::unordered_map<std::string, size_t> &graph_len, unsigned lanes);
+
+/**
+ * @brief
+ * Construct an object with 64 byte alignment, for SIMD members. Release with rg::Deleter.
+ * @tparam T type to construct
+ * @param args constructor arguments
+ * @return pointer to new object
+ */
+template<typename T, typename...Args>
+T *construct_aligned(Args &&...args) {
+    static constexpr size_t alignment = 64; // AVX512
+    T *ptr;
+    if(posix_memalign(reinterpret_cast<void **>(&ptr), alignment, sizeof(T))) throw std::bad_alloc();
+    return new(ptr) T(std::forward<Args>(args)...);
+}
+
+/**
+ * @brief
+ * Build a score profile from the align scoring options.
+ * @param match Match bonus
+ * @param npenalty Penalty for non-A/C/G/T
+ * @param mismatch "MIN,MAX" or "N" mismatch penalty
+ * @param rdg "OPEN,EXT" read gap penalty
+ * @param rfg "OPEN,EXT" reference gap penalty
+ * @return Local alignment profile
+ * @throws std::invalid_argument on malformed penalties
+ */
+vargas::ScoreProfile parse_score_profile(unsigned match, unsigned npenalty, const std::string &mismatch,
+                                         const std::string &rdg, const std::string &rfg);
+
+/**
+ * @brief
+ * Narrowest cell width that holds the score range of the longest read. Long reads
+ * overflow 16 bits and use the 32 bit aligner.
+ * @param prof Score profile
+ * @param read_len Longest read
+ * @return 8, 16, or 32
+ */
+unsigned aligner_width(const vargas::ScoreProfile &prof, size_t read_len);
+
+/**
+ * @param width Cell width from aligner_width()
+ * @return Reads per SIMD vector of aligners of that width
+ */
+unsigned aligner_lanes(unsigned width);
 
 /**
  * @brief
@@ -89,12 +296,12 @@ create_tasks(vargas::isam &reads, std::string &align_targets, int chunk_size, si
  * @param prof Score profile
  * @param node_len Maximum node length of graph
  * @param read_len Read length
- * @param use_wide use 16 bit cell elements instead of 8 bit
+ * @param width Cell width in bits, see aligner_width()
  * @param end_to_end End to end alignment
  * @return pointer to new aligner
  */
 std::unique_ptr<vargas::AlignerBase, rg::Deleter>
-make_aligner(const vargas::ScoreProfile &prof, size_t read_len, bool use_wide, bool msonly, bool maxonly);
+make_aligner(const vargas::ScoreProfile &prof, size_t read_len, unsigned width, bool msonly, bool maxonly);
 
 /**
  * @brief
@@ -106,6 +313,33 @@ make_aligner(const vargas::ScoreProfile &prof, size_t read_len, bool use_wide, b
  */
 void load_fast(std::string &file, bool fastq, vargas::isam &ret, bool p64=false);
 
+/**
+ * @brief
+ * Load up to n records from a FASTA or FASTQ stream.
+ * @param in Input stream
+ * @param fastq Keep qualities
+ * @param batch Records are stored here, resized to the number read
+ * @param n Maximum number of records
+ * @param p64 Phred+64 encoding
+ * @return Number of records read, 0 at end of input
+ */
+size_t load_fast(vargas::ifastx &in, bool fastq, std::vector<vargas::SAM::Record> &batch, size_t n, bool p64=false);
+
+/**
+ * @brief
+ * Load up to n records of a shard from a FASTA or FASTQ stream. Reads of other shards are skipped.
+ * @param in Input stream
+ * @param fastq Keep qualities
+ * @param batch Records are stored here, resized to the number read
+ * @param n Maximum number of records
+ * @param p64 Phred+64 encoding
+ * @param shard Shard to keep, records are tagged with their read index
+ * @param next_read Index of the next read in the stream, advanced past the reads consumed
+ * @return Number of records read, 0 at end of input
+ */
+size_t load_fast(vargas::ifastx &in, bool fastq, std::vector<vargas::SAM::Record> &batch, size_t n, bool p64,
+                 const Shard &shard, uint64_t &next_read);
+
 /**
  * Read file format type.
  */
@@ -113,12 +347,21 @@ enum class ReadFmt {SAM, FASTQ, FASTA};
 
 /**
  * @brief
- * Identity read file type
+ * Identity read file type. Files ending in ".bam" are read as SAM.
  * @param filename
  * @return SAM, FASTA, or FASTQ
  */
 ReadFmt read_fmt(const std::string& filename);
 
+/**
+ * @brief
+ * Add a sequence line for each graph contig not already in the header.
+ * BAM output requires every reference name to be defined.
+ * @param gm Graph manager
+ * @param hdr SAM header to add to
+ */
+void add_contigs(const vargas::GraphMan &gm, vargas::SAM::Header &hdr);
+
 void align_help(const cxxopts::Options &opts);
 
 
@@ -0,0 +1,251 @@
+/**
+ * @brief
+ * Optional per thread instrumentation of the aligner. Built with -DVA_ALIGN_STATS=1
+ * (cmake -DBUILD_ALIGN_STATS=ON), otherwise the VA_STATS_* macros expand to nothing.
+ *
+ * @details
+ * Each worker binds its own ThreadStats with VA_STATS_BIND, so counters are
+ * written without synchronization. Totals are merged when the summary is written.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#ifndef VARGAS_ALIGN_STATS_H
+#define VARGAS_ALIGN_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#ifndef VA_ALIGN_STATS
+#define VA_ALIGN_STATS 0
+#endif
+
+namespace vargas {
+  namespace stats {
+
+    enum Phase : unsigned {
+        LOAD, /**< Reading input, or copying reads out of records */
+        PACK, /**< Building the query profile */
+        FILL, /**< DP fill over the graph */
+        TRACEBACK, /**< Scalar traceback for linear references */
+        FORMAT, /**< Setting record fields and tags */
+        LOCK_WAIT, /**< Waiting for the output mutex */
+        OUTPUT, /**< Writing records, holding the output mutex */
+        NUM_PHASES
+    };
+
+    /**
+     * @return JSON key of the phase
+     */
+    const char *phase_name(Phase p);
+
+    /**
+     * @brief
+     * Counters of one thread. Padded to a cache line to avoid false sharing between workers.
+     */
+    struct ThreadStats {
+        uint64_t ns[NUM_PHASES] = {}; /**< Nanoseconds spent in each phase */
+        uint64_t tasks = 0;
+        uint64_t reads = 0;
+        uint64_t cells = 0; /**< DP cells, read length * reference length * strands */
+        uint64_t vectors = 0; /**< SIMD read groups aligned */
+        uint64_t lanes = 0; /**< Lanes holding a read */
+        uint64_t lane_capacity = 0; /**< Lanes available, vectors * read_capacity() */
+        char _pad[64];
+
+        /**
+         * @return Filled lanes / available lanes, 0 if nothing was aligned
+         */
+        double lane_utilization() const {
+            return lane_capacity ? double(lanes) / lane_capacity : 0;
+        }
+
+        double seconds(Phase p) const {
+            return ns[p] * 1e-9;
+        }
+
+        ThreadStats &operator+=(const ThreadStats &o);
+    };
+
+    /**
+     * @brief
+     * Holds the counters of all threads for a run. One instance is shared by the process, see recorder().
+     */
+    class Recorder {
+      public:
+
+        /**
+         * @brief
+         * Clear all counters and size for the given number of workers.
+         * @param nthreads Number of workers
+         */
+        void reset(unsigned nthreads);
+
+        /**
+         * @brief
+         * Grow the number of workers, keeping counters.
+         * @param nthreads Number of workers
+         */
+        void reserve(unsigned nthreads) {
+            if (nthreads > _threads.size()) _threads.resize(nthreads);
+        }
+
+        ThreadStats &thread(unsigned tid) {
+            return _threads[tid];
+        }
+
+        /**
+         * @return Counters of the coordinating thread, e.g. input loading.
+         */
+        ThreadStats &main() {
+            return _main;
+        }
+
+        /**
+         * @param s Seconds of wall time to add
+         */
+        void add_wall(double s) {
+            _wall += s;
+        }
+
+        double wall() const {
+            return _wall;
+        }
+
+        /**
+         * @return Sum of main and all worker counters
+         */
+        ThreadStats total() const;
+
+        /**
+         * @brief
+         * Write a JSON summary: totals, throughput, and per thread counters.
+         * @param os Output stream
+         */
+        void write_json(std::ostream &os) const;
+
+        /**
+         * @brief
+         * Reads finished by all workers, updated once per task so a progress reporter can poll it.
+         */
+        std::atomic<uint64_t> reads_done{0};
+
+      private:
+        std::vector<ThreadStats> _threads;
+        ThreadStats _main;
+        double _wall = 0;
+    };
+
+    /**
+     * @return Process wide recorder
+     */
+    Recorder &recorder();
+
+    /**
+     * @return Counters bound to the calling thread, nullptr if none.
+     */
+    inline ThreadStats *&current() {
+        static thread_local ThreadStats *s = nullptr;
+        return s;
+    }
+
+    /**
+     * @brief
+     * Bind counters to the calling thread for the lifetime of the guard.
+     */
+    class Bind {
+      public:
+        explicit Bind(ThreadStats &s) : _prev(current()) {
+            current() = &s;
+        }
+        ~Bind() {
+            current() = _prev;
+        }
+        Bind(const Bind &) = delete;
+        Bind &operator=(const Bind &) = delete;
+      private:
+        ThreadStats *_prev;
+    };
+
+    /**
+     * @brief
+     * Add the lifetime of the timer to a phase of the bound counters.
+     */
+    class ScopedTimer {
+      public:
+        explicit ScopedTimer(Phase p) : ScopedTimer(p, p) {}
+
+        /**
+         * @param p Phase to add to
+         * @param exclude Time added to this phase while the timer is alive is not counted towards p
+         */
+        ScopedTimer(Phase p, Phase exclude) : _p(p), _ex(exclude), _start(std::chrono::steady_clock::now()) {
+            ThreadStats *s = current();
+            _ex_start = s && _ex != _p ? s->ns[_ex] : 0;
+        }
+
+        ~ScopedTimer() {
+            if (ThreadStats *s = current()) {
+                uint64_t d = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start).count();
+                if (_ex != _p) d -= std::min(d, s->ns[_ex] - _ex_start);
+                s->ns[_p] += d;
+            }
+        }
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+      private:
+        Phase _p, _ex;
+        std::chrono::steady_clock::time_point _start;
+        uint64_t _ex_start;
+    };
+
+    /**
+     * @brief
+     * Prints a line with reads done and throughput to stderr every interval while alive.
+     */
+    class Progress {
+      public:
+        /**
+         * @param rec Recorder to poll
+         * @param interval Seconds between lines, no lines if <= 0
+         */
+        Progress(const Recorder &rec, double interval);
+        ~Progress();
+        Progress(const Progress &) = delete;
+        Progress &operator=(const Progress &) = delete;
+      private:
+        struct Impl;
+        Impl *_impl = nullptr;
+    };
+
+  }
+}
+
+#define VA_STATS_CAT_(a, b) a##b
+#define VA_STATS_CAT(a, b) VA_STATS_CAT_(a, b)
+
+#if VA_ALIGN_STATS
+#define VA_STATS_BIND(s) vargas::stats::Bind VA_STATS_CAT(_va_bind_, __LINE__)(s)
+#define VA_STATS_TIMER(phase) vargas::stats::ScopedTimer VA_STATS_CAT(_va_timer_, __LINE__)(vargas::stats::phase)
+#define VA_STATS_TIMER_EXCL(phase, exclude) \
+    vargas::stats::ScopedTimer VA_STATS_CAT(_va_timer_, __LINE__)(vargas::stats::phase, vargas::stats::exclude)
+#define VA_STATS_ADD(field, n) do { if (vargas::stats::ThreadStats *_va_s = vargas::stats::current()) _va_s->field += (n); } while (0)
+#define VA_STATS_ONLY(...) __VA_ARGS__
+#else
+#define VA_STATS_BIND(s) do {} while (0)
+#define VA_STATS_TIMER(phase) do {} while (0)
+#define VA_STATS_TIMER_EXCL(phase, exclude) do {} while (0)
+#define VA_STATS_ADD(field, n) do {} while (0)
+#define VA_STATS_ONLY(...)
+#endif
+
+#endif //VARGAS_ALIGN_STATS_H
@@ -24,6 +24,8 @@
 
 #include "scoring.h"
 #include "utils.h"
+#include "arena.h"
+#include "align_stats.h"
 #include "simd.h"
 #include "graph.h"
 #include "doctest.h"
@@ -35,6 +37,8 @@
 #include <cstdlib>
 #include <string>
 #include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 
 #define VARGAS_ALIGN_DEBUG_SW 0 // Print SW Grids for each node
 #define VARGAS_ALIGN_DEBUG_QP 0  // Print Query profile
@@ -72,6 +76,21 @@ namespace vargas {
                               const std::vector<std::vector<char>> &,
                               Graph::const_iterator, Graph::const_iterator, Results &, bool) = 0;
 
+      /**
+       * @brief
+       * Align a batch of reads to several subgraphs in one traversal of their parent graph.
+       * Each subgraph keeps its own seeds and best scores, so results are the same as aligning
+       * to each subgraph separately, while the reads are packed once and each node is visited once.
+       * @param read_group vector of reads to align to
+       * @param quals Quality values
+       * @param targets Subgraphs to align to
+       * @param aligns Results packet for each subgraph, in order of targets
+       * @param fwdonly Only align to forward strand
+       */
+      virtual void align_into(const std::vector<std::string> &,
+                              const std::vector<std::vector<char>> &,
+                              const SubgraphSet &, std::vector<Results> &, bool) = 0;
+
       /**
        * @brief
        * Align a batch of reads to a graph range, return a vector of alignments
@@ -88,8 +107,14 @@ namespace vargas {
           return aligns;
       }
 
+      /**
+       * @return Number of reads aligned per SIMD vector
+       */
+      virtual unsigned lanes() const = 0;
+
     protected:
       ScoreProfile _prof;
+      Arena _arena; /**< Scratch memory of the aligner, constructed before any derived member */
 
       /**
        * @brief
@@ -98,11 +123,22 @@ namespace vargas {
       template<typename st>
       struct _seed {
           _seed() = delete;
-          explicit _seed(const unsigned _read_len) : S_col(_read_len + 1), I_col(_read_len + 1) {}
+          _seed(const unsigned _read_len, Arena *arena) :
+          S_col(_read_len + 1, st(), typename SIMDVector<st>::allocator_type(arena)),
+          I_col(_read_len + 1, st(), typename SIMDVector<st>::allocator_type(arena)) {}
           SIMDVector<st> S_col; /**< Last column of score matrix.*/
           SIMDVector<st> I_col;
+          unsigned pending = 0; /**< Successors that have not read the seed yet */
       };
 
+      /**
+       * @brief
+       * Node ID to seed map, with nodes allocated from the arena.
+       */
+      template<typename st>
+      using _seed_map = std::unordered_map<unsigned, _seed<st>, std::hash<unsigned>, std::equal_to<unsigned>,
+                                           aligned_allocator<std::pair<const unsigned, _seed<st>>, VA_ARENA_ALIGN>>;
+
   };
   inline AlignerBase::~AlignerBase() = default;
 
@@ -139,7 +175,7 @@ namespace vargas {
    * // ATTA, score:8 pos:18
    * // CCNT, score:8 pos:80
    * @endcode
-   * @tparam simd_t data type of score matrix element. One of SIMD<uint8_t>, SIMD<uint16_t>
+   * @tparam simd_t data type of score matrix element. One of SIMD<uint8_t>, SIMD<uint16_t>, SIMD<int32_t>
    * @tparam END_TO_END If true, perform end to end alignment
    * @tparam MSONLY Only collect max score- no positions or subscores
    * @tparam MAXONLY Only collect max score, max position, and count (no subscore)
@@ -160,10 +196,18 @@ namespace vargas {
        */
       using qp_t = std::vector<std::array<simd_t, 5>, aligned_allocator<std::array<simd_t, 5>, simd_t::size>>;
 
+      /**
+       * @brief
+       * Per-read positions and counts, one 32 bit lane for each score lane.
+       */
+      using lanes_t = Lanes32<simd_t::length>;
+
       AlignerT(unsigned read_len, const ScoreProfile &prof) :
-      _alignment_group(read_len),
-      _S(read_len + 1), _Dc(read_len + 1), _Ic(read_len + 1),
-      _read_len(read_len) {
+      _alignment_group(read_len, &_arena),
+      _S(read_len + 1, simd_t(), typename SIMDVector<simd_t>::allocator_type(&_arena)),
+      _Dc(read_len + 1, simd_t(), typename SIMDVector<simd_t>::allocator_type(&_arena)),
+      _Ic(read_len + 1, simd_t(), typename SIMDVector<simd_t>::allocator_type(&_arena)),
+      _read_len_v(read_len), _read_len(read_len) {
           set_scores(prof); // May throw
       }
 
@@ -191,35 +235,81 @@ namespace vargas {
        * @details
        * Reads are interleaved so each SIMD vector
        * contains bases from all reads, respective to the base number. For example AlignmentGroup[0]
-       * would contain the first bases of every read. All reads must be the same length. Minimal error checking.
+       * would contain the first bases of every read. Short reads are left padded. Minimal error checking.
        */
       class AlignmentGroup {
         public:
 
-          explicit AlignmentGroup(unsigned read_len) : _query_prof(read_len), _rd_ln(read_len) {}
+          /**
+           * @param read_len Maximum read length
+           * @param arena Arena to allocate the profile from, nullptr for the heap
+           */
+          explicit AlignmentGroup(unsigned read_len, Arena *arena = nullptr) :
+          _query_prof(read_len, typename qp_t::value_type(), typename qp_t::allocator_type(arena)),
+          _bases(read_len, simd_t(), typename SIMDVector<simd_t>::allocator_type(arena)),
+          _mismatch(read_len, simd_t(), typename SIMDVector<simd_t>::allocator_type(arena)), _rd_ln(read_len) {
+              _lens.fill(0);
+              _penalty_lut.fill(0);
+          }
           AlignmentGroup() = delete;
 
+          /**
+           * @brief
+           * Cache the scoring parameters used to build query profiles.
+           * @param prof ScoreProfile
+           */
+          void set_scores(const ScoreProfile &prof) {
+              _match = prof.match;
+              _ambig = -native_t(prof.ambig);
+              _mismatch_max = -native_t(prof.mismatch_max);
+              const auto lut = prof.penalty_lut();
+              for (unsigned i = 0; i < lut.size(); ++i) _penalty_lut[i] = -native_t(lut[i]);
+          }
+
           /**
            * @param batch load the given vector of reads.
            */
           void load_reads(const std::vector<std::string> &batch,
                           const std::vector<std::vector<char>> &quals,
-                          const ScoreProfile &prof,
-                          size_t begin, size_t end,
-                          bool revcomp) {
-              std::vector<std::vector<rg::Base>> _reads;
-              for (auto &b : batch) _reads.push_back(rg::seq_to_num(b));
-              _package_reads(_reads, quals, prof, revcomp, begin, end);
+                          size_t begin, size_t end) {
+              _package_reads(batch, quals, begin, end);
           }
 
           /**
            * @param batch load the given vector of reads.
            */
           void load_reads(const std::vector<std::vector<rg::Base>> &batch,
-                          const std::vector<std::vector<char>> &quals,
-                          const ScoreProfile &prof,
-                          bool revcomp) {
-              _package_reads(batch, quals, prof, revcomp, 0, batch.size());
+                          const std::vector<std::vector<char>> &quals) {
+              _package_reads(batch, quals, 0, batch.size());
+          }
+
+          /**
+           * @brief
+           * Convert the loaded forward profile to the reverse complement profile in place.
+           * @details
+           * Row i of the reverse complement is row (len - 1 - i) of the forward profile with
+           * the reference bases permuted A<->T, C<->G; the N column is unchanged. Lanes holding
+           * reads shorter than the read length are shifted back behind their padding.
+           */
+          void reverse_complement() {
+              for (unsigned lo = 0; lo < (_rd_ln + 1) / 2; ++lo) {
+                  const unsigned hi = _rd_ln - 1 - lo;
+                  const typename qp_t::value_type fwd_lo = _query_prof[lo], fwd_hi = _query_prof[hi];
+                  _complement_row(fwd_hi, _query_prof[lo]);
+                  _complement_row(fwd_lo, _query_prof[hi]);
+              }
+
+              // Ragged lanes now have their padding at the end
+              for (unsigned lane = 0; lane < group_size(); ++lane) {
+                  const unsigned pad = _rd_ln - _lens[lane];
+                  if (pad == 0 || pad == _rd_ln) continue;
+                  for (unsigned p = _rd_ln - 1; p >= pad; --p) {
+                      for (unsigned b = 0; b < 5; ++b) _query_prof[p][b][lane] = _query_prof[p - pad][b][lane];
+                  }
+                  for (unsigned p = 0; p < pad; ++p) {
+                      for (unsigned b = 0; b < 5; ++b) _query_prof[p][b][lane] = 0;
+                  }
+              }
           }
 
           typename qp_t::value_type &at(const unsigned i) const {
@@ -261,94 +351,92 @@ namespace vargas {
 
         private:
           qp_t _query_prof;
+          SIMDVector<simd_t> _bases, _mismatch; // Interleaved read bases and negated mismatch penalties
+          std::array<unsigned, simd_t::length> _lens; // Read length of each lane
+          std::array<native_t, std::tuple_size<ScoreProfile::penalty_lut_t>::value> _penalty_lut;
+          native_t _match = 0, _ambig = 0, _mismatch_max = 0;
           const unsigned _rd_ln;
 
+          // Marks lanes in the left padding, or lanes without a read
+          static constexpr native_t _pad = 5;
+
+          static void _complement_row(const typename qp_t::value_type &src, typename qp_t::value_type &dst) {
+              dst[rg::Base::N] = src[rg::Base::N];
+              dst[rg::Base::A] = src[rg::Base::T];
+              dst[rg::Base::C] = src[rg::Base::G];
+              dst[rg::Base::G] = src[rg::Base::C];
+              dst[rg::Base::T] = src[rg::Base::A];
+          }
+
+          static rg::Base _to_base(const char c) { return rg::base_to_num(c); }
+          static rg::Base _to_base(const rg::Base b) { return b; }
+
           /**
            * Interleaves reads so all same-index base positions are in one
-           * vector. Empty spaces are padded with Base::N.
+           * vector. Padding scores 0 against every reference base.
+           * @details
+           * Only the read base and the mismatch penalty are scattered per lane, the
+           * profile itself is built with one compare and blend per reference base.
            * @param reads vector of reads to package
            * @param quals Quality values for reads, Phred
-           * @param prof ScoreProfile
-           * @param revcomp Use reverse complement
+           * @param vstart first read in the group
+           * @param vend one past the last read in the group
            */
-          void _package_reads(const std::vector<std::vector<rg::Base>> &reads,
+          template<typename Seq>
+          void _package_reads(const std::vector<Seq> &reads,
                               const std::vector<std::vector<char>> &quals,
-                              const ScoreProfile &prof,
-                              bool revcomp, const size_t vstart, const size_t vend) {
+                              const size_t vstart, const size_t vend) {
               assert(vend - vstart <= group_size());
               static constexpr std::array<rg::Base, 4> bases = {rg::Base::A, rg::Base::C, rg::Base::G, rg::Base::T};
-              // Interleave reads
-              // For each read (read[i] is in _packaged_reads[0..n][i]
+              static constexpr int max_phred = std::tuple_size<ScoreProfile::penalty_lut_t>::value - 1;
 
-              const int inc = revcomp ? -1 : 1;
+              std::fill(_bases.begin(), _bases.end(), simd_t(_pad));
+              std::fill(_mismatch.begin(), _mismatch.end(), simd_t(native_t(0)));
+              _lens.fill(0);
 
               for (size_t r = vstart; r < vend; ++r) {
-                  const unsigned qidx = r - vstart;
-
-                  // Prepend short reads with 0
-                  int pos = _rd_ln - reads[r].size();
-                  for (int i = 0; i < pos; ++i) {
-                      for (auto b : bases) _query_prof[i][b][r] = 0;
+                  const unsigned lane = r - vstart;
+                  const auto &read = reads[r];
+                  assert(read.size() <= _rd_ln);
+                  const unsigned pad = _rd_ln - read.size();
+                  _lens[lane] = read.size();
+                  if (quals.empty() || quals[r].empty()) {
+                      for (unsigned p = 0; p < read.size(); ++p) {
+                          _bases[pad + p][lane] = _to_base(read[p]);
+                          _mismatch[pad + p][lane] = _mismatch_max;
+                      }
+                  } else {
+                      const auto &qual = quals[r];
+                      for (unsigned p = 0; p < read.size(); ++p) {
+                          const int q = qual[p] < 0 ? 0 : (qual[p] > max_phred ? max_phred : qual[p]);
+                          _bases[pad + p][lane] = _to_base(read[p]);
+                          _mismatch[pad + p][lane] = _penalty_lut[q];
+                      }
                   }
+              }
 
-                  const int start = revcomp ? reads[r].size() - 1 : 0;
-                  const int end = revcomp ? -1 : reads[r].size();
-
-                  // Store in index pos, run through bases from idx start --> end based on revcomp
-                  for (int p = start; p != end; p += inc) {
-                      const auto rdb = revcomp ? rg::complement_b(reads[r][p]) : reads[r][p];
-                      _query_prof[pos][rg::Base::N][qidx] = -prof.ambig;
-                      for (auto b : bases) {
-                          if (rdb == rg::Base::N) _query_prof[pos][b][qidx] = -prof.ambig;
-                          else if (rdb == b) _query_prof[pos][b][qidx] = prof.match;
-                          else if (quals.empty() || quals[r].empty()) _query_prof[pos][b][qidx] = -prof.mismatch_max;
-                          else _query_prof[pos][b][qidx] = -prof.penalty(quals[r][p]);
-                      }
-                      ++pos;
+              const simd_t pad_v = _pad, n_v = native_t(rg::Base::N), zero_v = native_t(0);
+              const simd_t match_v = _match, ambig_v = _ambig;
+              for (unsigned p = 0; p < _rd_ln; ++p) {
+                  const simd_t &rb = _bases[p];
+                  auto &row = _query_prof[p];
+                  const auto is_n = rb == n_v;
+                  for (auto b : bases) {
+                      row[b] = blend(is_n, ambig_v, blend(rb == simd_t(native_t(b)), match_v, _mismatch[p]));
                   }
+                  row[rg::Base::N] = blend(rb == pad_v, zero_v, ambig_v);
               }
 
               #if VARGAS_ALIGN_DEBUG_QP
               // Print query profile
-              std::cerr << "\nQuery Profile (" << VARGAS_ALIGN_DEBUG_N << "), Reverse: " << revcomp
-                        << ". MP=Mismatch, P=Phred." << std::endl;
-              for (unsigned i = 0; i < _rd_ln - reads[vstart + VARGAS_ALIGN_DEBUG_N].size(); ++i) std::cerr << "\t-";
-              for (auto b : reads[vstart + VARGAS_ALIGN_DEBUG_N]) std::cerr << "\t" << rg::num_to_base(b);
-
-              if (quals.size()) {
-                  std::cerr << std::endl << "P";
-                  for (unsigned i = 0; i < _rd_ln - reads[vstart + VARGAS_ALIGN_DEBUG_N].size(); ++i)
-                      std::cerr << "\t-";
-                  for (auto b : quals[vstart + VARGAS_ALIGN_DEBUG_N]) std::cerr << "\t" << (int) b;
-                  std::cerr << std::endl << "MP";
-                  for (unsigned i = 0; i < _rd_ln - reads[vstart + VARGAS_ALIGN_DEBUG_N].size(); ++i)
-                      std::cerr << "\t-";
-                  for (auto b : quals[vstart + VARGAS_ALIGN_DEBUG_N]) std::cerr << "\t" << int(prof.penalty(b));
-              }
-
-              std::cerr << std::endl << "A\t";
-              for (unsigned i = 0; i < _rd_ln; ++i) {
-                  std::cerr << (int)_query_prof[i][rg::Base::A][VARGAS_ALIGN_DEBUG_N] << '\t';
-              }
-              std::cerr << std::endl << "C\t";
-
-              for (unsigned i = 0; i < _rd_ln; ++i) {
-                  std::cerr << (int)_query_prof[i][rg::Base::C][VARGAS_ALIGN_DEBUG_N] << '\t';
-              }
-              std::cerr << std::endl << "G\t";
-
-              for (unsigned i = 0; i < _rd_ln; ++i) {
-                  std::cerr << (int)_query_prof[i][rg::Base::G][VARGAS_ALIGN_DEBUG_N] << '\t';
-              }
-              std::cerr << std::endl << "T\t";
-
-              for (unsigned i = 0; i < _rd_ln; ++i) {
-                  std::cerr << (int)_query_prof[i][rg::Base::T][VARGAS_ALIGN_DEBUG_N] << '\t';
-              }
-              std::cerr << std::endl << "N\t";
-
-              for (unsigned i = 0; i < _rd_ln; ++i) {
-                  std::cerr << (int)_query_prof[i][rg::Base::N][VARGAS_ALIGN_DEBUG_N] << '\t';
+              std::cerr << "\nQuery Profile (" << VARGAS_ALIGN_DEBUG_N << "). MP=Mismatch." << std::endl;
+              std::cerr << "MP\t";
+              for (unsigned i = 0; i < _rd_ln; ++i) std::cerr << (int) _mismatch[i][VARGAS_ALIGN_DEBUG_N] << '\t';
+              for (auto b : {rg::Base::A, rg::Base::C, rg::Base::G, rg::Base::T, rg::Base::N}) {
+                  std::cerr << std::endl << rg::num_to_base(b) << '\t';
+                  for (unsigned i = 0; i < _rd_ln; ++i) {
+                      std::cerr << (int) _query_prof[i][b][VARGAS_ALIGN_DEBUG_N] << '\t';
+                  }
               }
               std::cerr << std::endl << std::endl;
               #endif
@@ -360,6 +448,7 @@ namespace vargas {
       virtual void set_scores(const ScoreProfile &prof) override {
           _prof = prof;
           _prof.end_to_end = END_TO_END;
+          _alignment_group.set_scores(prof);
           _bias = _get_bias(_read_len, prof.match, prof.mismatch_max, prof.read_gopen, prof.read_gext);
           _Dc[0] = std::numeric_limits<native_t>::min();
           _S[0] = _bias;
@@ -374,24 +463,31 @@ namespace vargas {
        */
       static constexpr unsigned read_capacity() { return simd_t::length; }
 
+      unsigned lanes() const override { return read_capacity(); }
+
       void align_into(const std::vector<std::string> &read_group,
                       const std::vector<std::vector<char>> &quals,
                       Graph::const_iterator begin, Graph::const_iterator end,
                       Results &aligns, bool fwdonly=true) override {
 
           const unsigned num_groups = 1 + ((read_group.size() - 1) / read_capacity());
-          // Possible oversize if there is a partial group
-          aligns.resize(num_groups * read_capacity());
+          aligns.resize(read_group.size());
 
           // Keep the scores at the positions, overwrites position. [0] is current position, 1-:ead_capacity + 1 is pos
-          std::unordered_map<unsigned, _seed<simd_t>> seed_map; // Maps node ID to the ending matrix cols of the node
-          _seed <simd_t> seed(_read_len);
+          _seed_map<simd_t> seed_map{typename _seed_map<simd_t>::allocator_type(&_arena)}; // Maps node ID to the ending matrix cols of the node
+          _seed <simd_t> seed(_read_len, &_arena);
 
           if (fwdonly){
               std::fill(aligns.max_strand.begin(), aligns.max_strand.end(), Strand::FWD);
               std::fill(aligns.sub_strand.begin(), aligns.sub_strand.end(), Strand::FWD);
           }
 
+          VA_STATS_ONLY(
+          uint64_t ref_len = 0;
+          for (auto gi = begin; gi != end; ++gi) ref_len += gi->length();
+          const unsigned strands = fwdonly ? 1 : 2;
+          )
+
           for (unsigned group = 0; group < num_groups; ++group) {
               seed_map.clear();
 
@@ -400,81 +496,52 @@ namespace vargas {
               const unsigned end_offset = std::min<unsigned>((group + 1) * read_capacity(), read_group.size());
               const unsigned len = end_offset - beg_offset;
               assert(len <= read_capacity());
-
-              _max_score = std::numeric_limits<native_t>::min();
-
-              if (!MSONLY) {
-                  _max_pos = aligns.max_pos.data() + beg_offset;
-                  _max_last_pos = aligns.max_last_pos.data() + beg_offset;
-                  _max_count = aligns.max_count.data() + beg_offset;
-              }
-
-              if (!MAXONLY) {
-                  _sub_score = std::numeric_limits<native_t>::min();
-                  _sub_pos = aligns.sub_pos.data() + beg_offset;
-                  _sub_last_pos = aligns.sub_last_pos.data() + beg_offset;
-                  _sub_count = aligns.sub_count.data() + beg_offset;
-                  _waiting_score = std::numeric_limits<native_t>::min();
-                  _waiting_pos = aligns.waiting_pos.data() + beg_offset;
-                  _waiting_last_pos = aligns.waiting_last_pos.data() + beg_offset;
+              VA_STATS_ADD(vectors, 1);
+              VA_STATS_ADD(lanes, len);
+              VA_STATS_ADD(lane_capacity, read_capacity());
+              VA_STATS_ONLY(
+              for (unsigned i = beg_offset; i < end_offset; ++i) {
+                  VA_STATS_ADD(cells, read_group[i].size() * ref_len * strands);
               }
+              )
 
-              #ifdef VA_SIMD_USE_AVX512
-              MaskType _tmp0;
-              #else
-              simd_t _tmp0;
-              #endif
+              _reset_scores();
 
               // Forward
-              _alignment_group.load_reads(read_group, quals, _prof, beg_offset, end_offset, false);
-              for (auto gi = begin; gi != end; ++gi) {
-                  _get_seed(gi.incoming(), seed_map, seed);
-                  if (gi->is_pinched()) seed_map.clear();
-                  _fill_node(*gi, _alignment_group.query_profile(), seed, seed_map.emplace(gi->id(), _read_len).first->second);
+              {
+                  VA_STATS_TIMER(PACK);
+                  _alignment_group.load_reads(read_group, quals, beg_offset, end_offset);
               }
-
-              _tmp0 = _waiting_score > _sub_score;
-              if (_tmp0) {
-                  // commit the waiting 2nd max score if we've got one and reached the end of the genome without
-                  // seeing a new _max_last_pos
-                  for (unsigned i = 0; i < read_capacity(); ++i) {
-                      if (_tmp0[i] && _max_last_pos[i] < _waiting_pos[i]) {
-                          _sub_score[i] = _waiting_score[i];
-                          _sub_count[i] = 1;
-                          _sub_pos[i] = _waiting_pos[i];
-                          _sub_last_pos[i] = _waiting_last_pos[i];
-                      }
+              {
+                  VA_STATS_TIMER(FILL);
+                  for (auto gi = begin; gi != end; ++gi) {
+                      const unsigned succ = gi.outgoing().size();
+                      _fill_step(*gi, gi.incoming(), succ, _alignment_group.query_profile(), seed_map, seed);
                   }
+                  _commit_waiting_end();
               }
 
               // Reverse
               if (!fwdonly) {
                   seed_map.clear();
-                  _alignment_group.load_reads(read_group, quals, _prof, beg_offset, end_offset, true);
+                  {
+                      VA_STATS_TIMER(PACK);
+                      _alignment_group.reverse_complement();
+                  }
                   //reset "right-most non-adjacent occurrence of score value" to zero
-                  if (!MSONLY) for (unsigned i = 0; i < read_capacity(); ++i) { _max_last_pos[i] = 0;}
-                  if (!MAXONLY) for (unsigned i = 0; i < read_capacity(); ++i) { _sub_last_pos[i] = 0;}
+                  _max_last_pos = 0;
+                  _sub_last_pos = 0;
                   //remember the scores on forward strand so we can tell if it increased and assign REV strand
                   simd_t fwdmax = _max_score;
                   simd_t fwdsub = _sub_score;
 
-                  for (auto gi = begin; gi != end; ++gi) {
-                      _get_seed(gi.incoming(), seed_map, seed);
-                      if (gi->is_pinched()) seed_map.clear();
-                      _fill_node(*gi, _alignment_group.query_profile(), seed, seed_map.emplace(gi->id(), _read_len).first->second);
-                  }
-                  _tmp0 = _waiting_score > _sub_score;
-                  if (_tmp0) {
-                      // commit the waiting 2nd max score if we've got one and reached the end of the genome without
-                      // seeing a new _max_last_pos
-                      for (unsigned i = 0; i < read_capacity(); ++i) {
-                          if (_tmp0[i] && _max_last_pos[i] < _waiting_pos[i]) {
-                              _sub_score[i] = _waiting_score[i];
-                              _sub_count[i] = 1;
-                              _sub_pos[i] = _waiting_pos[i];
-                              _sub_last_pos[i] = _waiting_last_pos[i];
-                          }
+                  {
+                      VA_STATS_TIMER(FILL);
+                      for (auto gi = begin; gi != end; ++gi) {
+                          const unsigned succ = gi.outgoing().size();
+                          _fill_step(*gi, gi.incoming(), succ, _alignment_group.query_profile(), seed_map, seed);
                       }
+                      _commit_waiting_end();
                   }
 
                   // Assign strands
@@ -486,23 +553,295 @@ namespace vargas {
               }
 
 
-              // Copy scores
-              for (unsigned char i = 0; i < len; ++i) {
-                  aligns.max_score[beg_offset + i] = _max_score[i] - _bias;
-                  if (!MSONLY && !MAXONLY) {
-                      aligns.sub_score[beg_offset + i] = _sub_score[i] - _bias;
-                  }
-              }
+              _copy_results(aligns, beg_offset, len);
 
           }
-          // Crop off potential buffer
-          aligns.resize(read_group.size());
           aligns.profile = _prof;
 
       }
 
+      void align_into(const std::vector<std::string> &read_group,
+                      const std::vector<std::vector<char>> &quals,
+                      const SubgraphSet &targets, std::vector<Results> &aligns, bool fwdonly=true) override {
+          using mask_t = SubgraphSet::mask_t;
+          const unsigned num_groups = 1 + ((read_group.size() - 1) / read_capacity());
+          const size_t num_targets = targets.size();
+          const Graph &parent = targets.parent();
+          aligns.resize(num_targets);
+          for (auto &a : aligns) {
+              a.resize(read_group.size());
+              if (fwdonly) {
+                  std::fill(a.max_strand.begin(), a.max_strand.end(), Strand::FWD);
+                  std::fill(a.sub_strand.begin(), a.sub_strand.end(), Strand::FWD);
+              }
+          }
+
+          std::vector<_seed_map<simd_t>> seed_maps(num_targets, _seed_map<simd_t>(typename _seed_map<simd_t>::allocator_type(&_arena)));
+          _seed <simd_t> seed(_read_len, &_arena);
+          using states_t = std::vector<_score_state, aligned_allocator<_score_state, simd_t::size>>;
+          states_t states(num_targets, _score_state(), typename states_t::allocator_type(&_arena)), fwd(states);
+
+          VA_STATS_ONLY(
+          uint64_t ref_len = 0;
+          {
+              size_t k = 0;
+              for (auto gi = parent.begin(); gi != parent.end(); ++gi, ++k) {
+                  ref_len += gi->length() * __builtin_popcountll(targets.mask(k));
+              }
+          }
+          const unsigned strands = fwdonly ? 1 : 2;
+          )
+
+          // Score state of the target currently in the members, swapped only when the target changes
+          size_t active = num_targets;
+          auto activate = [&](size_t t) {
+              if (t == active) return;
+              if (active != num_targets) _save_scores(states[active]);
+              _load_scores(states[t]);
+              active = t;
+          };
+          auto traverse = [&]() {
+              size_t k = 0;
+              for (auto gi = parent.begin(); gi != parent.end(); ++gi, ++k) {
+                  for (mask_t m = targets.mask(k); m; m &= m - 1) {
+                      const size_t t = __builtin_ctzll(m);
+                      activate(t);
+                      _get_seed_present(gi.incoming(), seed_maps[t], seed);
+                      if (gi->is_pinched()) seed_maps[t].clear();
+                      _fill_node(*gi, _alignment_group.query_profile(), seed,
+                                 _new_seed(seed_maps[t], gi->id()));
+                  }
+              }
+              for (size_t t = 0; t < num_targets; ++t) {
+                  activate(t);
+                  _commit_waiting_end();
+              }
+              _save_scores(states[active]);
+          };
+
+          for (unsigned group = 0; group < num_groups; ++group) {
+              const unsigned beg_offset = group * read_capacity();
+              const unsigned end_offset = std::min<unsigned>((group + 1) * read_capacity(), read_group.size());
+              const unsigned len = end_offset - beg_offset;
+              assert(len <= read_capacity());
+              VA_STATS_ADD(vectors, 1);
+              VA_STATS_ADD(lanes, len);
+              VA_STATS_ADD(lane_capacity, read_capacity());
+              VA_STATS_ONLY(
+              for (unsigned i = beg_offset; i < end_offset; ++i) {
+                  VA_STATS_ADD(cells, read_group[i].size() * ref_len * strands);
+              }
+              )
+
+              _reset_scores();
+              for (size_t t = 0; t < num_targets; ++t) {
+                  _save_scores(states[t]);
+                  seed_maps[t].clear();
+              }
+              active = num_targets;
+
+              // Forward
+              {
+                  VA_STATS_TIMER(PACK);
+                  _alignment_group.load_reads(read_group, quals, beg_offset, end_offset);
+              }
+              {
+                  VA_STATS_TIMER(FILL);
+                  traverse();
+              }
+
+              // Reverse
+              if (!fwdonly) {
+                  {
+                      VA_STATS_TIMER(PACK);
+                      _alignment_group.reverse_complement();
+                  }
+                  for (size_t t = 0; t < num_targets; ++t) {
+                      seed_maps[t].clear();
+                      fwd[t] = states[t];
+                      states[t].max_last_pos = 0;
+                      states[t].sub_last_pos = 0;
+                  }
+                  active = num_targets;
+                  {
+                      VA_STATS_TIMER(FILL);
+                      traverse();
+                  }
+                  for (size_t t = 0; t < num_targets; ++t) {
+                      for (size_t i = 0; i < len; ++i) {
+                          aligns[t].max_strand[beg_offset + i] =
+                          states[t].max_score[i] > fwd[t].max_score[i] ? Strand::REV : Strand::FWD;
+                          aligns[t].sub_strand[beg_offset + i] =
+                          states[t].sub_score[i] > fwd[t].sub_score[i] ? Strand::REV : Strand::FWD;
+                      }
+                  }
+              }
+
+              for (size_t t = 0; t < num_targets; ++t) {
+                  _load_scores(states[t]);
+                  _copy_results(aligns[t], beg_offset, len);
+              }
+          }
+          for (auto &a : aligns) a.profile = _prof;
+      }
+
     private:
 
+      /**
+       * @brief
+       * Best score bookkeeping of one target in a multi target alignment.
+       */
+      struct _score_state {
+          simd_t max_score, sub_score, waiting_score;
+          lanes_t max_pos, sub_pos, waiting_pos, max_last_pos, sub_last_pos, waiting_last_pos, max_count, sub_count;
+      };
+
+      void _save_scores(_score_state &s) const {
+          s.max_score = _max_score;
+          s.sub_score = _sub_score;
+          s.waiting_score = _waiting_score;
+          s.max_pos = _max_pos;
+          s.sub_pos = _sub_pos;
+          s.waiting_pos = _waiting_pos;
+          s.max_last_pos = _max_last_pos;
+          s.sub_last_pos = _sub_last_pos;
+          s.waiting_last_pos = _waiting_last_pos;
+          s.max_count = _max_count;
+          s.sub_count = _sub_count;
+      }
+
+      void _load_scores(const _score_state &s) {
+          _max_score = s.max_score;
+          _sub_score = s.sub_score;
+          _waiting_score = s.waiting_score;
+          _max_pos = s.max_pos;
+          _sub_pos = s.sub_pos;
+          _waiting_pos = s.waiting_pos;
+          _max_last_pos = s.max_last_pos;
+          _sub_last_pos = s.sub_last_pos;
+          _waiting_last_pos = s.waiting_last_pos;
+          _max_count = s.max_count;
+          _sub_count = s.sub_count;
+      }
+
+      /**
+       * @brief
+       * Clear best scores before aligning a read group.
+       */
+      void _reset_scores() {
+          _max_score = std::numeric_limits<native_t>::min();
+          _sub_score = std::numeric_limits<native_t>::min();
+          _waiting_score = std::numeric_limits<native_t>::min();
+          _max_pos = 0;
+          _max_last_pos = 0;
+          _max_count = 0;
+          _sub_pos = 0;
+          _sub_last_pos = 0;
+          _sub_count = 0;
+          _waiting_pos = 0;
+          _waiting_last_pos = 0;
+      }
+
+      /**
+       * @brief
+       * Copy best scores of a read group to results.
+       * @param aligns Results
+       * @param beg_offset Index of the first read of the group
+       * @param len Reads in the group
+       */
+      void _copy_results(Results &aligns, const unsigned beg_offset, const unsigned len) {
+          for (unsigned i = 0; i < len; ++i) {
+              aligns.max_score[beg_offset + i] = int64_t(_max_score[i]) - _bias;
+              if (!MSONLY) {
+                  aligns.max_pos[beg_offset + i] = _max_pos[i];
+                  aligns.max_count[beg_offset + i] = _max_count[i];
+              }
+              if (!MSONLY && !MAXONLY) {
+                  aligns.sub_score[beg_offset + i] = int64_t(_sub_score[i]) - _bias;
+                  aligns.sub_pos[beg_offset + i] = _sub_pos[i];
+                  aligns.sub_count[beg_offset + i] = _sub_count[i];
+              }
+          }
+      }
+
+      /**
+       * @brief
+       * Best seed from the previous nodes that are in the target. Nodes without a seed are
+       * outside the target. If none are in the target, the matrix is seeded as a start node.
+       * @param prev_ids Nodes preceding the current node in the parent graph
+       * @param seed_map ID->seed map of the target
+       * @param seed best seed to populate
+       */
+      __RG_STRONG_INLINE__
+      void _get_seed_present(const std::vector<unsigned> &prev_ids,
+                             const _seed_map<simd_t> &seed_map,
+                             _seed<simd_t> &seed) const {
+          const _seed<simd_t> *found[8];
+          std::vector<const _seed<simd_t> *> more;
+          unsigned n = 0;
+          for (const unsigned id : prev_ids) {
+              const auto it = seed_map.find(id);
+              if (it == seed_map.end()) continue;
+              if (n < 8) found[n] = &it->second;
+              else more.push_back(&it->second);
+              ++n;
+          }
+          if (n == 0) {
+              _seed_matrix(seed);
+              return;
+          }
+          for (unsigned i = 1; i < _read_len + 1; ++i) {
+              seed.S_col[i] = found[0]->S_col[i];
+              seed.I_col[i] = found[0]->I_col[i];
+              for (unsigned p = 1; p < n; ++p) {
+                  const auto &t = p < 8 ? *found[p] : *more[p - 8];
+                  seed.S_col[i] = max(seed.S_col[i], t.S_col[i]);
+                  seed.I_col[i] = max(seed.I_col[i], t.I_col[i]);
+              }
+          }
+      }
+
+      /**
+       * @brief
+       * Add a seed for a node, allocated from the arena.
+       * @param seed_map ID->seed map
+       * @param id Node ID
+       * @return Seed of the node
+       */
+      _seed<simd_t> &_new_seed(_seed_map<simd_t> &seed_map, const unsigned id) {
+          return seed_map.emplace(std::piecewise_construct, std::forward_as_tuple(id),
+                                  std::forward_as_tuple(_read_len, &_arena)).first->second;
+      }
+
+      /**
+       * @brief
+       * Align to a node from the seeds of its previous nodes, and keep its seed for its successors.
+       * A seed is released once all successors have read it, so only seeds of the traversal
+       * frontier are held. A seed is O(read length), so this bounds memory for long reads.
+       * @param n Node to align to
+       * @param prev_ids Previous nodes of n
+       * @param succ Number of successors of n
+       * @param read_group Query profile
+       * @param seed_map ID->seed map
+       * @param seed Buffer for the seed of n
+       */
+      __RG_STRONG_INLINE__
+      void _fill_step(const Graph::Node &n, const std::vector<unsigned> &prev_ids, const unsigned succ,
+                      const qp_t &read_group, _seed_map<simd_t> &seed_map, _seed<simd_t> &seed) {
+          _get_seed(prev_ids, seed_map, seed);
+          if (n.is_pinched()) seed_map.clear();
+          else {
+              for (const unsigned id : prev_ids) {
+                  const auto it = seed_map.find(id);
+                  if (it != seed_map.end() && --it->second.pending == 0) seed_map.erase(it);
+              }
+          }
+          auto &nxt = _new_seed(seed_map, n.id());
+          _fill_node(n, read_group, seed, nxt);
+          if (succ) nxt.pending = succ;
+          else seed_map.erase(n.id());
+      }
+
       /**
        * @brief
        * Seeds the matrix when there are no previous nodes. In end to end mode, the seed is penalized.
@@ -513,7 +852,7 @@ namespace vargas {
           if (END_TO_END) {
               seed.S_col[0] = _bias;
               for (unsigned i = 1; i <= _read_len; ++i) {
-                  int v = _bias - _prof.ref_gopen - (i * _prof.ref_gext); //TODO should this be the read? since it's a gap in the read that gets penalized?
+                  const int64_t v = int64_t(_bias) - _prof.ref_gopen - int64_t(i) * _prof.ref_gext; //TODO should this be the read? since it's a gap in the read that gets penalized?
                   seed.S_col[i] = v < std::numeric_limits<native_t>::min() ? std::numeric_limits<native_t>::min() : v;
               }
           }
@@ -535,7 +874,7 @@ namespace vargas {
        */
       __RG_STRONG_INLINE__
       void _get_seed(const std::vector<unsigned> &prev_ids,
-                     std::unordered_map<unsigned, _seed<simd_t>> &seed_map,
+                     _seed_map<simd_t> &seed_map,
                      _seed<simd_t> &seed) const {
           if (prev_ids.empty()) {
               _seed_matrix(seed);
@@ -588,14 +927,15 @@ namespace vargas {
           _Ic = s.I_col;
           for (const rg::Base ref_base : n) {
               _Sd = _bias;
+              _curr_pos = curr_pos;
 
               for (unsigned r = 0; r < _read_len; ++r) {
-                  _fill_cell(read_group[r], ref_base, r + 1, curr_pos);
+                  _fill_cell(read_group[r], ref_base, r + 1);
                   #if VARGAS_ALIGN_DEBUG_SW
                   grid[r][deb_col] = _S[r+1][VARGAS_ALIGN_DEBUG_N];
                   #endif
               }
-              if (END_TO_END) _fill_cell_finish(_read_len, curr_pos);
+              if (END_TO_END) _fill_cell_finish(_read_len);
               ++curr_pos;
 
               #if VARGAS_ALIGN_DEBUG_SW
@@ -626,12 +966,10 @@ namespace vargas {
        * @param read_base ReadBatch vector
        * @param ref reference sequence base
        * @param row _curr_pos row in matrix
-       * @param col _curr_pos column in matrix
        * Does not consider adjacent gaps in read/reference (moving from D to I matrix consecutively)
        */
       __RG_STRONG_INLINE__
-      void _fill_cell(const typename qp_t::value_type &prof, const rg::Base &ref,
-                      const unsigned &row, const pos_t &curr_pos) {
+      void _fill_cell(const typename qp_t::value_type &prof, const rg::Base &ref, const unsigned &row) {
           assert(uint64_t(&_Dc[0]) % sizeof(_Dc[0]) == 0);
           assert(uint64_t(&_S[0]) % sizeof(_S[0]) == 0);
           _Dc[row] = max(_Dc[row - 1] - _gap_extend_vec_ref, _S[row - 1] - _gap_open_extend_vec_ref);
@@ -639,146 +977,105 @@ namespace vargas {
           simd_t sr = _Sd + prof[ref];
           _Sd = _S[row]; // S(i-1, j-1) for the next cell to be filled in
           _S[row] = max(_Ic[row], max(_Dc[row], sr));
-          if (!END_TO_END) _fill_cell_finish(row, curr_pos);
+          if (!END_TO_END) _fill_cell_finish(row);
       }
 
       /**
        * @brief
        * Takes the max of D,I, and M vectors and stores the _curr_pos best score/position
-       * Currently does not support non-default template args
+       * @details
+       * Per-lane bookkeeping is done with lane masks, so no lane is visited individually.
        * @param row _curr_pos row
-       * @param curr_pos Current position, used to get absolute alignment position
        */
       __RG_STRONG_INLINE__ __RG_UNROLL__
-      void _fill_cell_finish(const unsigned &row, const pos_t &curr_pos) {
+      void _fill_cell_finish(const unsigned &row) {
+          const simd_t &S = _S[row];
           if (MSONLY) {
-              _max_score = max(_S[row], _max_score);
-          } else if (MAXONLY) {
-              #ifdef VA_SIMD_USE_AVX512
-              MaskType _tmp0;
-              #else
-              simd_t _tmp0;
-              #endif
-              _tmp0 = _S[row] == _max_score;
-              if (_tmp0) {
-                  // Check for repeat max score. Update closest occurrence location; increment counter if > read_len
-                  // from closest occurrence of max
-                  for (unsigned i = 0; i < read_capacity(); ++i) {
-                      if (_tmp0[i]) {
-                          if (curr_pos > _max_last_pos[i] + _read_len) ++(_max_count[i]);
-                          _max_last_pos[i] = curr_pos;
-                      }
-                  }
-              }
-
-              _tmp0 = _S[row] > _max_score;
-              if (_tmp0) {
-                  for (unsigned i = 0; i < read_capacity(); ++i) {
-                      if (_tmp0[i]) {
-                          // Check for new max score.
-                          _max_count[i] = 1;
-                          _max_pos[i] = curr_pos;
-                          _max_last_pos[i] = curr_pos;
-                      }
-                  }
-                  _max_score = max(_S[row], _max_score);
-              }
+              _max_score = max(S, _max_score);
+              return;
           }
-          else { // the genome is not a graph so we can look for the 2nd-max score
-              #ifdef VA_SIMD_USE_AVX512
-              MaskType _tmp0;
-              #else
-              simd_t _tmp0;
-              #endif
-              _tmp0 = _S[row] == _max_score;
-              if (_tmp0) {
-                  // Check for repeat max score. Update closest occurrence location; increment counter if > read_len
-                  // from closest occurrence of max
-                  for (unsigned i = 0; i < read_capacity(); ++i) {
-                      if (_tmp0[i]) {
-                          if (curr_pos > _max_last_pos[i] + _read_len) ++(_max_count[i]);
-                          _max_last_pos[i] = curr_pos;
-                          _waiting_pos[i] = 0;
-                          _waiting_score[i] = _sub_score[i];
-                      }
-                  }
-              }
 
-              _tmp0 = _S[row] > _max_score;
-              if (_tmp0) {
-                  for (unsigned i = 0; i < read_capacity(); ++i) {
-                      if (_tmp0[i]) {
-                          // Check for new max score.
-                          _max_count[i] = 1;
-                          _max_pos[i] = curr_pos;
-                          _max_last_pos[i] = curr_pos;
-                          _waiting_pos[i] = 0;
-                          _waiting_score[i] = _sub_score[i];
-                      }
-                  }
-                  _max_score = max(_S[row], _max_score);
+          // Repeat max score: update closest occurrence location; increment counter if > read_len
+          // from closest occurrence of max. New max score: reset counter and position.
+          const lane_mask_t eq = lane_mask(S == _max_score), gt = lane_mask(S > _max_score);
+          if (eq | gt) {
+              _max_count.increment(eq & (_curr_pos > _max_last_pos + _read_len_v));
+              _max_count.assign(gt, 1);
+              _max_pos.assign(gt, _curr_pos);
+              _max_last_pos.assign(eq | gt, _curr_pos);
+              if (!MAXONLY) {
+                  _waiting_pos.assign(eq | gt, 0);
+                  _waiting_score = mask_blend(eq | gt, _sub_score, _waiting_score);
               }
+              _max_score = max(S, _max_score);
+          }
+          if (MAXONLY) return;
+
+          // the genome is not a graph so we can look for the 2nd-max score
+
+          // Repeat waiting 2nd-max score. Update closest occurrence location.
+          lane_mask_t m = lane_mask(S == _waiting_score) & _waiting_pos.nonzero();
+          if (m) _waiting_last_pos.assign(m, _curr_pos);
+
+          // Repeat 2nd-max score. Update closest occurrence location; increment counter if
+          // > read_len from closest occurence of max or 2nd-max score
+          // TODO will overcount if there is an upcoming max within a read-length
+          m = lane_mask(S == _sub_score);
+          if (m) {
+              _sub_count.increment(m & (_curr_pos > _max_last_pos + _read_len_v)
+                                   & (_curr_pos > _sub_last_pos + _read_len_v));
+              _sub_last_pos.assign(m, _curr_pos);
+          }
 
-                _tmp0 = _S[row] == _waiting_score;
-                if (_tmp0) {
-                    // Check for repeat waiting 2nd-max score. Update closest occurrence location.
-                    for (unsigned i = 0; i < read_capacity(); ++i) {
-                        if (_tmp0[i] && _waiting_pos[i] > 0) _waiting_last_pos[i] = curr_pos;
-                    }
-                }
-
-                _tmp0 = _S[row] == _sub_score;
-                if (_tmp0) {
-                    // Check for repeat 2nd-max score. Update closest occurrence location; increment counter if
-                    // > read_len from closest occurence of max or 2nd-max score
-                    // TODO will overcount if there is an upcoming max within a read-length
-                    for (unsigned i = 0; i < read_capacity(); ++i) {
-                        if (_tmp0[i]) {
-                            if (curr_pos > _max_last_pos[i] + _read_len && curr_pos > _sub_last_pos[i] + _read_len) {
-                                ++(_sub_count[i]);
-                            }
-                            _sub_last_pos[i] = curr_pos;
-                        }
-                    }
-                }
-
-                // Greater than old 2nd-max and less than max score
-                _tmp0 = (_S[row] > _sub_score) & (_S[row] < _max_score);
-                if (_tmp0) {
-                    // Check for new 2nd-max score. Set waiting 2nd max if it's greater than the current waiting 2nd max
-                    // or we have no waiting 2nd max
-                    for (unsigned i = 0; i < read_capacity(); ++i) {
-                        if (_tmp0[i] && curr_pos > _max_last_pos[i] + _read_len && (_waiting_pos[i] == 0 || _S[row][i] > _waiting_score[i])) {
-                            _waiting_score[i] = _S[row][i];
-                            _waiting_pos[i] = curr_pos;
-                            _waiting_last_pos[i] = curr_pos;
-                        }
-                    }
-                }
+          // Greater than old 2nd-max and less than max score. Set waiting 2nd max if it's greater
+          // than the current waiting 2nd max or we have no waiting 2nd max
+          m = lane_mask(S > _sub_score) & lane_mask(S < _max_score);
+          if (m) {
+              m &= (_curr_pos > _max_last_pos + _read_len_v)
+                   & (~_waiting_pos.nonzero() | lane_mask(S > _waiting_score));
+              _waiting_score = mask_blend(m, S, _waiting_score);
+              _waiting_pos.assign(m, _curr_pos);
+              _waiting_last_pos.assign(m, _curr_pos);
+          }
 
-                _tmp0 = _waiting_score > _sub_score;
-                if (_tmp0) {
-                    // commit the waiting 2nd max score if we're a read length beyond it
-                    for (unsigned i = 0; i < read_capacity(); ++i) {
-                        if (_tmp0[i] && curr_pos > _waiting_pos[i] + _read_len && _waiting_pos[i] > 0) {
-                            //set the waiting 2nd max, if it's greater than the current waiting 2nd max
-                            _sub_score[i] = _waiting_score[i];
-                            _sub_count[i] = 1;
-                            _sub_pos[i] = _waiting_pos[i];
-                            _sub_last_pos[i] = _waiting_last_pos[i];
-                            _waiting_pos[i] = 0; //if nonzero, indicates that something is waiting
-                        }
-                    }
-                }
-            }
+          // commit the waiting 2nd max score if we're a read length beyond it
+          m = lane_mask(_waiting_score > _sub_score);
+          if (m) {
+              m &= (_curr_pos > _waiting_pos + _read_len_v) & _waiting_pos.nonzero();
+              _commit_waiting(m);
+              _waiting_pos.assign(m, 0); //if nonzero, indicates that something is waiting
           }
+      }
 
+      /**
+       * @brief
+       * Make the waiting 2nd max score the 2nd max score in the selected lanes.
+       * @param m lanes to commit
+       */
+      __RG_STRONG_INLINE__
+      void _commit_waiting(const lane_mask_t m) {
+          _sub_score = mask_blend(m, _waiting_score, _sub_score);
+          _sub_count.assign(m, 1);
+          _sub_pos.assign(m, _waiting_pos);
+          _sub_last_pos.assign(m, _waiting_last_pos);
+      }
 
+      /**
+       * @brief
+       * commit the waiting 2nd max score if we've got one and reached the end of the genome without
+       * seeing a new _max_last_pos
+       */
+      void _commit_waiting_end() {
+          if (MSONLY || MAXONLY) return;
+          const lane_mask_t m = lane_mask(_waiting_score > _sub_score) & (_waiting_pos > _max_last_pos);
+          if (m) _commit_waiting(m);
+      }
 
       static native_t _get_bias(const unsigned read_len, const unsigned match, const unsigned mismatch,
                                 const unsigned gopen, const unsigned gext) {
           static bool has_warned = false;
-          if (read_len * match > std::numeric_limits<native_t>::max() - std::numeric_limits<native_t>::min()) {
+          const int64_t range = int64_t(std::numeric_limits<native_t>::max()) - std::numeric_limits<native_t>::min();
+          if (int64_t(read_len) * match > range) {
               throw std::domain_error("Insufficient bit-width for given match score and read length.");
           }
           if (!END_TO_END) return std::numeric_limits<native_t>::min();
@@ -789,7 +1086,7 @@ namespace vargas {
           if (!has_warned && (gopen + (gext * (read_len - 1)) > b || read_len * mismatch > b)) {
               std::cerr << "[warn] Possibility of score saturation with parameters in end-to-end mode:\n"
                         << "\tCell Width: "
-                        << (int) std::numeric_limits<native_t>::max() - (int) std::numeric_limits<native_t>::min()
+                        << range
                         << ", Bias: " << b << ", Limits: gaplen=" << (b - gopen)/gext << " OR mismatches=" << b/mismatch << "\n";
               has_warned = true;
           }
@@ -804,9 +1101,10 @@ namespace vargas {
       simd_t _Sd, _max_score, _sub_score, _waiting_score,
       _gap_extend_vec_ref, _gap_open_extend_vec_ref, _gap_extend_vec_rd, _gap_open_extend_vec_rd;
 
-      pos_t *_max_pos, *_sub_pos, *_waiting_pos;
-      pos_t *_max_last_pos, *_sub_last_pos, *_waiting_last_pos;
-      unsigned  *_max_count, *_sub_count;
+      // Lane-wise positions and counts of the current read group, copied to Results once per group
+      lanes_t _max_pos, _sub_pos, _waiting_pos, _max_last_pos, _sub_last_pos, _waiting_last_pos;
+      lanes_t _max_count, _sub_count;
+      lanes_t _curr_pos, _read_len_v; // Broadcast current column position and read length
 
       native_t _bias;
       const unsigned int _read_len;
@@ -823,6 +1121,12 @@ namespace vargas {
   using MSAlignerETE = AlignerT<int8_fast, true, true>;
   using MSWordAlignerETE = AlignerT<int16_fast, true, true>;
 
+  // 32 bit cells for long reads whose scores overflow 16 bits
+  using LongAligner = AlignerT<int32_fast, false, false>;
+  using LongAlignerETE = AlignerT<int32_fast, true, false>;
+  using MSLongAligner = AlignerT<int32_fast, false, true>;
+  using MSLongAlignerETE = AlignerT<int32_fast, true, true>;
+
 
 }
 
@@ -1156,6 +1460,30 @@ TEST_CASE("Reverse strand") {
         CHECK(res.max_strand[0] == vargas::Strand::FWD);
         CHECK(res.max_strand[1] == vargas::Strand::REV);
     }
+
+    SUBCASE("Derived profile") {
+        // Reverse complement profile should match one built from the reverse complemented reads
+        vargas::ScoreProfile prof(2, 6, 3, 1);
+        prof.ambig = 1;
+        const std::vector<std::string> fwd = {"GCCAGTG", "ACGTN", "TTG"}, rev = {"CACTGGC", "NACGT", "CAA"};
+        std::vector<std::vector<char>> fwd_q = {{40, 30, 20, 10, 0, 5, 15}, {1, 12, 23, 34, 45}, {}}, rev_q = fwd_q;
+        for (auto &q : rev_q) std::reverse(q.begin(), q.end());
+
+        vargas::Aligner::AlignmentGroup derived(7), direct(7);
+        derived.set_scores(prof);
+        direct.set_scores(prof);
+        derived.load_reads(fwd, fwd_q, 0, fwd.size());
+        derived.reverse_complement();
+        direct.load_reads(rev, rev_q, 0, rev.size());
+
+        for (unsigned p = 0; p < 7; ++p) {
+            for (unsigned b = 0; b < 5; ++b) {
+                for (unsigned l = 0; l < derived.group_size(); ++l) {
+                    CHECK((int) derived[p][b][l] == (int) direct[p][b][l]);
+                }
+            }
+        }
+    }
 }
 
 TEST_CASE("Indels") {
@@ -1334,6 +1662,185 @@ TEST_CASE("Target score") {
     CHECK(res.sub_pos[0] == 19); //max and 2nd max have to be far enough away, so sub_pos can't be 3
 }
 
+TEST_CASE("Multiple subgraphs") {
+    vargas::Graph::Node::_newID = 0;
+    auto g = std::make_shared<vargas::Graph>();
+    const std::string left = "ACGTTGCAGGCTAAGCTTAC", mid = "GGATCCAATGCTTACGATCG", right = "TTAGCCGATCAGGTACCATG";
+
+    /**
+     *          A(ref)         G(ref)
+     *         /     \        /     \
+     *    left        mid          right
+     *         \     /        \     /
+     *          C              T
+     */
+    auto add = [&](const std::string &seq, unsigned endpos, bool ref, std::vector<bool> pop, float af) {
+        vargas::Graph::Node n;
+        n.set_seq(seq);
+        n.set_endpos(endpos);
+        if (ref) n.set_as_ref();
+        else n.set_not_ref();
+        n.set_population(pop);
+        n.set_af(af);
+        g->add_node(n);
+    };
+    add(left, 19, true, {1, 1, 1}, 1);
+    add("A", 20, true, {1, 0, 1}, 0.4);
+    add("C", 20, false, {0, 1, 0}, 0.6);
+    add(mid, 40, true, {1, 1, 1}, 1);
+    add("G", 41, true, {0, 1, 1}, 0.7);
+    add("T", 41, false, {1, 0, 0}, 0.3);
+    add(right, 61, true, {1, 1, 1}, 1);
+    g->add_edge(0, 1);
+    g->add_edge(0, 2);
+    g->add_edge(1, 3);
+    g->add_edge(2, 3);
+    g->add_edge(3, 4);
+    g->add_edge(3, 5);
+    g->add_edge(4, 6);
+    g->add_edge(5, 6);
+
+    vargas::Graph::Population pop0(3, false), pop1(3, false);
+    pop0.set(0);
+    pop1.set(1);
+    const std::vector<std::shared_ptr<const vargas::Graph>> subgraphs = {
+    g,
+    std::make_shared<vargas::Graph>(*g, vargas::Graph::Type::REF),
+    std::make_shared<vargas::Graph>(*g, vargas::Graph::Type::MAXAF),
+    std::make_shared<vargas::Graph>(*g, pop0),
+    std::make_shared<vargas::Graph>(*g, pop1)
+    };
+    const vargas::SubgraphSet set(g, subgraphs);
+    REQUIRE(set.size() == subgraphs.size());
+    CHECK(set.mask(0) == 0x1F);
+    CHECK(set.mask(1) == 0x0B);
+    CHECK(set.mask(2) == 0x15);
+
+    // Reads across both bubbles on every path, and their reverse complements
+    std::vector<std::string> reads;
+    for (const std::string a : {"A", "C"}) {
+        for (const std::string b : {"G", "T"}) {
+            const std::string path = left + a + mid + b + right;
+            for (size_t i = 0; i + 12 <= path.size(); i += 7) {
+                const std::string r = path.substr(i, 12);
+                std::string rc(r.rbegin(), r.rend());
+                for (char &c : rc) c = c == 'A' ? 'T' : c == 'T' ? 'A' : c == 'C' ? 'G' : 'C';
+                reads.push_back(r);
+                reads.push_back(rc);
+            }
+        }
+    }
+    const std::vector<std::vector<char>> quals;
+
+    vargas::Aligner a(12);
+    vargas::AlignerETE b(12);
+    vargas::MSAligner c(12);
+    vargas::AlignerT<vargas::int8_fast, false, false, true> d(12);
+    for (vargas::AlignerBase *aligner : std::vector<vargas::AlignerBase *>{&a, &b, &c, &d}) {
+        for (const bool fwdonly : {true, false}) {
+            std::vector<vargas::Results> onepass;
+            aligner->align_into(reads, quals, set, onepass, fwdonly);
+            REQUIRE(onepass.size() == subgraphs.size());
+            for (size_t t = 0; t < subgraphs.size(); ++t) {
+                vargas::Results sep;
+                aligner->align_into(reads, quals, subgraphs[t]->begin(), subgraphs[t]->end(), sep, fwdonly);
+                REQUIRE(onepass[t].size() == reads.size());
+                for (size_t i = 0; i < reads.size(); ++i) {
+                    CHECK(onepass[t].max_score[i] == sep.max_score[i]);
+                    CHECK(onepass[t].max_pos[i] == sep.max_pos[i]);
+                    CHECK(onepass[t].max_count[i] == sep.max_count[i]);
+                    CHECK(onepass[t].max_strand[i] == sep.max_strand[i]);
+                    CHECK(onepass[t].sub_score[i] == sep.sub_score[i]);
+                    CHECK(onepass[t].sub_pos[i] == sep.sub_pos[i]);
+                    CHECK(onepass[t].sub_count[i] == sep.sub_count[i]);
+                    CHECK(onepass[t].sub_strand[i] == sep.sub_strand[i]);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Long reads") {
+    vargas::Graph::Node::_newID = 0;
+    vargas::Graph g;
+    std::string left, right;
+    uint32_t state = 7;
+    auto base = [&]() {
+        state = state * 1103515245u + 12345u;
+        return "ACGT"[(state >> 16) & 3];
+    };
+    for (unsigned i = 0; i < 3000; ++i) left += base();
+    for (unsigned i = 0; i < 3000; ++i) right += base();
+    auto add = [&](const std::string &seq, unsigned endpos, bool ref) {
+        vargas::Graph::Node n;
+        n.set_seq(seq);
+        n.set_endpos(endpos);
+        if (ref) n.set_as_ref();
+        else n.set_not_ref();
+        g.add_node(n);
+    };
+    add(left, 2999, true);
+    add("A", 3000, true);
+    add("TG", 3001, false);
+    add(right, 6001, true);
+    g.add_edge(0, 1);
+    g.add_edge(0, 2);
+    g.add_edge(1, 3);
+    g.add_edge(2, 3);
+
+    SUBCASE("Scores beyond 16 bits") {
+        // 4000bp through the alt allele, ending 1998bp into the right node
+        std::string read = left.substr(1000) + "TG" + right.substr(0, 1998);
+        REQUIRE(read.size() == 4000);
+        const vargas::ScoreProfile prof(20, 4, 6, 1, 6, 1);
+        CHECK_THROWS(vargas::WordAligner(read.size(), prof));
+
+        vargas::LongAligner a(read.size(), prof);
+        vargas::Results res = a.align({read}, g.begin(), g.end());
+        CHECK(res.max_score[0] == 80000);
+        CHECK(res.max_pos[0] == 5000);
+
+        vargas::ScoreProfile ete = prof;
+        ete.end_to_end = true;
+        read[100] = read[100] == 'A' ? 'C' : 'A';
+        vargas::LongAlignerETE e(read.size(), ete);
+        res = e.align({read}, g.begin(), g.end());
+        CHECK(res.max_score[0] == 80000 - 20 - 4);
+        CHECK(res.max_pos[0] == 5000);
+    }
+
+    SUBCASE("Same as 16 bit") {
+        std::vector<std::string> reads;
+        for (const std::string mid : {"A", "TG"}) {
+            const std::string path = left + mid + right;
+            for (size_t i = 2850; i + 150 <= 3250; i += 7) {
+                reads.push_back(path.substr(i, 150));
+                if (i % 3 == 0) reads.back()[75] = 'N';
+            }
+        }
+        vargas::ScoreProfile ete(0, 6, 5, 3, 5, 3);
+        ete.end_to_end = true;
+
+        vargas::WordAligner w(150);
+        vargas::LongAligner l(150);
+        vargas::WordAlignerETE we(150, ete);
+        vargas::LongAlignerETE le(150, ete);
+        for (const bool fwdonly : {true, false}) {
+            for (const bool e : {false, true}) {
+                vargas::Results rw, rl;
+                (e ? static_cast<vargas::AlignerBase &>(we) : w).align_into(reads, {}, g.begin(), g.end(), rw, fwdonly);
+                (e ? static_cast<vargas::AlignerBase &>(le) : l).align_into(reads, {}, g.begin(), g.end(), rl, fwdonly);
+                CHECK(rw.max_score == rl.max_score);
+                CHECK(rw.max_pos == rl.max_pos);
+                CHECK(rw.max_count == rl.max_count);
+                CHECK(rw.max_strand == rl.max_strand);
+                CHECK(rw.sub_score == rl.sub_score);
+                CHECK(rw.sub_pos == rl.sub_pos);
+            }
+        }
+    }
+}
+
 TEST_SUITE_END();
 
 #endif //VARGAS_ALIGNMENT_H
@@ -0,0 +1,141 @@
+/**
+ * @brief
+ * Arena for aligner scratch memory, optionally backed by 2MB huge pages.
+ *
+ * @details
+ * Memory is carved from large chunks. Freed blocks are kept on a free list by size and reused,
+ * so an aligner stops calling the system allocator once its buffers have been allocated once.
+ * An arena is not thread safe, each aligner owns one and is used by one thread at a time.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#ifndef VARGAS_ARENA_H
+#define VARGAS_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define VA_ARENA_ALIGN 64 // AVX512
+#define VA_ARENA_CHUNK (size_t(1) << 21) // One 2MB huge page
+
+namespace vargas {
+
+  /**
+   * @brief
+   * Backing of arena chunks.
+   * NONE: regular pages.
+   * TRANSPARENT: 2MB aligned chunks advised for transparent huge pages.
+   * EXPLICIT: chunks mapped from the hugetlbfs pool, falling back to TRANSPARENT if the pool is empty.
+   */
+  enum class HugePages {NONE, TRANSPARENT, EXPLICIT};
+
+  /**
+   * @param s "none", "thp", or "explicit"
+   * @return HugePages
+   * @throws std::invalid_argument on other values
+   */
+  HugePages huge_pages_from_string(const std::string &s);
+
+  class Arena {
+    public:
+
+      /**
+       * @param pages Backing of chunks
+       * @param chunk Minimum chunk size in bytes, rounded up to 2MB with huge pages
+       */
+      explicit Arena(HugePages pages = default_pages(), size_t chunk = VA_ARENA_CHUNK) :
+      _pages(pages), _chunk(chunk ? chunk : VA_ARENA_CHUNK) {}
+
+      ~Arena();
+
+      Arena(const Arena &) = delete;
+      Arena &operator=(const Arena &) = delete;
+
+      /**
+       * @brief
+       * Allocate a block aligned to VA_ARENA_ALIGN bytes.
+       * @param bytes Block size
+       * @param align Required alignment, at most VA_ARENA_ALIGN
+       * @return Block
+       * @throws std::invalid_argument if align is too large
+       * @throws std::bad_alloc if a chunk cannot be allocated
+       */
+      void *allocate(size_t bytes, size_t align = VA_ARENA_ALIGN);
+
+      /**
+       * @brief
+       * Return a block for reuse by allocations of the same size.
+       * @param p Block from allocate()
+       * @param bytes Size passed to allocate()
+       */
+      void deallocate(void *p, size_t bytes);
+
+      /**
+       * @return Bytes held in chunks
+       */
+      size_t reserved() const {
+          size_t ret = 0;
+          for (const auto &c : _chunks) ret += c.size;
+          return ret;
+      }
+
+      /**
+       * @return Number of chunks
+       */
+      size_t chunks() const {
+          return _chunks.size();
+      }
+
+      /**
+       * @return Backing in use. EXPLICIT becomes TRANSPARENT once the huge page pool runs out.
+       */
+      HugePages pages() const {
+          return _pages;
+      }
+
+      /**
+       * @brief
+       * Backing of arenas constructed without one, NONE by default.
+       * @param pages HugePages
+       */
+      static void set_default_pages(HugePages pages) {
+          _default_pages.store(pages, std::memory_order_relaxed);
+      }
+
+      static HugePages default_pages() {
+          return _default_pages.load(std::memory_order_relaxed);
+      }
+
+    private:
+      struct Chunk {
+          char *ptr;
+          size_t size;
+          bool mapped; /**< From mmap, else from posix_memalign */
+      };
+
+      HugePages _pages;
+      const size_t _chunk;
+      std::vector<Chunk> _chunks;
+      char *_cur = nullptr, *_end = nullptr;
+      std::unordered_map<size_t, std::vector<void *>> _free; // Block size -> free blocks
+
+      static std::atomic<HugePages> _default_pages;
+
+      void _grow(size_t bytes);
+
+      static size_t _round(size_t bytes) {
+          return (bytes + VA_ARENA_ALIGN - 1) & ~size_t(VA_ARENA_ALIGN - 1);
+      }
+  };
+
+}
+
+#endif //VARGAS_ARENA_H
@@ -0,0 +1,93 @@
+/**
+ * @brief
+ * Built in benchmarks of the aligner kernels, I/O, and the simulator on synthetic data.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#ifndef VARGAS_BENCH_H
+#define VARGAS_BENCH_H
+
+#include "cxxopts.hpp"
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief
+ * Timings of one benchmark. Times are wall clock seconds per repetition, warmup excluded.
+ */
+struct BenchResult {
+    std::string name;
+    std::string unit; /**< Unit of work, e.g. cells or records */
+    double work = 0; /**< Units of work done by each repetition */
+    std::vector<double> times;
+
+    double mean() const;
+
+    /**
+     * @return Sample standard deviation, 0 with less than two repetitions
+     */
+    double stddev() const;
+
+    double min() const;
+
+    double max() const;
+
+    /**
+     * @return Units of work per second at the mean time
+     */
+    double throughput() const {
+        return work / mean();
+    }
+};
+
+/**
+ * @brief
+ * Time a benchmark.
+ * @param name Benchmark name
+ * @param unit Unit of work
+ * @param work Units of work per call of fn
+ * @param warmup Untimed calls before timing
+ * @param reps Timed calls
+ * @param fn Function to time
+ * @param setup Called before each call of fn, not timed
+ * @return timings
+ */
+BenchResult run_bench(const std::string &name, const std::string &unit, double work,
+                      unsigned warmup, unsigned reps,
+                      const std::function<void()> &fn, const std::function<void()> &setup = nullptr);
+
+/**
+ * @brief
+ * Write results as a JSON object with build info and one entry per benchmark.
+ * @param os Output stream
+ * @param results Benchmark results
+ */
+void write_bench_json(std::ostream &os, const std::vector<BenchResult> &results);
+
+/**
+ * @brief
+ * Write results as CSV, one row per benchmark.
+ * @param os Output stream
+ * @param results Benchmark results
+ */
+void write_bench_csv(std::ostream &os, const std::vector<BenchResult> &results);
+
+/**
+ * @brief
+ * Run benchmarks.
+ * @param argc CL arg count
+ * @param argv CL args
+ */
+int bench_main(int argc, char *argv[]);
+
+void bench_help(const cxxopts::Options &opts);
+
+#endif //VARGAS_BENCH_H
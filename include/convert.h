@@ -0,0 +1,117 @@
+/**
+ * @brief
+ * Export columns of SAM files as CSV.
+ *
+ * @details
+ * SAM text is split into byte ranges on line boundaries and converted by several threads.
+ * Records are not parsed: a scanner finds only the requested columns and aux tags, and
+ * read group values are looked up once per read group. Rows are written in input order.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#ifndef VARGAS_CONVERT_H
+#define VARGAS_CONVERT_H
+
+#include "sam.h"
+#include "utils.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define CONVERT_BLOCK_SIZE (size_t(4) << 20) // Bytes of SAM text per task
+
+namespace vargas {
+
+  /**
+   * @brief
+   * Projects SAM record lines onto a list of columns, one quoted CSV row per record.
+   * Values are the same as SAM::Record::get() of the parsed record.
+   */
+  class SAMProjection {
+    public:
+
+      /**
+       * @param hdr Header, for "RG:" prefixed columns
+       * @param columns Required field names (e.g. QNAME), aux tags, or read group tags prefixed with "RG:"
+       * @param prefix Prepended to each row
+       */
+      SAMProjection(const SAM::Header &hdr, const std::vector<std::string> &columns, std::string prefix = "");
+
+      /**
+       * @brief
+       * Append the row of a record.
+       * @param line Record line without the newline
+       * @param out string to append to
+       * @param missing Flag of each column, set to 1 if the record does not have it
+       * @throws std::invalid_argument if the record has fewer than 11 columns or a requested value is malformed
+       */
+      void row(rg::str_view line, std::string &out, std::vector<char> &missing) const;
+
+      /**
+       * @brief
+       * Append the rows of all records in a block of whole lines. Empty and header lines are skipped.
+       * @param begin Start of the first line
+       * @param end End of the block
+       * @param out string to append to
+       * @param missing Flag of each column, set to 1 if a record does not have it
+       * @return Number of rows
+       * @throws std::invalid_argument if a record is malformed
+       */
+      size_t rows(const char *begin, const char *end, std::string &out, std::vector<char> &missing) const;
+
+      /**
+       * @return Number of columns
+       */
+      size_t size() const {
+          return _cols.size();
+      }
+
+    private:
+      enum class Kind: uint8_t {QNAME, FLAG, RNAME, POS, MAPQ, CIGAR, RNEXT, PNEXT, TLEN, SEQ, QUAL, AUX, READ_GROUP};
+
+      struct Column {
+          Kind kind;
+          uint16_t code; /**< Aux tag code, see SAM::Optional::tag_code() */
+          size_t rg; /**< Index into the read group values */
+      };
+
+      struct RGValue {
+          bool found;
+          std::string val;
+      };
+
+      std::vector<Column> _cols;
+      std::vector<uint16_t> _aux; /**< Distinct aux tags to scan for, RG included if a read group column is used */
+      uint16_t _rg_code;
+      std::string _prefix;
+      std::unordered_map<std::string, std::vector<RGValue>> _read_groups; /**< RG ID -> value of each read group column */
+      size_t _num_rg = 0;
+  };
+
+  /**
+   * @brief
+   * Write the columns of SAM or BAM files as CSV. SAM files are converted by threads in blocks
+   * of whole lines, stdin is read a few blocks per thread at a time. BAM files are decoded by
+   * one thread. A warning is printed the first time a column is missing from a record.
+   * @param files Input files, an empty name reads stdin
+   * @param columns Columns, see SAMProjection
+   * @param threads Number of threads
+   * @param out Output stream
+   * @param block Bytes of SAM text per task
+   * @return Number of rows written
+   * @throws std::invalid_argument if a file cannot be read or a record is malformed
+   */
+  size_t convert_sam(const std::vector<std::string> &files, const std::vector<std::string> &columns,
+                     unsigned threads, std::ostream &out, size_t block = CONVERT_BLOCK_SIZE);
+
+}
+
+#endif //VARGAS_CONVERT_H
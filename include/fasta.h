@@ -25,6 +25,7 @@
 
 #include "utils.h"
 #include "htslib/faidx.h"
+#include "htslib/bgzf.h"
 
 
 namespace vargas {
@@ -377,6 +378,110 @@ namespace vargas {
       faidx_t *_index = nullptr;
   };
 
+  /**
+   * @brief
+   * Streaming FASTA/FASTQ reader.
+   * @details
+   * Input is read through htslib's BGZF, so plain, gzip, and bgzip files are handled.
+   * Records are read one at a time and the file is never held in memory. Multi-line
+   * FASTA sequences are joined. \n
+   * Usage:\n
+   * @code{.cpp}
+   * #include "fasta.h"
+   *
+   * vargas::ifastx in("reads.fq.gz", 4); // 4 decompression threads
+   * while (in.next()) {
+   *     in.name(); // Up to the first whitespace
+   *     in.seq();
+   *     in.qual(); // empty for FASTA
+   * }
+   * @endcode
+   */
+  class ifastx {
+    public:
+      ifastx() = default;
+
+      /**
+       * @param file_name file to open, empty for stdin
+       * @param threads BGZF decompression threads
+       */
+      explicit ifastx(const std::string &file_name, int threads = 0) {
+          open(file_name, threads);
+      }
+
+      ~ifastx() {
+          close();
+      }
+
+      ifastx(const ifastx &) = delete;
+      ifastx &operator=(const ifastx &) = delete;
+
+      /**
+       * @brief
+       * Close any open file and open the given file.
+       * @param file_name file to open, empty for stdin
+       * @param threads BGZF decompression threads. Only bgzip input is decompressed in parallel.
+       * @throws std::invalid_argument if the file cannot be opened
+       */
+      void open(const std::string &file_name, int threads = 0);
+
+      /**
+       * @brief
+       * Close the file.
+       */
+      void close();
+
+      /**
+       * @return true if a file is open.
+       */
+      bool good() const {
+          return _fp != nullptr;
+      }
+
+      /**
+       * @brief
+       * Load the next record.
+       * @return false if there are no more records
+       * @throws std::invalid_argument if the record is malformed
+       */
+      bool next();
+
+      /**
+       * @return Name of the current record, up to the first whitespace
+       */
+      const std::string &name() const {
+          return _name;
+      }
+
+      /**
+       * @return Sequence of the current record
+       */
+      const std::string &seq() const {
+          return _seq;
+      }
+
+      /**
+       * @return Qualities of the current record, empty for FASTA
+       */
+      const std::string &qual() const {
+          return _qual;
+      }
+
+    private:
+
+      /**
+       * @brief
+       * Read a line into _line, trailing CR removed.
+       * @return false at end of file
+       */
+      bool _getline();
+
+      BGZF *_fp = nullptr;
+      kstring_t _line = {0, 0, nullptr};
+      bool _pending = false; /**< _line holds the header of the next record */
+      std::string _name, _seq, _qual;
+  };
+
 }
 
 #endif //VARGAS_FASTA_H
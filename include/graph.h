@@ -7,7 +7,8 @@
  * @details
  * Each node stores a sequence and relevant
  * information. Graphs can be derived from other graphs with a filter, allowing
- * the extraction of population subsets.
+ * the extraction of population subsets. Derived graphs are a node mask over
+ * their base graph, and their edges are filtered from the base graph as they are traversed.
  *
  * @copyright
  * Distributed under the MIT Software License.
@@ -24,6 +25,8 @@
 #include "utils.h"
 #include "dyn_bitset.h"
 
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <unordered_map>
@@ -339,6 +342,29 @@ namespace vargas {
 
       using nodemap_t = std::unordered_map<unsigned, Node>; // Map an ID to a node
       using edgemap_t = std::unordered_map<unsigned, std::vector<unsigned>>; // Map an ID to a vec of next ID's
+      using mask_t = std::vector<uint64_t>; // Bit i set if node i of the base order is included
+
+      /**
+       * @brief
+       * Edges in compressed sparse row form. Nodes are referred to by their index in the node order.
+       * Edges of node i are [in_offsets[i], in_offsets[i + 1]) of in, likewise for out.
+       */
+      struct Topology {
+          std::vector<unsigned> order; /**< Node ID's, topographically ordered */
+          std::vector<unsigned> in_offsets, in;
+          std::vector<unsigned> out_offsets, out;
+
+          /**
+           * Position index: pinched nodes that begin after every node before them in the order ends.
+           * Sorted by position and order index. Built on first use, see Graph::build_index().
+           */
+          struct Pinch {
+              pos_t begin, end;
+              unsigned index;
+          };
+          mutable std::once_flag pinch_once;
+          mutable std::vector<Pinch> pinches;
+      };
 
       /**
        * @brief
@@ -352,13 +378,16 @@ namespace vargas {
 
           /**
            * @param g Graph
-           * @param idx Node in the insertion order to begin iterator at.
+           * @param idx Node in the insertion order to begin iterator at. For derived graphs,
+           * the next node of the graph at or after idx, in the direction of iteration.
            */
-          explicit GraphIterator(const Graph &g, const unsigned idx = 0) : _graph(g), _currID(idx), _empty(0) {}
+          explicit GraphIterator(const Graph &g, const unsigned idx = 0) :
+          _graph(g), _currID(FWD ? g._next_pos(idx) : g._prev_pos(idx)), _empty(0) {}
 
-          GraphIterator operator=(const GraphIterator &gi) {
+          GraphIterator &operator=(const GraphIterator &gi) {
               _graph = gi._graph;
               _currID = gi._currID;
+              return *this;
           }
           /**
            * @brief
@@ -388,15 +417,7 @@ namespace vargas {
            * @return iterator to the next Node.
            */
           GraphIterator &operator++() {
-              if (FWD) {
-                  if (_currID < _graph.get()._add_order.size()) ++_currID;
-              }
-              else {
-                  // reverse iterator
-                  const auto s = _graph.get()._add_order.size();
-                  if (_currID == 0) _currID = s;
-                  else if (_currID != s) --_currID;
-              }
+              _advance();
               return *this;
           }
 
@@ -407,14 +428,7 @@ namespace vargas {
            */
           GraphIterator operator++(int) {
               auto ret = *this;
-              if (FWD) {
-                  if (_currID < _graph.get()._add_order.size()) ++_currID;
-              }
-              else {
-                  const auto s = _graph.get()._add_order.size();
-                  if (_currID == 0) _currID = s;
-                  else if (_currID != s) --_currID;
-              }
+              _advance();
               return ret;
           }
 
@@ -424,7 +438,7 @@ namespace vargas {
            * @return Node
            */
           T &operator*() const {
-              return _graph.get()._IDMap->at(_graph.get()._add_order[_currID]);
+              return _graph.get()._IDMap->at(_graph.get()._id_at(_currID));
           }
 
           /**
@@ -437,22 +451,28 @@ namespace vargas {
           /**
            * @brief
            * All nodes that we've traversed that have incoming edges to the current node.
+           * For derived graphs the edges are filtered into a buffer reused by the next call.
            * @return vector of previous nodes
            */
           const std::vector<unsigned> &incoming() const {
+              const Graph &g = _graph.get();
+              if (g._masked) return g._masked_edges(_currID, g._topo->in_offsets, g._topo->in, _edges);
               try {
                   // Assume the previous edge existing is the common case (DAG w 1 start node)
-                  return _graph.get()._prev_map.at(_graph.get()._add_order[_currID]);
+                  return g._prev_map.at(g._add_order[_currID]);
               } catch (std::exception &e) { return _empty; }
           }
 
           /**
-           * @return vector of all outgoing edges
+           * @return vector of all outgoing edges. For derived graphs the edges are filtered
+           * into a buffer reused by the next call.
            */
           const std::vector<unsigned> &outgoing() const {
+              const Graph &g = _graph.get();
+              if (g._masked) return g._masked_edges(_currID, g._topo->out_offsets, g._topo->out, _edges);
               try {
                   // Assume the previous edge existing is the common case (DAG w 1 start node)
-                  return _graph.get()._next_map.at(_graph.get()._add_order[_currID]);
+                  return g._next_map.at(g._add_order[_currID]);
               } catch (std::exception &e) { return _empty; }
           }
 
@@ -469,6 +489,20 @@ namespace vargas {
           std::reference_wrapper<const Graph> _graph;
           unsigned _currID;
           const std::vector<unsigned> _empty;
+          mutable std::vector<unsigned> _edges; // Filtered edges of derived graphs
+
+          void _advance() {
+              const Graph &g = _graph.get();
+              const auto s = g._positions();
+              if (FWD) {
+                  if (_currID < s) _currID = g._next_pos(_currID + 1);
+              }
+              else {
+                  // reverse iterator
+                  if (_currID == 0) _currID = s;
+                  else if (_currID != s) _currID = g._prev_pos(_currID - 1);
+              }
+          }
       };
 
       using const_iterator = GraphIterator<const Graph::Node, true>;
@@ -485,29 +519,51 @@ namespace vargas {
        * @return end iterator.
        */
       const_iterator end() const {
-          return const_iterator(*this, _add_order.size());
+          return const_iterator(*this, _positions());
       }
 
       const_reverse_iterator rbegin() const {
-          return const_reverse_iterator(*this, _add_order.size() - 1);
+          return const_reverse_iterator(*this, _positions() - 1);
       }
 
       const_reverse_iterator rend() const {
-          return const_reverse_iterator(*this, _add_order.size());
+          return const_reverse_iterator(*this, _positions());
       }
 
       /**
-       * Seek a sequence position.
+       * Seek a sequence position. Binary searches the position index, then walks the nodes
+       * of at most one variant site.
        * @param pos 1 based
-       * @return pair of iterator and sequence offset
+       * @return pair of iterator and sequence offset, end() if pos is past the graph
        */
       std::pair<const_iterator, pos_t> seek(pos_t pos) const {
-          auto it = begin();
           --pos; // graph pos are stored as 0 indexed
-          while (it->end_pos() < pos) ++it;
-          return {it, pos - it->begin_pos()};
+          auto it = const_iterator(*this, _seek_pos(pos));
+          const auto e = end();
+          while (it != e && it->end_pos() < pos) ++it;
+          return {it, it == e ? 0 : pos - it->begin_pos()};
       };
 
+      /**
+       * @brief
+       * Nodes overlapping graph positions [min, max], without copying them. Runs from the first node
+       * ending at or after min to the first pinched node beginning after max, so alternate alleles
+       * near the ends may lie outside the range.
+       * @param min 0 based
+       * @param max 0 based, inclusive
+       * @return begin and end iterator
+       */
+      std::pair<const_iterator, const_iterator> range(pos_t min, pos_t max) const;
+
+      /**
+       * @brief
+       * Build the topology and position index now rather than on first use by seek(), range() or
+       * subgraph(). Until then those are not safe to call from multiple threads.
+       */
+      void build_index() const {
+          _pinches();
+      }
+
       /**
        * @brief
        * Default constructor inits a new Graph, including a new node map.
@@ -524,6 +580,16 @@ namespace vargas {
              std::vector<unsigned> node_order)
        : _IDMap(std::move(std::move(nodes))), _next_map(std::move(fwd)), _prev_map(std::move(rev)), _add_order(std::move(node_order)) {}
 
+      /**
+       * @brief
+       * Create a derived graph from a node mask over a base graph's topology.
+       * @param nodes Node map of the base graph
+       * @param base Topology of the base graph
+       * @param mask Bit i set to include node i of the base order
+       * @throws std::invalid_argument if the mask is not sized for the base graph
+       */
+      Graph(std::shared_ptr<nodemap_t> nodes, std::shared_ptr<const Topology> base, mask_t mask);
+
       /**
        * @brief
        * Build a graph given a reference FASTA file and a variant VCF or BCF file.
@@ -588,17 +654,43 @@ namespace vargas {
 
       /**
        * @brief
-       * Maps a node ID to a vector of all next nodes (outgoing edges)
+       * Maps a node ID to a vector of all next nodes (outgoing edges).
+       * Built on first use for derived graphs, prefer iterating.
        * @return map of ID, outgoing edge vectors
        */
-      const edgemap_t &next_map() const { return _next_map; }
+      const edgemap_t &next_map() const {
+          return _masked ? _built_maps().next : _next_map;
+      }
 
       /**
        * @brief
-       *  Maps a node ID to a vector of all incoming edge nodes
+       *  Maps a node ID to a vector of all incoming edge nodes.
+       *  Built on first use for derived graphs, prefer iterating.
        *  @return map of ID, incoming edges
        */
-      const edgemap_t &prev_map() const { return _prev_map; }
+      const edgemap_t &prev_map() const {
+          return _masked ? _built_maps().prev : _prev_map;
+      }
+
+      /**
+       * @return true if the graph is a node mask over a base graph
+       */
+      bool is_derived() const { return _masked; }
+
+      /**
+       * @brief
+       * For derived graphs the topology of the base graph, otherwise of this graph, built on first use.
+       * Graphs derived from this graph share it. Modifying the graph invalidates it.
+       * @return Edges in CSR form
+       */
+      std::shared_ptr<const Topology> topology() const;
+
+      /**
+       * @brief
+       * Nodes of the graph as a mask over topology()->order. All set if not derived.
+       * @return mask with topology()->order.size() bits
+       */
+      mask_t mask() const;
 
       /**
        * @brief
@@ -685,8 +777,11 @@ namespace vargas {
        */
       bool validate() const;
 
+      /**
+       * @return Node ID's in order. Built on first use for derived graphs, prefer iterating.
+       */
       const std::vector<unsigned> &order() const {
-          return _add_order;
+          return _masked ? _built_maps().order : _add_order;
       }
 
       /**
@@ -694,6 +789,7 @@ namespace vargas {
        * @param ids Node ID's, topographically ordered
        */
       void set_order(const std::vector<unsigned> &ids) {
+          _detach();
           _add_order = ids;
       }
 
@@ -703,6 +799,7 @@ namespace vargas {
        * @param edges forward edges
        */
       void set_edges(const edgemap_t &edges) {
+          _detach();
           for (auto &p : edges) {
               for (auto to : p.second) {
                   add_edge(p.first, to);
@@ -719,6 +816,7 @@ namespace vargas {
        * @param g
        */
       void assimilate(const Graph &g) {
+          _detach();
           // Insert new nodes
           std::set<unsigned> shared;
           for (auto &p : *g._IDMap) {
@@ -726,16 +824,33 @@ namespace vargas {
               else shared.insert(p.first);
           }
 
-          _add_order.reserve(_add_order.size() + g._add_order.size());
-          for (auto i : g._add_order) {
+          _add_order.reserve(_add_order.size() + g.order().size());
+          for (auto i : g.order()) {
               if (!shared.count(i)) _add_order.push_back(i);
           }
           _add_order.shrink_to_fit();
 
-          _merge_edges(_next_map, g._next_map);
-          _merge_edges(_prev_map, g._prev_map);
+          _merge_edges(_next_map, g.next_map());
+          _merge_edges(_prev_map, g.prev_map());
       }
 
+      /**
+       * @brief
+       * Insert variant sites into pinched reference nodes of an existing graph.
+       * @details
+       * A node holding sites is replaced by pinched reference nodes between the sites and a node per
+       * allele of each site. Graph positions are unchanged and new nodes get ID's above any in the node map.
+       * Sites are located through the position index. Apart from one pass over the order to splice in
+       * the new nodes, work is proportional to the number of sites. Replaced nodes are removed from the
+       * node map, so other graphs sharing it must be rebuilt.
+       * @param sites Allele nodes of each site, reference node first. Alleles of a site end at the same
+       * position and the reference allele must match the graph. ID's and pinch flags are set here.
+       * @return Each replaced node ID mapped to the ID's replacing it, in order
+       * @throws std::invalid_argument if the graph is derived, a site is not inside a pinched reference node,
+       * or sites overlap. The graph is unchanged if thrown.
+       */
+      std::unordered_map<unsigned, std::vector<unsigned>> insert_sites(std::vector<std::vector<Node>> sites);
+
       /**
        * @brief
        * Statistics about the current graph size.
@@ -761,14 +876,13 @@ namespace vargas {
        */
       Stats statistics() const {
           Stats ret;
-          for (const auto& i : *this) {
+          for (auto gi = begin(); gi != end(); ++gi) {
+              const Node &i = *gi;
               ++ret.num_nodes;
               ret.total_length += i.length();
               ret.num_snps += (i.length() == 1 && !i.is_ref());
               ret.num_dels += (i.length() == 0);
-              if (_next_map.count(i.id())) {
-                  ret.num_edges += _next_map.at(i.id()).size();
-              }
+              ret.num_edges += gi.outgoing().size();
           }
           return ret;
       }
@@ -786,11 +900,113 @@ namespace vargas {
       Population _filter;
 
       /**
-       * Given a subset of nodes from Graph g, rebuild all applicable edges in the new graph.
-       * @param g underlying parent graph
-       * @param includedNodes subset of g's nodes to include
+       * @brief
+       * Order and edge maps of a derived graph, built if requested through the accessors.
+       */
+      struct _Maps {
+          std::once_flag once;
+          edgemap_t next, prev;
+          std::vector<unsigned> order;
+      };
+
+      // Derived graphs are a mask over the base topology, and leave the maps and order above empty.
+      // Otherwise _topo caches this graph's topology.
+      bool _masked = false;
+      mask_t _mask;
+      mutable std::shared_ptr<const Topology> _topo;
+      std::shared_ptr<_Maps> _maps; // Shared by copies, the graph is immutable until detached
+
+      /**
+       * @return Number of positions iterators step over: the base order for derived graphs.
+       */
+      size_t _positions() const {
+          return _masked ? _topo->order.size() : _add_order.size();
+      }
+
+      bool _has(size_t i) const {
+          return (_mask[i >> 6] >> (i & 63)) & 1;
+      }
+
+      unsigned _id_at(size_t i) const {
+          return _masked ? _topo->order[i] : _add_order[i];
+      }
+
+      /**
+       * @return First position >= i in the graph, _positions() if none.
+       */
+      size_t _next_pos(size_t i) const {
+          const size_t s = _positions();
+          if (!_masked || i >= s) return std::min(i, s);
+          size_t w = i >> 6;
+          uint64_t bits = _mask[w] & (~uint64_t(0) << (i & 63));
+          while (!bits) {
+              if (++w == _mask.size()) return s;
+              bits = _mask[w];
+          }
+          return std::min<size_t>((w << 6) + __builtin_ctzll(bits), s);
+      }
+
+      /**
+       * @return Last position <= i in the graph, _positions() if none.
+       */
+      size_t _prev_pos(size_t i) const {
+          const size_t s = _positions();
+          if (i >= s) return s;
+          if (!_masked) return i;
+          size_t w = i >> 6;
+          uint64_t bits = _mask[w] & (~uint64_t(0) >> (63 - (i & 63)));
+          while (!bits) {
+              if (w-- == 0) return s;
+              bits = _mask[w];
+          }
+          return (w << 6) + 63 - __builtin_clzll(bits);
+      }
+
+      /**
+       * @brief
+       * Edges of base position i to nodes in the mask.
+       * @param i Position in the base order
+       * @param offsets CSR offsets
+       * @param edges CSR edges
+       * @param buf Output buffer
+       * @return buf, filled with node ID's
+       */
+      const std::vector<unsigned> &_masked_edges(size_t i, const std::vector<unsigned> &offsets,
+                                                 const std::vector<unsigned> &edges,
+                                                 std::vector<unsigned> &buf) const {
+          buf.clear();
+          for (unsigned e = offsets[i]; e < offsets[i + 1]; ++e) {
+              if (_has(edges[e])) buf.push_back(_topo->order[edges[e]]);
+          }
+          return buf;
+      }
+
+      /**
+       * @return Position index of the topology, built on first use.
+       */
+      const std::vector<Topology::Pinch> &_pinches() const;
+
+      /**
+       * @return Position in the base order from which a forward walk finds the first node ending at or after pos.
+       */
+      size_t _seek_pos(pos_t pos) const;
+
+      /**
+       * @brief
+       * Become a derived graph of base including the nodes in mask.
+       */
+      void _set_mask(std::shared_ptr<const Topology> base, mask_t mask);
+
+      /**
+       * @return Order and edge maps of a derived graph, built on first use.
+       */
+      const _Maps &_built_maps() const;
+
+      /**
+       * @brief
+       * Called before modifying the graph. A derived graph becomes a standalone graph.
        */
-      void _build_derived_edges(const Graph &g, const std::unordered_set<unsigned> &includedNodes);
+      void _detach();
 
       /**
        * @brief
@@ -832,6 +1048,51 @@ namespace vargas {
       return os;
   }
 
+  /**
+   * @brief
+   * Subgraphs of one parent graph, for aligning to all of them in one traversal of the parent.
+   * @details
+   * Each subgraph must be an induced subgraph of the parent, as derived graphs are: a subset of
+   * its nodes and all of the parent's edges between them. Each parent node carries a bit mask
+   * of the subgraphs containing it.
+   */
+  class SubgraphSet {
+    public:
+      using mask_t = uint64_t;
+      static constexpr unsigned max_size = 64;
+
+      /**
+       * @param parent Graph to traverse
+       * @param subgraphs Subgraphs of parent, at most max_size
+       * @throws std::invalid_argument if there are no subgraphs or more than max_size, or a subgraph has a node or edge that is not in the parent
+       */
+      SubgraphSet(std::shared_ptr<const Graph> parent, const std::vector<std::shared_ptr<const Graph>> &subgraphs);
+
+      const Graph &parent() const {
+          return *_parent;
+      }
+
+      /**
+       * @return Number of subgraphs
+       */
+      size_t size() const {
+          return _size;
+      }
+
+      /**
+       * @param i Index of a node in the parent's order
+       * @return Subgraphs containing the node, bit j set for subgraph j
+       */
+      mask_t mask(size_t i) const {
+          return _masks[i];
+      }
+
+    private:
+      std::shared_ptr<const Graph> _parent;
+      std::vector<mask_t> _masks;
+      size_t _size;
+  };
+
   /**
    * @brief
    * Takes a reference sequence and a variant file and builds a graph.
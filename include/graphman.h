@@ -22,6 +22,7 @@
 #include "fasta.h"
 #include "dyn_bitset.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <random>
 #include <chrono>
@@ -32,6 +33,10 @@ namespace vargas {
   /**
    * @brief
    * Resolve graph coords to a contig and position.
+   * @details
+   * Contigs are numbered in offset order. After _contig_offsets is filled, index() builds a flat
+   * contig table so that lookups do not allocate: a position resolves to a contig number,
+   * and the name is a reference into the table.
    */
   struct coordinate_resolver {
       /**
@@ -41,14 +46,103 @@ namespace vargas {
        * @return pair <contig name, position>
        */
       std::pair<std::string, unsigned> resolve(unsigned pos) const {
-          if (_contig_offsets.empty()) return {"", pos};
-          auto lb = _contig_offsets.lower_bound(pos);
-          if (lb != _contig_offsets.begin()) --lb; // For rare case that pos = 0
-          return {lb->second, pos - lb->first};
+          if (_names.empty()) return {"", pos};
+          const unsigned c = contig(pos);
+          return {_names[c], pos - _offsets[c]};
+      }
+
+      /**
+       * @brief
+       * Resolve a batch of positions, e.g. all alignments of a task. Consecutive positions in the same
+       * contig are resolved without a search.
+       * @param pos offset positions, 1 indexed
+       * @param contigs Set to contig number of each position
+       * @param rel Set to each position relative to its contig beginning
+       */
+      void resolve(const std::vector<pos_t> &pos, std::vector<unsigned> &contigs, std::vector<unsigned> &rel) const {
+          contigs.resize(pos.size());
+          rel.resize(pos.size());
+          if (_names.empty()) {
+              std::fill(contigs.begin(), contigs.end(), 0);
+              std::copy(pos.begin(), pos.end(), rel.begin());
+              return;
+          }
+          unsigned c = 0, lo = 0, hi = 0; // Positions in (lo, hi] are in contig c
+          for (size_t i = 0; i < pos.size(); ++i) {
+              const unsigned p = pos[i];
+              if (p <= lo || p > hi) {
+                  c = contig(p);
+                  lo = c ? _offsets[c] : 0;
+                  hi = c + 1 < _offsets.size() ? _offsets[c + 1] : ~0u;
+              }
+              contigs[i] = c;
+              rel[i] = p - _offsets[c];
+          }
+      }
+
+      /**
+       * @param pos offset position, 1 indexed
+       * @return Number of the contig containing pos. Requires index().
+       */
+      unsigned contig(unsigned pos) const {
+          const auto lb = std::lower_bound(_offsets.begin(), _offsets.end(), pos);
+          return lb == _offsets.begin() ? 0 : (lb - _offsets.begin()) - 1; // For rare case that pos = 0
+      }
+
+      /**
+       * @param name Contig name
+       * @return Number of the contig, size() if there is none
+       */
+      unsigned contig(const std::string &name) const {
+          const auto it = _ids.find(name);
+          return it == _ids.end() ? _names.size() : it->second;
+      }
+
+      /**
+       * @param contig Contig number
+       * @return Contig name, empty if the table has no such contig (e.g. a graph without contigs)
+       */
+      const std::string &name(unsigned contig) const {
+          static const std::string none;
+          return contig < _names.size() ? _names[contig] : none;
+      }
+
+      /**
+       * @param contig Contig number
+       * @return 0 based graph position of the first base of the contig
+       */
+      unsigned offset(unsigned contig) const {
+          return _offsets[contig];
+      }
+
+      /**
+       * @return Number of contigs in the table
+       */
+      size_t size() const {
+          return _names.size();
+      }
+
+      /**
+       * @brief
+       * Build the contig table from _contig_offsets.
+       */
+      void index() {
+          _offsets.clear();
+          _names.clear();
+          _ids.clear();
+          for (const auto &o : _contig_offsets) {
+              _ids.emplace(o.second, _names.size());
+              _offsets.push_back(o.first);
+              _names.push_back(o.second);
+          }
       }
 
       std::map<unsigned, std::string> _contig_offsets; // Maps an offset to contig
-      std::vector<std::string> _contig_hdr_order; // contigs in the order they are listed in header
+
+    private:
+      std::vector<unsigned> _offsets; // Contig table, sorted by offset
+      std::vector<std::string> _names;
+      std::unordered_map<std::string, unsigned> _ids;
   };
 
   /*
@@ -72,6 +166,7 @@ namespace vargas {
    *
    * @graphs
    * <name> <node id list> <edges>
+   * <name> mask <run lengths>
    * ...
    *
    * @nodes
@@ -80,6 +175,9 @@ namespace vargas {
    * ...
    *
    * @endcode
+   *
+   * Graphs derived from base are stored as a mask over the base node order: comma separated
+   * lengths of alternating runs of excluded and included nodes, starting with excluded.
    */
   class GraphMan {
     public:
@@ -112,7 +210,7 @@ namespace vargas {
 
       /**
        * @brief
-       * Open a graph definition file.
+       * Open a graph definition file. Position indexes of the graphs are built once loaded.
        * @param filename
        */
       void open(const std::string &filename);
@@ -133,15 +231,22 @@ namespace vargas {
        * @param contig_name
        * @return nodeID
        */
-      int nodeID_from_contig(const std::string& contig_name) {
-          return std::distance(_resolver._contig_hdr_order.begin(),
-                  std::find(_resolver._contig_hdr_order.begin(),_resolver._contig_hdr_order.end(), contig_name));
+      int nodeID_from_contig(const std::string& contig_name) const {
+          return _resolver.contig(contig_name);
       }
 
+      /**
+       * @brief
+       * Contig names and lengths in offset order, e.g. for SAM/BAM sequence lines.
+       * A contig spans from its offset to the next contig, the last ends at the last node.
+       * @return vector of <contig name, length>
+       */
+      std::vector<std::pair<std::string, unsigned>> contigs() const;
+
       /**
        * @return Object to resolve coordinates with.
        */
-      coordinate_resolver resolver() const {
+      const coordinate_resolver &resolver() const {
           return _resolver;
       }
 
@@ -198,6 +303,46 @@ namespace vargas {
        */
       std::string derive(std::string def);
 
+      /**
+       * @brief
+       * A variant to add to existing graphs.
+       */
+      struct Variant {
+          std::string contig;
+          pos_t pos; /**< 0 based position in the contig */
+          std::vector<std::string> alleles; /**< Reference allele first */
+          std::vector<float> af; /**< Allele frequencies, optional */
+          std::vector<Graph::Population> pop; /**< Haplotypes with each allele, optional */
+      };
+
+      /**
+       * @brief
+       * Insert variants into the base graph in place, see Graph::insert_sites.
+       * @details
+       * The ref and maxaf graphs are derived again from the new base. In population filtered graphs,
+       * pieces of a split node keep its membership and an allele is included if the filter has it.
+       * Without populations the reference allele has all haplotypes and alternates none. Alternates
+       * given a population are skipped if no one has them. Sites already in the graph with all of
+       * their alleles are skipped.
+       * @param vars Variants
+       * @param existing Set to the number of sites skipped as already present, optional
+       * @return Number of sites inserted
+       * @throws std::invalid_argument if a contig is unknown, a variant cannot be inserted, a graph is
+       * population filtered but its filter is not loaded (graph files do not store it), or a graph
+       * that is not a node mask of base holds a node that would be split. Graphs are unchanged if thrown.
+       */
+      size_t insert_variants(const std::vector<Variant> &vars, size_t *existing = nullptr);
+
+      /**
+       * @brief
+       * Insert the variants of a VCF or BCF file. Genotypes are used if the file has as many
+       * haplotypes as the base graph.
+       * @param vcf Variant file
+       * @param existing Set to the number of sites skipped as already present, optional
+       * @return Number of sites inserted
+       */
+      size_t insert_variants(const std::string &vcf, size_t *existing = nullptr);
+
 
     private:
       std::shared_ptr<Graph::nodemap_t> _nodes;
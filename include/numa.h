@@ -0,0 +1,81 @@
+/**
+ * @brief
+ * NUMA aware placement of worker threads. Node CPUs are read from sysfs, so no libnuma is needed.
+ *
+ * @details
+ * Memory is placed on the node of the CPU that first touches it. Data a worker should read
+ * locally is therefore allocated by a thread pinned to a CPU of that node, see run_each().
+ * On systems without NUMA information all allowed CPUs form a single node.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#ifndef VARGAS_NUMA_H
+#define VARGAS_NUMA_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace vargas {
+  namespace numa {
+
+    /**
+     * @brief
+     * Parse a sysfs CPU list.
+     * @param list e.g. "0-3,8,10-11"
+     * @return CPU numbers
+     * @throws std::invalid_argument on malformed lists
+     */
+    std::vector<unsigned> parse_cpulist(const std::string &list);
+
+    /**
+     * @return CPUs of each NUMA node that this process may run on. Nodes without such CPUs are omitted.
+     */
+    std::vector<std::vector<unsigned>> nodes();
+
+    /**
+     * @brief
+     * CPU and node of each worker.
+     */
+    struct Placement {
+        std::vector<unsigned> cpu; /**< CPU of each worker */
+        std::vector<unsigned> node; /**< Index into the node list of each worker */
+        unsigned num_nodes = 0;
+    };
+
+    /**
+     * @brief
+     * Spread workers round robin over the nodes, and in order over the CPUs of a node.
+     * CPUs are reused if there are more workers than CPUs.
+     * @param workers Number of workers
+     * @param nodes CPUs of each node, see nodes()
+     * @return Placement
+     */
+    Placement place(unsigned workers, const std::vector<std::vector<unsigned>> &nodes);
+
+    /**
+     * @brief
+     * Pin the calling thread to a CPU.
+     * @param cpu CPU number
+     * @return false if pinning is unsupported or refused
+     */
+    bool pin(unsigned cpu);
+
+    /**
+     * @brief
+     * Run fn(i) for each CPU on its own thread pinned to cpus[i], and wait for all of them.
+     * @param cpus CPU for each call
+     * @param fn Function, called with the index into cpus
+     * @throws The first exception thrown by fn
+     */
+    void run_each(const std::vector<unsigned> &cpus, const std::function<void(size_t)> &fn);
+
+  }
+}
+
+#endif //VARGAS_NUMA_H
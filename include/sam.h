@@ -16,7 +16,9 @@
 #define VARGAS_SAM_H
 
 #include "utils.h"
+#include "htslib/sam.h"
 #include <unordered_map>
+#include <cstdint>
 #include <utility>
 #include <vector>
 #include <sstream>
@@ -47,7 +49,17 @@ namespace vargas {
       /**
        * @param s Tokenize s into a cigar
        */
-      void parse(const std::string &s);
+      void parse(const std::string &s) {
+          parse(rg::str_view(s));
+      }
+
+      /**
+       * @brief
+       * Tokenize s into a cigar, reusing the operation storage.
+       * @param s cigar string, "*" or empty for no cigar
+       * @throws std::invalid_argument on an unknown operator or trailing length
+       */
+      void parse(rg::str_view s);
 
       std::string to_string() const {
           if (_cigar.empty()) return "*";
@@ -75,6 +87,20 @@ namespace vargas {
           return _cigar.cend();
       }
 
+      void clear() {
+          _cigar.clear();
+      }
+
+      /**
+       * @brief
+       * Append an operation.
+       * @param len operation length
+       * @param op operator
+       */
+      void push_back(size_t len, char op) {
+          _cigar.emplace_back(len, op);
+      }
+
       Cigar operator=(const std::string &s);
 
     private:
@@ -130,17 +156,82 @@ namespace vargas {
        * Represents optional data fields for any Header or Record type row.
        */
       struct Optional {
-          std::unordered_map<std::string, std::string> aux;
-          /**< Map the two char tag to value */
-          std::unordered_map<std::string, char> aux_fmt; /**< Map the two char tag to format */
 
           /**
            * @brief
-           * Clear all tags.
+           * A single aux field. Tags are packed into an integer so lookup
+           * is a compare rather than a string hash.
+           */
+          struct Field {
+              /**
+               * @brief
+               * How the value is stored. Numeric values are kept inline and only
+               * formatted when the record is written.
+               */
+              enum class Kind: uint8_t {STR, INT, FLOAT};
+
+              uint16_t tag; /**< Two char tag, see tag_code() */
+              char fmt; /**< SAM type character */
+              Kind kind;
+              union {
+                  int64_t i; /**< INT value */
+                  double f; /**< FLOAT value */
+              };
+              std::string val; /**< STR value, also used for types without a numeric form */
+
+              /**
+               * @brief
+               * Append the formatted value.
+               * @param out string to append to
+               */
+              void append_value(std::string &out) const;
+          };
+
+          Optional() = default;
+          Optional(const Optional &) = default;
+          Optional &operator=(const Optional &) = default;
+
+          /**
+           * @brief
+           * Moved from tags are left empty rather than with a stale count.
+           */
+          Optional(Optional &&o) noexcept : _fields(std::move(o._fields)), _n(o._n) {
+              o._n = 0;
+          }
+
+          Optional &operator=(Optional &&o) noexcept {
+              if (this != &o) {
+                  _fields = std::move(o._fields);
+                  _n = o._n;
+                  o._n = 0;
+              }
+              return *this;
+          }
+
+          /**
+           * @brief
+           * Pack a one or two char tag.
+           * @param t tag
+           * @return tag code, 0 if t is not a valid tag
+           */
+          static uint16_t tag_code(rg::str_view t) {
+              if (t.size() == 0 || t.size() > 2) return 0;
+              return uint16_t(uint8_t(t[0])) | uint16_t(t.size() == 2 ? uint8_t(t[1]) : 0) << 8;
+          }
+
+          /**
+           * @brief
+           * Clear all tags. Field storage is kept so later records reuse the buffers.
            */
           void clear() {
-              aux.clear();
-              aux_fmt.clear();
+              _n = 0;
+          }
+
+          /**
+           * @return Number of tags
+           */
+          size_t size() const {
+              return _n;
           }
 
           /**
@@ -148,25 +239,63 @@ namespace vargas {
            * Add a aux field of form X:Y:Z, where X is the tag
            * Y is the format, Z is the value. If Y is not provided, assume string.
            * @param a aux field
+           * @throws std::invalid_argument if a is not a valid field
            */
-          void add(std::string a);
+          void add(rg::str_view a);
 
+          void add(const std::string &a) {
+              add(rg::str_view(a));
+          }
+
+          /**
+           * @brief
+           * Set a tag, replacing any existing value.
+           * @param tag one or two char tag
+           * @param val value
+           * @throws std::invalid_argument if tag is not one or two chars
+           */
           template<typename T>
           void set(const std::string &tag, const T &val) {
-              char fmt_tag = 'Z'; // Default string type
-              if (std::is_floating_point<T>::value) fmt_tag = 'f';
-              else if (std::is_integral<T>::value) fmt_tag = 'i';
-              aux[tag] = rg::to_string(val);
-              aux_fmt[tag] = fmt_tag;
+              _set(_slot(tag), val);
           }
 
+          /**
+           * @brief
+           * Get a tag, converting from the stored type.
+           * @param tag one or two char tag
+           * @param val output
+           * @return true if the tag exists
+           */
           template<typename T>
           bool get(const std::string &tag, T &val) const {
-              if (aux.count(tag) == 0) return false;
-              rg::from_string(aux.at(tag), val);
+              const Field *f = find(tag_code(tag));
+              if (f == nullptr) return false;
+              _get(*f, val);
               return true;
           }
 
+          /**
+           * @param code tag code
+           * @return Field with the tag, or nullptr
+           */
+          const Field *find(uint16_t code) const {
+              if (code == 0) return nullptr;
+              for (size_t i = 0; i < _n; ++i) {
+                  if (_fields[i].tag == code) return &_fields[i];
+              }
+              return nullptr;
+          }
+
+          /**
+           * @return Fields in insertion order
+           */
+          const Field *begin() const {
+              return _fields.data();
+          }
+
+          const Field *end() const {
+              return _fields.data() + _n;
+          }
 
           /**
            * @brief
@@ -175,6 +304,75 @@ namespace vargas {
            */
           std::string to_string() const;
 
+          /**
+           * @brief
+           * Append all optional fields, tab leading.
+           * @param out string to append to
+           */
+          void append_to(std::string &out) const;
+
+        private:
+
+          template<typename T>
+          static typename std::enable_if<std::is_integral<T>::value>::type
+          _set(Field &f, T val) {
+              f.fmt = 'i';
+              f.kind = Field::Kind::INT;
+              f.i = val;
+          }
+
+          template<typename T>
+          static typename std::enable_if<std::is_floating_point<T>::value>::type
+          _set(Field &f, T val) {
+              f.fmt = 'f';
+              f.kind = Field::Kind::FLOAT;
+              f.f = val;
+          }
+
+          template<typename T>
+          static typename std::enable_if<!std::is_arithmetic<T>::value>::type
+          _set(Field &f, const T &val) {
+              f.fmt = 'Z';
+              f.kind = Field::Kind::STR;
+              f.val = rg::to_string(val);
+          }
+
+          static void _set(Field &f, const char *val) {
+              f.fmt = 'Z';
+              f.kind = Field::Kind::STR;
+              f.val.assign(val);
+          }
+
+          template<typename T>
+          static typename std::enable_if<std::is_arithmetic<T>::value>::type
+          _get(const Field &f, T &val) {
+              if (f.kind == Field::Kind::INT) val = f.i;
+              else if (f.kind == Field::Kind::FLOAT) val = f.f;
+              else rg::from_string(f.val, val);
+          }
+
+          static void _get(const Field &f, std::string &val) {
+              val.clear();
+              f.append_value(val);
+          }
+
+          /**
+           * @brief
+           * Get the field for tag, reusing a cleared slot if one is available.
+           * @param tag tag code
+           * @return Field with tag set
+           */
+          Field &_slot(uint16_t code);
+
+          Field &_slot(const std::string &tag) {
+              const uint16_t code = tag_code(tag);
+              if (code == 0) throw std::invalid_argument("Invalid aux tag: \"" + tag + "\"");
+              return _slot(code);
+          }
+
+          std::vector<Field> _fields; /**< Tags in insertion order, [0, _n) are live */
+          size_t _n = 0;
+
       };
 
       /**
@@ -477,8 +675,8 @@ namespace vargas {
            * Parse the given alignment line.
            * @param line
            */
-          explicit Record(std::string line) {
-              parse(std::move(line));
+          explicit Record(const std::string &line) {
+              parse(line);
           }
 
           /**
@@ -590,7 +788,19 @@ namespace vargas {
            * Parse the line and populate fields.
            * @throws std::invalid_argument if record has incorrect number of fields
            */
-          void parse(std::string line);
+          void parse(const std::string &line) {
+              parse(rg::str_view(line));
+          }
+
+          /**
+           * @brief
+           * Parse the line and populate fields. Fields are parsed in place and
+           * copied into the existing members, so parsing into the same Record does
+           * not allocate once its buffers are large enough.
+           * @param line SAM record line, without the newline
+           * @throws std::invalid_argument if record has incorrect number of fields
+           */
+          void parse(rg::str_view line);
 
           /**
            * @brief
@@ -606,8 +816,8 @@ namespace vargas {
            * Populate fields from a line
            * @param line SAM record line
            */
-          void operator<<(std::string line) {
-              parse(std::move(line));
+          void operator<<(const std::string &line) {
+              parse(line);
           }
 
           /**
@@ -615,8 +825,8 @@ namespace vargas {
            * Populate fields from a line
            * @param line SAM record line
            */
-          void operator=(std::string line) {
-              parse(std::move(line));
+          void operator=(const std::string &line) {
+              parse(line);
           }
 
           /**
@@ -686,6 +896,7 @@ namespace vargas {
  * @details
  * Minimal error checking is done, no error will be raised if there is a mismatch (e.g. a ref name
  * that is not defined in the header). \n
+ * Files ending in ".bam" are read through htslib and converted to the same Records. \n
  * See Vargas::SAM for more usage information.
  */
   class isam: public SAM {
@@ -702,6 +913,9 @@ namespace vargas {
           _pprec = std::move(o._pprec);
           _hdr = std::move(o._hdr);
           _use_stdio = o._use_stdio;
+          std::swap(_hts, o._hts);
+          std::swap(_bam_hdr, o._bam_hdr);
+          std::swap(_bam, o._bam);
       }
 
       ~isam() {
@@ -718,7 +932,7 @@ namespace vargas {
       /**
        * @brief
        * Close any open file and open the given file.
-       * @param file_name SAM file to open
+       * @param file_name SAM or BAM file to open
        * @throws std::invalid_argument if file cannot be opened
        */
       void open(std::string file_name);
@@ -727,17 +941,13 @@ namespace vargas {
        * @brief
        * Clear data and close any open handles.
        */
-      void close() {
-          in.close();
-          _hdr = SAM::Header();
-          _pprec = SAM::Record();
-      }
+      void close();
 
       /**
        * @return true if file is open.
        */
       bool good() const {
-          return in.good() || _use_stdio || !_buff.empty();
+          return in.good() || _use_stdio || _hts != nullptr || !_buff.empty();
       }
 
       /**
@@ -750,6 +960,13 @@ namespace vargas {
        */
       bool next();
 
+      /**
+       * @brief
+       * Pass over the next record without parsing it. The current record is unchanged.
+       * @return true if a record was skipped, false at the end of input
+       */
+      bool skip();
+
       /**
        * @brief
        * Push a record onto the SAM buffer.
@@ -761,10 +978,12 @@ namespace vargas {
 
       /**
        * @brief
-       * Load the rest of the records in the file and keep a subset of them.
-       * @param n Number of records to keep.
+       * Load the rest of the records in the file and keep a uniform random subset of them.
+       * Only n records are held at a time.
+       * @param n Number of records to keep, 0 to keep all.
+       * @param seed Sampling seed
        */
-      void subset(size_t n);
+      void subset(size_t n, uint64_t seed = 0);
 
       /**
        * @brief
@@ -784,10 +1003,24 @@ namespace vargas {
       }
 
     private:
+
+      /**
+       * @brief
+       * Read the next BAM record into _pprec.
+       * @return false at end of file
+       * @throws std::invalid_argument if the record cannot be read
+       */
+      bool _next_bam();
+
       std::string _curr_line;
       std::ifstream in;
       std::vector<Record> _buff;
 
+      // BAM input
+      samFile *_hts = nullptr;
+      bam_hdr_t *_bam_hdr = nullptr;
+      bam1_t *_bam = nullptr;
+
       SAM::Record _pprec;
   };
 
@@ -816,11 +1049,16 @@ namespace vargas {
        * @details
        * To allow streaming operation, the SAM::Header must be specified
        * at file open. This also allows for added alignments to be validated
-       * against header information.
+       * against header information. \n
+       * If file_name ends in ".bam" the output is written as BAM through htslib. Every
+       * reference name used by a record must then have a Sequence in the header.
        * @param file_name file to write
        * @param hdr SAM::Header of the file
+       * @param bam_threads BGZF compression threads for BAM output
+       * @param bam_compress Write compressed BAM, otherwise uncompressed BAM
        */
-      osam(std::string file_name, const SAM::Header &hdr) {
+      osam(std::string file_name, const SAM::Header &hdr, int bam_threads = 0, bool bam_compress = true) :
+      _bam_threads(bam_threads), _bam_compress(bam_compress) {
           _hdr = hdr;
           open(std::move(file_name));
       }
@@ -844,17 +1082,13 @@ namespace vargas {
        * @brief
        * Flush any data, and close the output file.
        */
-      void close() {
-          if (out.is_open()) {
-              out.close();
-          }
-      }
+      void close();
 
       /**
        * @return true of output open.
        */
       bool good() const {
-          return out.good() || _use_stdio;
+          return out.good() || _use_stdio || _hts != nullptr;
       }
 
       /**
@@ -865,7 +1099,8 @@ namespace vargas {
        */
       void add_record(const SAM::Record &r) {
           if (!good()) throw std::invalid_argument("No valid file open.");
-          (_use_stdio ? std::cout : out) << r.to_string() << '\n' << std::flush;
+          if (_hts) _write_bam(r);
+          else (_use_stdio ? std::cout : out) << r.to_string() << '\n' << std::flush;
       }
 
       /**
@@ -878,7 +1113,34 @@ namespace vargas {
       }
 
     private:
+
+      /**
+       * @brief
+       * Lay out the bam1_t data from the record fields and write it. Aux integers use the
+       * smallest BAM type that holds them, as htslib's SAM parser does.
+       * @param r record to write
+       * @throws std::invalid_argument if the record cannot be converted or written
+       */
+      void _write_bam(const SAM::Record &r);
+
+      /**
+       * @param name Reference name, "*" for none
+       * @return Target id, -1 if name is "*" or not in the header
+       */
+      int32_t _tid(const std::string &name) const {
+          if (name == "*") return -1;
+          return bam_name2id(_bam_hdr, name.c_str());
+      }
+
       std::ofstream out;
+
+      // BAM output
+      int _bam_threads = 0;
+      bool _bam_compress = true;
+      samFile *_hts = nullptr;
+      bam_hdr_t *_bam_hdr = nullptr;
+      bam1_t *_bam = nullptr;
+      std::vector<uint8_t> _data; /**< Scratch bam1_t data */
   };
 
 }
@@ -17,6 +17,7 @@
 #define VARGAS_SCORING_H
 
 #include "utils.h"
+#include <array>
 #include <vector>
 #include <cstdint>
 #include <cmath>
@@ -41,6 +42,8 @@ namespace vargas {
    * Aligner scoring parameters
    */
   struct ScoreProfile {
+      using penalty_lut_t = std::array<unsigned, 41>;
+
       ScoreProfile() = default;
 
       /**
@@ -77,6 +80,14 @@ namespace vargas {
           return mismatch_min + std::floor( (mismatch_max-mismatch_min) * (std::min<float>(c, 40.0)/40.0));
       }
 
+      /**
+       * @brief
+       * Mismatch penalties for all phred values, so the query profile
+       * does not evaluate penalty() for every read base.
+       * @return penalty LUT indexed by phred value, saturates at 40.
+       */
+      penalty_lut_t penalty_lut() const;
+
       unsigned
       match = 2, /**< Match bonus */
       mismatch_min = 2,
@@ -99,7 +110,7 @@ namespace vargas {
    * 1 based coords.
    */
   struct Results {
-      std::vector<pos_t> max_pos, sub_pos, max_last_pos, sub_last_pos, waiting_pos, waiting_last_pos;
+      std::vector<pos_t> max_pos, sub_pos;
       std::vector<unsigned> max_count, sub_count;
 
       std::vector<int> max_score; /**< Best scores */
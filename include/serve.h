@@ -0,0 +1,178 @@
+/**
+ * @brief
+ * Persistent alignment server. Graphs are loaded once and aligned against by requests
+ * arriving over a Unix domain socket, sharing one pool of workers with warm aligners.
+ *
+ * @details
+ * One request per connection. The client writes a request and shuts down its write side:
+ *
+ *     VARGAS-ALIGN 1
+ *     key=value        (zero or more, see AlignServer::handle)
+ *                      (empty line)
+ *     @HD ...          (SAM header of the reads, optional)
+ *     read records     (SAM lines)
+ *
+ * The server replies with "OK" and a SAM file of the aligned records, or "ERR <message>",
+ * then closes the connection.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#ifndef VARGAS_SERVE_H
+#define VARGAS_SERVE_H
+
+#include "cxxopts.hpp"
+#include "graphman.h"
+#include "sam.h"
+#include "scoring.h"
+#include "utils.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#define VARGAS_SERVE_MAGIC "VARGAS-ALIGN 1"
+
+namespace vargas {
+
+  class AlignerBase;
+
+  class AlignServer {
+    public:
+
+      /**
+       * @param gdfs Graph definition files. Requests name a graph by file name, the first is the default.
+       * @param prof Score profile used for all requests
+       * @param threads Number of alignment workers
+       * @throws std::invalid_argument if a graph cannot be loaded
+       */
+      AlignServer(const std::vector<std::string> &gdfs, const ScoreProfile &prof, unsigned threads);
+
+      ~AlignServer();
+
+      AlignServer(const AlignServer &) = delete;
+      AlignServer &operator=(const AlignServer &) = delete;
+
+      /**
+       * @brief
+       * Process one request. Keys are:
+       * graph: graph file name, default the first.
+       * alignto: targets as in align -a, default all reads to "base".
+       * flags: comma separated fwdonly, msonly, maxonly, notraceback, phred64, contigs, onepass.
+       * contigs adds sequence lines for the graph contigs, needed to write BAM.
+       * Safe to call concurrently.
+       * @param in Request
+       * @param out Response
+       */
+      void handle(std::istream &in, std::ostream &out);
+
+      /**
+       * @brief
+       * Accept connections on a Unix domain socket until stop() is called. Each connection is
+       * handled on its own thread. A stale socket at the path is replaced, and the socket is removed on return.
+       * @param path Socket path
+       * @throws std::runtime_error if the socket cannot be created, or another server is listening on path
+       */
+      void listen(const std::string &path);
+
+      /**
+       * @brief
+       * Make listen() return once open connections finish. Only sets a flag and shuts down the
+       * listening socket, so it can be called from a signal handler.
+       */
+      void stop();
+
+      unsigned threads() const {
+          return _workers.size();
+      }
+
+    private:
+      using aligner_ptr = std::unique_ptr<AlignerBase, rg::Deleter>;
+      using aligner_key = std::tuple<size_t, unsigned, bool, bool>; // read length, cell width, msonly, maxonly
+
+      ScoreProfile _prof;
+      std::vector<std::string> _names;
+      std::vector<std::unique_ptr<GraphMan>> _graphs;
+
+      std::mutex _graph_len_mut;
+      std::map<std::pair<size_t, std::string>, size_t> _graph_len; // (graph, label) -> bases
+
+      // Worker pool shared by all requests
+      std::mutex _mut;
+      std::condition_variable _cv;
+      std::deque<std::function<void(unsigned)>> _jobs;
+      bool _shutdown = false;
+      std::vector<std::thread> _workers;
+      std::vector<std::map<aligner_key, aligner_ptr>> _aligners; // Per worker, only touched by that worker
+
+      // Listening socket
+      std::atomic<int> _listen_fd{-1};
+      std::atomic<bool> _stopping{false};
+      std::mutex _conn_mut;
+      std::condition_variable _conn_cv;
+      unsigned _connections = 0;
+
+      void _work(unsigned tid);
+
+      size_t _graph_index(const std::string &name) const;
+
+      size_t _length(size_t graph, const std::string &label);
+
+      AlignerBase &_aligner(unsigned tid, size_t read_len, bool msonly, bool maxonly);
+
+      void _connection(int fd);
+  };
+
+  /**
+   * @brief
+   * Send a request to a server and return its response.
+   * @param path Socket path
+   * @param request Request text
+   * @return Response text
+   * @throws std::runtime_error on connection errors
+   */
+  std::string serve_request(const std::string &path, const std::string &request);
+
+  /**
+   * @brief
+   * Align the reads of a task list with a server.
+   * @param path Socket path
+   * @param keys Request key lines, each terminated by a newline
+   * @param reads_hdr Header of the reads
+   * @param task_list Reads to align
+   * @param resp_hdr Set to the header returned by the server
+   * @return Aligned records
+   * @throws std::runtime_error if the server reports an error
+   */
+  std::vector<SAM::Record> serve_align(const std::string &path, const std::string &keys, const SAM::Header &reads_hdr,
+                                       const std::vector<std::pair<std::string, std::vector<SAM::Record>>> &task_list,
+                                       SAM::Header &resp_hdr);
+
+}
+
+/**
+ * @brief
+ * Run an alignment server.
+ * @param argc CL arg count
+ * @param argv CL args
+ */
+int serve_main(int argc, char *argv[]);
+
+void serve_help(const cxxopts::Options &opts);
+
+#endif //VARGAS_SERVE_H
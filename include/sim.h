@@ -27,8 +27,10 @@
 #define SIM_SAM_USE_RATE_TAG "rt" // Errors were generated with rates rather than discrete numbers
 #define SIM_SAM_GRAPH_TAG "ph" // graph file
 
+#include <map>
 #include <random>
 #include <stdexcept>
+#include <unordered_map>
 
 #include "sam.h"
 #include "graphman.h"
@@ -37,11 +39,13 @@ namespace vargas {
 
   /**
    * @brief
-   * Generate reads from a graph using a given profile. srand() should be called externally.
+   * Generate reads from a graph using a given profile.
    * @details
    * Given a Graph, reads are generated by randomly picking a location in the graph, and extracting
    * a subsequence. Errors (either a fixed number, or at a specified rate) are introduced into the
    * read. The read is packed in a Read struct, containing the sequence and origin information.
+   * Each read draws from its own random stream, derived from the seed and the read index,
+   * so a batch can be split across several Sims and give the same reads.
    * Usage:\n
    * @code{.cpp}
    * #include "sim.h"
@@ -118,6 +122,17 @@ namespace vargas {
                                  _nodes(*(_graph.node_map())),
                                  _next(_graph.next_map()) { _init(); }
 
+      /**
+       * @brief
+       * Seed the generator. Read i after seeding is a function of (seed, first_read + i) only.
+       * @param seed Random seed
+       * @param first_read Index of the next read
+       */
+      void seed(uint64_t seed, uint64_t first_read = 0) {
+          _seed = seed;
+          _read_idx = first_read;
+      }
+
       /**
        * @brief
        * Generate and store an updated read.
@@ -161,6 +176,7 @@ namespace vargas {
           if (prof.var_nodes == 0 && prof.var_bases > 0)
               throw std::invalid_argument("Invalid profile option: var_nodes = 0, var_bases > 0.");
           _prof = prof;
+          _stratum = nullptr;
       }
 
       /**
@@ -189,31 +205,77 @@ namespace vargas {
 
 
       /**
-       * The last element represents the number of bases in the entire graph, with each element
-       * representing a running total. Generating a random number and then finding the first index
-       * greater than that gives a random node weighted to sequence length.
+       * Nodes in a dense index, graph order first. Successors of node i are
+       * _succ[_succ_begin[i], _succ_begin[i + 1]), so the walk does no map lookups.
        */
-      std::vector<unsigned> _node_ids;
-      std::vector<uint64_t> _node_weights;
+      std::vector<const Graph::Node *> _node_ptrs;
+      std::vector<size_t> _succ_begin;
+      std::vector<unsigned> _succ;
+      unsigned _num_graph_nodes;
+
+      /**
+       * Range of variant nodes and variant bases a read of _bounds_len can cover
+       * when it starts in a node, over all start offsets and paths.
+       */
+      struct _Bounds {
+          int min_vnodes, max_vnodes, min_vbases, max_vbases;
+      };
+      std::vector<_Bounds> _bounds;
+      unsigned _bounds_len = 0;
+
+      /**
+       * Start nodes that can satisfy a (var_nodes, var_bases) stratum, sampled by length.
+       */
+      struct _Stratum {
+          std::vector<unsigned> nodes;
+          rg::AliasTable table;
+      };
+      std::map<std::pair<int, int>, _Stratum> _strata;
+      const _Stratum *_stratum = nullptr;
 
       std::vector<SAM::Record> _batch;
       SAM::Record _read;
 
-      std::uniform_int_distribution<uint64_t> _node_weight_dist;
-      std::mt19937 _rand_generator;
+      rg::CounterRNG _rng;
+      uint64_t _seed, _read_idx = 0;
 
       // Abort trying to update the read after N tries
       const unsigned _abort_after = 1000000;
 
       /**
-       * Creates a vector of keys of all outgoing edges. Allows for random node selection
-       * This precludes the possibility of having reads begin in the last node of the graph.
+       * Builds the dense node index and successor lists.
        */
       void _init();
 
-      unsigned _random_node_id() {
-          return _node_ids[std::lower_bound(_node_weights.begin(), _node_weights.end(),
-                                            _node_weight_dist(_rand_generator)) - _node_weights.begin()];
+      /**
+       * @brief
+       * Select the start node index for the current profile, building it if needed.
+       * Only nodes that have a path covering the requested number of variant nodes and
+       * bases are kept, so tight strata are sampled directly instead of by rejection.
+       */
+      void _select_stratum();
+
+      /**
+       * @brief
+       * Bounds over all paths that cover r bases from the start of node idx.
+       */
+      _Bounds _walk_bounds(unsigned idx, unsigned r, std::unordered_map<uint64_t, _Bounds> &memo) const;
+
+      /**
+       * @brief
+       * Bounds over all successors of idx covering r bases, zero if there are none.
+       */
+      _Bounds _succ_bounds(unsigned idx, unsigned r, std::unordered_map<uint64_t, _Bounds> &memo) const;
+
+      /**
+       * @return Random start node index from the current stratum, weighted by length
+       */
+      unsigned _random_node() {
+          return _stratum->nodes[_stratum->table(_rng)];
+      }
+
+      char _rand_base() {
+          return "ACGTN"[_rng() % 5];
       }
 
       bool _update_read(const coordinate_resolver& resolver);
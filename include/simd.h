@@ -36,11 +36,13 @@
 #define VARGAS_SIMD_H
 
 #include "utils.h"
+#include "arena.h"
 #include "doctest.h"
 
 #include <type_traits>
 #include <stdexcept>
 #include <cstdint>
+#include <limits>
 #include <memory>
 #include <vector>
 #include <cstdlib>
@@ -66,6 +68,7 @@ AVX512F for AVX-512, KNCNI
 #ifdef VA_SIMD_USE_AVX512
 #  define VA_MAX_INT8 64
 #  define VA_MAX_INT16 32
+#  define VA_MAX_INT32 16
 #endif
 
 #ifdef VA_SIMD_USE_AVX2
@@ -75,6 +78,9 @@ AVX512F for AVX-512, KNCNI
 #  ifndef VA_MAX_INT16
 #    define VA_MAX_INT16 16
 #  endif
+#  ifndef VA_MAX_INT32
+#    define VA_MAX_INT32 8
+#  endif
 #endif
 
 #ifdef VA_SIMD_USE_SSE
@@ -84,6 +90,9 @@ AVX512F for AVX-512, KNCNI
 #  ifndef VA_MAX_INT16
 #    define VA_MAX_INT16 8
 #  endif
+#  ifndef VA_MAX_INT32
+#    define VA_MAX_INT32 4
+#  endif
 #endif
 
 namespace vargas {
@@ -101,7 +110,14 @@ namespace vargas {
 
   /**
    * @brief
-   * Allocate memory aligned to a boundary
+   * One bit per vector lane, lane i in bit i. Used to combine comparisons
+   * of vectors with different lane widths.
+   */
+  using lane_mask_t = uint64_t;
+
+  /**
+   * @brief
+   * Allocate memory aligned to a boundary, from an Arena if one is given.
    * @tparam T Allocator type
    * @tparam A alignment boundary, min 4 for 32 bit, 8 for 64 bit systems.
    */
@@ -122,7 +138,11 @@ namespace vargas {
       aligned_allocator() = default;
       aligned_allocator(const aligned_allocator &) = default;
       template<class U>
-      aligned_allocator(const aligned_allocator<U, A> &) {}
+      aligned_allocator(const aligned_allocator<U, A> &o) : _arena(o.arena()) {}
+      /**
+       * @param arena Arena to allocate from, nullptr for posix_memalign. Must outlive the allocations.
+       */
+      explicit aligned_allocator(Arena *arena) : _arena(arena) {}
       aligned_allocator &operator=(const aligned_allocator &) = delete;
       ~aligned_allocator() = default;
 
@@ -135,18 +155,20 @@ namespace vargas {
           return std::numeric_limits<size_t>::max() / sizeof(T);
       }
 
-      // stateless allocator
-      constexpr bool operator!=(const aligned_allocator &) const { return false; }
-      constexpr bool operator==(const aligned_allocator &) const { return true; }
+      bool operator!=(const aligned_allocator &o) const { return _arena != o._arena; }
+      bool operator==(const aligned_allocator &o) const { return _arena == o._arena; }
+
+      Arena *arena() const { return _arena; }
 
       T *allocate(std::size_t n) const {
           if (n == 0) return nullptr;
+          if (n > max_size()) throw std::length_error("aligned_allocator<T,A>::allocate() - Integer overflow.");
+          if (_arena) return static_cast<T *>(_arena->allocate(n * sizeof(T), A));
 
 #if USE_ALIGNED_ALLOC
           // aligned_alloc needs a multiple of al, but posix_memalign doesn't.
           if (n % al) n += al - (n % al);
 #endif
-          if (n > max_size()) throw std::length_error("aligned_allocator<T,A>::allocate() - Integer overflow.");
 
           void *p;
           int err = posix_memalign(&p, al, n * sizeof(T)); // aligned_alloc isn't implemented in most compilers even though it's part of C11/C++17
@@ -155,17 +177,21 @@ namespace vargas {
           return static_cast<T *>(p);
       }
 
-      void deallocate(T *p, std::size_t) const {
-          // Don't give std::size_t variable a name to eliminate the unused warning.
-          free(p);
+      void deallocate(T *p, std::size_t n) const {
+          if (_arena) _arena->deallocate(p, n * sizeof(T));
+          else free(p);
       }
+
+    private:
+      Arena *_arena = nullptr;
   };
 
 
   template<typename T, unsigned N>
   struct SIMD {
       using signed_type = typename std::make_signed<T>::type;
-      static_assert(std::is_same<signed_type, signed char>::value || std::is_same<signed_type, int16_t>::value, "Invalid signed_type in SIMD<signed_type,N>");
+      static_assert(std::is_same<signed_type, signed char>::value || std::is_same<signed_type, int16_t>::value
+                    || std::is_same<signed_type, int32_t>::value, "Invalid signed_type in SIMD<signed_type,N>");
 
       using native_t = T;
 
@@ -209,9 +235,12 @@ namespace vargas {
       __RG_STRONG_INLINE__ SIMD<T, N> and_not(const SIMD<T, N> &o) const;
       __RG_STRONG_INLINE__ bool any() const;
 
+      // Lane access type, may alias the vector register so writes are seen by vector ops
+      typedef native_t __attribute__((__may_alias__)) lane_t;
+
       __RG_STRONG_INLINE__
-      native_t &operator[](const int i) {
-          return reinterpret_cast<native_t *>(&v)[i];
+      lane_t &operator[](const int i) {
+          return reinterpret_cast<lane_t *>(&v)[i];
       };
 
       __RG_STRONG_INLINE__
@@ -256,17 +285,21 @@ namespace vargas {
   // SSE4.1
   using int8x16 = SIMD<char, 16>;
   using int16x8 = SIMD<int16_t, 8>;
+  using int32x4 = SIMD<int32_t, 4>;
 
   // AVX2
   using int8x32 = SIMD<char, 32>;
   using int16x16 = SIMD<int16_t, 16>;
+  using int32x8 = SIMD<int32_t, 8>;
 
   // AVX512
   using int8x64 = SIMD<char, 64>;
   using int16x32 = SIMD<int16_t, 32>;
+  using int32x16 = SIMD<int32_t, 16>;
 
   using int8_fast = SIMD<char, VA_MAX_INT8>;
   using int16_fast = SIMD<int16_t, VA_MAX_INT16>;
+  using int32_fast = SIMD<int32_t, VA_MAX_INT32>;
 
   /**
    * std::vector with an aligned allocator
@@ -279,51 +312,51 @@ namespace vargas {
 #define  COMPARISON_OPERATORS 1
   #ifdef VA_SIMD_USE_SSE
 
-  template<>
+  template<> __RG_STRONG_INLINE__
   int8x16 int8x16::operator^(const int8x16 &o) const {
       // XOR with all ones
       return _mm_xor_si128(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int8x16 &int8x16::operator=(const int8x16::native_t o) {
       v = _mm_set1_epi8(o);
       return *this;
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int8x16 int8x16::operator+(const int8x16 &o) const {
       return _mm_adds_epi8(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int8x16 int8x16::operator-(const int8x16 &o) const {
       return _mm_subs_epi8(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int8x16 int8x16::operator&(const int8x16 &o) const {
       return _mm_and_si128(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int8x16 int8x16::operator|(const int8x16 &o) const {
       return _mm_or_si128(v, o.v);
   }
 #if COMPARISON_OPERATORS
-  template<>
+  template<> __RG_STRONG_INLINE__
   typename int8x16::cmp_t int8x16::operator==(const int8x16 &o) const {
       return _mm_cmpeq_epi8(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   typename int8x16::cmp_t int8x16::operator>(const int8x16 &o) const {
       return _mm_cmpgt_epi8(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   typename int8x16::cmp_t int8x16::operator<(const int8x16 &o) const {
       return _mm_cmplt_epi8(v, o.v);
   }
 #endif
-  template<>
+  template<> __RG_STRONG_INLINE__
   bool int8x16::any() const {
       return _mm_movemask_epi8(v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int8x16 int8x16::and_not(const int8x16 &o) const {
       return _mm_andnot_si128(o.v, v);
   }
@@ -336,55 +369,67 @@ namespace vargas {
   int8x16 blend(const int8x16 &mask, const int8x16 &t, const int8x16 &f) {
       return _mm_blendv_epi8(f.v, t.v, mask.v);
   }
+  __RG_STRONG_INLINE__
+  lane_mask_t lane_mask(const int8x16 &mask) {
+      return uint16_t(_mm_movemask_epi8(mask.v));
+  }
+  __RG_STRONG_INLINE__
+  int8x16 mask_blend(const lane_mask_t mask, const int8x16 &t, const int8x16 &f) {
+      // Spread mask bytes 0,1 across lanes 0-7,8-15 and test one bit per lane
+      const __m128i sel = _mm_set1_epi64x(0x8040201008040201);
+      const __m128i spread = _mm_shuffle_epi8(_mm_cvtsi32_si128(int(mask)),
+                                              _mm_set_epi8(1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0));
+      return _mm_blendv_epi8(f.v, t.v, _mm_cmpeq_epi8(_mm_and_si128(spread, sel), sel));
+  }
 
 
 #if COMPARISON_OPERATORS
-  template<>
+  template<> __RG_STRONG_INLINE__
   typename int16x8::cmp_t
   int16x8::operator==(const int16x8 &o) const {
       return _mm_cmpeq_epi16(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   typename int16x8::cmp_t
   int16x8::operator>(const int16x8 &o) const {
       return _mm_cmpgt_epi16(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   typename int16x8::cmp_t
   int16x8::operator<(const int16x8 &o) const {
       return _mm_cmplt_epi16(v, o.v);
   }
 #endif
-  template<>
+  template<> __RG_STRONG_INLINE__
   int16x8 int16x8::operator^(const int16x8 &o) const {
       return _mm_xor_si128(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int16x8 &int16x8::operator=(const int16x8::native_t o) {
       v = _mm_set1_epi16(o);
       return *this;
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int16x8 int16x8::operator+(const int16x8 &o) const {
       return _mm_adds_epi16(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int16x8 int16x8::operator-(const int16x8 &o) const {
       return _mm_subs_epi16(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int16x8 int16x8::operator&(const int16x8 &o) const {
       return _mm_and_si128(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int16x8 int16x8::operator|(const int16x8 &o) const {
       return _mm_or_si128(v, o.v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   bool int16x8::any() const {
       return _mm_movemask_epi8(v);
   }
-  template<>
+  template<> __RG_STRONG_INLINE__
   int16x8 int16x8::and_not(const int16x8 &o) const {
       return _mm_andnot_si128(o.v, v);
   }
@@ -397,6 +442,93 @@ namespace vargas {
   int16x8 blend(const int16x8 &mask, const int16x8 &t, const int16x8 &f) {
       return _mm_blendv_epi8(f.v, t.v, mask.v);
   }
+  __RG_STRONG_INLINE__
+  lane_mask_t lane_mask(const int16x8 &mask) {
+      return uint8_t(_mm_movemask_epi8(_mm_packs_epi16(mask.v, _mm_setzero_si128())));
+  }
+  __RG_STRONG_INLINE__
+  int16x8 mask_blend(const lane_mask_t mask, const int16x8 &t, const int16x8 &f) {
+      const __m128i sel = _mm_set_epi16(128, 64, 32, 16, 8, 4, 2, 1);
+      const __m128i spread = _mm_set1_epi16(short(mask));
+      return _mm_blendv_epi8(f.v, t.v, _mm_cmpeq_epi16(_mm_and_si128(spread, sel), sel));
+  }
+
+  // 32 bit lanes have no saturating add/sub, overflowed lanes are clamped to the limit in the sign of a
+#if COMPARISON_OPERATORS
+  template<> __RG_STRONG_INLINE__
+  typename int32x4::cmp_t
+  int32x4::operator==(const int32x4 &o) const {
+      return _mm_cmpeq_epi32(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__
+  typename int32x4::cmp_t
+  int32x4::operator>(const int32x4 &o) const {
+      return _mm_cmpgt_epi32(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__
+  typename int32x4::cmp_t
+  int32x4::operator<(const int32x4 &o) const {
+      return _mm_cmplt_epi32(v, o.v);
+  }
+#endif
+  template<> __RG_STRONG_INLINE__
+  int32x4 int32x4::operator^(const int32x4 &o) const {
+      return _mm_xor_si128(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x4 &int32x4::operator=(const int32x4::native_t o) {
+      v = _mm_set1_epi32(o);
+      return *this;
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x4 int32x4::operator+(const int32x4 &o) const {
+      const __m128i r = _mm_add_epi32(v, o.v);
+      const __m128i ov = _mm_and_si128(_mm_xor_si128(v, r), _mm_xor_si128(o.v, r));
+      const __m128i sat = _mm_xor_si128(_mm_srai_epi32(v, 31), _mm_set1_epi32(INT32_MAX));
+      return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(r), _mm_castsi128_ps(sat), _mm_castsi128_ps(ov)));
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x4 int32x4::operator-(const int32x4 &o) const {
+      const __m128i r = _mm_sub_epi32(v, o.v);
+      const __m128i ov = _mm_and_si128(_mm_xor_si128(v, o.v), _mm_xor_si128(v, r));
+      const __m128i sat = _mm_xor_si128(_mm_srai_epi32(v, 31), _mm_set1_epi32(INT32_MAX));
+      return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(r), _mm_castsi128_ps(sat), _mm_castsi128_ps(ov)));
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x4 int32x4::operator&(const int32x4 &o) const {
+      return _mm_and_si128(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x4 int32x4::operator|(const int32x4 &o) const {
+      return _mm_or_si128(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__
+  bool int32x4::any() const {
+      return _mm_movemask_epi8(v);
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x4 int32x4::and_not(const int32x4 &o) const {
+      return _mm_andnot_si128(o.v, v);
+  }
+
+  __RG_STRONG_INLINE__
+  int32x4 max(const int32x4 &a, const int32x4 &b) {
+      return _mm_max_epi32(a.v, b.v);
+  }
+  __RG_STRONG_INLINE__
+  int32x4 blend(const int32x4 &mask, const int32x4 &t, const int32x4 &f) {
+      return _mm_blendv_epi8(f.v, t.v, mask.v);
+  }
+  __RG_STRONG_INLINE__
+  lane_mask_t lane_mask(const int32x4 &mask) {
+      return uint8_t(_mm_movemask_ps(_mm_castsi128_ps(mask.v)));
+  }
+  __RG_STRONG_INLINE__
+  int32x4 mask_blend(const lane_mask_t mask, const int32x4 &t, const int32x4 &f) {
+      const __m128i sel = _mm_set_epi32(8, 4, 2, 1);
+      const __m128i spread = _mm_set1_epi32(int(mask));
+      return _mm_blendv_epi8(f.v, t.v, _mm_cmpeq_epi32(_mm_and_si128(spread, sel), sel));
+  }
 
   #endif
 
@@ -404,42 +536,42 @@ namespace vargas {
 
   #ifdef VA_SIMD_USE_AVX2
 
-  template<> int8x32 int8x32::operator^(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x32 int8x32::operator^(const int8x32 &o) const {
       return _mm256_xor_si256(v, o.v);
   }
-  template<> int8x32 &int8x32::operator=(const int8x32::native_t o) {
+  template<> __RG_STRONG_INLINE__ int8x32 &int8x32::operator=(const int8x32::native_t o) {
       v = _mm256_set1_epi8(o);
       return *this;
   }
-  template<> int8x32 int8x32::operator+(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x32 int8x32::operator+(const int8x32 &o) const {
       return _mm256_adds_epi8(v, o.v);
   }
-  template<> int8x32 int8x32::operator-(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x32 int8x32::operator-(const int8x32 &o) const {
       assert(reinterpret_cast<uint64_t>(&o) % sizeof(o) == 0); 
       assert(reinterpret_cast<uint64_t>(this) % sizeof(*this) == 0); 
       return _mm256_subs_epi8(v, o.v);
   }
 #if COMPARISON_OPERATORS
-  template<> typename int8x32::cmp_t int8x32::operator==(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int8x32::cmp_t int8x32::operator==(const int8x32 &o) const {
       return _mm256_cmpeq_epi8(v, o.v);
   }
-  template<> typename int8x32::cmp_t int8x32::operator>(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int8x32::cmp_t int8x32::operator>(const int8x32 &o) const {
       return _mm256_cmpgt_epi8(v, o.v);
   }
-  template<> typename int8x32::cmp_t int8x32::operator<(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int8x32::cmp_t int8x32::operator<(const int8x32 &o) const {
       return _mm256_cmpgt_epi8(o.v, v);
   }
 #endif
-  template<> int8x32 int8x32::operator&(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x32 int8x32::operator&(const int8x32 &o) const {
       return _mm256_and_si256(v, o.v);
   }
-  template<> int8x32 int8x32::operator|(const int8x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x32 int8x32::operator|(const int8x32 &o) const {
       return _mm256_or_si256(v, o.v);
   }
-  template<> bool int8x32::any() const {
+  template<> __RG_STRONG_INLINE__ bool int8x32::any() const {
       return _mm256_movemask_epi8(v);
   }
-    template <>
+  template<> __RG_STRONG_INLINE__
   int8x32 int8x32::and_not(const int8x32 &o) const {
       return _mm256_andnot_si256(o.v, v);
   }
@@ -451,42 +583,55 @@ namespace vargas {
   int8x32 blend(const int8x32 &mask, const int8x32 &t, const int8x32 &f) {
       return _mm256_blendv_epi8(f.v, t.v, mask.v);
   }
+  __RG_STRONG_INLINE__
+  lane_mask_t lane_mask(const int8x32 &mask) {
+      return uint32_t(_mm256_movemask_epi8(mask.v));
+  }
+  __RG_STRONG_INLINE__
+  int8x32 mask_blend(const lane_mask_t mask, const int8x32 &t, const int8x32 &f) {
+      // Shuffles stay within 128 bit halves, so broadcast all four mask bytes first
+      const __m256i sel = _mm256_set1_epi64x(0x8040201008040201);
+      const __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32(int(mask)),
+                                                 _mm256_set_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+                                                                 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0));
+      return _mm256_blendv_epi8(f.v, t.v, _mm256_cmpeq_epi8(_mm256_and_si256(spread, sel), sel));
+  }
 
 
 #if COMPARISON_OPERATORS
-  template<> typename int16x16::cmp_t int16x16::operator==(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int16x16::cmp_t int16x16::operator==(const int16x16 &o) const {
       return _mm256_cmpeq_epi16(v, o.v);
   }
-  template<> typename int16x16::cmp_t int16x16::operator>(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int16x16::cmp_t int16x16::operator>(const int16x16 &o) const {
       return _mm256_cmpgt_epi16(v, o.v);
   }
-  template<> typename int16x16::cmp_t int16x16::operator<(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int16x16::cmp_t int16x16::operator<(const int16x16 &o) const {
       return _mm256_cmpgt_epi16(o.v, v);
   }
 #endif
-  template<> int16x16 int16x16::operator^(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x16 int16x16::operator^(const int16x16 &o) const {
       return _mm256_xor_si256(v, o.v);
   }
-  template<> int16x16 &int16x16::operator=(const int16x16::native_t o) {
+  template<> __RG_STRONG_INLINE__ int16x16 &int16x16::operator=(const int16x16::native_t o) {
       v = _mm256_set1_epi16(o);
       return *this;
   }
-  template<> int16x16 int16x16::operator+(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x16 int16x16::operator+(const int16x16 &o) const {
       return _mm256_adds_epi16(v, o.v);
   }
-  template<> int16x16 int16x16::operator-(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x16 int16x16::operator-(const int16x16 &o) const {
       return _mm256_subs_epi16(v, o.v);
   }
-  template<> int16x16 int16x16::operator&(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x16 int16x16::operator&(const int16x16 &o) const {
       return _mm256_and_si256(v, o.v);
   }
-  template<> int16x16 int16x16::operator|(const int16x16 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x16 int16x16::operator|(const int16x16 &o) const {
       return _mm256_or_si256(v, o.v);
   }
-  template<> bool int16x16::any() const {
+  template<> __RG_STRONG_INLINE__ bool int16x16::any() const {
       return _mm256_movemask_epi8(v);
   }
-  template <>
+  template<> __RG_STRONG_INLINE__
   int16x16 int16x16::and_not(const int16x16 &o) const {
       return _mm256_andnot_si256(o.v, v);
   }
@@ -494,47 +639,123 @@ namespace vargas {
   int16x16 max(const int16x16 &a, const int16x16 &b) {
       return _mm256_max_epi16(a.v, b.v);
   }
-//  __RG_STRONG_INLINE__
-//  int16x16 blend(const int16x16 &mask, const int16x16 &t, const int16x16 &f) {
-//      return _mm256_blendv_epi16(f.v, t.v, mask.v);
-//  }
+  __RG_STRONG_INLINE__
+  int16x16 blend(const int16x16 &mask, const int16x16 &t, const int16x16 &f) {
+      // Comparison masks set every bit of a lane, so a byte blend is equivalent
+      return _mm256_blendv_epi8(f.v, t.v, mask.v);
+  }
+  __RG_STRONG_INLINE__
+  lane_mask_t lane_mask(const int16x16 &mask) {
+      // packs interleaves the 128 bit halves, restore lane order before taking the sign bits
+      const __m256i packed = _mm256_packs_epi16(mask.v, _mm256_setzero_si256());
+      return uint16_t(_mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0))));
+  }
+  __RG_STRONG_INLINE__
+  int16x16 mask_blend(const lane_mask_t mask, const int16x16 &t, const int16x16 &f) {
+      const __m256i sel = _mm256_set_epi16(-32768, 16384, 8192, 4096, 2048, 1024, 512, 256,
+                                           128, 64, 32, 16, 8, 4, 2, 1);
+      const __m256i spread = _mm256_set1_epi16(short(mask));
+      return _mm256_blendv_epi8(f.v, t.v, _mm256_cmpeq_epi16(_mm256_and_si256(spread, sel), sel));
+  }
+
+  template<> __RG_STRONG_INLINE__ typename int32x8::cmp_t int32x8::operator==(const int32x8 &o) const {
+      return _mm256_cmpeq_epi32(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ typename int32x8::cmp_t int32x8::operator>(const int32x8 &o) const {
+      return _mm256_cmpgt_epi32(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ typename int32x8::cmp_t int32x8::operator<(const int32x8 &o) const {
+      return _mm256_cmpgt_epi32(o.v, v);
+  }
+  template<> __RG_STRONG_INLINE__ int32x8 int32x8::operator^(const int32x8 &o) const {
+      return _mm256_xor_si256(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ int32x8 &int32x8::operator=(const int32x8::native_t o) {
+      v = _mm256_set1_epi32(o);
+      return *this;
+  }
+  template<> __RG_STRONG_INLINE__ int32x8 int32x8::operator+(const int32x8 &o) const {
+      const __m256i r = _mm256_add_epi32(v, o.v);
+      const __m256i ov = _mm256_and_si256(_mm256_xor_si256(v, r), _mm256_xor_si256(o.v, r));
+      const __m256i sat = _mm256_xor_si256(_mm256_srai_epi32(v, 31), _mm256_set1_epi32(INT32_MAX));
+      return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(r), _mm256_castsi256_ps(sat),
+                                                   _mm256_castsi256_ps(ov)));
+  }
+  template<> __RG_STRONG_INLINE__ int32x8 int32x8::operator-(const int32x8 &o) const {
+      const __m256i r = _mm256_sub_epi32(v, o.v);
+      const __m256i ov = _mm256_and_si256(_mm256_xor_si256(v, o.v), _mm256_xor_si256(v, r));
+      const __m256i sat = _mm256_xor_si256(_mm256_srai_epi32(v, 31), _mm256_set1_epi32(INT32_MAX));
+      return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(r), _mm256_castsi256_ps(sat),
+                                                   _mm256_castsi256_ps(ov)));
+  }
+  template<> __RG_STRONG_INLINE__ int32x8 int32x8::operator&(const int32x8 &o) const {
+      return _mm256_and_si256(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ int32x8 int32x8::operator|(const int32x8 &o) const {
+      return _mm256_or_si256(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ bool int32x8::any() const {
+      return _mm256_movemask_epi8(v);
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x8 int32x8::and_not(const int32x8 &o) const {
+      return _mm256_andnot_si256(o.v, v);
+  }
+  __RG_STRONG_INLINE__
+  int32x8 max(const int32x8 &a, const int32x8 &b) {
+      return _mm256_max_epi32(a.v, b.v);
+  }
+  __RG_STRONG_INLINE__
+  int32x8 blend(const int32x8 &mask, const int32x8 &t, const int32x8 &f) {
+      return _mm256_blendv_epi8(f.v, t.v, mask.v);
+  }
+  __RG_STRONG_INLINE__
+  lane_mask_t lane_mask(const int32x8 &mask) {
+      return uint8_t(_mm256_movemask_ps(_mm256_castsi256_ps(mask.v)));
+  }
+  __RG_STRONG_INLINE__
+  int32x8 mask_blend(const lane_mask_t mask, const int32x8 &t, const int32x8 &f) {
+      const __m256i sel = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+      const __m256i spread = _mm256_set1_epi32(int(mask));
+      return _mm256_blendv_epi8(f.v, t.v, _mm256_cmpeq_epi32(_mm256_and_si256(spread, sel), sel));
+  }
 
   #endif // VA_SIMD_USE_AVX2
 
   #ifdef VA_SIMD_USE_AVX512
 
-  template<> typename int8x64::cmp_t int8x64::operator==(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int8x64::cmp_t int8x64::operator==(const int8x64 &o) const {
       return _mm512_cmpeq_epi8_mask(v, o.v);
   }
-  template<> typename int8x64::cmp_t int8x64::operator>(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int8x64::cmp_t int8x64::operator>(const int8x64 &o) const {
       return _mm512_cmpgt_epi8_mask(v, o.v);
   }
-  template<> typename int8x64::cmp_t int8x64::operator<(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int8x64::cmp_t int8x64::operator<(const int8x64 &o) const {
       return _mm512_cmpgt_epi8_mask(o.v, v);
   }
-  template<> int8x64 int8x64::operator^(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x64 int8x64::operator^(const int8x64 &o) const {
       return _mm512_xor_si512(v, o.v);
   }
-  template<> int8x64 &int8x64::operator=(const int8x64::native_t o) {
+  template<> __RG_STRONG_INLINE__ int8x64 &int8x64::operator=(const int8x64::native_t o) {
     v =  _mm512_set1_epi8(o);
     return *this;
   }
-  template<> int8x64 int8x64::operator+(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x64 int8x64::operator+(const int8x64 &o) const {
       return _mm512_adds_epi8(v, o.v);
   }
-  template<> int8x64 int8x64::operator-(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x64 int8x64::operator-(const int8x64 &o) const {
       return _mm512_subs_epi8(v, o.v);
   }
-  template<> int8x64 int8x64::operator&(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x64 int8x64::operator&(const int8x64 &o) const {
       return _mm512_and_si512(v, o.v);
   }
-  template<> int8x64 int8x64::operator|(const int8x64 &o) const {
+  template<> __RG_STRONG_INLINE__ int8x64 int8x64::operator|(const int8x64 &o) const {
       return _mm512_or_si512(v, o.v);
   }
-  template<> bool int8x64::any() const {
+  template<> __RG_STRONG_INLINE__ bool int8x64::any() const {
       return _mm512_movepi8_mask(v);
   }
-    template <>
+  template<> __RG_STRONG_INLINE__
   int8x64 int8x64::and_not(const int8x64 &o) const {
       return _mm512_andnot_si512(o.v, v);
   }
@@ -542,44 +763,48 @@ namespace vargas {
   int8x64 max(const int8x64 &a, const int8x64 &b) {
       return _mm512_max_epi8(a.v, b.v);
   }
-//  __RG_STRONG_INLINE__
-//  int8x64 blend(const int8x64 &mask, const int8x64 &t, const int8x64 &f) {
-//      return _mm512_blendv_epi8(f.v, t.v, mask.v);
-//  }
+  __RG_STRONG_INLINE__
+  int8x64 blend(const MaskType &mask, const int8x64 &t, const int8x64 &f) {
+      return _mm512_mask_blend_epi8(mask, f.v, t.v);
+  }
+  __RG_STRONG_INLINE__
+  int8x64 mask_blend(const lane_mask_t mask, const int8x64 &t, const int8x64 &f) {
+      return _mm512_mask_blend_epi8(mask, f.v, t.v);
+  }
 
 
-  template<> typename int16x32::cmp_t int16x32::operator==(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int16x32::cmp_t int16x32::operator==(const int16x32 &o) const {
       return _mm512_cmpeq_epi16_mask(v, o.v);
   }
-  template<> typename int16x32::cmp_t int16x32::operator>(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int16x32::cmp_t int16x32::operator>(const int16x32 &o) const {
       return _mm512_cmpgt_epi16_mask(v, o.v);
   }
-  template<> typename int16x32::cmp_t int16x32::operator<(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ typename int16x32::cmp_t int16x32::operator<(const int16x32 &o) const {
       return _mm512_cmpgt_epi16_mask(o.v, v);
   }
-  template<> int16x32 int16x32::operator^(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x32 int16x32::operator^(const int16x32 &o) const {
       return _mm512_xor_si512(v, o.v);
   }
-  template<> int16x32 &int16x32::operator=(const int16x32::native_t o) {
+  template<> __RG_STRONG_INLINE__ int16x32 &int16x32::operator=(const int16x32::native_t o) {
       v = _mm512_set1_epi16(o);
       return *this;
   }
-  template<> int16x32 int16x32::operator+(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x32 int16x32::operator+(const int16x32 &o) const {
       return _mm512_adds_epi16(v, o.v);
   }
-  template<> int16x32 int16x32::operator-(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x32 int16x32::operator-(const int16x32 &o) const {
       return _mm512_subs_epi16(v, o.v);
   }
-  template<> int16x32 int16x32::operator&(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x32 int16x32::operator&(const int16x32 &o) const {
       return _mm512_and_si512(v, o.v);
   }
-  template<> int16x32 int16x32::operator|(const int16x32 &o) const {
+  template<> __RG_STRONG_INLINE__ int16x32 int16x32::operator|(const int16x32 &o) const {
       return _mm512_or_si512(v, o.v);
   }
-  template<> bool int16x32::any() const {
+  template<> __RG_STRONG_INLINE__ bool int16x32::any() const {
       return _mm512_movepi16_mask(v);
   }
-  template <>
+  template<> __RG_STRONG_INLINE__
   int16x32 int16x32::and_not(const int16x32 &o) const {
       return _mm512_andnot_si512(o.v, v);
   }
@@ -587,14 +812,296 @@ namespace vargas {
   int16x32 max(const int16x32 &a, const int16x32 &b) {
       return _mm512_max_epi16(a.v, b.v);
   }
-//  __RG_STRONG_INLINE__
-//  int16x32 blend(const int16x32 &mask, const int16x32 &t, const int16x32 &f) {
-//      return _mm512_blendv_epi16(f.v, t.v, mask.v);
-//  }
+  __RG_STRONG_INLINE__
+  int16x32 blend(const MaskType &mask, const int16x32 &t, const int16x32 &f) {
+      return _mm512_mask_blend_epi16(mask, f.v, t.v);
+  }
+  __RG_STRONG_INLINE__
+  int16x32 mask_blend(const lane_mask_t mask, const int16x32 &t, const int16x32 &f) {
+      return _mm512_mask_blend_epi16(__mmask32(mask), f.v, t.v);
+  }
+
+
+  template<> __RG_STRONG_INLINE__ typename int32x16::cmp_t int32x16::operator==(const int32x16 &o) const {
+      return _mm512_cmpeq_epi32_mask(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ typename int32x16::cmp_t int32x16::operator>(const int32x16 &o) const {
+      return _mm512_cmpgt_epi32_mask(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ typename int32x16::cmp_t int32x16::operator<(const int32x16 &o) const {
+      return _mm512_cmpgt_epi32_mask(o.v, v);
+  }
+  template<> __RG_STRONG_INLINE__ int32x16 int32x16::operator^(const int32x16 &o) const {
+      return _mm512_xor_si512(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ int32x16 &int32x16::operator=(const int32x16::native_t o) {
+      v = _mm512_set1_epi32(o);
+      return *this;
+  }
+  template<> __RG_STRONG_INLINE__ int32x16 int32x16::operator+(const int32x16 &o) const {
+      const __m512i r = _mm512_add_epi32(v, o.v), zero = _mm512_setzero_si512();
+      const __m512i ov = _mm512_and_si512(_mm512_xor_si512(v, r), _mm512_xor_si512(o.v, r));
+      const __m512i sat = _mm512_mask_blend_epi32(_mm512_cmplt_epi32_mask(v, zero), _mm512_set1_epi32(INT32_MAX),
+                                                  _mm512_set1_epi32(INT32_MIN));
+      return _mm512_mask_blend_epi32(_mm512_cmplt_epi32_mask(ov, zero), r, sat);
+  }
+  template<> __RG_STRONG_INLINE__ int32x16 int32x16::operator-(const int32x16 &o) const {
+      const __m512i r = _mm512_sub_epi32(v, o.v), zero = _mm512_setzero_si512();
+      const __m512i ov = _mm512_and_si512(_mm512_xor_si512(v, o.v), _mm512_xor_si512(v, r));
+      const __m512i sat = _mm512_mask_blend_epi32(_mm512_cmplt_epi32_mask(v, zero), _mm512_set1_epi32(INT32_MAX),
+                                                  _mm512_set1_epi32(INT32_MIN));
+      return _mm512_mask_blend_epi32(_mm512_cmplt_epi32_mask(ov, zero), r, sat);
+  }
+  template<> __RG_STRONG_INLINE__ int32x16 int32x16::operator&(const int32x16 &o) const {
+      return _mm512_and_si512(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ int32x16 int32x16::operator|(const int32x16 &o) const {
+      return _mm512_or_si512(v, o.v);
+  }
+  template<> __RG_STRONG_INLINE__ bool int32x16::any() const {
+      return _mm512_cmplt_epi32_mask(v, _mm512_setzero_si512());
+  }
+  template<> __RG_STRONG_INLINE__
+  int32x16 int32x16::and_not(const int32x16 &o) const {
+      return _mm512_andnot_si512(o.v, v);
+  }
+  __RG_STRONG_INLINE__
+  int32x16 max(const int32x16 &a, const int32x16 &b) {
+      // Blend of a compare, _mm512_max_epi32 trips -Wmaybe-uninitialized in GCC 12 headers
+      return _mm512_mask_blend_epi32(_mm512_cmpgt_epi32_mask(b.v, a.v), a.v, b.v);
+  }
+  __RG_STRONG_INLINE__
+  int32x16 blend(const MaskType &mask, const int32x16 &t, const int32x16 &f) {
+      return _mm512_mask_blend_epi32(__mmask16(mask), f.v, t.v);
+  }
+  __RG_STRONG_INLINE__
+  int32x16 mask_blend(const lane_mask_t mask, const int32x16 &t, const int32x16 &f) {
+      return _mm512_mask_blend_epi32(__mmask16(mask), f.v, t.v);
+  }
+  __RG_STRONG_INLINE__
+  lane_mask_t lane_mask(const MaskType &mask) {
+      return mask.v;
+  }
 
   #endif // VA_SIMD_USE_AVX512
 
+  /**
+   * @brief
+   * Unsigned 32 bit lanes paired with an N lane score vector, e.g. positions and counts.
+   * @details
+   * Comparisons return a lane_mask_t so they can be combined with lane_mask() of score
+   * comparisons, and updates are masked by lane. Comparisons are unsigned.
+   * @tparam N number of lanes
+   */
+  template<unsigned N>
+  struct Lanes32 {
+      #ifdef VA_SIMD_USE_AVX512
+      using reg_t = __m512i;
+      #elif VA_SIMD_USE_AVX2
+      using reg_t = __m256i;
+      #else
+      using reg_t = __m128i;
+      #endif
+
+      static constexpr unsigned length = N;
+      static constexpr unsigned per_reg = sizeof(reg_t) / sizeof(uint32_t);
+      static constexpr unsigned regs = N / per_reg;
+      static_assert(N % per_reg == 0, "Lane count must fill whole registers.");
+
+      Lanes32() = default;
+      Lanes32(const uint32_t o) {
+          *this = o;
+      }
+
+      __RG_STRONG_INLINE__
+      Lanes32 &operator=(const uint32_t o) {
+          for (unsigned r = 0; r < regs; ++r) v[r] = _set1(o);
+          return *this;
+      }
+
+      typedef uint32_t __attribute__((__may_alias__)) lane_t;
+
+      __RG_STRONG_INLINE__
+      lane_t &operator[](const int i) {
+          return reinterpret_cast<lane_t *>(v)[i];
+      }
+
+      __RG_STRONG_INLINE__
+      const lane_t &operator[](const int i) const {
+          return reinterpret_cast<const lane_t *>(v)[i];
+      }
+
+      __RG_STRONG_INLINE__
+      Lanes32 operator+(const Lanes32 &o) const {
+          Lanes32 ret;
+          for (unsigned r = 0; r < regs; ++r) ret.v[r] = _add(v[r], o.v[r]);
+          return ret;
+      }
+
+      __RG_STRONG_INLINE__
+      lane_mask_t operator>(const Lanes32 &o) const {
+          lane_mask_t ret = 0;
+          for (unsigned r = 0; r < regs; ++r) ret |= _gt(v[r], o.v[r]) << (r * per_reg);
+          return ret;
+      }
+
+      __RG_STRONG_INLINE__
+      lane_mask_t operator<(const Lanes32 &o) const {
+          return o > *this;
+      }
+
+      /**
+       * @return mask of lanes that are not zero
+       */
+      __RG_STRONG_INLINE__
+      lane_mask_t nonzero() const {
+          lane_mask_t ret = 0;
+          for (unsigned r = 0; r < regs; ++r) ret |= _eq(v[r], _set1(0)) << (r * per_reg);
+          return ~ret;
+      }
+
+      /**
+       * @brief
+       * Copy lanes of o selected by mask.
+       */
+      __RG_STRONG_INLINE__
+      void assign(const lane_mask_t mask, const Lanes32 &o) {
+          for (unsigned r = 0; r < regs; ++r) v[r] = _blend(mask >> (r * per_reg), o.v[r], v[r]);
+      }
+
+      __RG_STRONG_INLINE__
+      void assign(const lane_mask_t mask, const uint32_t o) {
+          const reg_t b = _set1(o);
+          for (unsigned r = 0; r < regs; ++r) v[r] = _blend(mask >> (r * per_reg), b, v[r]);
+      }
+
+      /**
+       * @brief
+       * Add one to lanes selected by mask.
+       */
+      __RG_STRONG_INLINE__
+      void increment(const lane_mask_t mask) {
+          for (unsigned r = 0; r < regs; ++r) v[r] = _inc(mask >> (r * per_reg), v[r]);
+      }
+
+      reg_t v[regs];
+
+    private:
+      #ifdef VA_SIMD_USE_AVX512
+      __RG_STRONG_INLINE__ static reg_t _set1(const uint32_t o) { return _mm512_set1_epi32(o); }
+      __RG_STRONG_INLINE__ static reg_t _add(const reg_t &a, const reg_t &b) { return _mm512_add_epi32(a, b); }
+      __RG_STRONG_INLINE__ static lane_mask_t _gt(const reg_t &a, const reg_t &b) { return _mm512_cmpgt_epu32_mask(a, b); }
+      __RG_STRONG_INLINE__ static lane_mask_t _eq(const reg_t &a, const reg_t &b) { return _mm512_cmpeq_epi32_mask(a, b); }
+      __RG_STRONG_INLINE__ static reg_t _blend(const lane_mask_t m, const reg_t &t, const reg_t &f) {
+          return _mm512_mask_mov_epi32(f, __mmask16(m), t);
+      }
+      __RG_STRONG_INLINE__ static reg_t _inc(const lane_mask_t m, const reg_t &a) {
+          return _mm512_mask_add_epi32(a, __mmask16(m), a, _mm512_set1_epi32(1));
+      }
+      #elif VA_SIMD_USE_AVX2
+      __RG_STRONG_INLINE__ static reg_t _set1(const uint32_t o) { return _mm256_set1_epi32(o); }
+      __RG_STRONG_INLINE__ static reg_t _add(const reg_t &a, const reg_t &b) { return _mm256_add_epi32(a, b); }
+      __RG_STRONG_INLINE__ static lane_mask_t _gt(const reg_t &a, const reg_t &b) {
+          const reg_t bias = _mm256_set1_epi32(0x80000000);
+          const reg_t c = _mm256_cmpgt_epi32(_mm256_xor_si256(a, bias), _mm256_xor_si256(b, bias));
+          return uint8_t(_mm256_movemask_ps(_mm256_castsi256_ps(c)));
+      }
+      __RG_STRONG_INLINE__ static lane_mask_t _eq(const reg_t &a, const reg_t &b) {
+          return uint8_t(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))));
+      }
+      __RG_STRONG_INLINE__ static reg_t _expand(const lane_mask_t m) {
+          const reg_t sel = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+          return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(m)), sel), sel);
+      }
+      __RG_STRONG_INLINE__ static reg_t _blend(const lane_mask_t m, const reg_t &t, const reg_t &f) {
+          return _mm256_blendv_epi8(f, t, _expand(m));
+      }
+      __RG_STRONG_INLINE__ static reg_t _inc(const lane_mask_t m, const reg_t &a) {
+          return _mm256_sub_epi32(a, _expand(m)); // Selected lanes are -1
+      }
+      #else
+      __RG_STRONG_INLINE__ static reg_t _set1(const uint32_t o) { return _mm_set1_epi32(o); }
+      __RG_STRONG_INLINE__ static reg_t _add(const reg_t &a, const reg_t &b) { return _mm_add_epi32(a, b); }
+      __RG_STRONG_INLINE__ static lane_mask_t _gt(const reg_t &a, const reg_t &b) {
+          const reg_t bias = _mm_set1_epi32(0x80000000);
+          const reg_t c = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+          return uint8_t(_mm_movemask_ps(_mm_castsi128_ps(c)));
+      }
+      __RG_STRONG_INLINE__ static lane_mask_t _eq(const reg_t &a, const reg_t &b) {
+          return uint8_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))));
+      }
+      __RG_STRONG_INLINE__ static reg_t _expand(const lane_mask_t m) {
+          const reg_t sel = _mm_set_epi32(8, 4, 2, 1);
+          return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(m)), sel), sel);
+      }
+      __RG_STRONG_INLINE__ static reg_t _blend(const lane_mask_t m, const reg_t &t, const reg_t &f) {
+          return _mm_blendv_epi8(f, t, _expand(m));
+      }
+      __RG_STRONG_INLINE__ static reg_t _inc(const lane_mask_t m, const reg_t &a) {
+          return _mm_sub_epi32(a, _expand(m)); // Selected lanes are -1
+      }
+      #endif
+  };
+
 }
 
+TEST_CASE("SIMD lane masks") {
+    using namespace vargas;
+    int8_fast a(0), b(0);
+    int16_fast c(0), d(0);
+    for (unsigned i = 0; i < int8_fast::length; i += 3) b[i] = 1;
+    for (unsigned i = 0; i < int16_fast::length; i += 3) d[i] = 1;
+
+    const lane_mask_t m8 = lane_mask(b > a), m16 = lane_mask(d > c);
+    for (unsigned i = 0; i < int8_fast::length; ++i) CHECK(bool((m8 >> i) & 1) == (i % 3 == 0));
+    for (unsigned i = 0; i < int16_fast::length; ++i) CHECK(bool((m16 >> i) & 1) == (i % 3 == 0));
+
+    int8_fast e = mask_blend(m8, int8_fast(5), a);
+    int16_fast f = mask_blend(m16, int16_fast(500), c);
+    for (unsigned i = 0; i < int8_fast::length; ++i) CHECK(e[i] == (i % 3 == 0 ? 5 : 0));
+    for (unsigned i = 0; i < int16_fast::length; ++i) CHECK(f[i] == (i % 3 == 0 ? 500 : 0));
+
+    Lanes32<int8_fast::length> p(3000000000u), q(7);
+    p.increment(m8);
+    q.assign(m8, p);
+    for (unsigned i = 0; i < int8_fast::length; ++i) {
+        CHECK(p[i] == (i % 3 == 0 ? 3000000001u : 3000000000u));
+        CHECK(q[i] == (i % 3 == 0 ? 3000000001u : 7));
+    }
+    const lane_mask_t gt = p > q;
+    for (unsigned i = 0; i < int8_fast::length; ++i) CHECK(bool((gt >> i) & 1) == (i % 3 != 0));
+    q.assign(gt, 0);
+    CHECK((q.nonzero() & m8) == m8);
+    CHECK((q.nonzero() & gt) == 0);
+
+    int32_fast g(0), h(0);
+    for (unsigned i = 0; i < int32_fast::length; i += 3) h[i] = 1;
+    const lane_mask_t m32 = lane_mask(h > g);
+    for (unsigned i = 0; i < int32_fast::length; ++i) CHECK(bool((m32 >> i) & 1) == (i % 3 == 0));
+    int32_fast k = mask_blend(m32, int32_fast(100000), g);
+    for (unsigned i = 0; i < int32_fast::length; ++i) CHECK(k[i] == (i % 3 == 0 ? 100000 : 0));
+}
+
+TEST_CASE("SIMD 32 bit saturation") {
+    using namespace vargas;
+    const int32_t lo = std::numeric_limits<int32_t>::min(), hi = std::numeric_limits<int32_t>::max();
+    int32_fast a(lo), b(hi), one(1), big(2000000000);
+    a[0] = lo + 5;
+    b[0] = hi - 5;
+
+    int32_fast sub = a - big, add = b + big;
+    CHECK(sub[0] == lo);
+    CHECK(add[0] == hi);
+    for (unsigned i = 1; i < int32_fast::length; ++i) {
+        CHECK(sub[i] == lo);
+        CHECK(add[i] == hi);
+    }
+    CHECK((a + one)[0] == lo + 6);
+    CHECK((b - one)[0] == hi - 6);
+    CHECK((int32_fast(-5) - int32_fast(7))[0] == -12);
+    CHECK((int32_fast(-5) + big)[0] == 1999999995);
+    CHECK(max(a, int32_fast(-3))[0] == -3);
+    CHECK(lane_mask(a == int32_fast(lo)) == ((lane_mask_t(1) << int32_fast::length) - 2));
+}
 
 #endif //VARGAS_SIMD_H
@@ -0,0 +1,175 @@
+/**
+ * @brief
+ * Opt in timeline tracing. Scoped events are recorded into per thread ring buffers and written
+ * as Chrome trace event JSON, viewable in chrome://tracing or Perfetto.
+ *
+ * @details
+ * Each thread owns its buffer, so recording an event takes no lock. A lock is only taken the
+ * first time a thread records an event and when it exits, at which point its buffer is handed
+ * to the next new thread. When a buffer is full the oldest events are overwritten.
+ * With tracing off a scope costs one relaxed atomic load.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#ifndef VARGAS_TRACE_H
+#define VARGAS_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define VA_TRACE_DEFAULT_CAPACITY (1 << 16) // Events per thread
+
+namespace vargas {
+  namespace trace {
+
+    /**
+     * @brief
+     * A complete event. Names must be string literals, they are stored as pointers.
+     */
+    struct Event {
+        const char *name;
+        uint64_t begin; /**< ns since tracing started */
+        uint64_t dur; /**< ns */
+        int64_t arg; /**< Written as args.n if >= 0 */
+    };
+
+    /**
+     * @brief
+     * Fixed capacity ring of events with a single writer.
+     */
+    class Buffer {
+      public:
+        Buffer(size_t capacity, unsigned tid) : _events(capacity ? capacity : 1), _tid(tid) {}
+
+        void push(const Event &e) {
+            const uint64_t h = _head.load(std::memory_order_relaxed);
+            _events[h % _events.size()] = e;
+            _head.store(h + 1, std::memory_order_release);
+        }
+
+        /**
+         * @return Events held, oldest first
+         */
+        std::vector<Event> events() const;
+
+        /**
+         * @return Number of events overwritten
+         */
+        uint64_t dropped() const {
+            const uint64_t h = _head.load(std::memory_order_acquire);
+            return h > _events.size() ? h - _events.size() : 0;
+        }
+
+        unsigned tid() const {
+            return _tid;
+        }
+
+      private:
+        std::vector<Event> _events;
+        std::atomic<uint64_t> _head{0};
+        unsigned _tid;
+    };
+
+    namespace detail {
+      extern std::atomic<bool> enabled;
+    }
+
+    /**
+     * @return true if events are being recorded
+     */
+    inline bool enabled() {
+        return detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief
+     * Clear recorded events and start recording. Not safe while other threads are recording.
+     * @param capacity Events kept per thread
+     */
+    void start(size_t capacity = VA_TRACE_DEFAULT_CAPACITY);
+
+    /**
+     * @brief
+     * Stop recording. Recorded events are kept until the next start().
+     */
+    void stop();
+
+    /**
+     * @return ns since start()
+     */
+    uint64_t now();
+
+    /**
+     * @brief
+     * Record an event on the calling thread's buffer.
+     * @param name Event name, string literal
+     * @param begin Start, from now()
+     * @param end End, from now()
+     * @param arg Optional argument, omitted if negative
+     */
+    void record(const char *name, uint64_t begin, uint64_t end, int64_t arg = -1);
+
+    /**
+     * @brief
+     * Write all recorded events as Chrome trace event JSON.
+     * @param os Output stream
+     */
+    void write_json(std::ostream &os);
+
+    /**
+     * @brief
+     * Record the lifetime of the scope as an event.
+     */
+    class Scope {
+      public:
+        explicit Scope(const char *name, int64_t arg = -1) : _name(enabled() ? name : nullptr), _arg(arg) {
+            if (_name) _begin = now();
+        }
+        ~Scope() {
+            if (_name) record(_name, _begin, now(), _arg);
+        }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+      private:
+        const char *_name;
+        int64_t _arg;
+        uint64_t _begin = 0;
+    };
+
+    /**
+     * @brief
+     * Trace for the lifetime of the object and write the result when it is destroyed.
+     * Does nothing if the file name is empty.
+     */
+    class Session {
+      public:
+        /**
+         * @param file Output trace file
+         * @param capacity Events kept per thread
+         * @throws std::invalid_argument if file cannot be opened
+         */
+        explicit Session(const std::string &file, size_t capacity = VA_TRACE_DEFAULT_CAPACITY);
+        ~Session();
+        Session(const Session &) = delete;
+        Session &operator=(const Session &) = delete;
+      private:
+        std::ofstream _out;
+    };
+
+  }
+}
+
+#define VA_TRACE_CAT_(a, b) a##b
+#define VA_TRACE_CAT(a, b) VA_TRACE_CAT_(a, b)
+#define VA_TRACE_SCOPE(...) vargas::trace::Scope VA_TRACE_CAT(_va_trace_, __LINE__)(__VA_ARGS__)
+
+#endif //VARGAS_TRACE_H
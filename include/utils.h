@@ -275,6 +275,67 @@ print(", ".join(map(str, map(ord, lut))))
       vec = split(s, std::string(1, rg::guess_delim(s)));
   }
 
+  /**
+   * @brief
+   * Non-owning view of a character range, valid as long as the underlying buffer.
+   * Used to tokenize lines without copying each token into a std::string.
+   */
+  struct str_view {
+      str_view() = default;
+
+      str_view(const char *begin, const char *end) : b(begin), e(end) {}
+
+      str_view(const std::string &s) : b(s.data()), e(s.data() + s.size()) {}
+
+      const char *begin() const { return b; }
+
+      const char *end() const { return e; }
+
+      size_t size() const { return e - b; }
+
+      bool empty() const { return b == e; }
+
+      char operator[](size_t i) const { return b[i]; }
+
+      std::string str() const { return std::string(b, e); }
+
+      bool operator==(const str_view &o) const {
+          return size() == o.size() && std::equal(b, e, o.b);
+      }
+
+      bool operator!=(const str_view &o) const { return !(*this == o); }
+
+      const char *b = nullptr, *e = nullptr;
+  };
+
+  /**
+   * @brief
+   * Split s into views at delim. Empty tokens are kept, tokens are cleared first so
+   * the vector storage can be reused between calls.
+   * @param s string to split
+   * @param delim delimiter
+   * @param tokens vector to store views in
+   */
+  inline void tokenize(str_view s, char delim, std::vector<str_view> &tokens) {
+      tokens.clear();
+      const char *b = s.begin();
+      while (true) {
+          const char *e = std::find(b, s.end(), delim);
+          tokens.emplace_back(b, e);
+          if (e == s.end()) break;
+          b = e + 1;
+      }
+  }
+
+  /**
+   * @brief
+   * Parse a base 10 integer with an optional sign. The entire view must be consumed.
+   * @param s view to parse
+   * @return parsed value
+   * @throws std::invalid_argument if s is not an integer
+   */
+  long parse_int(str_view s);
+
 
 /**
  * @brief
@@ -286,6 +347,45 @@ print(", ".join(map(str, map(ord, lut))))
       return f.good();
   }
 
+/**
+ * @brief
+ * Counter based random number generator. Each output is a hash of (seed, stream, counter),
+ * so independent streams can be handed to threads and the sequence of a stream
+ * does not depend on how work is split. Satisfies UniformRandomBitGenerator.
+ */
+  class CounterRNG {
+    public:
+      using result_type = uint64_t;
+
+      /**
+       * @param seed Global seed
+       * @param stream Stream index
+       */
+      explicit CounterRNG(uint64_t seed = 0, uint64_t stream = 0) :
+      _key(mix(seed ^ mix(stream + 0x9E3779B97F4A7C15ULL))) {}
+
+      result_type operator()() {
+          return mix(_key + (++_ctr) * 0x9E3779B97F4A7C15ULL);
+      }
+
+      static constexpr result_type min() { return 0; }
+      static constexpr result_type max() { return ~result_type(0); }
+
+      /**
+       * @brief
+       * SplitMix64 finalizer.
+       */
+      static uint64_t mix(uint64_t z) {
+          z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+          z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+          return z ^ (z >> 31);
+      }
+
+    private:
+      uint64_t _key;
+      uint64_t _ctr = 0;
+  };
+
 /**
  * @return random base character in [ACGTN].
  */
@@ -434,6 +534,98 @@ print(", ".join(map(str, map(ord, lut))))
       os << vec_to_str(v);
   }
 
+  /**
+   * @brief
+   * Keeps a uniform random sample of up to n items from a stream of unknown length,
+   * with only n items resident (reservoir sampling, algorithm R).
+   * @tparam T item type
+   */
+  template<typename T>
+  class Reservoir {
+    public:
+      /**
+       * @param n Number of items to keep
+       * @param seed RNG seed, the same seed and stream yield the same sample
+       */
+      Reservoir(size_t n, uint64_t seed) : _n(n), _rng(seed) {
+          _items.reserve(n);
+      }
+
+      /**
+       * @brief
+       * Offer the next item of the stream. The item is moved from if it is kept.
+       * @param item
+       * @return true if the item was kept
+       */
+      bool offer(T &item) {
+          ++_seen;
+          if (_items.size() < _n) {
+              _items.push_back(std::move(item));
+              return true;
+          }
+          const uint64_t j = std::uniform_int_distribution<uint64_t>(0, _seen - 1)(_rng);
+          if (j >= _n) return false;
+          _items[j] = std::move(item);
+          return true;
+      }
+
+      /**
+       * @return Number of items offered so far
+       */
+      uint64_t seen() const {
+          return _seen;
+      }
+
+      /**
+       * @return Sampled items, in no particular order
+       */
+      std::vector<T> &items() {
+          return _items;
+      }
+
+    private:
+      size_t _n;
+      uint64_t _seen = 0;
+      std::mt19937_64 _rng;
+      std::vector<T> _items;
+  };
+
+  /**
+   * @brief
+   * Samples indices in proportion to a fixed set of weights in O(1) (Vose's alias method).
+   */
+  class AliasTable {
+    public:
+      AliasTable() = default;
+
+      /**
+       * @param weights Non-negative weights, index i is drawn with probability weights[i]/sum
+       */
+      explicit AliasTable(const std::vector<uint64_t> &weights);
+
+      /**
+       * @tparam RNG UniformRandomBitGenerator with 64 bit output
+       * @param rng
+       * @return random index
+       */
+      template<typename RNG>
+      size_t operator()(RNG &rng) const {
+          const size_t i = rng() % _prob.size();
+          return (rng() >> 11) * (1.0 / 9007199254740992.0) < _prob[i] ? i : _alias[i];
+      }
+
+      /**
+       * @return true if there is nothing to sample
+       */
+      bool empty() const {
+          return _prob.empty();
+      }
+
+    private:
+      std::vector<double> _prob;
+      std::vector<size_t> _alias;
+  };
+
   template<typename Object, typename R, typename ...Args>
   struct smart_fun {
       Object & obj;
@@ -494,9 +686,17 @@ print(", ".join(map(str, map(ord, lut))))
   typename _Unique_if<T>::_Known_bound
   make_unique(Args &&...) = delete;
 
+  /**
+   * @brief
+   * Destroy an object constructed in malloc'd memory, then free it.
+   * Polymorphic types need a virtual destructor.
+   */
   struct Deleter {
-      void operator()(const void *p) const {
-          ::std::free(const_cast<void *>(p));
+      template<typename T>
+      void operator()(T *p) const {
+          if (p == nullptr) return;
+          p->~T();
+          ::std::free(const_cast<typename std::remove_const<T>::type *>(p));
       }
   };
 
@@ -334,6 +334,13 @@ namespace vargas {
           return _alleles;
       }
 
+      /**
+       * @return Contig of the current record.
+       */
+      std::string chrom() const {
+          return bcf_seqname(_header, _curr_rec);
+      }
+
       /**
        * @brief
        * 0 based position, i.e. the VCF pos - 1.
@@ -15,8 +15,12 @@
 
 #include "align_main.h"
 #include "alignment.h"
+#include "align_stats.h"
+#include "serve.h"
 #include "sim.h"
 #include "threadpool.h"
+#include "trace.h"
+#include <map>
 #include <mutex>
 
 using rg::Deleter;
@@ -30,26 +34,35 @@ int align_main(int argc, char *argv[]) {
     }
 
     // Load parameters
-    unsigned match, npenalty, threads, chunk_size, subsample;
-    std::string read_file, gdf, align_targets, out_file, pgid, mismatch, rdg, rfg;
-    bool end_to_end = false, fwdonly = false, p64=false, msonly=false, maxonly=false, notraceback=false;
+    unsigned match, npenalty, threads, chunk_size, subsample, seed;
+    std::string read_file, gdf, align_targets, out_file, pgid, mismatch, rdg, rfg, server, shard_spec;
+    bool end_to_end = false, fwdonly = false, p64=false, msonly=false, maxonly=false, notraceback=false, ubam=false;
+    bool onepass = false, numa = false;
+    std::string trace_file, huge_pages, profile_ids;
+    VA_STATS_ONLY(std::string stats_file; double progress = 0;)
 
     cxxopts::Options opts("vargas align", "Align reads to a graph.");
     try {
         opts.add_options("Input")
         ("g,gdef", "<str> *Graph definition file.", cxxopts::value(gdf))
-        ("U,reads", "<str> *Unpaired reads in SAM, FASTQ, or FASTA format.", cxxopts::value(read_file));
+        ("U,reads", "<str> *Unpaired reads in SAM, BAM, FASTQ, or FASTA format (optionally gzipped).", cxxopts::value(read_file))
+        ("server", "<str> Align with a \"vargas serve\" listening on this socket. -g selects one of its graphs.", cxxopts::value(server));
 
         opts.add_options("Optional")
-        ("S,sam", "<str> Output file.", cxxopts::value(out_file))
+        ("S,sam", "<str> Output file, BAM if it ends in \".bam\".", cxxopts::value(out_file))
+        ("ubam", "Write uncompressed BAM.", cxxopts::value(ubam)->implicit_value("1"))
         ("msonly", "Only report max score. Improves speed.", cxxopts::value(msonly)->implicit_value("1"))
         ("maxonly", "Only report max score, location, and count. Improves speed.", cxxopts::value(maxonly)->implicit_value("1"))
         ("phred64", "Qualities are Phred+64, not Phred+33.", cxxopts::value(p64)->implicit_value("1"))
         ("p,subsample", "<N> Sample N random reads, 0 for all.", cxxopts::value(subsample)->default_value("0"))
+        ("seed", "<N> Subsample seed, random if not given.", cxxopts::value(seed))
         ("a,alignto", "<str> Target graph, or SAM Read Group -> graph mapping.\"(RG:ID:<group>,<target_graph>;)+|<graph>\"", cxxopts::value(align_targets))
         ("s,assess", "[ID] Use score profile from a previous alignment.", cxxopts::value(pgid)->implicit_value("."))
+        ("profiles", "<ID,...> Also score reads under the profiles of up to " + std::to_string(ALIGN_MAX_PROFILES) + " programs in the SAM header, aligning once more per profile. Scores go in tags a1, a2, ...", cxxopts::value(profile_ids))
         ("f,forward", "Only align to forward strand.", cxxopts::value(fwdonly))
-        ("notraceback", "If graph contains no variants, do not compute traceback", cxxopts::value(notraceback)->implicit_value("1"));
+        ("notraceback", "If graph contains no variants, do not compute traceback", cxxopts::value(notraceback)->implicit_value("1"))
+        ("onepass", "Align each read group to all of its targets in one traversal of the base graph.", cxxopts::value(onepass)->implicit_value("1"))
+        ("shard", "<i/N> Only align reads whose index modulo N is i, in input order. Combine shards with \"vargas merge\".", cxxopts::value(shard_spec));
 
         opts.add_options("Scoring")
         ("ete", "End to end alignment.", cxxopts::value(end_to_end))
@@ -61,7 +74,16 @@ int align_main(int argc, char *argv[]) {
 
         opts.add_options("Threading")
         ("j,threads", "<N> Number of threads.", cxxopts::value(threads)->default_value("1"))
-        ("u,chunk", "<N> Partition into tasks of max size N.", cxxopts::value(chunk_size)->default_value("64"));
+        ("u,chunk", "<N> Partition into tasks of max size N, rounded up to the SIMD width. 0 for automatic.", cxxopts::value(chunk_size)->default_value("0"))
+        ("numa", "Pin threads to cores spread over NUMA nodes, each node aligning to its own copy of the graph.", cxxopts::value(numa)->implicit_value("1"))
+        ("hugepages", "<str> Back aligner memory with 2MB pages: none, thp (transparent), or explicit (hugetlbfs).", cxxopts::value(huge_pages)->default_value("none"))
+        ("trace", "<str> Write a Chrome trace event timeline to file.", cxxopts::value(trace_file));
+
+        VA_STATS_ONLY(
+        opts.add_options("Instrumentation")
+        ("stats", "<str> Write a JSON summary of per thread alignment timings to file.", cxxopts::value(stats_file))
+        ("progress", "<N> Print throughput to stderr every N seconds.", cxxopts::value(progress));
+        )
 
         opts.add_options()("h,help", "Display this message.");
 
@@ -75,7 +97,7 @@ int align_main(int argc, char *argv[]) {
         return 0;
     }
 
-    if (!opts.count("gdef")) {
+    if (!opts.count("gdef") && server.empty()) {
         align_help(opts);
         throw std::invalid_argument("Graph definition file required.");
     }
@@ -86,68 +108,54 @@ int align_main(int argc, char *argv[]) {
     }
     ReadFmt format = read_fmt(read_file);
 
-    if (chunk_size < vargas::Aligner::read_capacity() || chunk_size % vargas::Aligner::read_capacity() != 0) {
-        std::cerr << "[warn] Chunk size is not a multiple of SIMD vector length: "
-                  << vargas::Aligner::read_capacity() << std::endl;
-    }
-
     if (opts.count("assess") && format != ReadFmt::SAM) {
         throw std::invalid_argument("Assess is only available for SAM inputs.");
     }
     if (!align_targets.empty() && format != ReadFmt::SAM) {
         throw std::invalid_argument("Alignment targets only available for SAM inputs.");
     }
+    if (!profile_ids.empty()) {
+        if (format != ReadFmt::SAM) throw std::invalid_argument("Extra profiles are only available for SAM inputs.");
+        if (onepass) throw std::invalid_argument("Extra profiles cannot be combined with --onepass.");
+        if (!server.empty()) throw std::invalid_argument("Extra profiles cannot be combined with --server.");
+    }
 
     if(opts.count("msonly") && opts.count("maxonly")) {
         throw std::invalid_argument("At most one of msonly and maxonly can be specified.");
     }
 
-    vargas::isam reads;
-    if (format == ReadFmt::FASTQ) {
-        load_fast(read_file, true, reads, p64);
-    } else if (format == ReadFmt::FASTA) {
-        load_fast(read_file, false, reads, p64);
-    } else {
-        reads.open(read_file);
+    if (!server.empty() && (opts.count("assess") || opts.count("ete") || opts.count("ma") || opts.count("mp") ||
+                            opts.count("np") || opts.count("rdg") || opts.count("rfg"))) {
+        std::cerr << "[warn] Scoring options are ignored with --server, the server's profile is used.\n";
     }
-    reads.subset(subsample);
-    auto &reads_hdr = reads.header();
 
-    vargas::ScoreProfile prof;
-    {
-        prof.match = match;
-        prof.ambig = npenalty;
+    vargas::Arena::set_default_pages(vargas::huge_pages_from_string(huge_pages));
 
-        auto sp = rg::split(mismatch, ',');
-        if (sp.size() == 2) {
-            prof.mismatch_min = std::stoi(sp[0]);
-            prof.mismatch_max = std::stoi(sp[1]);
-        }
-        else if (sp.size() == 1) {
-            prof.mismatch_max = prof.mismatch_min = std::stoi(sp[0]);
-        }
-        else {
-            throw std::invalid_argument("Invalid --mp argument.");
-        }
+    const Shard shard = shard_spec.empty() ? Shard() : parse_shard(shard_spec);
+    if (shard.count && subsample) {
+        throw std::invalid_argument("Subsampling cannot be combined with --shard.");
+    }
 
-        sp = rg::split(rdg, ',');
-        if (sp.size() == 2) {
-            prof.read_gopen = std::stoi(sp[0]);
-            prof.read_gext = std::stoi(sp[1]);
-        }
-        else {
-            throw std::invalid_argument("Invalid --rdg argument.");
-        }
+    if (!opts.count("seed")) seed = std::random_device()();
+    if (subsample) std::cerr << "Subsampling " << subsample << " reads, seed " << seed << ".\n";
 
-        sp = rg::split(rfg, ',');
-        if (sp.size() == 2) {
-            prof.ref_gopen = std::stoi(sp[0]);
-            prof.ref_gext = std::stoi(sp[1]);
-        }
-        else {
-            throw std::invalid_argument("Invalid --rfg argument.");
-        }
+    vargas::trace::Session trace_session(trace_file);
+    VA_STATS_ONLY(vargas::stats::recorder().reset(0);)
+    VA_STATS_BIND(vargas::stats::recorder().main());
+
+    // FASTA/Q input is streamed in batches
+    const bool stream = format != ReadFmt::SAM;
+    vargas::isam reads;
+    vargas::ifastx fast_reads;
+    if (stream) {
+        fast_reads.open(read_file, threads);
+    } else {
+        reads.open(read_file);
+        reads.subset(subsample, seed);
     }
+    auto &reads_hdr = reads.header();
+
+    vargas::ScoreProfile prof = parse_score_profile(match, npenalty, mismatch, rdg, rfg);
 
     if (pgid == ".") {
         bool check = false;
@@ -172,6 +180,27 @@ int align_main(int argc, char *argv[]) {
         prof.end_to_end = end_to_end;
     }
 
+    std::unique_ptr<AlignProfiles> profiles;
+    if (!profile_ids.empty()) {
+        const auto ids = rg::split(profile_ids, ',');
+        if (ids.size() > ALIGN_MAX_PROFILES) {
+            throw std::invalid_argument("At most " + std::to_string(ALIGN_MAX_PROFILES) + " extra profiles are supported.");
+        }
+        profiles.reset(new AlignProfiles);
+        profiles->main = prof;
+        for (size_t k = 0; k < ids.size(); ++k) {
+            vargas::ScoreProfile p;
+            try {
+                p = vargas::program_profile(reads_hdr.programs.at(ids[k]).command_line);
+            } catch (std::exception &e) {
+                throw std::invalid_argument("Unrecognized PG ID: " + ids[k]);
+            }
+            const std::string tag = ALIGN_SAM_PROFILE_SCORE_TAG + std::to_string(k + 1);
+            std::cerr << "Scoring profile " << tag << " (" << ids[k] << "): " << p.to_string() << "\n";
+            profiles->profs.push_back(p);
+        }
+    }
+
     vargas::SAM::Header::Program pg;
     pg.command_line = cl;
     pg.name = "vargas_align";
@@ -181,33 +210,142 @@ int align_main(int argc, char *argv[]) {
     const auto assigned_pgid = reads_hdr.add(pg);
 
     size_t read_len;
-    auto task_list = create_tasks(reads, align_targets, chunk_size, read_len);
+    uint64_t next_read = 0;
+    std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> task_list;
+    std::vector<vargas::SAM::Record> batch;
+    const size_t batch_chunk = chunk_size ? chunk_size_for(chunk_size, 0, 1, vargas::Aligner::read_capacity())
+                                          : ALIGN_MAX_CHUNK_VECTORS * vargas::Aligner::read_capacity();
+    const size_t batch_size = batch_chunk * (threads ? threads : 1) * 16;
+    {
+        VA_STATS_TIMER(LOAD);
+        VA_TRACE_SCOPE("load_reads");
+        if (stream) {
+            if (subsample) {
+                // Only the sample is resident, the rest of the stream is dropped as it is read
+                rg::Reservoir<vargas::SAM::Record> sample(subsample, seed);
+                while (load_fast(fast_reads, format == ReadFmt::FASTQ, batch, batch_size, p64)) {
+                    for (auto &rec : batch) sample.offer(rec);
+                }
+                batch = std::move(sample.items());
+            } else {
+                load_fast(fast_reads, format == ReadFmt::FASTQ, batch, batch_size, p64, shard, next_read);
+            }
+            if (batch.empty()) throw std::invalid_argument("No records available.");
+            task_list = create_tasks(reads_hdr, batch, align_targets, chunk_size, read_len, true, threads, onepass);
+        } else {
+            task_list = create_tasks(reads, align_targets, chunk_size, read_len, threads, shard, onepass);
+        }
+    }
 
+    // A streamed batch only bounds its own parallelism, align() clamps the pool per batch
     const size_t num_tasks = task_list.size();
-    if (num_tasks < threads) {
+    if (!stream && num_tasks < threads) {
         std::cerr << "[warn] Number of threads is greater than number of tasks. Try decreasing -u.\n";
     }
 
-    threads = threads ? threads > task_list.size() ? task_list.size() : threads
+    threads = threads ? !stream && threads > num_tasks ? num_tasks : threads
                       : 1;
 
-    int bias = 255 - (read_len * match);
-    const bool use_wide = (bias < 0) or (end_to_end and (static_cast<signed long long>(prof.ref_gopen + (prof.ref_gext * (read_len - 1))) > bias || read_len * prof.mismatch_max > bias));
-    if (use_wide) {
-        std::cerr << "Score range: " << read_len * match << " to -" << std::min(prof.ref_gopen + (prof.ref_gext * (read_len - 1)), read_len * prof.mismatch_max) <<
-        ". Using 16-bit aligner (" << vargas::WordAligner::read_capacity() << " reads/vector).\n";
+    if (!server.empty()) {
+        // Graphs and aligners stay loaded in the server, reads are sent one batch per request
+        std::ostringstream keys;
+        if (!gdf.empty()) keys << "graph=" << gdf << '\n';
+        if (!align_targets.empty()) keys << "alignto=" << align_targets << '\n';
+        std::string flags;
+        if (fwdonly) flags += ",fwdonly";
+        if (msonly) flags += ",msonly";
+        if (maxonly) flags += ",maxonly";
+        if (notraceback) flags += ",notraceback";
+        if (onepass) flags += ",onepass";
+        if (p64) flags += ",phred64";
+        if (rg::ends_with(out_file, ".bam")) flags += ",contigs";
+        if (!flags.empty()) keys << "flags=" << flags.substr(1) << '\n';
+
+        reads_hdr.programs[assigned_pgid].aux.set(ALIGN_SAM_PG_GDF, gdf.empty() ? server : gdf);
+        std::unique_ptr<vargas::osam> remote_out;
+        for (;;) {
+            std::cerr << "Aligning with \"" << server << "\"... " << std::flush;
+            auto start_time = std::chrono::steady_clock::now();
+            vargas::SAM::Header resp_hdr;
+            auto aligned = vargas::serve_align(server, keys.str(), reads_hdr, task_list, resp_hdr);
+            std::cerr << rg::chrono_duration(start_time) << "s.\n";
+            if (!remote_out) {
+                for (const auto &sq : resp_hdr.sequences) {
+                    if (!reads_hdr.sequences.count(sq.first)) reads_hdr.add(sq.second);
+                }
+                remote_out.reset(new vargas::osam(out_file, reads_hdr, threads, !ubam));
+            }
+            if (shard.count) {
+                std::vector<const vargas::SAM::Record *> ptrs;
+                for (const auto &rec : aligned) ptrs.push_back(&rec);
+                write_by_read_index(*remote_out, ptrs);
+            } else {
+                for (const auto &rec : aligned) remote_out->add_record(rec);
+            }
+
+            if (!stream || !load_fast(fast_reads, format == ReadFmt::FASTQ, batch, batch_size, p64, shard, next_read)) break;
+            task_list = create_tasks(reads_hdr, batch, align_targets, chunk_size, read_len, false, threads, onepass);
+        }
+        return 0;
+    }
+
+    std::unique_ptr<AlignPlacement> placement;
+    if (numa) {
+        placement.reset(new AlignPlacement);
+        placement->workers = vargas::numa::place(threads, vargas::numa::nodes());
+        placement->graphs.resize(std::min<size_t>(placement->workers.num_nodes, threads));
+        std::cerr << "Placing " << threads << " threads on " << placement->graphs.size() << " NUMA node(s).\n";
     }
-    std::cerr << "Scoring profile: " << prof.to_string() << "\n";
 
     std::vector<std::unique_ptr<vargas::AlignerBase, rg::Deleter>> aligners(threads);
-    for (size_t k = 0; k < threads; ++k) {
-        aligners[k] = make_aligner(prof, read_len, use_wide, msonly, maxonly);
+    const vargas::ScoreProfile *other_prof = nullptr;
+    if (profiles) {
+        for (const auto &p : profiles->profs) {
+            if (p.end_to_end != prof.end_to_end && !other_prof) other_prof = &p;
+        }
+        if (other_prof) profiles->aligners.resize(threads);
     }
+    auto make_aligners = [&](size_t read_len) {
+        unsigned width = aligner_width(prof, read_len), other_width = 8;
+        if (profiles) {
+            // An aligner is reused for every profile of its mode, so it must be wide enough for each
+            for (const auto &p : profiles->profs) {
+                unsigned &w = p.end_to_end == prof.end_to_end ? width : other_width;
+                w = std::max(w, aligner_width(p, read_len));
+            }
+        }
+        auto make = [&](size_t k) {
+            aligners[k] = make_aligner(prof, read_len, width, msonly, maxonly);
+            // Only scores are reported for extra profiles
+            if (other_prof) profiles->aligners[k] = make_aligner(*other_prof, read_len, other_width, true, false);
+        };
+        if (width > 8) {
+            std::cerr << "Score range: " << read_len * match << " to -" << std::min(prof.ref_gopen + (prof.ref_gext * (read_len - 1)), read_len * prof.mismatch_max) <<
+            ". Using " << width << "-bit aligner (" << aligner_lanes(width) << " reads/vector).\n";
+        }
+        if (placement) {
+            // Allocate each aligner's matrices from its worker's CPU, so they are first touched on its node
+            vargas::numa::run_each(placement->workers.cpu, make);
+        } else {
+            for (size_t k = 0; k < threads; ++k) make(k);
+        }
+    };
+    make_aligners(read_len);
+    std::cerr << "Scoring profile: " << prof.to_string() << "\n";
 
 
     std::cerr << "\nLoading \"" << gdf << "\"...\n";
     auto start_time = std::chrono::steady_clock::now();
-    vargas::GraphMan gm(gdf);
+    vargas::GraphMan gm;
+    if (placement) {
+        // One copy per node, loaded from that node. Workers are placed round robin, so worker n is on node n.
+        std::vector<unsigned> cpus(placement->workers.cpu.begin(), placement->workers.cpu.begin() + placement->graphs.size());
+        vargas::numa::run_each(cpus, [&](size_t n) {
+            if (n == 0) gm.open(gdf);
+            else placement->graphs[n].reset(new vargas::GraphMan(gdf));
+        });
+    }
+    else gm.open(gdf);
     if (gm.labels().size() != 1 && maxonly) {
         std::cerr << "[warn] With --maxonly, max score position and count may be incorrect because the genome is a graph." << std::endl;
     }
@@ -218,9 +356,39 @@ int align_main(int argc, char *argv[]) {
 
     if (out_file.length()) std::cerr << "Writing to \"" << (out_file.empty() ? "stdout" : out_file) << "\".\n";
     reads_hdr.programs[assigned_pgid].aux.set(ALIGN_SAM_PG_GDF, gdf);
-    vargas::osam aligns_out(out_file, reads_hdr);
+    if (rg::ends_with(out_file, ".bam")) add_contigs(gm, reads_hdr);
+    vargas::osam aligns_out(out_file, reads_hdr, threads, !ubam);
     char phred_offset = opts.count("phred64") ? 64 : 33;
-    align(gm, task_list, aligns_out, aligners, fwdonly, msonly, maxonly, notraceback, phred_offset);
+    VA_STATS_ONLY(vargas::stats::Progress progress_lines(vargas::stats::recorder(), progress);)
+    align(gm, task_list, aligns_out, aligners, fwdonly, msonly, maxonly, notraceback, phred_offset, shard.count != 0,
+          placement.get(), profiles.get());
+
+    if (stream) {
+        size_t batch_len;
+        for (;;) {
+            {
+                VA_STATS_TIMER(LOAD);
+                VA_TRACE_SCOPE("load_reads");
+                if (!load_fast(fast_reads, format == ReadFmt::FASTQ, batch, batch_size, p64, shard, next_read)) break;
+                task_list = create_tasks(reads_hdr, batch, align_targets, chunk_size, batch_len, false, threads, onepass);
+            }
+            if (batch_len > read_len) {
+                // Longer reads than the aligners were built for
+                read_len = batch_len;
+                make_aligners(read_len);
+            }
+            align(gm, task_list, aligns_out, aligners, fwdonly, msonly, maxonly, notraceback, phred_offset, shard.count != 0,
+                  placement.get(), profiles.get());
+        }
+    }
+
+    VA_STATS_ONLY(
+    if (!stats_file.empty()) {
+        std::ofstream so(stats_file);
+        if (!so.good()) throw std::invalid_argument("Error opening file \"" + stats_file + "\"");
+        vargas::stats::recorder().write_json(so);
+    }
+    )
 
     return 0;
 }
@@ -232,65 +400,56 @@ struct align_helper {
     const std::vector<std::unique_ptr<vargas::AlignerBase, rg::Deleter>> &aligners;
     bool fwdonly, msonly, maxonly, notraceback;
     char phred_offset;
+    bool ordered;
     std::mutex &mut;
+    const AlignPlacement *placement;
+    bool pin; /**< Pin workers to their CPUs. False when the pool runs tasks on the calling thread */
+    const AlignProfiles *profiles;
 };
 
-void align_helper_func(void *data, long index, int tid) {
-    align_helper &help(*(align_helper *)data);
-    auto &aligners = help.aligners;
-    auto &out = help.out;
-    auto &task_list = help.task_list;
-    auto &gm = help.gm;
-    auto fwdonly = help.fwdonly;
-    auto msonly = help.msonly;
-    auto maxonly = help.maxonly;
-    auto notraceback = help.notraceback;
-    char phred_offset = help.phred_offset;
-
-    const size_t num_reads = task_list.at(index).second.size();
-    std::vector<std::string> read_seqs(num_reads);
-    std::vector<std::vector<char>> quals(num_reads);
-    for (size_t i = 0; i < num_reads; ++i) {
-        const auto &r = task_list.at(index).second.at(i);
-        read_seqs[i] = r.seq;
-        if (r.qual.size() == r.seq.size()) {
-            std::transform(r.qual.begin(),
-                           r.qual.end(),
-                           std::back_inserter(quals[i]),
-                           [](char c){ return c - 33; }); //TODO needs to be offset variable
-        }
-    }
-    auto subgraph = gm.at(task_list.at(index).first);
-    vargas::Results aligns;
-    aligners[tid]->align_into(read_seqs, quals, subgraph->begin(), subgraph->end(), aligns, fwdonly);
-
+/**
+ * @brief
+ * Set position, strand, CIGAR and score tags of records from their alignments to a subgraph.
+ */
+static void format_records(vargas::GraphMan &gm, const vargas::Graph &subgraph, const vargas::Results &aligns,
+                           std::vector<vargas::SAM::Record> &records, const std::vector<std::vector<char>> &quals,
+                           bool msonly, bool maxonly, bool notraceback, char phred_offset) {
+    const vargas::coordinate_resolver &resolver = gm.resolver();
     //If no variants (# nodes == # contigs) compute the alignment traceback
-    bool not_graph = subgraph->node_map()->size() == gm.resolver()._contig_hdr_order.size();
+    bool not_graph = subgraph.node_map()->size() == resolver.size();
+
+    // Contig and contig position of each alignment, resolved for the whole task
+    std::vector<unsigned> max_contig, max_rel, sub_contig, sub_rel;
+    if (!msonly) resolver.resolve(aligns.max_pos, max_contig, max_rel);
+    if (!msonly && !maxonly) resolver.resolve(aligns.sub_pos, sub_contig, sub_rel);
 
-    for (size_t j = 0; j < task_list.at(index).second.size(); ++j) {
-        vargas::SAM::Record &rec = task_list.at(index).second.at(j);
-        auto abs = gm.absolute_position(aligns.max_pos[j]);
+    for (size_t j = 0; j < records.size(); ++j) {
+        VA_STATS_TIMER_EXCL(FORMAT, TRACEBACK);
+        vargas::SAM::Record &rec = records.at(j);
         rec.aux.set("AS", aligns.max_score[j]);
         if (!msonly) {
+            const unsigned max_pos = max_rel[j];
             // Can only guess start position for end to end
-            // if (aligns.profile.end_to_end) rec.pos = abs.second - rec.seq.size() + 1;
+            // if (aligns.profile.end_to_end) rec.pos = max_pos - rec.seq.size() + 1;
 
-            rec.ref_name = abs.first;
+            rec.ref_name = resolver.name(max_contig[j]);
             rec.flag.rev_complement = aligns.max_strand[j] == vargas::Strand::REV;
             if (rec.flag.rev_complement) {
                 rg::reverse_complement_inplace(rec.seq);
                 std::reverse(rec.qual.begin(), rec.qual.end());
             }
-            rec.aux.set(ALIGN_SAM_MAX_POS_TAG, abs.second);
+            rec.aux.set(ALIGN_SAM_MAX_POS_TAG, max_pos);
             rec.aux.set(ALIGN_SAM_MAX_COUNT_TAG, aligns.max_count[j]);
 
             if (not_graph & !notraceback) {
-                int nodeID = gm.nodeID_from_contig(rec.ref_name);
-                vargas::Graph::nodemap_t _node_map = *(subgraph->node_map());
+                VA_STATS_TIMER(TRACEBACK);
+                // Node holding the alignment end, through the position index
+                const auto hit = subgraph.seek(aligns.max_pos[j]);
+                const size_t node_end = hit.second + 1;
                 //TODO upper-bound the length of reference slice needed based on the score or scoring function
-                int ref_len = 2*rec.seq.length() < abs.second ? 2*rec.seq.length() : abs.second ;
-                int ref_start = abs.second-ref_len;
-                auto ref_iter = std::next(_node_map[nodeID].begin(),ref_start); //TODO this is linear time I think?
+                size_t ref_len = 2*rec.seq.length() < node_end ? 2*rec.seq.length() : node_end ;
+                size_t ref_start = node_end-ref_len;
+                auto ref_iter = hit.first->begin() + ref_start;
 
                 // Allocate the three DP score matrixes: M (match) D (deletion) I (insertion), initialize with zero
                 std::vector<std::vector<int>> M;
@@ -451,7 +610,7 @@ void align_helper_func(void *data, long index, int tid) {
                             --currRow;
                         }
                     }
-                    rec.pos = abs.second - ref_len + currCol;
+                    rec.pos = max_pos - ref_len + currCol;
                     for (int row = 0; row < currRow; ++row) {
                         aln.push_back('I'); //unaligned bases in beginning of query
                     }
@@ -501,7 +660,7 @@ void align_helper_func(void *data, long index, int tid) {
                             --currRow;
                         } else { break; } //if score goes to or below zero
                     }
-                    rec.pos = abs.second - ref_len + currCol;
+                    rec.pos = max_pos - ref_len + currCol;
                     for (int row = 0; row < currRow; ++row) {
                         aln.push_back('S'); //unaligned bases in beginning of query
                     }
@@ -527,20 +686,122 @@ void align_helper_func(void *data, long index, int tid) {
 
             // Flags for 2nd max
             if (!maxonly) {
-                abs = gm.absolute_position(aligns.sub_pos[j]);
-                rec.aux.set(ALIGN_SAM_SUB_SEQ, abs.first);
-                rec.aux.set(ALIGN_SAM_SUB_POS_TAG, abs.second);
+                rec.aux.set(ALIGN_SAM_SUB_SEQ, resolver.name(sub_contig[j]));
+                rec.aux.set(ALIGN_SAM_SUB_POS_TAG, sub_rel[j]);
                 rec.aux.set(ALIGN_SAM_SUB_COUNT_TAG, aligns.sub_count[j]);
                 rec.aux.set(ALIGN_SAM_SUB_SCORE_TAG, aligns.sub_score[j]);
                 rec.aux.set(ALIGN_SAM_SUB_STRAND_TAG, aligns.sub_strand[j] == vargas::Strand::FWD ? "fwd" : "rev");
             }
         }
     }
+}
 
+void align_task(vargas::GraphMan &gm, const std::string &label, std::vector<vargas::SAM::Record> &records,
+                vargas::AlignerBase &aligner, bool fwdonly, bool msonly, bool maxonly, bool notraceback,
+                char phred_offset, const AlignProfiles *profiles, vargas::AlignerBase *other) {
+    const size_t num_reads = records.size();
+    std::vector<std::string> read_seqs(num_reads);
+    std::vector<std::vector<char>> quals(num_reads);
     {
-        std::lock_guard<std::mutex> lock(help.mut);
-        for (const auto & j : task_list.at(index).second) out.add_record(j);
+        VA_STATS_TIMER(LOAD);
+        for (size_t i = 0; i < num_reads; ++i) {
+            const auto &r = records.at(i);
+            read_seqs[i] = r.seq;
+            if (r.qual.size() == r.seq.size()) {
+                std::transform(r.qual.begin(),
+                               r.qual.end(),
+                               std::back_inserter(quals[i]),
+                               [](char c){ return c - 33; }); //TODO needs to be offset variable
+            }
+        }
+    }
+
+    if (label.find(',') == std::string::npos) {
+        auto subgraph = gm.at(label);
+        vargas::Results aligns;
+        {
+            VA_TRACE_SCOPE("align_into", num_reads);
+            aligner.align_into(read_seqs, quals, subgraph->begin(), subgraph->end(), aligns, fwdonly);
+        }
+        format_records(gm, *subgraph, aligns, records, quals, msonly, maxonly, notraceback, phred_offset);
+        if (profiles) {
+            // One more alignment per profile, tags in order of --profiles
+            for (size_t k = 0; k < profiles->profs.size(); ++k) {
+                const auto &p = profiles->profs[k];
+                vargas::AlignerBase &a = p.end_to_end == profiles->main.end_to_end ? aligner : *other;
+                {
+                    VA_TRACE_SCOPE("align_into", num_reads);
+                    a.set_scores(p);
+                    a.align_into(read_seqs, quals, subgraph->begin(), subgraph->end(), aligns, fwdonly);
+                }
+                const std::string tag = ALIGN_SAM_PROFILE_SCORE_TAG + std::to_string(k + 1);
+                for (size_t j = 0; j < num_reads; ++j) records[j].aux.set(tag, aligns.max_score[j]);
+            }
+            aligner.set_scores(profiles->main);
+        }
+        return;
     }
+
+    // Several targets, aligned in one traversal of the base graph. Records are repeated once per target.
+    const auto labels = rg::split(label, ',');
+    std::vector<std::shared_ptr<const vargas::Graph>> subgraphs;
+    for (const auto &l : labels) subgraphs.push_back(gm.at(l));
+    const vargas::SubgraphSet targets(gm.at("base"), subgraphs);
+    std::vector<vargas::Results> aligns;
+    {
+        VA_TRACE_SCOPE("align_into", num_reads);
+        aligner.align_into(read_seqs, quals, targets, aligns, fwdonly);
+    }
+    std::vector<vargas::SAM::Record> out;
+    out.reserve(num_reads * labels.size());
+    for (size_t t = 0; t < labels.size(); ++t) {
+        std::vector<vargas::SAM::Record> target_records;
+        if (t + 1 == labels.size()) target_records = std::move(records);
+        else target_records = records;
+        format_records(gm, *subgraphs[t], aligns[t], target_records, quals, msonly, maxonly, notraceback, phred_offset);
+        std::move(target_records.begin(), target_records.end(), std::back_inserter(out));
+    }
+    records = std::move(out);
+}
+
+void align_helper_func(void *data, long index, int tid) {
+    align_helper &help(*(align_helper *)data);
+    auto &task = help.task_list.at(index);
+    VA_STATS_ONLY(const size_t num_reads = task.second.size();)
+
+    VA_STATS_BIND(vargas::stats::recorder().thread(tid));
+    VA_TRACE_SCOPE("align_task", index);
+
+    vargas::GraphMan *gm = &help.gm;
+    if (help.placement) {
+        // Pool threads are created per batch, pin each on its first task
+        static thread_local int pinned = -1;
+        const unsigned cpu = help.placement->workers.cpu[tid];
+        if (help.pin && pinned != int(cpu)) {
+            vargas::numa::pin(cpu);
+            pinned = cpu;
+        }
+        if (vargas::GraphMan *local = help.placement->graphs[help.placement->workers.node[tid]].get()) gm = local;
+    }
+
+    vargas::AlignerBase *other = help.profiles && !help.profiles->aligners.empty() ? help.profiles->aligners[tid].get() : nullptr;
+    align_task(*gm, task.first, task.second, *help.aligners[tid],
+               help.fwdonly, help.msonly, help.maxonly, help.notraceback, help.phred_offset, help.profiles, other);
+
+    if (!help.ordered) {
+        std::unique_lock<std::mutex> lock(help.mut, std::defer_lock);
+        {
+            VA_STATS_TIMER(LOCK_WAIT);
+            VA_TRACE_SCOPE("output_wait");
+            lock.lock();
+        }
+        VA_STATS_TIMER(OUTPUT);
+        VA_TRACE_SCOPE("output_write");
+        for (const auto & j : task.second) help.out.add_record(j);
+    }
+    VA_STATS_ADD(tasks, 1);
+    VA_STATS_ADD(reads, num_reads);
+    VA_STATS_ONLY(vargas::stats::recorder().reads_done += num_reads;)
 }
 
 #if !NDEBUG
@@ -552,22 +813,72 @@ void align(vargas::GraphMan &gm,
            std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> &task_list,
            vargas::osam &out,
            const std::vector<std::unique_ptr<vargas::AlignerBase, rg::Deleter>> &aligners,
-           bool fwdonly, bool msonly, bool maxonly, bool notraceback, char phred_offset) {
+           bool fwdonly, bool msonly, bool maxonly, bool notraceback, char phred_offset, bool ordered,
+           const AlignPlacement *placement, const AlignProfiles *profiles) {
     std::cerr << "Aligning... " << std::flush;
-    rg::ForPool fp(aligners.size());
+    VA_TRACE_SCOPE("align_batch", task_list.size());
+    const size_t workers = std::max<size_t>(1, std::min(aligners.size(), task_list.size()));
+    rg::ForPool fp(workers);
+    VA_STATS_ONLY(vargas::stats::recorder().reserve(aligners.size());)
     auto start_time = std::chrono::steady_clock::now();
 
+    {
+        // Largest tasks first
+        std::unordered_map<std::string, size_t> graph_len;
+        for (const auto &task : task_list) {
+            if (!graph_len.count(task.first)) graph_len[task.first] = graph_length(gm, task.first);
+        }
+        schedule_tasks(task_list, graph_len, aligners.front()->lanes());
+    }
+
     const auto num_tasks = task_list.size();
     std::mutex mut;
-    align_helper help{gm, task_list, out, aligners, fwdonly, msonly, maxonly, notraceback, phred_offset, mut};
+    // One worker runs on this thread, which must keep its affinity after the batch
+    align_helper help{gm, task_list, out, aligners, fwdonly, msonly, maxonly, notraceback, phred_offset, ordered, mut,
+                      placement, workers > 1, profiles};
     fp.forpool(&align_helper_func, (void *)&help, num_tasks);
 
+    if (ordered) {
+        VA_TRACE_SCOPE("output_write");
+        std::vector<const vargas::SAM::Record *> records;
+        for (const auto &task : task_list) {
+            for (const auto &rec : task.second) records.push_back(&rec);
+        }
+        write_by_read_index(out, records);
+    }
+
+    VA_STATS_ONLY(vargas::stats::recorder().add_wall(rg::chrono_duration(start_time));)
     std::cerr << rg::chrono_duration(start_time) << "s.\n";
 
 }
 
 std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>>
-create_tasks(vargas::isam &reads, std::string &align_targets, const int chunk_size, size_t &read_len) {
+create_tasks(vargas::isam &reads, std::string &align_targets, const int chunk_size, size_t &read_len, unsigned threads,
+             const Shard &shard, bool onepass) {
+    std::cerr << "Loading reads... " << std::flush;
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<vargas::SAM::Record> records;
+    uint64_t index = 0;
+    do {
+        if (shard.contains(index)) {
+            records.push_back(reads.record());
+            if (shard.count) records.back().aux.set(ALIGN_SAM_READ_INDEX_TAG, index);
+        }
+        ++index;
+        // Records of other shards are passed over unparsed
+        while (!shard.contains(index) && reads.skip()) ++index;
+    } while (reads.next());
+    if (records.empty()) throw std::invalid_argument("No records available.");
+    std::cerr << rg::chrono_duration(start_time) << "s." << std::endl;
+
+    return create_tasks(reads.header(), records, align_targets, chunk_size, read_len, true, threads, onepass);
+}
+
+std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>>
+create_tasks(vargas::SAM::Header &reads_hdr, std::vector<vargas::SAM::Record> &records,
+             std::string &align_targets, const int requested_chunk_size, size_t &read_len, bool verbose, unsigned threads,
+             bool onepass) {
+    const size_t chunk_size = chunk_size_for(requested_chunk_size, records.size(), threads, vargas::Aligner::read_capacity());
     std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> task_list;
     std::unordered_map<std::string, std::vector<vargas::SAM::Record>> read_groups;
 
@@ -577,16 +888,10 @@ create_tasks(vargas::isam &reads, std::string &align_targets, const int chunk_si
         alignment_pairs = rg::split(align_targets, ';');
     }
 
-    std::cerr << "Loading reads... " << std::flush;
-    auto start_time = std::chrono::steady_clock::now();
-
     size_t total = 0;
-    auto &reads_hdr = reads.header();
     std::string read_group;
-    vargas::SAM::Record rec;
-    read_len = reads.record().seq.length();
-    do {
-        rec = reads.record();
+    read_len = 0;
+    for (auto &rec : records) {
         if (rec.seq.length() > read_len) read_len = rec.seq.length();
         if (!rec.aux.get("RG", read_group)) {
             read_group = UNGROUPED_READGROUP;
@@ -595,8 +900,9 @@ create_tasks(vargas::isam &reads, std::string &align_targets, const int chunk_si
                 reads_hdr.add(vargas::SAM::Header::ReadGroup("@RG\tID:" + std::string(UNGROUPED_READGROUP)));
             }
         }
-        read_groups[read_group].push_back(rec);
-    } while (reads.next());
+        read_groups[read_group].push_back(std::move(rec));
+    }
+    records.clear();
 
     if (alignment_pairs.empty()) {
         for (const auto &p : read_groups) {
@@ -617,6 +923,7 @@ create_tasks(vargas::isam &reads, std::string &align_targets, const int chunk_si
 
     // Maps target graph to read group ID's
     std::unordered_map<std::string, std::vector<std::string>> alignment_rg_map;
+    std::vector<std::string> targets; // In order of the alignment pairs
 
     std::string tag, val, target_val;
     for (const std::string &p : alignment_pairs) {
@@ -638,10 +945,32 @@ create_tasks(vargas::isam &reads, std::string &align_targets, const int chunk_si
             else continue;
             if (val == target_val) alignment_rg_map[pair[1]].push_back(rg_pair.first);
         }
+        if (std::find(targets.begin(), targets.end(), pair[1]) == targets.end()) targets.push_back(pair[1]);
 
     }
-
-    std::cerr << rg::chrono_duration(start_time) << "s." << std::endl;
+    const size_t num_subgraphs = alignment_rg_map.size();
+
+    // Group the targets of each read group into tasks aligning to all of them at once
+    if (onepass) {
+        std::map<std::string, std::vector<std::string>> rg_targets;
+        for (const auto &target : targets) {
+            if (!alignment_rg_map.count(target)) continue;
+            for (const auto &rgid : alignment_rg_map.at(target)) {
+                auto &t = rg_targets[rgid];
+                if (std::find(t.begin(), t.end(), target) == t.end()) t.push_back(target);
+            }
+        }
+        alignment_rg_map.clear();
+        for (const auto &p : rg_targets) {
+            for (size_t i = 0; i < p.second.size(); i += vargas::SubgraphSet::max_size) {
+                std::string label;
+                for (size_t j = i; j < std::min<size_t>(i + vargas::SubgraphSet::max_size, p.second.size()); ++j) {
+                    label += (j > i ? "," : "") + p.second[j];
+                }
+                alignment_rg_map[label].push_back(p.first);
+            }
+        }
+    }
 
     // graph label to vector of reads
     for (const auto &sub_rg_pair : alignment_rg_map) {
@@ -665,79 +994,211 @@ create_tasks(vargas::isam &reads, std::string &align_targets, const int chunk_si
         }
     }
 
-    std::cerr << read_groups.size() << "\tRead group(s).\n"
-              << alignment_rg_map.size() << "\tSubgraph(s).\n"
-              << task_list.size() << "\tTask(s).\n"
-              << total << "\tTotal alignments.\n"
-              << read_len << "\tMax read length.\n";
+    if (verbose) {
+        std::cerr << read_groups.size() << "\tRead group(s).\n"
+                  << num_subgraphs << "\tSubgraph(s).\n"
+                  << task_list.size() << "\tTask(s) of up to " << chunk_size << " reads.\n"
+                  << total << "\tTotal alignments.\n"
+                  << read_len << "\tMax read length.\n";
+    }
 
     return task_list;
 }
 
+size_t graph_length(vargas::GraphMan &gm, const std::string &label) {
+    size_t len = 0;
+    for (const auto &l : rg::split(label, ',')) {
+        auto subgraph = gm.at(l);
+        for (auto gi = subgraph->begin(); gi != subgraph->end(); ++gi) len += gi->length();
+    }
+    return len;
+}
+
+size_t chunk_size_for(size_t chunk_size, size_t num_reads, unsigned threads, unsigned lanes) {
+    if (chunk_size == 0) {
+        const size_t tasks = size_t(threads ? threads : 1) * ALIGN_TASKS_PER_THREAD;
+        chunk_size = std::min<size_t>((num_reads + tasks - 1) / tasks, ALIGN_MAX_CHUNK_VECTORS * lanes);
+    }
+    chunk_size = std::max<size_t>(chunk_size, 1);
+    return ((chunk_size + lanes - 1) / lanes) * lanes;
+}
+
+void schedule_tasks(std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> &task_list,
+                    const std::unordered_map<std::string, size_t> &graph_len, unsigned lanes) {
+    std::vector<std::pair<uint64_t, size_t>> cost(task_list.size());
+    for (size_t i = 0; i < task_list.size(); ++i) {
+        size_t rows = 0;
+        for (const auto &r : task_list[i].second) rows = std::max(rows, r.seq.size());
+        const auto len = graph_len.find(task_list[i].first);
+        cost[i] = {task_cost(task_list[i].second.size(), rows, len == graph_len.end() ? 0 : len->second, lanes), i};
+    }
+    // Stable so equal tasks keep their read order
+    std::stable_sort(cost.begin(), cost.end(),
+                     [](const std::pair<uint64_t, size_t> &a, const std::pair<uint64_t, size_t> &b) {
+                         return a.first > b.first;
+                     });
+    std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> sorted;
+    sorted.reserve(task_list.size());
+    for (const auto &c : cost) sorted.push_back(std::move(task_list[c.second]));
+    task_list = std::move(sorted);
+}
+
+Shard parse_shard(const std::string &spec) {
+    const auto parts = rg::split(spec, '/');
+    Shard ret;
+    try {
+        if (parts.size() != 2) throw std::invalid_argument(spec);
+        size_t end;
+        ret.index = std::stoul(parts[0], &end);
+        if (end != parts[0].size()) throw std::invalid_argument(spec);
+        ret.count = std::stoul(parts[1], &end);
+        if (end != parts[1].size()) throw std::invalid_argument(spec);
+    } catch (std::exception &) {
+        throw std::invalid_argument("Invalid shard \"" + spec + "\", expected i/N.");
+    }
+    if (ret.count == 0 || ret.index >= ret.count) {
+        throw std::invalid_argument("Invalid shard \"" + spec + "\", expected 0 <= i < N.");
+    }
+    return ret;
+}
+
+void write_by_read_index(vargas::osam &out, const std::vector<const vargas::SAM::Record *> &records) {
+    std::vector<std::pair<uint64_t, const vargas::SAM::Record *>> order;
+    order.reserve(records.size());
+    uint64_t index;
+    for (const auto *rec : records) {
+        if (!rec->aux.get(ALIGN_SAM_READ_INDEX_TAG, index)) {
+            throw std::invalid_argument("Record \"" + rec->query_name + "\" has no read index.");
+        }
+        order.emplace_back(index, rec);
+    }
+    // Stable, so the records of a read keep the order of the scheduled tasks, costliest target first
+    std::stable_sort(order.begin(), order.end(),
+              [](const std::pair<uint64_t, const vargas::SAM::Record *> &a,
+                 const std::pair<uint64_t, const vargas::SAM::Record *> &b) {
+                  return a.first < b.first;
+              });
+    for (const auto &o : order) out.add_record(*o.second);
+}
+
+
+vargas::ScoreProfile parse_score_profile(unsigned match, unsigned npenalty, const std::string &mismatch,
+                                         const std::string &rdg, const std::string &rfg) {
+    vargas::ScoreProfile prof;
+    prof.match = match;
+    prof.ambig = npenalty;
 
-template<typename T, typename...Args>
-T *construct_aligned(Args &&...args) {
-    static constexpr size_t alignment = 64; // AVX512
-    T *ptr;
-    if(posix_memalign(reinterpret_cast<void **>(&ptr), alignment, sizeof(T))) throw std::bad_alloc();
-    return new(ptr) T(std::forward<Args>(args)...);
+    auto sp = rg::split(mismatch, ',');
+    if (sp.size() == 2) {
+        prof.mismatch_min = std::stoi(sp[0]);
+        prof.mismatch_max = std::stoi(sp[1]);
+    }
+    else if (sp.size() == 1) {
+        prof.mismatch_max = prof.mismatch_min = std::stoi(sp[0]);
+    }
+    else {
+        throw std::invalid_argument("Invalid --mp argument.");
+    }
+
+    sp = rg::split(rdg, ',');
+    if (sp.size() == 2) {
+        prof.read_gopen = std::stoi(sp[0]);
+        prof.read_gext = std::stoi(sp[1]);
+    }
+    else {
+        throw std::invalid_argument("Invalid --rdg argument.");
+    }
+
+    sp = rg::split(rfg, ',');
+    if (sp.size() == 2) {
+        prof.ref_gopen = std::stoi(sp[0]);
+        prof.ref_gext = std::stoi(sp[1]);
+    }
+    else {
+        throw std::invalid_argument("Invalid --rfg argument.");
+    }
+    return prof;
 }
 
+unsigned aligner_width(const vargas::ScoreProfile &prof, size_t read_len) {
+    for (const unsigned bits : {8u, 16u}) {
+        const long long bias = ((1ll << bits) - 1) - static_cast<long long>(read_len * prof.match);
+        if (bias < 0) continue;
+        if (prof.end_to_end && (static_cast<long long>(prof.ref_gopen + (prof.ref_gext * (read_len - 1))) > bias
+                                || static_cast<long long>(read_len * prof.mismatch_max) > bias)) continue;
+        return bits;
+    }
+    return 32;
+}
 
 std::unique_ptr<vargas::AlignerBase, Deleter>
-make_aligner(const vargas::ScoreProfile &prof, size_t read_len, bool use_wide, bool msonly, bool maxonly) {
+make_aligner(const vargas::ScoreProfile &prof, size_t read_len, unsigned width, bool msonly, bool maxonly) {
     std::unique_ptr<vargas::AlignerBase, Deleter> ret;
     if (msonly) {
         if (prof.end_to_end) {
-            if(use_wide) ret.reset(construct_aligned<vargas::MSWordAlignerETE>(read_len, prof));
+            if (width > 16) ret.reset(construct_aligned<vargas::MSLongAlignerETE>(read_len, prof));
+            else if (width > 8) ret.reset(construct_aligned<vargas::MSWordAlignerETE>(read_len, prof));
             else ret.reset(construct_aligned<vargas::MSAlignerETE>(read_len, prof));
         } else {
-            if(use_wide) ret.reset(construct_aligned<vargas::MSWordAligner>(read_len, prof));
+            if (width > 16) ret.reset(construct_aligned<vargas::MSLongAligner>(read_len, prof));
+            else if (width > 8) ret.reset(construct_aligned<vargas::MSWordAligner>(read_len, prof));
             else ret.reset(construct_aligned<vargas::MSAligner>(read_len, prof));
         }
     }
     else {
         if (prof.end_to_end) {
-            if(use_wide) ret.reset(construct_aligned<vargas::WordAlignerETE>(read_len, prof));
+            if (width > 16) ret.reset(construct_aligned<vargas::LongAlignerETE>(read_len, prof));
+            else if (width > 8) ret.reset(construct_aligned<vargas::WordAlignerETE>(read_len, prof));
             else ret.reset(construct_aligned<vargas::AlignerETE>(read_len, prof));
         } else {
-            if(use_wide) ret.reset(construct_aligned<vargas::WordAligner>(read_len, prof));
+            if (width > 16) ret.reset(construct_aligned<vargas::LongAligner>(read_len, prof));
+            else if (width > 8) ret.reset(construct_aligned<vargas::WordAligner>(read_len, prof));
             else ret.reset(construct_aligned<vargas::Aligner>(read_len, prof));
         }
     }
     return ret;
 }
 
+unsigned aligner_lanes(unsigned width) {
+    if (width > 16) return vargas::LongAligner::read_capacity();
+    if (width > 8) return vargas::WordAligner::read_capacity();
+    return vargas::Aligner::read_capacity();
+}
+
 void load_fast(std::string &file, const bool fastq, vargas::isam &ret, bool p64) {
-    std::string input;
-    if (file.empty()) {
-        std::stringstream ss;
-        ss << std::cin.rdbuf();
-        input = ss.str();
-    } else {
-        std::ifstream in(file);
-        if (!in.good()) throw std::invalid_argument("Unable to open file \"" + file + "\"");
-        std::stringstream ss;
-        ss << in.rdbuf();
-        input = ss.str();
+    vargas::ifastx in(file);
+    std::vector<vargas::SAM::Record> batch;
+    while (load_fast(in, fastq, batch, 1024, p64)) {
+        for (const auto &rec : batch) ret.push(rec);
     }
-    const auto lines = rg::split(input, '\n');
+    ret.next();
+}
 
+size_t load_fast(vargas::ifastx &in, const bool fastq, std::vector<vargas::SAM::Record> &batch, size_t n, bool p64) {
+    uint64_t next_read = 0;
+    return load_fast(in, fastq, batch, n, p64, Shard(), next_read);
+}
+
+size_t load_fast(vargas::ifastx &in, const bool fastq, std::vector<vargas::SAM::Record> &batch, size_t n, bool p64,
+                 const Shard &shard, uint64_t &next_read) {
+    batch.resize(n);
+    size_t i = 0;
     try {
-        for (unsigned i = 0; i < lines.size(); i += (fastq ? 4 : 2)) {
-            vargas::SAM::Record rec;
-            rec.query_name = std::string(lines.at(i).begin() + 1,
-                                         std::find_if(lines.at(i).begin() + 1, lines.at(i).end(), isspace));
-            rec.seq = lines.at(i + 1);
-            if (fastq) rec.qual = lines.at(i + 3);
+        while (i < n && in.next()) {
+            const uint64_t index = next_read++;
+            if (!shard.contains(index)) continue;
+            vargas::SAM::Record &rec = batch[i++];
+            rec.query_name = in.name();
+            rec.seq = in.seq();
+            if (fastq) rec.qual = in.qual();
             if (p64) std::transform(rec.qual.begin(), rec.qual.end(), rec.qual.begin(), [](char c){return c-31;});
-
-            ret.push(rec);
+            if (shard.count) rec.aux.set(ALIGN_SAM_READ_INDEX_TAG, index);
         }
     } catch (std::exception &e) {
-        throw std::runtime_error("Invalid FASTA/Q file.");
+        throw std::runtime_error("Invalid FASTA/Q file: " + std::string(e.what()));
     }
-    ret.next();
+    batch.resize(i);
+    return i;
 }
 
 void align_help(const cxxopts::Options &opts) {
@@ -749,17 +1210,45 @@ void align_help(const cxxopts::Options &opts) {
 }
 
 ReadFmt read_fmt(const std::string& filename) {
-    std::ifstream in(filename);
-    if (!in.good()) throw std::invalid_argument("Invalid read file: " + filename);
+    if (rg::ends_with(filename, ".bam")) return ReadFmt::SAM;
+    // BGZF reads plain and gzip files alike
+    BGZF *in = bgzf_open(filename.c_str(), "r");
+    if (in == nullptr) throw std::invalid_argument("Invalid read file: " + filename);
+    kstring_t ks = {0, 0, nullptr};
+    auto getline = [&](std::string &line) {
+        if (bgzf_getline(in, '\n', &ks) < 0) return false;
+        line.assign(ks.s, ks.l);
+        return true;
+    };
 
     std::string line;
-    if (!std::getline(in, line)) throw std::invalid_argument("Empty Read File."); // @SAM or fasta/q name
-    if (line.substr(0,3) == "@HD") return ReadFmt::SAM;
-    if (!std::getline(in, line)) throw std::invalid_argument("Invalid Read File."); // SAM comment/header, or read
-    if (!std::getline(in, line)) return ReadFmt::FASTA; // Single record fasta, or SAM line, or +, or name
-    if (!line.empty() && line[0] == '+') return ReadFmt::FASTQ;
-    if (!line.empty() && (line[0] == '>' || line[0] == '@')) return ReadFmt::FASTA;
-    return ReadFmt::SAM;
+    ReadFmt ret = ReadFmt::SAM;
+    try {
+        if (!getline(line)) throw std::invalid_argument("Empty Read File."); // @SAM or fasta/q name
+        if (line.substr(0,3) == "@HD") ret = ReadFmt::SAM;
+        else if (!line.empty() && line[0] == '>') ret = ReadFmt::FASTA; // Possibly multi-line
+        else if (!getline(line)) throw std::invalid_argument("Invalid Read File."); // SAM comment/header, or read
+        else if (!getline(line)) ret = ReadFmt::FASTA; // Single record fasta, or SAM line, or +, or name
+        else if (!line.empty() && line[0] == '+') ret = ReadFmt::FASTQ;
+        else if (!line.empty() && (line[0] == '>' || line[0] == '@')) ret = ReadFmt::FASTA;
+    } catch (...) {
+        bgzf_close(in);
+        free(ks.s);
+        throw;
+    }
+    bgzf_close(in);
+    free(ks.s);
+    return ret;
+}
+
+void add_contigs(const vargas::GraphMan &gm, vargas::SAM::Header &hdr) {
+    for (const auto &c : gm.contigs()) {
+        if (hdr.sequences.count(c.first)) continue;
+        vargas::SAM::Header::Sequence seq;
+        seq.name = c.first;
+        seq.len = c.second;
+        hdr.add(seq);
+    }
 }
 
 TEST_SUITE("System");
@@ -798,3 +1287,46 @@ TEST_CASE ("Load FASTA") {
     CHECK_FALSE(ss.next());
     remove(tmpfq.c_str());
 }
+
+TEST_CASE ("Task scheduling") {
+    SUBCASE("Chunk size") {
+        CHECK(chunk_size_for(64, 1000, 4, 16) == 64);
+        CHECK(chunk_size_for(50, 1000, 4, 16) == 64);
+        CHECK(chunk_size_for(1, 1000, 4, 32) == 32);
+        // 10000 reads over 4 threads is capped at 16 vectors
+        CHECK(chunk_size_for(0, 10000, 4, 16) == 256);
+        // 1000 reads -> 32 tasks of ~32 reads
+        CHECK(chunk_size_for(0, 1000, 4, 16) == 32);
+        CHECK(chunk_size_for(0, 3, 4, 16) == 16);
+        CHECK(chunk_size_for(0, 0, 0, 16) == 16);
+    }
+
+    SUBCASE("Cost") {
+        CHECK(task_cost(16, 100, 1000, 16) == 16 * 100 * 1000);
+        // Partial vectors cost a full vector
+        CHECK(task_cost(17, 100, 1000, 16) == 32 * 100 * 1000);
+    }
+
+    SUBCASE("Order") {
+        auto make = [](const std::string &label, size_t n, size_t len) {
+            std::vector<vargas::SAM::Record> reads(n);
+            for (auto &r : reads) r.seq = std::string(len, 'A');
+            return std::make_pair(label, reads);
+        };
+        std::vector<std::pair<std::string, std::vector<vargas::SAM::Record>>> tasks;
+        tasks.push_back(make("small", 16, 100));
+        tasks.push_back(make("big", 4, 100));
+        tasks.push_back(make("small", 32, 100));
+        tasks.push_back(make("small", 16, 100));
+        tasks.push_back(make("small", 16, 150));
+        tasks.back().second[0].query_name = "x";
+        std::unordered_map<std::string, size_t> len{{"small", 100}, {"big", 10000}};
+        schedule_tasks(tasks, len, 16);
+        REQUIRE(tasks.size() == 5);
+        CHECK(tasks[0].first == "big");
+        CHECK(tasks[1].second.size() == 32);
+        CHECK(tasks[2].second[0].query_name == "x");
+        CHECK(tasks[3].second.size() == 16);
+        CHECK(tasks[4].second.size() == 16);
+    }
+}
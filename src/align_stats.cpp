@@ -0,0 +1,201 @@
+/**
+ * @brief
+ * Optional per thread instrumentation of the aligner. Implementation.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#include "align_stats.h"
+#include "doctest.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+const char *vargas::stats::phase_name(Phase p) {
+    switch (p) {
+        case LOAD: return "load";
+        case PACK: return "pack";
+        case FILL: return "fill";
+        case TRACEBACK: return "traceback";
+        case FORMAT: return "format";
+        case LOCK_WAIT: return "lock_wait";
+        case OUTPUT: return "output";
+        default: return "unknown";
+    }
+}
+
+vargas::stats::ThreadStats &vargas::stats::ThreadStats::operator+=(const ThreadStats &o) {
+    for (unsigned p = 0; p < NUM_PHASES; ++p) ns[p] += o.ns[p];
+    tasks += o.tasks;
+    reads += o.reads;
+    cells += o.cells;
+    vectors += o.vectors;
+    lanes += o.lanes;
+    lane_capacity += o.lane_capacity;
+    return *this;
+}
+
+void vargas::stats::Recorder::reset(unsigned nthreads) {
+    _threads.assign(nthreads, ThreadStats());
+    _main = ThreadStats();
+    _wall = 0;
+    reads_done = 0;
+}
+
+vargas::stats::ThreadStats vargas::stats::Recorder::total() const {
+    ThreadStats ret = _main;
+    for (const auto &t : _threads) ret += t;
+    return ret;
+}
+
+namespace {
+  void write_counters(std::ostream &os, const vargas::stats::ThreadStats &s) {
+      using namespace vargas::stats;
+      os << "\"tasks\":" << s.tasks
+         << ",\"reads\":" << s.reads
+         << ",\"cells\":" << s.cells
+         << ",\"vectors\":" << s.vectors
+         << ",\"lane_utilization\":" << s.lane_utilization()
+         << ",\"phases_s\":{";
+      for (unsigned p = 0; p < NUM_PHASES; ++p) {
+          if (p) os << ',';
+          os << '"' << phase_name(Phase(p)) << "\":" << s.seconds(Phase(p));
+      }
+      os << '}';
+  }
+}
+
+void vargas::stats::Recorder::write_json(std::ostream &os) const {
+    const ThreadStats tot = total();
+    os << "{\"threads\":" << _threads.size()
+       << ",\"wall_s\":" << _wall
+       << ",\"reads_per_s\":" << (_wall > 0 ? tot.reads / _wall : 0)
+       << ",\"gcups\":" << (_wall > 0 ? tot.cells / _wall * 1e-9 : 0)
+       << ",\"total\":{";
+    write_counters(os, tot);
+    os << "},\"main\":{";
+    write_counters(os, _main);
+    os << "},\"per_thread\":[";
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        if (i) os << ',';
+        os << "{\"tid\":" << i << ',';
+        write_counters(os, _threads[i]);
+        os << '}';
+    }
+    os << "]}\n";
+}
+
+vargas::stats::Recorder &vargas::stats::recorder() {
+    static Recorder r;
+    return r;
+}
+
+struct vargas::stats::Progress::Impl {
+    std::mutex mut;
+    std::condition_variable cv;
+    bool done = false;
+    std::thread th;
+};
+
+vargas::stats::Progress::Progress(const Recorder &rec, double interval) {
+    if (interval <= 0) return;
+    _impl = new Impl;
+    Impl *impl = _impl;
+    const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(interval));
+    _impl->th = std::thread([impl, &rec, period]() {
+        const auto start = std::chrono::steady_clock::now();
+        uint64_t last = rec.reads_done;
+        std::unique_lock<std::mutex> lock(impl->mut);
+        while (!impl->cv.wait_for(lock, period, [impl] { return impl->done; })) {
+            const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const uint64_t n = rec.reads_done;
+            std::cerr << "[progress] " << t << "s, " << n << " reads, "
+                      << (n - last) / std::chrono::duration<double>(period).count() << " reads/s\n";
+            last = n;
+        }
+    });
+}
+
+vargas::stats::Progress::~Progress() {
+    if (!_impl) return;
+    {
+        std::lock_guard<std::mutex> lock(_impl->mut);
+        _impl->done = true;
+    }
+    _impl->cv.notify_all();
+    _impl->th.join();
+    delete _impl;
+}
+
+TEST_SUITE("Align stats");
+
+TEST_CASE ("Align stats") {
+    using namespace vargas::stats;
+    Recorder rec;
+    rec.reset(2);
+
+    SUBCASE("Binding") {
+        CHECK(current() == nullptr);
+        {
+            Bind b(rec.thread(1));
+            CHECK(current() == &rec.thread(1));
+            {
+                Bind c(rec.main());
+                CHECK(current() == &rec.main());
+                ScopedTimer t(FILL);
+            }
+            CHECK(current() == &rec.thread(1));
+        }
+        CHECK(current() == nullptr);
+        CHECK(rec.main().ns[FILL] > 0);
+    }
+
+    SUBCASE("Exclusive timer") {
+        Bind b(rec.thread(0));
+        {
+            ScopedTimer t(FORMAT, TRACEBACK);
+            ScopedTimer u(TRACEBACK);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        CHECK(rec.thread(0).ns[TRACEBACK] >= 20000000);
+        CHECK(rec.thread(0).ns[FORMAT] < rec.thread(0).ns[TRACEBACK]);
+    }
+
+    SUBCASE("Totals") {
+        rec.thread(0).reads = 16;
+        rec.thread(0).vectors = 1;
+        rec.thread(0).lanes = 16;
+        rec.thread(0).lane_capacity = 16;
+        rec.thread(1).reads = 4;
+        rec.thread(1).vectors = 1;
+        rec.thread(1).lanes = 4;
+        rec.thread(1).lane_capacity = 16;
+        rec.thread(1).ns[LOCK_WAIT] = 2000000000;
+        rec.add_wall(2);
+
+        const ThreadStats tot = rec.total();
+        CHECK(tot.reads == 20);
+        CHECK(tot.vectors == 2);
+        CHECK(tot.lane_utilization() == 20.0 / 32);
+        CHECK(tot.seconds(LOCK_WAIT) == 2);
+        CHECK(ThreadStats().lane_utilization() == 0);
+
+        std::ostringstream ss;
+        rec.write_json(ss);
+        const std::string js = ss.str();
+        CHECK(js.find("\"threads\":2") != std::string::npos);
+        CHECK(js.find("\"reads_per_s\":10") != std::string::npos);
+        CHECK(js.find("\"lock_wait\":2") != std::string::npos);
+        CHECK(js.find("\"tid\":1") != std::string::npos);
+    }
+}
+
+TEST_SUITE_END();
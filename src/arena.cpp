@@ -0,0 +1,158 @@
+/**
+ * @brief
+ * Arena for aligner scratch memory. Implementation.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#include "arena.h"
+#include "doctest.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define VA_HUGE_PAGE (size_t(1) << 21)
+
+std::atomic<vargas::HugePages> vargas::Arena::_default_pages{vargas::HugePages::NONE};
+
+vargas::HugePages vargas::huge_pages_from_string(const std::string &s) {
+    if (s == "none") return HugePages::NONE;
+    if (s == "thp") return HugePages::TRANSPARENT;
+    if (s == "explicit") return HugePages::EXPLICIT;
+    throw std::invalid_argument("Invalid huge page mode \"" + s + "\", expected none, thp, or explicit.");
+}
+
+
+vargas::Arena::~Arena() {
+    for (const auto &c : _chunks) {
+        #ifdef __linux__
+        if (c.mapped) {
+            munmap(c.ptr, c.size);
+            continue;
+        }
+        #endif
+        std::free(c.ptr);
+    }
+}
+
+
+void *vargas::Arena::allocate(size_t bytes, const size_t align) {
+    if (align > VA_ARENA_ALIGN || (align & (align - 1))) {
+        throw std::invalid_argument("Arena alignment must be a power of two up to " + std::to_string(VA_ARENA_ALIGN));
+    }
+    bytes = _round(bytes ? bytes : 1);
+
+    auto f = _free.find(bytes);
+    if (f != _free.end() && !f->second.empty()) {
+        void *p = f->second.back();
+        f->second.pop_back();
+        return p;
+    }
+
+    if (_cur == nullptr || size_t(_end - _cur) < bytes) _grow(bytes);
+    void *p = _cur;
+    _cur += bytes;
+    return p;
+}
+
+
+void vargas::Arena::deallocate(void *p, const size_t bytes) {
+    if (p == nullptr) return;
+    _free[_round(bytes ? bytes : 1)].push_back(p);
+}
+
+
+void vargas::Arena::_grow(const size_t bytes) {
+    const bool huge = _pages != HugePages::NONE;
+    size_t size = bytes > _chunk ? bytes : _chunk;
+    if (huge) size = (size + VA_HUGE_PAGE - 1) & ~(VA_HUGE_PAGE - 1);
+
+    Chunk c{nullptr, size, false};
+
+    #if defined(__linux__) && defined(MAP_HUGETLB)
+    if (_pages == HugePages::EXPLICIT) {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            c.ptr = static_cast<char *>(p);
+            c.mapped = true;
+        } else {
+            _pages = HugePages::TRANSPARENT;
+        }
+    }
+    #else
+    if (_pages == HugePages::EXPLICIT) _pages = HugePages::TRANSPARENT;
+    #endif
+
+    if (c.ptr == nullptr) {
+        void *p;
+        if (posix_memalign(&p, huge ? VA_HUGE_PAGE : VA_ARENA_ALIGN, size)) throw std::bad_alloc();
+        c.ptr = static_cast<char *>(p);
+        #if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (huge) madvise(p, size, MADV_HUGEPAGE); // Advisory, THP may be disabled
+        #endif
+    }
+
+    _chunks.push_back(c);
+    _cur = c.ptr;
+    _end = c.ptr + size;
+}
+
+TEST_SUITE("Memory");
+
+TEST_CASE ("Arena") {
+    using vargas::Arena;
+    using vargas::HugePages;
+
+    SUBCASE("Reuse") {
+        Arena a(HugePages::NONE, 1024);
+        void *p = a.allocate(100);
+        void *q = a.allocate(100);
+        CHECK(p != q);
+        CHECK(reinterpret_cast<uintptr_t>(p) % VA_ARENA_ALIGN == 0);
+        CHECK(reinterpret_cast<uintptr_t>(q) % VA_ARENA_ALIGN == 0);
+        CHECK(a.chunks() == 1);
+
+        a.deallocate(p, 100);
+        CHECK(a.allocate(128) == p); // Same rounded size
+        CHECK(a.allocate(100) != p);
+
+        // Larger than a chunk
+        void *big = a.allocate(4096);
+        CHECK(big != nullptr);
+        CHECK(a.chunks() == 2);
+        CHECK(a.reserved() == 1024 + 4096);
+
+        CHECK_THROWS(a.allocate(8, 128));
+        CHECK_THROWS(a.allocate(8, 48));
+    }
+
+    SUBCASE("Huge pages") {
+        for (auto mode : {HugePages::TRANSPARENT, HugePages::EXPLICIT}) {
+            Arena a(mode, 4096);
+            char *p = static_cast<char *>(a.allocate(10000));
+            for (size_t i = 0; i < 10000; ++i) p[i] = char(i);
+            CHECK(a.reserved() == VA_HUGE_PAGE);
+            CHECK(a.pages() != HugePages::NONE);
+            CHECK(p[9999] == char(9999));
+        }
+    }
+
+    SUBCASE("Mode names") {
+        CHECK(vargas::huge_pages_from_string("none") == HugePages::NONE);
+        CHECK(vargas::huge_pages_from_string("thp") == HugePages::TRANSPARENT);
+        CHECK(vargas::huge_pages_from_string("explicit") == HugePages::EXPLICIT);
+        CHECK_THROWS(vargas::huge_pages_from_string("2M"));
+    }
+}
+
+TEST_SUITE_END();
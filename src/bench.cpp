@@ -0,0 +1,402 @@
+/**
+ * @brief
+ * Built in benchmarks of the aligner kernels, I/O, and the simulator on synthetic data.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#include "bench.h"
+#include "main.h"
+#include "align_main.h"
+#include "alignment.h"
+#include "sim.h"
+#include "doctest.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+double BenchResult::mean() const {
+    double sum = 0;
+    for (double t : times) sum += t;
+    return times.empty() ? 0 : sum / times.size();
+}
+
+double BenchResult::stddev() const {
+    if (times.size() < 2) return 0;
+    const double m = mean();
+    double ss = 0;
+    for (double t : times) ss += (t - m) * (t - m);
+    return std::sqrt(ss / (times.size() - 1));
+}
+
+double BenchResult::min() const {
+    return times.empty() ? 0 : *std::min_element(times.begin(), times.end());
+}
+
+double BenchResult::max() const {
+    return times.empty() ? 0 : *std::max_element(times.begin(), times.end());
+}
+
+BenchResult run_bench(const std::string &name, const std::string &unit, double work,
+                      unsigned warmup, unsigned reps,
+                      const std::function<void()> &fn, const std::function<void()> &setup) {
+    BenchResult ret;
+    ret.name = name;
+    ret.unit = unit;
+    ret.work = work;
+    for (unsigned i = 0; i < warmup + reps; ++i) {
+        if (setup) setup();
+        auto start_time = std::chrono::steady_clock::now();
+        fn();
+        const double t = rg::chrono_duration(start_time);
+        if (i >= warmup) ret.times.push_back(t);
+    }
+    std::cerr << std::left << std::setw(24) << name << std::right
+              << std::setw(12) << std::setprecision(4) << ret.throughput() << " " << unit << "/s  ("
+              << ret.mean() << " +/- " << ret.stddev() << " s)\n";
+    return ret;
+}
+
+static const char *simd_name() {
+    #if defined(VA_SIMD_USE_AVX512)
+    return "AVX512";
+    #elif defined(VA_SIMD_USE_AVX2)
+    return "AVX2";
+    #else
+    return "SSE";
+    #endif
+}
+
+void write_bench_json(std::ostream &os, const std::vector<BenchResult> &results) {
+    os << std::setprecision(9);
+    os << "{\n"
+       << "  \"version\": \"" << VARGAS_VERSION << "\",\n"
+       << "  \"simd\": \"" << simd_name() << "\",\n"
+       << "  \"read_capacity\": " << vargas::Aligner::read_capacity() << ",\n"
+       << "  \"date\": \"" << rg::current_date() << "\",\n"
+       << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+        os << (i ? ",\n" : "\n")
+           << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"work\": " << r.work
+           << ", \"reps\": " << r.times.size() << ", \"mean_s\": " << r.mean() << ", \"stddev_s\": " << r.stddev()
+           << ", \"min_s\": " << r.min() << ", \"max_s\": " << r.max() << ", \"throughput\": " << r.throughput()
+           << ", \"times_s\": [" << rg::vec_to_str(r.times, ", ") << "]}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+void write_bench_csv(std::ostream &os, const std::vector<BenchResult> &results) {
+    os << std::setprecision(9);
+    os << "name,unit,work,reps,mean_s,stddev_s,min_s,max_s,throughput,simd\n";
+    for (const auto &r : results) {
+        os << r.name << ',' << r.unit << ',' << r.work << ',' << r.times.size() << ','
+           << r.mean() << ',' << r.stddev() << ',' << r.min() << ',' << r.max() << ','
+           << r.throughput() << ',' << simd_name() << '\n';
+    }
+}
+
+/**
+ * @brief
+ * Reference chain with a SNP bubble every density bases.
+ * @param genome Reference sequence
+ * @param density Bases between SNPs
+ * @param g Graph to populate
+ */
+static void bench_graph(const std::string &genome, unsigned density, vargas::Graph &g) {
+    std::vector<unsigned> tails;
+    auto link = [&](const std::vector<unsigned> &to) {
+        for (unsigned t : tails) for (unsigned n : to) g.add_edge(t, n);
+        tails = to;
+    };
+    size_t pos = 0;
+    while (pos < genome.size()) {
+        const size_t len = std::min<size_t>(density - 1, genome.size() - pos);
+        if (len) {
+            // Linear reference between sites is pinched, as GraphFactory builds it
+            vargas::Graph::Node n;
+            n.pinch();
+            n.set_endpos(pos + len - 1);
+            n.set_as_ref();
+            n.set_seq(genome.substr(pos, len));
+            link({g.add_node(n)});
+            pos += len;
+        }
+        if (pos == genome.size()) break;
+
+        vargas::Graph::Node ref, alt;
+        ref.set_endpos(pos);
+        ref.set_as_ref();
+        ref.set_seq(genome.substr(pos, 1));
+        alt.set_endpos(pos);
+        alt.set_not_ref();
+        alt.set_seq(std::string(1, genome[pos] == 'A' ? 'C' : 'A'));
+        const unsigned r = g.add_node(ref), a = g.add_node(alt);
+        link({r, a});
+        ++pos;
+    }
+}
+
+int bench_main(int argc, char *argv[]) {
+    unsigned reps, warmup, read_len, num_reads, density, seed;
+    size_t size;
+    std::string filter, format, out_file, prefix;
+
+    cxxopts::Options opts("vargas bench", "Benchmark aligner kernels, I/O, and the simulator on synthetic data.");
+    try {
+        opts.add_options()
+        ("b,bench", "<S1,...> Only run benchmarks starting with these names. (default: all)", cxxopts::value(filter))
+        ("r,reps", "<N> Timed repetitions.", cxxopts::value(reps)->default_value("5"))
+        ("w,warmup", "<N> Untimed warmup repetitions.", cxxopts::value(warmup)->default_value("1"))
+        ("s,size", "<N> Synthetic genome length.", cxxopts::value(size)->default_value("100000"))
+        ("d,density", "<N> A SNP every N bases.", cxxopts::value(density)->default_value("100"))
+        ("l,rlen", "<N> Read length.", cxxopts::value(read_len)->default_value("100"))
+        ("n,numreads", "<N> Reads per aligner batch.", cxxopts::value(num_reads)->default_value("256"))
+        ("f,format", "<str> Output format, json or csv.", cxxopts::value(format)->default_value("json"))
+        ("o,out", "<str> Output file. (default: stdout)", cxxopts::value(out_file))
+        ("p,prefix", "<str> Prefix for temporary files.", cxxopts::value(prefix)->default_value("vargas_bench_tmp"))
+        ("seed", "<N> Random seed for the synthetic data.", cxxopts::value(seed)->default_value("1"))
+        ("h,help", "Display this message.");
+        opts.parse(argc, argv);
+    } catch (std::exception &e) {
+        throw std::invalid_argument("Error parsing options: " + std::string(e.what()));
+    }
+    if (opts.count("h")) {
+        bench_help(opts);
+        return 0;
+    }
+    if (format != "json" && format != "csv") throw std::invalid_argument("Invalid format: " + format);
+    if (density < 2) throw std::invalid_argument("Density must be at least 2.");
+    if (read_len == 0 || num_reads == 0 || size < read_len) throw std::invalid_argument("Invalid synthetic data size.");
+
+    const auto selected = rg::split(filter, ',');
+    auto wanted = [&](const std::string &name) {
+        if (selected.empty()) return true;
+        for (const auto &s : selected) if (name.compare(0, s.size(), s) == 0) return true;
+        return false;
+    };
+    // True if any benchmark under group may be selected
+    auto wanted_group = [&](const std::string &group) {
+        if (selected.empty()) return true;
+        for (const auto &s : selected) {
+            if (s.compare(0, group.size(), group) == 0 || group.compare(0, s.size(), s) == 0) return true;
+        }
+        return false;
+    };
+
+    std::vector<BenchResult> results;
+    auto bench = [&](const std::string &name, const std::string &unit, double work,
+                     const std::function<void()> &fn, const std::function<void()> &setup) {
+        if (!wanted(name)) return;
+        try {
+            results.push_back(run_bench(name, unit, work, warmup, reps, fn, setup));
+        } catch (std::exception &e) {
+            std::cerr << "[warn] Skipping " << name << ": " << e.what() << '\n';
+        }
+    };
+
+    // Synthetic data
+    rg::CounterRNG rng(seed);
+    std::string genome(size, 'A');
+    for (auto &c : genome) c = "ACGT"[rng() % 4];
+
+    vargas::Graph::Node::_newID = 0;
+    vargas::Graph g;
+    bench_graph(genome, density, g);
+    size_t graph_bases = 0;
+    for (const auto &n : g) graph_bases += n.length();
+
+    vargas::Sim::Profile sim_prof;
+    sim_prof.len = read_len;
+    sim_prof.mut = 2;
+    sim_prof.indel = 1;
+    vargas::Sim sim(g, sim_prof);
+    sim.seed(seed);
+    const std::vector<vargas::SAM::Record> records = sim.get_batch(num_reads, vargas::coordinate_resolver());
+    std::vector<std::string> reads;
+    for (const auto &r : records) reads.push_back(r.seq);
+    std::cerr << "Synthetic graph: " << graph_bases << " bases, " << reads.size() << " reads of length "
+              << read_len << ".\n\n";
+
+    // Aligner kernels, forward strand only
+    size_t max_len = 0;
+    for (const auto &r : reads) max_len = std::max(max_len, r.size());
+    const double cells = double(reads.size()) * max_len * graph_bases;
+    vargas::Results res;
+    auto bench_aligner = [&](const std::string &name, vargas::AlignerBase *aligner) {
+        std::unique_ptr<vargas::AlignerBase, rg::Deleter> owner(aligner);
+        bench(name, "cells", cells, [&]() {
+            aligner->align_into(reads, {}, g.begin(), g.end(), res, true);
+        }, nullptr);
+    };
+    const vargas::ScoreProfile local;
+    vargas::ScoreProfile ete;
+    ete.end_to_end = true;
+    using namespace vargas;
+    if (wanted_group("align/8bit")) {
+        bench_aligner("align/8bit", construct_aligned<Aligner>(max_len, local));
+        bench_aligner("align/8bit/msonly", construct_aligned<MSAligner>(max_len, local));
+        bench_aligner("align/8bit/maxonly", construct_aligned<AlignerT<int8_fast, false, false, true>>(max_len, local));
+        bench_aligner("align/8bit/ete", construct_aligned<AlignerETE>(max_len, ete));
+        bench_aligner("align/8bit/ete/msonly", construct_aligned<MSAlignerETE>(max_len, ete));
+        bench_aligner("align/8bit/ete/maxonly", construct_aligned<AlignerT<int8_fast, true, false, true>>(max_len, ete));
+    }
+    if (wanted_group("align/16bit")) {
+        bench_aligner("align/16bit", construct_aligned<WordAligner>(max_len, local));
+        bench_aligner("align/16bit/msonly", construct_aligned<MSWordAligner>(max_len, local));
+        bench_aligner("align/16bit/maxonly", construct_aligned<AlignerT<int16_fast, false, false, true>>(max_len, local));
+        bench_aligner("align/16bit/ete", construct_aligned<WordAlignerETE>(max_len, ete));
+        bench_aligner("align/16bit/ete/msonly", construct_aligned<MSWordAlignerETE>(max_len, ete));
+        bench_aligner("align/16bit/ete/maxonly", construct_aligned<AlignerT<int16_fast, true, false, true>>(max_len, ete));
+    }
+    if (wanted_group("align/32bit")) {
+        bench_aligner("align/32bit", construct_aligned<LongAligner>(max_len, local));
+        bench_aligner("align/32bit/msonly", construct_aligned<MSLongAligner>(max_len, local));
+        bench_aligner("align/32bit/maxonly", construct_aligned<AlignerT<int32_fast, false, false, true>>(max_len, local));
+        bench_aligner("align/32bit/ete", construct_aligned<LongAlignerETE>(max_len, ete));
+        bench_aligner("align/32bit/ete/msonly", construct_aligned<MSLongAlignerETE>(max_len, ete));
+        bench_aligner("align/32bit/ete/maxonly", construct_aligned<AlignerT<int32_fast, true, false, true>>(max_len, ete));
+    }
+
+    // Simulator, includes building the start node tables
+    const unsigned num_sim = num_reads * 4;
+    bench("sim", "reads", num_sim, [&]() {
+        vargas::Sim s(g, sim_prof);
+        s.seed(seed);
+        s.get_batch(num_sim, vargas::coordinate_resolver());
+    }, nullptr);
+    {
+        vargas::Sim::Profile strat = sim_prof;
+        strat.var_nodes = 1;
+        bench("sim/stratum", "reads", num_sim, [&]() {
+            vargas::Sim s(g, strat);
+            s.seed(seed);
+            s.get_batch(num_sim, vargas::coordinate_resolver());
+        }, nullptr);
+    }
+
+    // SAM records, repeated to get measurable times
+    std::vector<std::string> lines;
+    for (unsigned i = 0; i < 16; ++i) {
+        for (const auto &r : records) lines.push_back(r.to_string());
+    }
+    bench("sam/format", "records", lines.size(), [&]() {
+        size_t bytes = 0;
+        for (unsigned i = 0; i < 16; ++i) {
+            for (const auto &r : records) bytes += r.to_string().size();
+        }
+        if (bytes == 0) throw std::logic_error("Empty records.");
+    }, nullptr);
+    {
+        vargas::SAM::Record rec;
+        bench("sam/parse", "records", lines.size(), [&]() {
+            for (const auto &l : lines) rec.parse(l);
+        }, nullptr);
+    }
+
+    // VCF ingest and graph files. These go through htslib and the filesystem.
+    const std::string fa_file = prefix + ".fa", vcf_file = prefix + ".vcf", gdf_file = prefix + ".gdf";
+    if (wanted_group("vcf") || wanted_group("graph")) {
+        const unsigned num_samples = 8;
+        {
+            std::ofstream fa(fa_file);
+            fa << ">bench\n";
+            for (size_t i = 0; i < genome.size(); i += 80) fa << genome.substr(i, 80) << '\n';
+        }
+        size_t num_var = 0;
+        {
+            std::ofstream vcf(vcf_file);
+            vcf << "##fileformat=VCFv4.1\n##contig=<ID=bench>\n"
+                << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n"
+                << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+            for (unsigned s = 0; s < num_samples; ++s) vcf << "\ts" << s;
+            vcf << '\n';
+            for (size_t pos = density - 1; pos < genome.size(); pos += density) {
+                vcf << "bench\t" << pos + 1 << "\t.\t" << genome[pos] << '\t' << (genome[pos] == 'A' ? 'C' : 'A')
+                    << "\t99\t.\t.\tGT";
+                for (unsigned s = 0; s < num_samples; ++s) vcf << '\t' << (rng() & 1) << '|' << (rng() & 1);
+                vcf << '\n';
+                ++num_var;
+            }
+        }
+
+        bench("vcf/ingest", "variants", num_var, [&]() {
+            vargas::GraphMan gm;
+            gm.create_base(fa_file, vcf_file);
+        }, nullptr);
+
+        std::unique_ptr<vargas::GraphMan> gm;
+        bench("graph/write", "bases", genome.size(), [&]() {
+            gm->write(gdf_file);
+        }, [&]() {
+            // Writing consumes the graphs
+            gm.reset(new vargas::GraphMan());
+            gm->create_base(fa_file, vcf_file);
+        });
+        bench("graph/load", "bases", genome.size(), [&]() {
+            vargas::GraphMan loaded(gdf_file);
+        }, [&]() {
+            if (rg::file_exists(gdf_file)) return;
+            vargas::GraphMan gm;
+            gm.create_base(fa_file, vcf_file);
+            gm.write(gdf_file);
+        });
+
+        for (const auto &f : {fa_file, fa_file + ".fai", vcf_file, gdf_file}) remove(f.c_str());
+    }
+
+    std::ofstream of;
+    if (out_file.size()) {
+        of.open(out_file);
+        if (!of.good()) throw std::invalid_argument("Error opening output file \"" + out_file + "\"");
+    }
+    std::ostream &os = out_file.size() ? of : std::cout;
+    if (format == "csv") write_bench_csv(os, results);
+    else write_bench_json(os, results);
+
+    return 0;
+}
+
+void bench_help(const cxxopts::Options &opts) {
+    using std::cerr;
+    using std::endl;
+
+    cerr << opts.help() << "\n\n";
+    cerr << "Benchmarks: align/{8,16,32}bit[/ete][/msonly|/maxonly], sim, sim/stratum, sam/format, sam/parse,\n"
+         << "vcf/ingest, graph/write, graph/load.\n"
+         << "Times are wall clock. Aligner throughput is in cells (read bases x graph bases) per second." << endl;
+}
+
+TEST_SUITE("Benchmarks");
+
+TEST_CASE ("Bench results") {
+    BenchResult r;
+    r.name = "x";
+    r.unit = "cells";
+    r.work = 8;
+    r.times = {1, 2, 3};
+    CHECK(r.mean() == 2);
+    CHECK(r.stddev() == 1);
+    CHECK(r.min() == 1);
+    CHECK(r.max() == 3);
+    CHECK(r.throughput() == 4);
+
+    std::ostringstream csv;
+    write_bench_csv(csv, {r});
+    CHECK(rg::split(csv.str(), '\n').at(1).find("x,cells,8,3,2,1,1,3,4,") == 0);
+
+    unsigned calls = 0, setups = 0;
+    auto t = run_bench("count", "calls", 1, 2, 3, [&]() { ++calls; }, [&]() { ++setups; });
+    CHECK(t.times.size() == 3);
+    CHECK(calls == 5);
+    CHECK(setups == 5);
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,572 @@
+/**
+ * @brief
+ * Export columns of SAM files as CSV. Implementation.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#include "convert.h"
+#include "threadpool.h"
+#include "doctest.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+  void append_int(std::string &out, const long v) {
+      // Same text as SAM::Record::get() of the stored int
+      out += std::to_string(int(v));
+  }
+
+  rg::str_view next_col(const char *&p, const char *end) {
+      const char *e = std::find(p, end, '\t');
+      rg::str_view col(p, e);
+      p = e == end ? e : e + 1;
+      return col;
+  }
+
+  /**
+   * @brief
+   * Split an aux field into its tag code and value, as SAM::Optional::add() does.
+   * @param a TAG:TYPE:VALUE or TAG:VALUE
+   * @param fmt SAM type character, 'Z' if absent
+   * @return Value text
+   * @throws std::invalid_argument if a is not a valid field
+   */
+  rg::str_view split_aux(rg::str_view a, uint16_t &code, char &fmt) {
+      const char *c1 = std::find(a.begin(), a.end(), ':');
+      if (c1 == a.end() || c1 - a.begin() != 2) throw std::invalid_argument("Invalid format: " + a.str());
+      const char *c2 = std::find(c1 + 1, a.end(), ':');
+      code = vargas::SAM::Optional::tag_code(rg::str_view(a.begin(), c1));
+      if (c2 == a.end()) {
+          fmt = 'Z';
+          return rg::str_view(c1 + 1, a.end());
+      }
+      if (c2 - c1 != 2) throw std::invalid_argument("Invalid format: " + a.str());
+      fmt = c1[1];
+      return rg::str_view(c2 + 1, a.end());
+  }
+
+  void append_aux(std::string &out, const char fmt, rg::str_view val) {
+      // Integers are stored parsed, so they are written in canonical form
+      if (fmt == 'i') append_int(out, rg::parse_int(val));
+      else out.append(val.begin(), val.end());
+  }
+
+  /**
+   * @brief
+   * Shared state of the threads converting one SAM file.
+   */
+  struct convert_helper {
+      const vargas::SAMProjection &proj;
+      const std::string &file; /**< Read by range, unless blocks is set */
+      uint64_t data_begin, data_end; /**< Byte range of the records */
+      size_t block;
+      const std::vector<std::string> *blocks; /**< Whole line blocks already in memory */
+      std::vector<std::unique_ptr<std::ifstream>> &streams; /**< Per thread */
+      std::mutex &m;
+      std::vector<std::string> &done; /**< Rows waiting to be written in order */
+      std::vector<std::vector<char>> &missing;
+      std::vector<char> &ready;
+      size_t &next_write;
+      std::exception_ptr &err;
+      std::ostream &out;
+      std::vector<char> &warned;
+      size_t &rows;
+      const std::vector<std::string> &columns;
+  };
+
+  /**
+   * @brief
+   * Read the lines that start in [begin, end) of a file. The line crossing end is read to its newline.
+   */
+  void read_range(std::ifstream &in, const uint64_t data_begin, const uint64_t data_end,
+                  uint64_t begin, const uint64_t end, std::string &buf) {
+      // Read from one byte early to see if begin is the start of a line
+      const uint64_t from = begin > data_begin ? begin - 1 : begin;
+      buf.resize(end - from);
+      in.clear();
+      in.seekg(from);
+      in.read(&buf[0], buf.size());
+      if (size_t(in.gcount()) != buf.size()) throw std::invalid_argument("Error reading SAM file.");
+
+      size_t skip = 0;
+      if (from < begin) {
+          const size_t nl = buf.find('\n');
+          skip = nl == std::string::npos ? buf.size() : nl + 1;
+      }
+      if (skip == buf.size()) {
+          buf.clear(); // No line starts in the range
+          return;
+      }
+
+      // Complete the last line
+      uint64_t pos = end;
+      char chunk[1 << 16];
+      while (buf.back() != '\n' && pos < data_end) {
+          const size_t n = std::min<uint64_t>(sizeof(chunk), data_end - pos);
+          in.read(chunk, n);
+          if (size_t(in.gcount()) != n) throw std::invalid_argument("Error reading SAM file.");
+          const char *nl = std::find(chunk, chunk + n, '\n');
+          buf.append(chunk, (nl == chunk + n ? nl : nl + 1) - chunk);
+          pos += n;
+          if (nl != chunk + n) break;
+      }
+      buf.erase(0, skip);
+  }
+
+  void convert_helper_func(void *data, long index, int tid) {
+      convert_helper &help = *(convert_helper *) data;
+      std::string rows;
+      std::vector<char> missing(help.proj.size(), 0);
+      size_t n = 0;
+      std::exception_ptr err;
+      try {
+          if (help.blocks) {
+              const std::string &b = (*help.blocks)[index];
+              n = help.proj.rows(b.data(), b.data() + b.size(), rows, missing);
+          } else {
+              auto &in = help.streams[tid];
+              if (!in) {
+                  in.reset(new std::ifstream(help.file, std::ios::binary));
+                  if (!in->good()) throw std::invalid_argument("Error opening file \"" + help.file + "\"");
+              }
+              const uint64_t begin = help.data_begin + uint64_t(index) * help.block;
+              const uint64_t end = std::min<uint64_t>(begin + help.block, help.data_end);
+              std::string buf;
+              read_range(*in, help.data_begin, help.data_end, begin, end, buf);
+              n = help.proj.rows(buf.data(), buf.data() + buf.size(), rows, missing);
+          }
+      } catch (...) {
+          err = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(help.m);
+      if (err && !help.err) help.err = err;
+      help.done[index] = std::move(rows);
+      help.missing[index] = std::move(missing);
+      help.ready[index] = 1;
+      help.rows += n;
+      for (; help.next_write < help.ready.size() && help.ready[help.next_write]; ++help.next_write) {
+          if (help.err) continue;
+          const auto &miss = help.missing[help.next_write];
+          for (size_t c = 0; c < miss.size(); ++c) {
+              if (miss[c] && !help.warned[c]) {
+                  std::cerr << "WARN: Tag \"" << help.columns[c] << "\" not present." << std::endl;
+                  help.warned[c] = 1;
+              }
+          }
+          auto &chunk = help.done[help.next_write];
+          help.out.write(chunk.data(), chunk.size());
+          std::string().swap(chunk);
+      }
+  }
+
+  /**
+   * @brief
+   * Convert blocks of one input in parallel, writing rows in block order.
+   * @param blocks Number of blocks
+   * @return Rows converted
+   */
+  size_t convert_blocks(const vargas::SAMProjection &proj, const std::string &file, uint64_t data_begin,
+                        uint64_t data_end, size_t block, const std::vector<std::string> *in_memory, size_t blocks,
+                        unsigned threads, std::ostream &out, std::vector<char> &warned,
+                        const std::vector<std::string> &columns) {
+      if (blocks == 0) return 0;
+      std::vector<std::unique_ptr<std::ifstream>> streams(threads);
+      std::mutex m;
+      std::vector<std::string> done(blocks);
+      std::vector<std::vector<char>> missing(blocks);
+      std::vector<char> ready(blocks, 0);
+      size_t next_write = 0, rows = 0;
+      std::exception_ptr err;
+      convert_helper help{proj, file, data_begin, data_end, block, in_memory, streams, m, done, missing, ready,
+                          next_write, err, out, warned, rows, columns};
+      {
+          rg::ForPool fp(threads);
+          fp.forpool(&convert_helper_func, (void *) &help, blocks);
+      }
+      if (err) std::rethrow_exception(err);
+      return rows;
+  }
+
+  /**
+   * @brief
+   * Read the header lines at the start of a stream.
+   * @param in stream positioned at the start
+   * @param hdr parsed header
+   * @param first First record line, if any. Empty if the stream has only a header.
+   * @return Bytes of header
+   */
+  uint64_t read_header(std::istream &in, vargas::SAM::Header &hdr, std::string &first) {
+      std::ostringstream text;
+      uint64_t len = 0;
+      first.clear();
+      std::string line;
+      while (std::getline(in, line)) {
+          if (line.empty() || line[0] != '@') {
+              first = line;
+              break;
+          }
+          text << line << '\n';
+          len += line.size() + 1;
+      }
+      if (text.tellp() > 0) hdr << text.str();
+      return len;
+  }
+
+}
+
+vargas::SAMProjection::SAMProjection(const SAM::Header &hdr, const std::vector<std::string> &columns,
+                                     std::string prefix) : _prefix(std::move(prefix)) {
+    static const std::vector<std::pair<const std::string *, Kind>> required = {
+    {&SAM::Record::REQUIRED_QNAME, Kind::QNAME}, {&SAM::Record::REQUIRED_FLAG, Kind::FLAG},
+    {&SAM::Record::REQUIRED_RNAME, Kind::RNAME}, {&SAM::Record::REQUIRED_POS, Kind::POS},
+    {&SAM::Record::REQUIRED_MAPQ, Kind::MAPQ}, {&SAM::Record::REQUIRED_CIGAR, Kind::CIGAR},
+    {&SAM::Record::REQUIRED_RNEXT, Kind::RNEXT}, {&SAM::Record::REQUIRED_PNEXT, Kind::PNEXT},
+    {&SAM::Record::REQUIRED_TLEN, Kind::TLEN}, {&SAM::Record::REQUIRED_SEQ, Kind::SEQ},
+    {&SAM::Record::REQUIRED_QUAL, Kind::QUAL}};
+
+    std::vector<std::string> rg_tags;
+    for (const auto &c : columns) {
+        Column col{Kind::AUX, 0, 0};
+        if (c.length() > 3 && c.substr(0, 3) == "RG:") {
+            col.kind = Kind::READ_GROUP;
+            col.rg = rg_tags.size();
+            rg_tags.push_back(c.substr(3));
+        } else {
+            const auto it = std::find_if(required.begin(), required.end(),
+                                         [&](const std::pair<const std::string *, Kind> &r) { return *r.first == c; });
+            if (it != required.end()) col.kind = it->second;
+            else col.code = SAM::Optional::tag_code(c); // 0 never matches
+        }
+        _cols.push_back(col);
+    }
+
+    // Read group values only depend on the RG of the record
+    _num_rg = rg_tags.size();
+    if (_num_rg) {
+        for (const auto &rg : hdr.read_groups) {
+            auto &vals = _read_groups[rg.first];
+            for (const auto &t : rg_tags) {
+                RGValue v;
+                v.found = rg.second.aux.get(t, v.val);
+                vals.push_back(std::move(v));
+            }
+        }
+    }
+
+    for (const auto &col : _cols) {
+        if (col.kind == Kind::AUX && col.code && std::find(_aux.begin(), _aux.end(), col.code) == _aux.end()) {
+            _aux.push_back(col.code);
+        }
+    }
+    _rg_code = SAM::Optional::tag_code(std::string("RG"));
+    if (_num_rg && std::find(_aux.begin(), _aux.end(), _rg_code) == _aux.end()) _aux.push_back(_rg_code);
+}
+
+
+void vargas::SAMProjection::row(rg::str_view line, std::string &out, std::vector<char> &missing) const {
+    if (std::count(line.begin(), line.end(), '\t') < 10)
+        throw std::invalid_argument("Record should have at least 11 columns");
+
+    rg::str_view req[11];
+    const char *p = line.begin();
+    for (auto &r : req) r = next_col(p, line.end());
+
+    // Last occurrence of each wanted tag, as when the tags are parsed into a record
+    struct Found {
+        char fmt;
+        rg::str_view val;
+    };
+    Found found[16];
+    std::vector<Found> more;
+    if (_aux.size() > 16) more.resize(_aux.size() - 16);
+    auto slot = [&](size_t i) -> Found & { return i < 16 ? found[i] : more[i - 16]; };
+    for (size_t i = 0; i < _aux.size(); ++i) slot(i).fmt = 0;
+
+    while (p != line.end()) {
+        const rg::str_view a = next_col(p, line.end());
+        if (a.empty()) continue;
+        uint16_t code;
+        char fmt;
+        const rg::str_view val = split_aux(a, code, fmt);
+        for (size_t i = 0; i < _aux.size(); ++i) {
+            if (_aux[i] == code) {
+                slot(i) = Found{fmt, val};
+                break;
+            }
+        }
+    }
+    auto lookup = [&](uint16_t code) -> const Found * {
+        for (size_t i = 0; i < _aux.size(); ++i) {
+            if (_aux[i] == code) return slot(i).fmt ? &slot(i) : nullptr;
+        }
+        return nullptr;
+    };
+
+    const std::vector<RGValue> *rg_vals = nullptr;
+    if (_num_rg) {
+        if (const Found *f = lookup(_rg_code)) {
+            std::string id;
+            append_aux(id, f->fmt, f->val);
+            const auto it = _read_groups.find(id);
+            if (it != _read_groups.end()) rg_vals = &it->second;
+        }
+    }
+
+    out += _prefix;
+    Cigar cigar;
+    for (size_t c = 0; c < _cols.size(); ++c) {
+        const Column &col = _cols[c];
+        out += '"';
+        try {
+            switch (col.kind) {
+                case Kind::QNAME:
+                case Kind::RNAME:
+                case Kind::CIGAR:
+                case Kind::RNEXT:
+                case Kind::SEQ:
+                case Kind::QUAL: {
+                    const rg::str_view v = req[unsigned(col.kind)];
+                    if (col.kind == Kind::CIGAR) {
+                        cigar.parse(v);
+                        out += cigar.to_string();
+                    } else out.append(v.begin(), v.end());
+                    break;
+                }
+                case Kind::FLAG:
+                    append_int(out, rg::parse_int(req[unsigned(col.kind)]) & 0xFFF);
+                    break;
+                case Kind::POS:
+                case Kind::MAPQ:
+                case Kind::PNEXT:
+                case Kind::TLEN:
+                    append_int(out, rg::parse_int(req[unsigned(col.kind)]));
+                    break;
+                case Kind::AUX:
+                    if (const Found *f = lookup(col.code)) append_aux(out, f->fmt, f->val);
+                    else {
+                        out += '*';
+                        missing[c] = 1;
+                    }
+                    break;
+                case Kind::READ_GROUP:
+                    if (rg_vals && (*rg_vals)[col.rg].found) out += (*rg_vals)[col.rg].val;
+                    else {
+                        out += '*';
+                        missing[c] = 1;
+                    }
+                    break;
+            }
+        } catch (std::exception &e) {
+            throw std::invalid_argument("Error parsing SAM record:\n" + line.str());
+        }
+        out += c + 1 == _cols.size() ? "\"\n" : "\",";
+    }
+    if (_cols.empty()) out += '\n';
+}
+
+
+size_t vargas::SAMProjection::rows(const char *begin, const char *end, std::string &out,
+                                   std::vector<char> &missing) const {
+    size_t n = 0;
+    while (begin < end) {
+        const char *e = std::find(begin, end, '\n');
+        if (e != begin && *begin != '@') {
+            row(rg::str_view(begin, e), out, missing);
+            ++n;
+        }
+        begin = e == end ? e : e + 1;
+    }
+    return n;
+}
+
+
+size_t vargas::convert_sam(const std::vector<std::string> &files, const std::vector<std::string> &columns,
+                           unsigned threads, std::ostream &out, size_t block) {
+    if (threads < 1) threads = 1;
+    if (block < 1) block = CONVERT_BLOCK_SIZE;
+    std::vector<char> warned(columns.size(), 0);
+    size_t rows = 0;
+
+    for (const auto &f : files) {
+        const std::string prefix = files.size() > 1 ? f + "," : "";
+
+        if (rg::ends_with(f, ".bam")) {
+            // Binary records, decoded by htslib one at a time
+            vargas::isam input(f);
+            SAMProjection proj(input.header(), columns, prefix);
+            std::string line, buff;
+            std::vector<char> missing(columns.size(), 0);
+            if (!input.good()) continue;
+            do {
+                line.clear();
+                input.record() >> line;
+                proj.row(line, buff, missing);
+                ++rows;
+                if (buff.size() >= block) {
+                    out.write(buff.data(), buff.size());
+                    buff.clear();
+                }
+            } while (input.next());
+            for (size_t c = 0; c < missing.size(); ++c) {
+                if (missing[c] && !warned[c]) {
+                    std::cerr << "WARN: Tag \"" << columns[c] << "\" not present." << std::endl;
+                    warned[c] = 1;
+                }
+            }
+            out.write(buff.data(), buff.size());
+            continue;
+        }
+
+        SAM::Header hdr;
+        std::string first;
+        if (f.empty()) {
+            // Not seekable, convert a few blocks per thread at a time
+            read_header(std::cin, hdr, first);
+            SAMProjection proj(hdr, columns, prefix);
+            std::vector<std::string> blocks;
+            std::string carry = first.empty() ? "" : first + "\n";
+            bool more = !first.empty() || std::cin.good();
+            while (more) {
+                blocks.clear();
+                while (blocks.size() < size_t(threads) * 4 && more) {
+                    std::string b = std::move(carry);
+                    carry.clear();
+                    const size_t have = b.size();
+                    b.resize(have + block);
+                    std::cin.read(&b[have], block);
+                    b.resize(have + std::cin.gcount());
+                    more = size_t(std::cin.gcount()) == block;
+                    const size_t nl = b.rfind('\n');
+                    if (more && nl == std::string::npos) {
+                        // Record longer than a block, keep reading until it ends
+                        carry = std::move(b);
+                        continue;
+                    }
+                    if (more) {
+                        carry.assign(b, nl + 1, std::string::npos);
+                        b.resize(nl + 1);
+                    }
+                    if (!b.empty()) blocks.push_back(std::move(b));
+                }
+                rows += convert_blocks(proj, f, 0, 0, block, &blocks, blocks.size(), threads, out, warned, columns);
+            }
+            continue;
+        }
+
+        uint64_t data_begin, data_end;
+        {
+            std::ifstream in(f, std::ios::binary);
+            if (!in.good()) throw std::invalid_argument("Error opening file \"" + f + "\"");
+            data_begin = read_header(in, hdr, first);
+            in.clear();
+            in.seekg(0, std::ios::end);
+            data_end = in.tellg();
+        }
+        SAMProjection proj(hdr, columns, prefix);
+        const size_t blocks = (data_end - data_begin + block - 1) / block;
+        rows += convert_blocks(proj, f, data_begin, data_end, block, nullptr, blocks, threads, out, warned, columns);
+    }
+    out.flush();
+    return rows;
+}
+
+TEST_SUITE("SAM Parser");
+
+TEST_CASE ("SAM to CSV") {
+    const std::string hdr_text = "@HD\tVN:1.0\n@RG\tID:g1\tpo:7\n@RG\tID:g2\n";
+    const std::vector<std::string> lines = {
+    "r1\t16\tx\t5\t60\t4M\t*\t0\t0\tACGT\tIIII\tRG:Z:g1\tms:i:+08\tmc:i:2\txf:f:1.50",
+    "r2\t4\tx\t9\t255\t2M1I1M\t=\t3\t-7\tACGT\t*\tRG:Z:g2\tms:i:-3\tms:i:4",
+    "r3\t0\ty\t1\t0\t*\t*\t0\t0\tAC\t*\tna:bare",
+    };
+    vargas::SAM::Header hdr;
+    hdr << hdr_text;
+    const std::vector<std::string> cols = {"QNAME", "FLAG", "POS", "CIGAR", "TLEN", "ms", "xf", "RG:po", "na", "RG"};
+
+    std::string text;
+    for (const auto &l : lines) text += l + "\n";
+
+    SUBCASE("Same as parsed records") {
+        vargas::SAMProjection proj(hdr, cols);
+        std::string rows;
+        std::vector<char> missing(cols.size(), 0);
+        CHECK(proj.rows(text.data(), text.data() + text.size(), rows, missing) == 3);
+
+        std::string expected;
+        for (const auto &l : lines) {
+            vargas::SAM::Record rec(l);
+            std::string row, val;
+            for (const auto &c : cols) {
+                val = "*";
+                rec.get(hdr, c, val);
+                row += "\"" + val + "\",";
+            }
+            row.back() = '\n';
+            expected += row;
+        }
+        CHECK(rows == expected);
+        CHECK((missing == std::vector<char>{0, 0, 0, 0, 0, 1, 1, 1, 1, 1}));
+
+        CHECK_THROWS(proj.row(rg::str_view(std::string("r1\t0\tx")), rows, missing));
+        CHECK_THROWS(proj.row(rg::str_view(lines[0] + "\tbad"), rows, missing));
+    }
+
+    SUBCASE("Threads and blocks") {
+        const std::string file = "convert_test.sam";
+        std::string body;
+        for (unsigned i = 0; i < 500; ++i) body += lines[i % lines.size()] + "\n";
+        {
+            std::ofstream o(file);
+            o << hdr_text << body;
+        }
+
+        std::ostringstream one;
+        CHECK(vargas::convert_sam({file}, cols, 1, one, 1 << 20) == 500);
+        vargas::SAMProjection proj(hdr, cols);
+        std::string expected;
+        std::vector<char> missing(cols.size(), 0);
+        proj.rows(body.data(), body.data() + body.size(), expected, missing);
+        CHECK(one.str() == expected);
+
+        // Ranges smaller than a line
+        for (const size_t block : {7, 64, 1000}) {
+            std::ostringstream many;
+            CHECK(vargas::convert_sam({file}, cols, 4, many, block) == 500);
+            CHECK(many.str() == expected);
+        }
+
+        // stdin with blocks smaller than a line
+        {
+            std::istringstream in(hdr_text + body);
+            std::streambuf *cin_buf = std::cin.rdbuf(in.rdbuf());
+            std::ostringstream piped;
+            const size_t n = vargas::convert_sam({""}, cols, 2, piped, 7);
+            std::cin.rdbuf(cin_buf);
+            std::cin.clear();
+            CHECK(n == 500);
+            CHECK(piped.str() == expected);
+        }
+
+        std::ostringstream two;
+        vargas::convert_sam({file, file}, {"QNAME"}, 3, two, 100);
+        const std::string both = two.str();
+        CHECK(both.substr(0, file.size() + 5) == file + ",\"r1\"");
+        CHECK(std::count(both.begin(), both.end(), '\n') == 1000);
+        remove(file.c_str());
+    }
+}
+
+TEST_SUITE_END();
@@ -16,6 +16,11 @@
 
 #include "fasta.h"
 #include "doctest.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 
 void vargas::ofasta::open(const std::string& file_name) {
     close();
@@ -82,6 +87,73 @@ std::string vargas::ifasta::seq_name(const size_t i) const {
     return std::string(faidx_iseq(_index, i));
 }
 
+void vargas::ifastx::open(const std::string &file_name, int threads) {
+    close();
+    _fp = file_name.empty() ? bgzf_dopen(STDIN_FILENO, "r") : bgzf_open(file_name.c_str(), "r");
+    if (_fp == nullptr) throw std::invalid_argument("Error opening file \"" + file_name + "\"");
+    if (threads > 1) bgzf_mt(_fp, threads, 256);
+}
+
+void vargas::ifastx::close() {
+    if (_fp) bgzf_close(_fp);
+    _fp = nullptr;
+    _pending = false;
+    std::free(_line.s);
+    _line = {0, 0, nullptr};
+}
+
+bool vargas::ifastx::_getline() {
+    if (bgzf_getline(_fp, '\n', &_line) < 0) return false;
+    if (_line.l && _line.s[_line.l - 1] == '\r') _line.s[--_line.l] = '\0';
+    return true;
+}
+
+bool vargas::ifastx::next() {
+    if (_fp == nullptr) return false;
+    if (!_pending) {
+        do {
+            if (!_getline()) return false;
+        } while (_line.l == 0);
+    }
+    _pending = false;
+
+    const char type = _line.s[0];
+    if (type != '>' && type != '@') {
+        throw std::invalid_argument("Expected a FASTA or FASTQ record, got: " + std::string(_line.s, _line.l));
+    }
+    char *name_end = std::find_if(_line.s + 1, _line.s + _line.l, [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+    _name.assign(_line.s + 1, name_end);
+    _seq.clear();
+    _qual.clear();
+
+    if (type == '>') {
+        while (_getline()) {
+            if (_line.l && _line.s[0] == '>') {
+                _pending = true;
+                break;
+            }
+            _seq.append(_line.s, _line.l);
+        }
+        return true;
+    }
+
+    // FASTQ, sequence and quality may span lines
+    bool has_sep = false;
+    while (_getline()) {
+        if (_line.l && _line.s[0] == '+') {
+            has_sep = true;
+            break;
+        }
+        _seq.append(_line.s, _line.l);
+    }
+    if (!has_sep) throw std::invalid_argument("Truncated FASTQ record: " + _name);
+    while (_qual.size() < _seq.size() && _getline()) {
+        _qual.append(_line.s, _line.l);
+    }
+    if (_qual.size() != _seq.size()) throw std::invalid_argument("Quality length mismatch in FASTQ record: " + _name);
+    return true;
+}
+
 TEST_SUITE("FASTA Parser");
 
 TEST_CASE ("FASTA Reading") {
@@ -169,6 +241,51 @@ TEST_CASE ("FASTA Reading") {
     remove(tmpfa.c_str());
     remove((tmpfa + ".fai").c_str());
 }
+
+TEST_CASE ("FASTX Streaming") {
+    const std::string tmp = "tmp_tc_stream.fx";
+    SUBCASE("FASTA") {
+        {
+            std::ofstream o(tmp);
+            o << ">x desc\nACGT\nAC\r\n\n>y\nGG\n";
+        }
+        vargas::ifastx in(tmp);
+        REQUIRE(in.next());
+        CHECK(in.name() == "x");
+        CHECK(in.seq() == "ACGTAC");
+        CHECK(in.qual().empty());
+        REQUIRE(in.next());
+        CHECK(in.name() == "y");
+        CHECK(in.seq() == "GG");
+        CHECK_FALSE(in.next());
+    }
+    SUBCASE("FASTQ") {
+        {
+            std::ofstream o(tmp);
+            o << "@a\nACGT\n+\n@@!!\n@b x\nAC\nG\n+b x\n#\n##\n";
+        }
+        vargas::ifastx in(tmp);
+        REQUIRE(in.next());
+        CHECK(in.name() == "a");
+        CHECK(in.seq() == "ACGT");
+        CHECK(in.qual() == "@@!!");
+        REQUIRE(in.next());
+        CHECK(in.name() == "b");
+        CHECK(in.seq() == "ACG");
+        CHECK(in.qual() == "###");
+        CHECK_FALSE(in.next());
+    }
+    SUBCASE("Truncated") {
+        {
+            std::ofstream o(tmp);
+            o << "@a\nACGT\n+\n@@\n";
+        }
+        vargas::ifastx in(tmp);
+        CHECK_THROWS(in.next());
+    }
+    remove(tmp.c_str());
+}
+
 TEST_CASE ("FASTA Writing") {
     SUBCASE("open constructor") {
         {
@@ -12,6 +12,7 @@
  * @file
  */
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -37,17 +38,12 @@ vargas::Graph::Graph(const vargas::Graph &g, const Population &filter) {
     _pop_size = g.pop_size();
     _filter = filter;
 
-    // Add all nodes
-    std::unordered_set<unsigned> includedNodes;
-    for (auto &nid : g._add_order) {
-        auto &n = (*_IDMap)[nid];
-        if (n.belongs(filter)) {
-            includedNodes.insert(nid);
-            _add_order.push_back(nid);
-        }
+    const auto topo = g.topology();
+    mask_t mask(g.mask());
+    for (size_t i = g._next_pos(0); i < g._positions(); i = g._next_pos(i + 1)) {
+        if (!_IDMap->at(topo->order[i]).belongs(filter)) mask[i >> 6] &= ~(uint64_t(1) << (i & 63));
     }
-
-    _build_derived_edges(g, includedNodes);
+    _set_mask(topo, std::move(mask));
 }
 
 
@@ -56,58 +52,172 @@ vargas::Graph::Graph(const Graph &g, Type type) {
     _pop_size = g.pop_size();
     _filter = Population(_pop_size, true);
 
-    std::unordered_set<unsigned> includedNodes;
+    const auto topo = g.topology();
+    const mask_t in_g = g.mask();
+    mask_t mask(in_g.size(), 0);
+    auto has = [&in_g](unsigned i) { return (in_g[i >> 6] >> (i & 63)) & 1; };
+    auto set = [&mask](unsigned i) { mask[i >> 6] |= uint64_t(1) << (i & 63); };
 
     if (type == Type::REF) {
-        for (auto &nid : g._add_order) {
-            auto &n = (*_IDMap)[nid];
-            if (n.is_ref()) {
-                includedNodes.insert(nid);
-                _add_order.push_back(nid);
-            }
+        for (size_t i = g._next_pos(0); i < g._positions(); i = g._next_pos(i + 1)) {
+            if (_IDMap->at(topo->order[i]).is_ref()) set(i);
         }
     } else if (type == Type::MAXAF) {
+        for (size_t i = g._next_pos(0); i < g._positions(); i = g._next_pos(i + 1)) {
+            // Start at nodes without incoming edges in g
+            bool start = true;
+            for (unsigned e = topo->in_offsets[i]; start && e < topo->in_offsets[i + 1]; ++e) {
+                start = !has(topo->in[e]);
+            }
+            if (!start) continue;
 
-        std::vector<unsigned> graphstarts;
-        for (auto id : g._add_order) {
-            if (g._prev_map.count(id) == 0) graphstarts.push_back(id);
-        }
-
-        for (auto start : graphstarts) {
-            unsigned curr = start;
-            unsigned maxid, size;
+            unsigned curr = i;
             while (true) {
-                includedNodes.insert(curr);
-                _add_order.push_back(curr);
-                if (g._next_map.count(curr) == 0) break; // end of graph
-                maxid = g._next_map.at(curr).at(0);
-                size = g._next_map.at(curr).size();
-                for (unsigned i = 1; i < size; ++i) {
-                    const unsigned &id = g._next_map.at(curr).at(i);
-                    if (g._IDMap->at(id).freq() > g._IDMap->at(maxid).freq())
-                        maxid = id;
+                set(curr);
+                bool found = false;
+                unsigned maxidx = 0;
+                for (unsigned e = topo->out_offsets[curr]; e < topo->out_offsets[curr + 1]; ++e) {
+                    const unsigned next = topo->out[e];
+                    if (!has(next)) continue;
+                    if (!found || _IDMap->at(topo->order[next]).freq() > _IDMap->at(topo->order[maxidx]).freq()) {
+                        maxidx = next;
+                        found = true;
+                    }
                 }
-                curr = maxid;
+                if (!found) break; // end of graph
+                curr = maxidx;
             }
         }
     }
 
-    _build_derived_edges(g, includedNodes);
+    _set_mask(topo, std::move(mask));
+}
+
+
+vargas::Graph::Graph(std::shared_ptr<nodemap_t> nodes, std::shared_ptr<const Topology> base, mask_t mask) :
+_IDMap(std::move(nodes)) {
+    if (mask.size() != (base->order.size() + 63) / 64) {
+        throw std::invalid_argument("Mask does not match the base graph.");
+    }
+    _set_mask(std::move(base), std::move(mask));
+}
+
 
+void vargas::Graph::_set_mask(std::shared_ptr<const Topology> base, mask_t mask) {
+    _masked = true;
+    _topo = std::move(base);
+    _mask = std::move(mask);
+    _maps = std::make_shared<_Maps>();
+    _add_order.clear();
+    _next_map.clear();
+    _prev_map.clear();
 }
 
 
-void vargas::Graph::_build_derived_edges(const vargas::Graph &g, const std::unordered_set<unsigned> &includedNodes) {
-    // Add all edges for included nodes
-    for (auto &n : includedNodes) {
-        if (g._next_map.count(n) == 0) continue;
-        for (auto &e : g._next_map.at(n)) {
-            if (includedNodes.count(e)) {
-                add_edge(n, e);
+std::shared_ptr<const vargas::Graph::Topology> vargas::Graph::topology() const {
+    if (_topo) return _topo;
+    auto topo = std::make_shared<Topology>();
+    topo->order = _add_order;
+    std::unordered_map<unsigned, unsigned> index;
+    for (unsigned i = 0; i < _add_order.size(); ++i) index[_add_order[i]] = i;
+
+    auto build = [&](const edgemap_t &edges, std::vector<unsigned> &offsets, std::vector<unsigned> &csr) {
+        offsets.assign(1, 0);
+        offsets.reserve(_add_order.size() + 1);
+        for (const unsigned id : _add_order) {
+            const auto it = edges.find(id);
+            if (it != edges.end()) {
+                for (const unsigned e : it->second) {
+                    const auto idx = index.find(e);
+                    if (idx != index.end()) csr.push_back(idx->second);
+                }
             }
+            offsets.push_back(csr.size());
         }
-    }
+        csr.shrink_to_fit();
+    };
+    build(_prev_map, topo->in_offsets, topo->in);
+    build(_next_map, topo->out_offsets, topo->out);
+    _topo = topo;
+    return _topo;
+}
+
+
+const std::vector<vargas::Graph::Topology::Pinch> &vargas::Graph::_pinches() const {
+    const auto topo = topology();
+    std::call_once(topo->pinch_once, [&]() {
+        // A pinch that begins after every earlier node ends bounds the positions on either side of it
+        pos_t reach = 0;
+        for (unsigned i = 0; i < topo->order.size(); ++i) {
+            const Node &n = _IDMap->at(topo->order[i]);
+            if (n.is_pinched() && (i == 0 || n.begin_pos() > reach)) {
+                topo->pinches.push_back({n.begin_pos(), n.end_pos(), i});
+            }
+            if (i == 0 || n.end_pos() > reach) reach = n.end_pos();
+        }
+        topo->pinches.shrink_to_fit();
+    });
+    return topo->pinches;
+}
+
+
+size_t vargas::Graph::_seek_pos(const pos_t pos) const {
+    const auto &pinches = _pinches();
+    // Every node before the last pinch ending before pos also ends before pos
+    const auto p = std::lower_bound(pinches.begin(), pinches.end(), pos,
+                                    [](const Topology::Pinch &a, pos_t b) { return a.end < b; });
+    return p == pinches.begin() ? 0 : std::prev(p)->index + 1;
+}
+
+
+std::pair<vargas::Graph::const_iterator, vargas::Graph::const_iterator>
+vargas::Graph::range(const pos_t min, const pos_t max) const {
+    const auto e = end();
+    if (min > max) return {e, e};
+    auto first = const_iterator(*this, _seek_pos(min));
+    while (first != e && first->end_pos() < min) ++first;
+    const auto &pinches = _pinches();
+    const auto p = std::upper_bound(pinches.begin(), pinches.end(), max,
+                                    [](pos_t a, const Topology::Pinch &b) { return a < b.begin; });
+    return {first, p == pinches.end() ? e : const_iterator(*this, p->index)};
+}
+
+
+vargas::Graph::mask_t vargas::Graph::mask() const {
+    if (_masked) return _mask;
+    const size_t n = topology()->order.size();
+    mask_t ret((n + 63) / 64, ~uint64_t(0));
+    if (n % 64) ret.back() = (uint64_t(1) << (n % 64)) - 1;
+    return ret;
+}
+
+
+const vargas::Graph::_Maps &vargas::Graph::_built_maps() const {
+    std::call_once(_maps->once, [this]() {
+        auto &m = *_maps;
+        for (auto gi = begin(); gi != end(); ++gi) {
+            m.order.push_back(gi->id());
+            const auto &in = gi.incoming();
+            if (!in.empty()) m.prev[gi->id()] = in;
+            const auto &out = gi.outgoing();
+            if (!out.empty()) m.next[gi->id()] = out;
+        }
+    });
+    return *_maps;
+}
+
 
+void vargas::Graph::_detach() {
+    if (_masked) {
+        const auto &m = _built_maps();
+        _add_order = m.order;
+        _next_map = m.next;
+        _prev_map = m.prev;
+        _masked = false;
+        _mask.clear();
+        _maps.reset();
+    }
+    _topo.reset();
 }
 
 
@@ -116,6 +226,7 @@ unsigned vargas::Graph::add_node(const Node &n) {
         throw std::invalid_argument("Duplicate node insertion.");
     }
 
+    _detach();
     _IDMap->emplace(n.id(), n);
     _add_order.push_back(n.id());
     return n.id();
@@ -125,6 +236,7 @@ unsigned vargas::Graph::add_node(const Node &n) {
 bool vargas::Graph::add_edge(const unsigned n1, const unsigned n2) {
     // Check if the nodes exist
     if (_IDMap->count(n1) == 0 || _IDMap->count(n2) == 0) return false;
+    _detach();
 
     // init if first edge to be added
     if (_next_map.count(n1) == 0) {
@@ -139,6 +251,7 @@ bool vargas::Graph::add_edge(const unsigned n1, const unsigned n2) {
 }
 
 void vargas::Graph::add_edge_unchecked(const unsigned n1, const unsigned n2) {
+    _detach();
     if (_next_map.count(n1) == 0) {
         _next_map[n1] = std::vector<unsigned>();
     }
@@ -149,6 +262,54 @@ void vargas::Graph::add_edge_unchecked(const unsigned n1, const unsigned n2) {
     _prev_map[n2].push_back(n1);
 }
 
+vargas::SubgraphSet::SubgraphSet(std::shared_ptr<const Graph> parent,
+                                 const std::vector<std::shared_ptr<const Graph>> &subgraphs) :
+_parent(parent), _masks(parent->order().size(), 0), _size(subgraphs.size()) {
+    if (subgraphs.empty() || subgraphs.size() > max_size) {
+        throw std::invalid_argument("Expected 1 to " + std::to_string(max_size) + " subgraphs.");
+    }
+
+    std::unordered_map<unsigned, size_t> index;
+    const auto &order = parent->order();
+    for (size_t i = 0; i < order.size(); ++i) index[order[i]] = i;
+
+    for (size_t s = 0; s < subgraphs.size(); ++s) {
+        const mask_t bit = mask_t(1) << s;
+
+        // Derived from the parent: the node mask is over the parent's order, edges are induced
+        if (!parent->is_derived() && subgraphs[s]->is_derived() && subgraphs[s]->topology() == parent->topology()) {
+            const auto sub = subgraphs[s]->mask();
+            for (size_t i = 0; i < _masks.size(); ++i) {
+                if ((sub[i >> 6] >> (i & 63)) & 1) _masks[i] |= bit;
+            }
+            continue;
+        }
+
+        for (const unsigned id : subgraphs[s]->order()) {
+            const auto it = index.find(id);
+            if (it == index.end()) throw std::invalid_argument("Node " + std::to_string(id) + " is not in the parent graph.");
+            _masks[it->second] |= bit;
+        }
+
+        // Incoming edges are the parent's from nodes in the subgraph
+        const auto &sub_prev = subgraphs[s]->prev_map();
+        const auto &parent_prev = parent->prev_map();
+        for (const unsigned id : subgraphs[s]->order()) {
+            const auto sp = sub_prev.find(id), pp = parent_prev.find(id);
+            size_t expected = 0;
+            if (pp != parent_prev.end()) {
+                for (const unsigned p : pp->second) expected += (_masks[index.at(p)] & bit) != 0;
+            }
+            const size_t have = sp == sub_prev.end() ? 0 : sp->second.size();
+            bool subset = have == expected;
+            for (size_t e = 0; subset && e < have; ++e) {
+                subset = std::find(pp->second.begin(), pp->second.end(), sp->second[e]) != pp->second.end();
+            }
+            if (!subset) throw std::invalid_argument("Edges into node " + std::to_string(id) + " differ from the parent graph.");
+        }
+    }
+}
+
 
 std::string vargas::Graph::to_DOT(std::string name) const {
     std::ostringstream dot;
@@ -315,28 +476,147 @@ vargas::Graph::Population vargas::Graph::subset(int ingroup) const {
     return p;
 }
 
+std::unordered_map<unsigned, std::vector<unsigned>> vargas::Graph::insert_sites(std::vector<std::vector<Node>> sites) {
+    if (_masked) throw std::invalid_argument("Cannot insert variants into a derived graph.");
+    for (const auto &site : sites) {
+        if (site.empty() || !site[0].is_ref() || site[0].length() == 0) {
+            throw std::invalid_argument("Variant site needs a reference allele.");
+        }
+        for (const Node &n : site) {
+            if (n.end_pos() != site[0].end_pos()) {
+                throw std::invalid_argument("Alleles of a variant site must end at the same position.");
+            }
+        }
+    }
+    std::sort(sites.begin(), sites.end(), [](const std::vector<Node> &a, const std::vector<Node> &b) {
+        return a[0].end_pos() < b[0].end_pos();
+    });
+
+    // Find the node of each site before changing anything
+    std::vector<std::pair<unsigned, std::vector<size_t>>> split; // Node ID, sites within it
+    for (size_t i = 0; i < sites.size(); ++i) {
+        const Node &ref = sites[i][0];
+        const std::string where = " at " + std::to_string(ref.begin_pos());
+        if (i && sites[i - 1][0].end_pos() >= ref.begin_pos()) throw std::invalid_argument("Overlapping variants" + where);
+        const auto hit = seek(ref.begin_pos() + 1);
+        if (hit.first == end() || !hit.first->is_pinched() || !hit.first->is_ref() || ref.end_pos() > hit.first->end_pos()) {
+            throw std::invalid_argument("Variant is not within a reference node" + where);
+        }
+        if (!std::equal(ref.seq().begin(), ref.seq().end(), hit.first->seq().begin() + hit.second)) {
+            throw std::invalid_argument("Reference allele does not match the graph" + where);
+        }
+        if (split.empty() || split.back().first != hit.first->id()) split.emplace_back(hit.first->id(), std::vector<size_t>());
+        split.back().second.push_back(i);
+    }
+
+    _detach();
+    unsigned next_id = 0;
+    for (const auto &p : *_IDMap) next_id = std::max(next_id, p.first + 1);
+
+    // Replace old with repl in an edge list, keeping its place
+    auto splice = [](std::vector<unsigned> &edges, unsigned old, const std::vector<unsigned> &repl) {
+        const auto it = std::find(edges.begin(), edges.end(), old);
+        if (it == edges.end()) return;
+        edges.insert(edges.erase(it), repl.begin(), repl.end());
+    };
+
+    std::unordered_map<unsigned, std::vector<unsigned>> ret;
+    for (const auto &sp : split) {
+        const Node old = _IDMap->at(sp.first);
+        std::vector<std::vector<unsigned>> levels; // Nodes are connected to all nodes of the next level
+        auto ref_piece = [&](pos_t begin, pos_t end) {
+            Node n = old;
+            n.set_id(next_id++);
+            n.set_seq(std::vector<rg::Base>(old.seq().begin() + (begin - old.begin_pos()),
+                                            old.seq().begin() + (end - old.begin_pos()) + 1));
+            n.set_endpos(end);
+            _IDMap->emplace(n.id(), n);
+            levels.push_back({n.id()});
+        };
+
+        pos_t curr = old.begin_pos();
+        for (const size_t i : sp.second) {
+            auto &site = sites[i];
+            if (site[0].begin_pos() > curr) ref_piece(curr, site[0].begin_pos() - 1);
+            levels.emplace_back();
+            for (Node &n : site) {
+                n.set_id(next_id++);
+                n.set_pinch(false);
+                levels.back().push_back(n.id());
+                _IDMap->emplace(n.id(), std::move(n));
+            }
+            curr = site[0].end_pos() + 1;
+        }
+        if (curr <= old.end_pos()) ref_piece(curr, old.end_pos());
+
+        for (size_t l = 1; l < levels.size(); ++l) {
+            for (const unsigned a : levels[l - 1]) {
+                for (const unsigned b : levels[l]) {
+                    _next_map[a].push_back(b);
+                    _prev_map[b].push_back(a);
+                }
+            }
+        }
+
+        // The first level takes the incoming edges of the old node, the last the outgoing
+        const auto in = _prev_map.find(old.id());
+        if (in != _prev_map.end()) {
+            const std::vector<unsigned> prev = std::move(in->second);
+            _prev_map.erase(in);
+            for (const unsigned p : prev) splice(_next_map[p], old.id(), levels.front());
+            for (const unsigned n : levels.front()) _prev_map[n] = prev;
+        }
+        const auto out = _next_map.find(old.id());
+        if (out != _next_map.end()) {
+            const std::vector<unsigned> next = std::move(out->second);
+            _next_map.erase(out);
+            for (const unsigned n : next) splice(_prev_map[n], old.id(), levels.back());
+            for (const unsigned n : levels.back()) _next_map[n] = next;
+        }
+
+        _IDMap->erase(old.id());
+        auto &ids = ret[old.id()];
+        for (const auto &l : levels) ids.insert(ids.end(), l.begin(), l.end());
+    }
+    // Nodes made later must not take an ID assigned here
+    Node::_newID = std::max(Node::_newID, next_id);
+
+    size_t added = 0;
+    for (const auto &r : ret) added += r.second.size() - 1;
+    std::vector<unsigned> order;
+    order.reserve(_add_order.size() + added);
+    for (const unsigned id : _add_order) {
+        const auto r = ret.find(id);
+        if (r == ret.end()) order.push_back(id);
+        else order.insert(order.end(), r->second.begin(), r->second.end());
+    }
+    _add_order.swap(order);
+    return ret;
+}
+
+
 vargas::Graph vargas::Graph::subgraph(const pos_t min, const pos_t max) const {
     Graph ret;
-    std::unordered_map<unsigned, unsigned> new_to_old, old_to_new;
+    std::unordered_map<unsigned, unsigned> old_to_new;
+    std::vector<std::pair<unsigned, unsigned>> edges; // Old ID's
     unsigned new_id;
-    for (const Node &n : *this) {
+    const auto r = range(min, max);
+    for (auto gi = r.first; gi != r.second; ++gi) {
+        const Node &n = *gi;
         if (n.end_pos() < min) continue;
-        if (n.is_pinched() && n.begin_pos() > max) break;
 
         // begin in range
         if (n.begin_pos() >= min) {
             if (n.end_pos() <= max) {
                 new_id = ret.add_node(n);
-                new_to_old[new_id] = n.id();
                 old_to_new[n.id()] = new_id;
             } else {
                 Node cpy = n;
                 std::vector<rg::Base> cropped = n.seq();
-                cropped.resize(n.end_pos() - max + 1);
+                cropped.resize(max - n.begin_pos() + 1);
                 cpy.set_seq(cropped);
                 cpy.set_endpos(max);
                 new_id = ret.add_node(cpy);
-                new_to_old[new_id] = n.id();
                 old_to_new[n.id()] = new_id;
             }
         }
@@ -348,20 +628,17 @@ vargas::Graph vargas::Graph::subgraph(const pos_t min, const pos_t max) const {
             std::vector<rg::Base> cropped(seq.begin() + min - n.begin_pos(), seq.end());
             cpy.set_seq(cropped);
             new_id = ret.add_node(cpy);
-            new_to_old[new_id] = n.id();
             old_to_new[n.id()] = new_id;
         }
+        else continue;
+
+        for (const unsigned next : gi.outgoing()) edges.emplace_back(n.id(), next);
     }
 
     // Build Edges
-    for (const auto &ids : new_to_old) {
-        const auto &nid = ids.first;
-        const auto &oid = ids.second;
-        if (_next_map.count(oid)) {
-            for (const auto &next : _next_map.at(oid)) {
-                if (old_to_new.count(next)) ret.add_edge(nid, old_to_new[next]);
-            }
-        }
+    for (const auto &e : edges) {
+        const auto to = old_to_new.find(e.second);
+        if (to != old_to_new.end()) ret.add_edge(old_to_new.at(e.first), to->second);
     }
 
     return ret;
@@ -748,6 +1025,118 @@ TEST_CASE ("Graph class") {
 
     }
 
+    SUBCASE("Position index") {
+        // AAA [CCC|GG] TTT [A|C] GGGGG, pinched between variants
+        vargas::Graph p;
+        auto add = [&p](const std::string &seq, rg::pos_t end, bool pinch, const std::vector<bool> &pop) {
+            vargas::Graph::Node n;
+            n.set_seq(seq);
+            n.set_endpos(end);
+            n.set_population(pop);
+            if (pinch) n.pinch();
+            return p.add_node(n);
+        };
+        const unsigned a = add("AAA", 2, true, {1, 1}), b = add("CCC", 5, false, {1, 0}), c = add("GG", 5, false, {0, 1}),
+        d = add("TTT", 8, true, {1, 1}), e = add("A", 9, false, {1, 0}), f = add("C", 9, false, {0, 1}),
+        h = add("GGGGG", 14, true, {1, 1});
+        p.add_edge(a, b); p.add_edge(a, c); p.add_edge(b, d); p.add_edge(c, d);
+        p.add_edge(d, e); p.add_edge(d, f); p.add_edge(e, h); p.add_edge(f, h);
+        p.build_index();
+        CHECK(p.topology()->pinches.size() == 3);
+
+        vargas::Graph::Population filter(2, false);
+        filter.set(1);
+        const vargas::Graph q(p, filter); // AAA GG TTT C GGGGG
+
+        // Same as a linear scan from the first node
+        for (const vargas::Graph *g : std::vector<const vargas::Graph *>{&p, &q}) {
+            for (rg::pos_t pos = 1; pos <= 15; ++pos) {
+                auto it = g->begin();
+                while (it != g->end() && it->end_pos() < pos - 1) ++it;
+                const auto s = g->seek(pos);
+                CHECK(s.first == it);
+                if (it != g->end()) CHECK(s.second == pos - 1 - it->begin_pos());
+            }
+        }
+        CHECK(p.seek(5).first->id() == b);
+        CHECK(q.seek(5).first->id() == c);
+        CHECK(p.seek(16).first == p.end());
+
+        const auto r = p.range(4, 9);
+        CHECK(r.first->id() == b);
+        CHECK(r.second->id() == h);
+        CHECK(std::distance(r.first, r.second) == 5);
+        CHECK(p.range(10, 14).second == p.end());
+
+        auto sub = q.subgraph(3, 9);
+        auto si = sub.begin();
+        CHECK(si->seq_str() == "GG");
+        CHECK(si.outgoing().size() == 1);
+        ++si;
+        CHECK(si->seq_str() == "TTT");
+        ++si;
+        CHECK(si->seq_str() == "C");
+        ++si;
+        CHECK(si == sub.end());
+    }
+
+    SUBCASE("Derived graph mask") {
+        vargas::Graph::Population filter(3, false);
+        filter.set(1);
+        vargas::Graph g2(g, filter); // AAA GGG TTT
+        vargas::Graph g3(g2, vargas::Graph::Type::REF); // AAA TTT
+        CHECK(!g.is_derived());
+        CHECK(g2.is_derived());
+        CHECK(g3.is_derived());
+        CHECK(g2.topology() == g.topology());
+        CHECK(g3.topology() == g.topology());
+        CHECK(g2.mask() == vargas::Graph::mask_t{0xD});
+        CHECK(g3.mask() == vargas::Graph::mask_t{0x9});
+
+        // Edges are filtered while iterating
+        auto it = g3.begin();
+        CHECK(it->seq_str() == "AAA");
+        CHECK(it.outgoing().empty());
+        ++it;
+        CHECK(it->seq_str() == "TTT");
+        CHECK(it.incoming().empty());
+        ++it;
+        CHECK(it == g3.end());
+        auto rit = g2.rbegin();
+        CHECK(rit->seq_str() == "TTT");
+        CHECK(rit.incoming() == std::vector<unsigned>{2});
+        ++rit;
+        CHECK(rit->seq_str() == "GGG");
+
+        // Maps are built on request, and modifying a derived graph detaches it from the base
+        CHECK((g2.order() == std::vector<unsigned>{0, 2, 3}));
+        CHECK(g2.prev_map().at(3) == std::vector<unsigned>{2});
+        CHECK(g3.statistics().num_edges == 0);
+        g3.add_edge(0, 3);
+        CHECK(!g3.is_derived());
+        CHECK((g3.order() == std::vector<unsigned>{0, 3}));
+        CHECK(g3.statistics().num_edges == 1);
+    }
+
+    SUBCASE("Subgraph set") {
+        auto parent = std::make_shared<vargas::Graph>(g);
+        auto ref = std::make_shared<vargas::Graph>(g, vargas::Graph::Type::REF);
+        auto maxaf = std::make_shared<vargas::Graph>(g, vargas::Graph::Type::MAXAF);
+        vargas::SubgraphSet set(parent, {ref, maxaf, parent});
+        CHECK(set.size() == 3);
+        CHECK(set.mask(0) == 7); // AAA
+        CHECK(set.mask(1) == 5); // CCC
+        CHECK(set.mask(2) == 6); // GGG
+        CHECK(set.mask(3) == 7); // TTT
+
+        // Nodes or edges the parent does not have
+        auto extra = std::make_shared<vargas::Graph>(*ref);
+        extra->add_edge(0, 3);
+        const std::vector<std::shared_ptr<const vargas::Graph>> all = {parent}, bad = {extra};
+        CHECK_THROWS(vargas::SubgraphSet(ref, all));
+        CHECK_THROWS(vargas::SubgraphSet(parent, bad));
+    }
+
 }
 TEST_CASE ("Graph Factory") {
     using std::endl;
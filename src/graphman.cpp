@@ -17,11 +17,120 @@
 #include <iomanip>
 #include <iterator>
 #include "graphman.h"
+#include "trace.h"
+
+namespace {
+  /**
+   * @brief
+   * Run length encode a node mask as comma separated lengths of alternating excluded and
+   * included runs, starting with excluded.
+   */
+  std::string encode_mask(const vargas::Graph::mask_t &mask, size_t bits) {
+      std::ostringstream ss;
+      bool val = false;
+      size_t run = 0;
+      for (size_t i = 0; i < bits; ++i) {
+          const bool b = (mask[i >> 6] >> (i & 63)) & 1;
+          if (b != val) {
+              ss << run << ',';
+              val = b;
+              run = 0;
+          }
+          ++run;
+      }
+      ss << run;
+      return ss.str();
+  }
+
+  vargas::Graph::mask_t decode_mask(const std::string &runs, size_t bits) {
+      vargas::Graph::mask_t mask((bits + 63) / 64, 0);
+      bool val = false;
+      size_t pos = 0;
+      for (const auto &r : rg::split(runs, ',')) {
+          const size_t len = std::stoul(r);
+          if (pos + len > bits) throw std::domain_error("Graph mask is longer than the base graph.");
+          if (val) {
+              for (size_t i = pos; i < pos + len; ++i) mask[i >> 6] |= uint64_t(1) << (i & 63);
+          }
+          pos += len;
+          val = !val;
+      }
+      if (pos != bits) throw std::domain_error("Graph mask is shorter than the base graph.");
+      return mask;
+  }
+
+  /**
+   * @brief
+   * Express g as a mask over base, if it is a subgraph induced by its nodes and in base order.
+   * @return Derived graph, nullptr if g is not such a subgraph
+   */
+  std::shared_ptr<vargas::Graph> as_mask(const vargas::Graph &base, const vargas::Graph &g) {
+      const auto topo = base.topology();
+      std::unordered_map<unsigned, unsigned> index;
+      for (unsigned i = 0; i < topo->order.size(); ++i) index[topo->order[i]] = i;
+
+      vargas::Graph::mask_t mask((topo->order.size() + 63) / 64, 0);
+      auto has = [&mask](unsigned i) { return (mask[i >> 6] >> (i & 63)) & 1; };
+      size_t next = 0; // Nodes must follow the base order
+      for (const unsigned id : g.order()) {
+          const auto it = index.find(id);
+          if (it == index.end() || it->second < next) return nullptr;
+          next = it->second + 1;
+          mask[it->second >> 6] |= uint64_t(1) << (it->second & 63);
+      }
+
+      const auto &prev = g.prev_map();
+      for (const unsigned id : g.order()) {
+          const unsigned i = index.at(id);
+          const auto p = prev.find(id);
+          std::vector<unsigned> have, induced;
+          if (p != prev.end()) have = p->second;
+          for (unsigned e = topo->in_offsets[i]; e < topo->in_offsets[i + 1]; ++e) {
+              if (has(topo->in[e])) induced.push_back(topo->order[topo->in[e]]);
+          }
+          std::sort(have.begin(), have.end());
+          std::sort(induced.begin(), induced.end());
+          if (have != induced) return nullptr;
+      }
+      return std::make_shared<vargas::Graph>(g.node_map(), topo, std::move(mask));
+  }
+
+  /**
+   * @brief
+   * Check if the graph already has a variant site with every allele of site, e.g. when
+   * a newer release of a VCF repeats earlier variants.
+   * @param site Allele nodes, reference first
+   */
+  bool has_site(const vargas::Graph &g, const std::vector<vargas::Graph::Node> &site) {
+      const auto end = site[0].end_pos();
+      const auto hit = g.seek(end + 1);
+      if (hit.first == g.end() || hit.first->is_pinched() || hit.first->end_pos() != end) return false;
+
+      // Alleles of the site share a predecessor
+      std::unordered_set<std::string> alleles = {hit.first->seq_str()};
+      const auto prev = g.prev_map().find(hit.first->id());
+      if (prev != g.prev_map().end()) {
+          for (const unsigned p : prev->second) {
+              const auto next = g.next_map().find(p);
+              if (next == g.next_map().end()) continue;
+              for (const unsigned n : next->second) {
+                  const auto &node = g.node_map()->at(n);
+                  if (node.end_pos() == end) alleles.insert(node.seq_str());
+              }
+          }
+      }
+      for (const auto &n : site) {
+          if (!alleles.count(n.seq_str())) return false;
+      }
+      return true;
+  }
+}
 
 
 std::shared_ptr<vargas::Graph>
 vargas::GraphMan::create_base(const std::string fasta, const std::string vcf, std::vector<vargas::Region> region,
                               std::string sample_filter, size_t limvar) {
+    VA_TRACE_SCOPE("create_base");
 
     if (_nodes == nullptr) _nodes = std::make_shared<Graph::nodemap_t>();
     else _nodes->clear();
@@ -44,6 +153,7 @@ vargas::GraphMan::create_base(const std::string fasta, const std::string vcf, st
 
     size_t nhaplo = 0;
     if (vcf.size()) {
+        VA_TRACE_SCOPE("read_vcf_header");
         _aux["vcf"] = vcf;
         vargas::VCF v(vcf);
         if (!v.good()) throw std::invalid_argument("Invalid VCF: " + vcf);
@@ -59,6 +169,7 @@ vargas::GraphMan::create_base(const std::string fasta, const std::string vcf, st
     unsigned offset = 0;
 
     for (auto reg : region) {
+        VA_TRACE_SCOPE("build_contig", offset);
         if (_print) std::cerr << "Building \"" << reg.seq_name << "\" (offset: " << offset << ")..." << std::endl;
         GraphFactory gf(fasta, vcf);
         gf.add_sample_filter(sample_filter);
@@ -71,18 +182,22 @@ vargas::GraphMan::create_base(const std::string fasta, const std::string vcf, st
         offset = g.rbegin()->end_pos() + 1;
         _graphs["base"]->assimilate(g);
     }
+    _resolver.index();
 
     _graphs["base"]->set_filter(Graph::Population(nhaplo, true));
     _graphs["base"]->set_popsize(nhaplo);
 
     if (nhaplo) {
+        VA_TRACE_SCOPE("derive_maxaf_ref");
         _graphs["maxaf"] = std::make_shared<Graph>(*_graphs["base"], Graph::Type::MAXAF);
         _graphs["ref"] = std::make_shared<Graph>(*_graphs["base"], Graph::Type::REF);
     }
+    _graphs["base"]->build_index();
     return _graphs["base"];
 }
 
 void vargas::GraphMan::write(const std::string &filename) {
+    VA_TRACE_SCOPE("graph_write");
     std::ios::sync_with_stdio(false);
     std::ofstream of(filename);
     if (!of.good()) throw std::invalid_argument("Error opening file: " + filename);
@@ -101,9 +216,15 @@ void vargas::GraphMan::write(const std::string &filename) {
 
     // graphs
     // Label    [node_id_list]  [edge-list a:b,c;d:b,c;]
+    // Label    mask            [run lengths over the base order]
     of << "\n@graphs\n";
     if (_print) std::cerr << "Flushing " << _graphs.size() << " graphs...\n";
+    const auto base = _graphs.count("base") ? _graphs.at("base") : nullptr;
     for (auto &g : _graphs) {
+        if (base && g.second->is_derived() && !base->is_derived() && g.second->topology() == base->topology()) {
+            of << g.first << "\tmask\t" << encode_mask(g.second->mask(), base->order().size()) << '\n';
+            continue;
+        }
         of << g.first << '\t' << rg::vec_to_str(g.second->order(), ",") << '\t';
         for (auto &p : g.second->next_map()) {
             of << p.first << ':' << rg::vec_to_str(p.second, ",") << ';';
@@ -124,6 +245,7 @@ void vargas::GraphMan::write(const std::string &filename) {
 }
 
 void vargas::GraphMan::open(const std::string &filename) {
+    VA_TRACE_SCOPE("graph_open");
     std::ifstream in(filename);
     if (!in.good()) throw std::invalid_argument("Error opening file: " + filename);
 
@@ -152,39 +274,63 @@ void vargas::GraphMan::open(const std::string &filename) {
         rg::split(line, '\t', tokens);
         if (tokens.size() != 2) throw std::domain_error("Invalid contig def: " + line);
         _resolver._contig_offsets[std::stoul(tokens[0])] = tokens[1];
-        _resolver._contig_hdr_order.push_back(tokens[1]);
     }
+    _resolver.index();
 
     assert(line == "@graphs");
     if (_print) std::cerr << "Loading graphs...\n";
     std::vector<std::string> unparsed;
-    while(std::getline(in, line) && line[0] != '@') {
-        if (!line.size()) continue;
-        rg::split(line, '\t', tokens);
-        if (tokens.size() < 2) throw std::domain_error("Invalid graph definition.");
-        _graphs[tokens[0]] = std::make_shared<Graph>(_nodes);
-        rg::split(tokens[1], ',', unparsed);
-        std::vector<unsigned> order;
-        order.reserve(unparsed.size());
-        std::transform(unparsed.begin(), unparsed.end(), std::back_inserter(order), [](const std::string &c){return std::stoul(c);});
-        _graphs[tokens[0]]->set_order(order);
-
-        if (tokens.size() > 2) {
-            unparsed = rg::split(tokens[2], ';');
-            std::vector<std::string> edge;
-            for (const auto &epair : unparsed) {
-                rg::split(epair, ':', edge);
-                assert(edge.size() == 2);
-                const unsigned from = std::stoul(edge[0]);
-                for (auto &to : rg::split(edge[1], ',')) {
-                    _graphs[tokens[0]]->add_edge_unchecked(from, std::stoul(to));
+    {
+        VA_TRACE_SCOPE("open_graphs");
+        std::vector<std::pair<std::string, std::string>> masked; // Derived graphs, built once the base is read
+        while(std::getline(in, line) && line[0] != '@') {
+            if (!line.size()) continue;
+            rg::split(line, '\t', tokens);
+            if (tokens.size() < 2) throw std::domain_error("Invalid graph definition.");
+            if (tokens[1] == "mask") {
+                if (tokens.size() != 3) throw std::domain_error("Invalid graph definition.");
+                masked.emplace_back(tokens[0], tokens[2]);
+                continue;
+            }
+            _graphs[tokens[0]] = std::make_shared<Graph>(_nodes);
+            rg::split(tokens[1], ',', unparsed);
+            std::vector<unsigned> order;
+            order.reserve(unparsed.size());
+            std::transform(unparsed.begin(), unparsed.end(), std::back_inserter(order), [](const std::string &c){return std::stoul(c);});
+            _graphs[tokens[0]]->set_order(order);
+
+            if (tokens.size() > 2) {
+                unparsed = rg::split(tokens[2], ';');
+                std::vector<std::string> edge;
+                for (const auto &epair : unparsed) {
+                    rg::split(epair, ':', edge);
+                    assert(edge.size() == 2);
+                    const unsigned from = std::stoul(edge[0]);
+                    for (auto &to : rg::split(edge[1], ',')) {
+                        _graphs[tokens[0]]->add_edge_unchecked(from, std::stoul(to));
+                    }
                 }
             }
         }
+
+        if (masked.size() && !_graphs.count("base")) throw std::domain_error("Graph masks require a base graph.");
+        if (_graphs.count("base")) {
+            const auto &base = *_graphs.at("base");
+            const auto topo = base.topology();
+            for (const auto &m : masked) {
+                _graphs[m.first] = std::make_shared<Graph>(_nodes, topo, decode_mask(m.second, topo->order.size()));
+            }
+            // Files written before masks list every graph in full
+            for (auto &g : _graphs) {
+                if (g.first == "base" || g.second->is_derived()) continue;
+                if (auto derived = as_mask(base, *g.second)) g.second = derived;
+            }
+        }
     }
 
     assert(line =="@nodes");
     if (_print) std::cerr << "Loading nodes...\n";
+    VA_TRACE_SCOPE("open_nodes");
     while(std::getline(in, line)) {
         if (!line.size()) continue;
         // node meta
@@ -208,9 +354,27 @@ void vargas::GraphMan::open(const std::string &filename) {
             seq.push_back(rg::base_to_num(c));
         }
     }
+
+    VA_TRACE_SCOPE("open_index");
+    for (const auto &g : _graphs) g.second->build_index();
+}
+
+std::vector<std::pair<std::string, unsigned>> vargas::GraphMan::contigs() const {
+    pos_t last = 0;
+    if (_nodes) {
+        for (const auto &n : *_nodes) last = std::max(last, n.second.end_pos());
+    }
+    std::vector<std::pair<std::string, unsigned>> ret;
+    for (auto it = _resolver._contig_offsets.begin(); it != _resolver._contig_offsets.end(); ++it) {
+        const auto nxt = std::next(it);
+        const unsigned end = nxt == _resolver._contig_offsets.end() ? last + 1 : nxt->first;
+        ret.emplace_back(it->second, end > it->first ? end - it->first : 0);
+    }
+    return ret;
 }
 
 std::string vargas::GraphMan::derive(std::string def) {
+    VA_TRACE_SCOPE("derive");
     std::transform(def.begin(), def.end(), def.begin(), tolower);
 
     std::string ancestor, label, assignment;
@@ -259,9 +423,130 @@ std::string vargas::GraphMan::derive(std::string def) {
     for (size_t i = 0; i < amount; ++i) newpop.set(idx[i], true);
 
     _graphs[label] = std::make_shared<Graph>(*_graphs.at(ancestor), newpop);
+    _graphs[label]->build_index();
     return label;
 }
 
+size_t vargas::GraphMan::insert_variants(const std::vector<Variant> &vars, size_t *existing) {
+    VA_TRACE_SCOPE("insert_variants", vars.size());
+    if (!_graphs.count("base")) throw std::invalid_argument("No base graph to insert variants into.");
+    Graph &base = *_graphs.at("base");
+    const Graph::Population none(base.pop_size(), false);
+    if (existing) *existing = 0;
+
+    std::vector<std::vector<Graph::Node>> sites;
+    for (const auto &v : vars) {
+        const unsigned c = _resolver.contig(v.contig);
+        if (c == _resolver.size()) throw std::invalid_argument("Unknown contig: " + v.contig);
+        if (v.alleles.empty() || v.alleles[0].empty()) continue;
+        const std::string &ref = v.alleles[0];
+        const pos_t end = _resolver.offset(c) + v.pos + ref.length() - 1;
+        sites.emplace_back();
+        auto &site = sites.back();
+        site.emplace_back(end, ref, v.pop.size() ? v.pop[0] : Graph::Population(base.pop_size(), true),
+                          true, v.af.size() ? v.af[0] : 1);
+        std::unordered_set<std::string> seen = {ref};
+        for (size_t i = 1; i < v.alleles.size(); ++i) {
+            const std::string &allele = v.alleles[i];
+            if (!seen.insert(allele).second) continue;
+            if (v.pop.size() > i && !v.pop[i].any()) continue;
+            site.emplace_back(end, allele, v.pop.size() > i ? v.pop[i] : none, false, v.af.size() > i ? v.af[i] : 0);
+        }
+        if (has_site(base, site)) {
+            sites.pop_back();
+            if (existing) ++*existing;
+        }
+    }
+    if (sites.empty()) return 0;
+
+    // Membership of new alleles in a population filtered graph needs its filter and the allele populations,
+    // neither of which are stored in graph files
+    for (const auto &g : _graphs) {
+        if (!g.second->is_derived() || g.first == "ref" || g.first == "maxaf") continue;
+        if (base.pop_size() == 0 || g.second->filter().size() != base.pop_size()) {
+            throw std::invalid_argument("Graph \"" + g.first + "\" is filtered by population, which graph files do not "
+            "store. Rebuild the graph with the updated variants to redefine it.");
+        }
+    }
+
+    // Graphs with their own edges cannot follow a split node
+    std::unordered_set<unsigned> touched;
+    for (const auto &site : sites) {
+        const auto hit = base.seek(site[0].begin_pos() + 1);
+        if (hit.first != base.end()) touched.insert(hit.first->id());
+    }
+    for (const auto &g : _graphs) {
+        if (g.first == "base" || g.second->is_derived()) continue;
+        for (auto gi = g.second->begin(); gi != g.second->end(); ++gi) {
+            if (touched.count(gi->id())) {
+                throw std::invalid_argument("Graph \"" + g.first + "\" is not a node mask of base and would be split, "
+                "redefine it from the updated variants.");
+            }
+        }
+    }
+
+    const size_t inserted = sites.size();
+    const auto old_topo = base.topology();
+    const auto replaced = base.insert_sites(std::move(sites));
+    const auto topo = base.topology();
+
+    // Derived graphs are rebuilt as define would build them from the new base
+    for (auto &g : _graphs) {
+        if (!g.second->is_derived()) continue;
+        if (g.first == "ref" || g.first == "maxaf") {
+            *g.second = Graph(base, g.first == "ref" ? Graph::Type::REF : Graph::Type::MAXAF);
+            continue;
+        }
+
+        // Population filtered: pieces of a split node keep its membership, alleles are filtered
+        const Graph::Population &filter = g.second->filter();
+        const Graph::mask_t old_mask = g.second->mask();
+        Graph::mask_t mask((topo->order.size() + 63) / 64, 0);
+        size_t j = 0;
+        for (size_t i = 0; i < old_topo->order.size(); ++i) {
+            const bool in = (old_mask[i >> 6] >> (i & 63)) & 1;
+            const auto r = replaced.find(old_topo->order[i]);
+            if (r == replaced.end()) {
+                if (in) mask[j >> 6] |= uint64_t(1) << (j & 63);
+                ++j;
+                continue;
+            }
+            for (const unsigned id : r->second) {
+                const auto &n = _nodes->at(id);
+                if (in && (n.is_pinched() || n.belongs(filter))) mask[j >> 6] |= uint64_t(1) << (j & 63);
+                ++j;
+            }
+        }
+        Graph ng(_nodes, topo, mask);
+        ng.set_filter(g.second->filter());
+        ng.set_popsize(g.second->pop_size());
+        *g.second = ng;
+    }
+
+    base.build_index();
+    return inserted;
+}
+
+
+size_t vargas::GraphMan::insert_variants(const std::string &vcf, size_t *existing) {
+    VCF vf(vcf);
+    if (!vf.good()) throw std::invalid_argument("Invalid variant file: " + vcf);
+    const bool genotypes = vf.num_haplotypes() > 0 && vf.num_haplotypes() == at("base")->pop_size();
+    std::vector<Variant> vars;
+    while (vf.next()) {
+        Variant v;
+        v.contig = vf.chrom();
+        v.pos = vf.pos();
+        v.alleles = vf.alleles();
+        v.af = vf.frequencies();
+        if (genotypes) {
+            for (const auto &a : v.alleles) v.pop.push_back(vf.allele_pop(a));
+        }
+        vars.push_back(std::move(v));
+    }
+    return insert_variants(vars, existing);
+}
+
 TEST_CASE("Load graph") {
     const std::string jfile = "tmp.vgraph";
     const std::string jstr = R"(
@@ -275,6 +560,8 @@ aux	null
 
 @graphs
 base	0,1,2,3,4,5	0:1;1:2,3;2:4;3:4;4:5;
+ref	0,1,2,4,5	0:1;1:2;2:4;4:5;
+alt	0,1,3,5	0:1;1:3;3:5;
 
 @nodes
 0	5	1.0	1	5	1
@@ -347,10 +634,54 @@ ACGTACGAC
         p = gg.absolute_position(20);
         CHECK(p.first == "chr2");
         CHECK(p.second == 7);
+
+        std::vector<unsigned> contigs, rel;
+        const std::vector<rg::pos_t> pos = {13, 14, 20, 1, 13};
+        gg.resolver().resolve(pos, contigs, rel);
+        CHECK((contigs == std::vector<unsigned>{0, 1, 1, 0, 0}));
+        CHECK((rel == std::vector<unsigned>{13, 1, 7, 1, 13}));
+        CHECK(gg.resolver().name(1) == "chr2");
+
+        // No contig table: contig 0 has no name, positions are unchanged
+        vargas::coordinate_resolver none;
+        none.index();
+        none.resolve(pos, contigs, rel);
+        CHECK((contigs == std::vector<unsigned>{0, 0, 0, 0, 0}));
+        CHECK((rel == std::vector<unsigned>{13, 14, 20, 1, 13}));
+        CHECK(none.name(0) == "");
+        CHECK(none.resolve(14).first == "");
+        CHECK(gg.nodeID_from_contig("chr2") == 1);
+        CHECK(gg.nodeID_from_contig("chr3") == 2);
     }
     remove(jfile.c_str());
+    REQUIRE(gg.count("ref"));
+    CHECK(gg.at("ref")->is_derived());
+    CHECK(!gg.at("alt")->is_derived());
     gg.write(jfile);
+    {
+        // Derived graphs are stored as a mask over the base order
+        std::ifstream written(jfile);
+        std::string line;
+        bool found = false, full = false;
+        while (std::getline(written, line)) {
+            found |= line == "ref\tmask\t0,3,1,2";
+            full |= line.substr(0, 4) == "alt\t" && line.find("mask") == std::string::npos;
+        }
+        CHECK(found);
+        CHECK(full); // Edge 3->5 is not in the base graph
+    }
     gg.open(jfile);
+    {
+        REQUIRE(gg.count("ref"));
+        const auto &ref = *gg.at("ref");
+        CHECK(ref.is_derived());
+        std::string seqs;
+        for (auto gi = ref.begin(); gi != ref.end(); ++gi) {
+            seqs += gi->seq_str() + ",";
+            if (gi->seq_str() == "GCGC") CHECK(gi.incoming() == std::vector<unsigned>{2});
+        }
+        CHECK(seqs == "AAAAA,GGG,C,GCGC,ACGTACGAC,");
+    }
     {
         REQUIRE(gg.count("base"));
 
@@ -538,3 +869,92 @@ TEST_CASE("Write graph") {
     remove(tmpfa.c_str());
     remove(tmpvcf.c_str());
 }
+
+TEST_CASE("Insert variants") {
+    const std::string jfile = "tmp_ins.vgraph";
+    auto load = [&jfile](const std::string &extra) {
+        {
+            std::ofstream o(jfile);
+            o << "@vgraph\n\n@contigs\n0\tchr1\n10\tchr2\n\n@graphs\n"
+              << "base\t0,1,2\t1:2;\nref\tmask\t0,3\nmaxaf\tmask\t0,3\nalt\t1,2\t\n" << extra << "\n@nodes\n"
+              << "0\t9\t1\t1\t1\t10\nACGTACGTAC\n1\t11\t1\t1\t1\t2\nGG\n2\t14\t1\t1\t1\t3\nGGG\n";
+        }
+        vargas::GraphMan ret(jfile);
+        remove(jfile.c_str());
+        return ret;
+    };
+    vargas::GraphMan gg = load("");
+
+    vargas::GraphMan::Variant snp, del;
+    snp.contig = del.contig = "chr1";
+    snp.pos = 2;
+    snp.alleles = {"G", "T"};
+    snp.af = {0.3, 0.7};
+    del.pos = 5;
+    del.alleles = {"CG", "C", "C"};
+
+    SUBCASE("Split nodes") {
+        CHECK(gg.insert_variants({del, snp}) == 2);
+        const auto &base = *gg.at("base");
+        CHECK(base.validate());
+        std::vector<std::string> seqs;
+        std::vector<rg::pos_t> ends;
+        std::vector<bool> pinched;
+        for (auto gi = base.begin(); gi != base.end(); ++gi) {
+            seqs.push_back(gi->seq_str());
+            ends.push_back(gi->end_pos());
+            pinched.push_back(gi->is_pinched());
+        }
+        CHECK((seqs == std::vector<std::string>{"AC", "G", "T", "TA", "CG", "C", "TAC", "GG", "GGG"}));
+        CHECK((ends == std::vector<rg::pos_t>{1, 2, 2, 4, 6, 6, 9, 11, 14}));
+        CHECK((pinched == std::vector<bool>{1, 0, 0, 1, 0, 0, 1, 1, 1}));
+        CHECK(base.seek(6).first->seq_str() == "CG");
+        CHECK(base.order().front() == 3); // New ID's follow the loaded ones
+        const vargas::Graph::Node fresh;
+        CHECK(base.node_map()->count(fresh.id()) == 0);
+
+        // Derived graphs keep the reference alleles
+        const auto &ref = *gg.at("ref");
+        CHECK(ref.is_derived());
+        std::string rseq;
+        for (const auto &n : ref) rseq += n.seq_str();
+        CHECK(rseq == "ACGTACGTACGGGGG");
+
+        // maxaf is derived again, taking the more frequent allele
+        std::string mseq;
+        for (const auto &n : *gg.at("maxaf")) mseq += n.seq_str();
+        CHECK(mseq == "ACTTACGTACGGGGG");
+
+        // Repeated sites are skipped
+        vargas::GraphMan::Variant snp2 = snp;
+        snp2.pos = 8;
+        snp2.alleles = {"A", "G"};
+        size_t existing;
+        CHECK(gg.insert_variants({snp, del, snp2}, &existing) == 1);
+        CHECK(existing == 2);
+        CHECK(gg.at("base")->order().size() == 12);
+        CHECK(gg.insert_variants({snp2}, &existing) == 0);
+        CHECK(existing == 1);
+    }
+
+    SUBCASE("Rejected") {
+        vargas::GraphMan::Variant bad = snp;
+        bad.alleles = {"A", "T"};
+        CHECK_THROWS(gg.insert_variants({bad}));
+        bad.contig = "chr3";
+        CHECK_THROWS(gg.insert_variants({bad}));
+        CHECK_THROWS(gg.insert_variants({snp, snp}));
+        vargas::GraphMan::Variant full;
+        full.contig = "chr2"; // In alt, which lacks an edge of base so is not a mask
+        full.pos = 0;
+        full.alleles = {"G", "A"};
+        CHECK_THROWS(gg.insert_variants({full}));
+        CHECK(gg.at("base")->order().size() == 3);
+
+        // Samples are not stored, so population subgraphs cannot take new alleles
+        vargas::GraphMan pop = load("pop\tmask\t0,3\n");
+        REQUIRE(pop.at("pop")->is_derived());
+        CHECK_THROWS(pop.insert_variants({snp}));
+        CHECK(pop.at("base")->order().size() == 3);
+    }
+}
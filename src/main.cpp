@@ -18,16 +18,22 @@
 
 #include "main.h"
 #include "align_main.h"
+#include "bench.h"
+#include "convert.h"
 #include "graphman.h"
+#include "serve.h"
 #include "threadpool.h"
+#include "trace.h"
 
 #include <iostream>
 #include <algorithm>
 #include <scoring.h>
 #include <mutex>
+#include <queue>
+#include <set>
 
 int main(int argc, char *argv[]) {
-    srand(time(nullptr)); // Rand used in profiles and sim
+    srand(time(nullptr)); // Rand used in profiles
 
     try {
         if (argc > 1) {
@@ -47,8 +53,14 @@ int main(int argc, char *argv[]) {
                 return align_main(argc - 1, argv + 1);
             } else if (!strcmp(argv[1], "convert")) {
                 return convert_main(argc - 1, argv + 1);
+            } else if (!strcmp(argv[1], "merge")) {
+                return merge_main(argc - 1, argv + 1);
             } else if (!strcmp(argv[1], "query")) {
                 return query_main(argc - 1, argv + 1);
+            } else if (!strcmp(argv[1], "bench")) {
+                return bench_main(argc - 1, argv + 1);
+            } else if (!strcmp(argv[1], "serve")) {
+                return serve_main(argc - 1, argv + 1);
             }
         }
     } catch (std::exception &e) {
@@ -65,7 +77,7 @@ int main(int argc, char *argv[]) {
 }
 
 int define_main(int argc, char *argv[]) {
-    std::string fasta_file, varfile, region, out_file, sample_filter, subdef;
+    std::string fasta_file, varfile, region, out_file, sample_filter, subdef, trace_file, update_file;
     bool not_contig = false;
     size_t varlim = 0;
 
@@ -81,7 +93,9 @@ int define_main(int argc, char *argv[]) {
         ("s,subgraph", "<str> Subgraph definitions, see below.", cxxopts::value(subdef))
         ("p,filter", "<str> Filter by sample names in file.", cxxopts::value(sample_filter))
         ("n,limvar", "<N> Limit to the first N variant records", cxxopts::value(varlim))
-        ("c,notcontig", "VCF records for a given contig are not contiguous.", cxxopts::value(not_contig)->implicit_value("true"));
+        ("c,notcontig", "VCF records for a given contig are not contiguous.", cxxopts::value(not_contig)->implicit_value("true"))
+        ("u,update", "<str> Insert the variants of -v into this graph file instead of building from -f.", cxxopts::value(update_file))
+        ("trace", "<str> Write a Chrome trace event timeline to file.", cxxopts::value(trace_file));
 
         opts.add_options()("h,help", "Display this message.");
         opts.parse(argc, argv);
@@ -92,13 +106,25 @@ int define_main(int argc, char *argv[]) {
         define_help(opts);
         return 0;
     }
-    if (!opts.count("f")) {
+    if (!opts.count("f") && update_file.empty()) {
         define_help(opts);
         throw std::invalid_argument("FASTA file required.");
     }
 
+    vargas::trace::Session trace_session(trace_file);
     vargas::GraphMan gm;
     gm.print_progress();
+
+    if (!update_file.empty()) {
+        if (varfile.empty()) throw std::invalid_argument("Variant file required to update a graph.");
+        for (const char *o : {"p", "n", "g"}) {
+            if (opts.count(o)) throw std::invalid_argument("-" + std::string(o) + " cannot be combined with -u.");
+        }
+        gm.open(update_file);
+        size_t existing;
+        std::cerr << "Inserted " << gm.insert_variants(varfile, &existing) << " variant(s).\n";
+        if (existing) std::cerr << "Skipped " << existing << " variant(s) already in the graph.\n";
+    }
     if (sample_filter.length()) {
         std::ifstream in(sample_filter);
         if (!in.good()) throw std::invalid_argument("Error opening file: \"" + sample_filter + "\"");
@@ -115,8 +141,10 @@ int define_main(int argc, char *argv[]) {
         std::transform(v.begin(), v.end(), std::back_inserter(region_vec), vargas::parse_region);
     }
 
-    if (!not_contig) gm.assume_contig_chr();
-    gm.create_base(fasta_file, varfile, region_vec, sample_filter, varlim);
+    if (update_file.empty()) {
+        if (!not_contig) gm.assume_contig_chr();
+        gm.create_base(fasta_file, varfile, region_vec, sample_filter, varlim);
+    }
 
     if (!subdef.empty()) {
         auto defs = rg::split(subdef, ';');
@@ -131,28 +159,63 @@ int define_main(int argc, char *argv[]) {
     return 0;
 }
 
+// Reads per sim work unit. Fixed so the split does not depend on the thread count.
+#define SIM_CHUNK_SIZE 512
+
 struct main_helper {
     std::vector<std::pair<std::string, // Graph label
                           std::pair<std::string, // RG ID
                                     vargas::Sim::Profile>>> // sim prof
      &task_list;
+    std::vector<std::pair<size_t, unsigned>> &chunks; // Task index, first read
     vargas::GraphMan &gm;
     int num_reads;
+    uint64_t seed;
+    std::vector<std::unique_ptr<vargas::Sim>> &sims; // Per thread
+    std::vector<std::string> &sim_labels;
     std::mutex &m;
+    std::vector<std::vector<vargas::SAM::Record>> &done; // Chunks waiting to be written in order
+    std::vector<char> &ready;
+    size_t &next_write;
     vargas::osam &out;
 };
-void main_helper_func(void *data, long index, int) {
+void main_helper_func(void *data, long index, int tid) {
+    VA_TRACE_SCOPE("sim_task", index);
     main_helper &help = *(main_helper *)data;
-    auto &task_list = help.task_list;
-    auto &gm = help.gm;
-    const std::string &label = task_list.at(index).first;
-    auto subgraph_ptr = gm.at(label);
-    vargas::Sim sim(*subgraph_ptr, task_list[index].second.second);
-    auto results = sim.get_batch(help.num_reads, gm.resolver());
-    for(auto &r: results) r.aux.set("RG", task_list[index].second.first);
+    const size_t task = help.chunks[index].first;
+    const unsigned first = help.chunks[index].second;
+    const std::string &label = help.task_list.at(task).first;
+    const auto &prof = help.task_list[task].second.second;
+
+    // Node weights are only built once per thread and subgraph
+    auto &sim = help.sims[tid];
+    if (!sim || help.sim_labels[tid] != label) {
+        VA_TRACE_SCOPE("sim_build");
+        sim.reset(new vargas::Sim(*help.gm.at(label), prof));
+        help.sim_labels[tid] = label;
+    } else {
+        sim->set_prof(prof);
+    }
+    sim->seed(rg::CounterRNG(help.seed, task)(), first);
+    std::vector<vargas::SAM::Record> results;
     {
-        std::lock_guard<std::mutex> lock(help.m);
-        for(const auto &r: results) help.out.add_record(r);
+        VA_TRACE_SCOPE("sim_batch");
+        results = sim->get_batch(std::min<unsigned>(SIM_CHUNK_SIZE, help.num_reads - first), help.gm.resolver());
+        for (auto &r: results) r.aux.set("RG", help.task_list[task].second.first);
+    }
+
+    std::unique_lock<std::mutex> lock(help.m, std::defer_lock);
+    {
+        VA_TRACE_SCOPE("output_wait");
+        lock.lock();
+    }
+    VA_TRACE_SCOPE("output_write");
+    help.done[index] = std::move(results);
+    help.ready[index] = 1;
+    for (; help.next_write < help.ready.size() && help.ready[help.next_write]; ++help.next_write) {
+        auto &chunk = help.done[help.next_write];
+        for (const auto &r : chunk) help.out.add_record(r);
+        std::vector<vargas::SAM::Record>().swap(chunk);
     }
 }
 
@@ -165,8 +228,9 @@ int sim_main(int argc, char *argv[]) {
     }
 
     int read_len, num_reads, threads;
-    std::string mut, indel, vnodes, vbases, gdf_file, out_file, sim_src;
-    bool use_rate = false, sim_src_isfile = false;
+    unsigned seed;
+    std::string mut, indel, vnodes, vbases, gdf_file, out_file, sim_src, trace_file;
+    bool use_rate = false, sim_src_isfile = false, ubam = false;
 
     cxxopts::Options opts("vargas sim", "Simulate reads from genome graphs.");
     try {
@@ -174,12 +238,15 @@ int sim_main(int argc, char *argv[]) {
         ("g,graph", "<str> *Graph definition file.", cxxopts::value(gdf_file));
 
         opts.add_options("Optional")
-        ("t,out", "<str> Output file. (default: stdout)", cxxopts::value(out_file))
+        ("t,out", "<str> Output file, BAM if it ends in \".bam\". (default: stdout)", cxxopts::value(out_file))
+        ("ubam", "Write uncompressed BAM.", cxxopts::value(ubam)->implicit_value("1"))
         ("s,sub", "<S1,...> Subgraphs to simulate from. (default: base)", cxxopts::value(sim_src))
         ("f,file", "-s specifies a filename.", cxxopts::value(sim_src_isfile))
         ("l,rlen", "<N> Read length.", cxxopts::value(read_len)->default_value("50"))
         ("n,numreads", "<N> Number of reads to generate.", cxxopts::value(num_reads)->default_value("1000"))
-        ("j,threads", "<N> Number of threads.", cxxopts::value(threads)->default_value("1"));
+        ("j,threads", "<N> Number of threads.", cxxopts::value(threads)->default_value("1"))
+        ("seed", "<N> Random seed, output is the same for any -j. (default: random)", cxxopts::value(seed))
+        ("trace", "<str> Write a Chrome trace event timeline to file.", cxxopts::value(trace_file));
 
         opts.add_options("Stratum")
         ("v,vnodes", "<N1,...> Variant nodes. \'*\' for any.", cxxopts::value(vnodes)->default_value("*"))
@@ -202,6 +269,11 @@ int sim_main(int argc, char *argv[]) {
         throw std::invalid_argument("Graph definition file required.");
     }
 
+    if (!opts.count("seed")) seed = std::random_device()();
+    std::cerr << "Seed: " << seed << '\n';
+
+    vargas::trace::Session trace_session(trace_file);
+
     vargas::SAM::Header sam_hdr;
     {
         vargas::SAM::Header::Program pg;
@@ -280,6 +352,10 @@ int sim_main(int argc, char *argv[]) {
                         std::cerr << "Invalid profile argument: " << e.what() << std::endl;
                         return 1;
                     }
+                    if (prof.var_nodes == 0 && prof.var_bases > 0) {
+                        std::cerr << "[warn] Skipping unsatisfiable profile: " << prof.to_string() << '\n';
+                        continue;
+                    }
 
                     rg.aux.set(SIM_SAM_INDEL_ERR_TAG, prof.indel);
                     rg.aux.set(SIM_SAM_VAR_NODES_TAG, prof.var_nodes);
@@ -303,7 +379,8 @@ int sim_main(int argc, char *argv[]) {
               << sam_hdr.read_groups.size() << " read group(s) over "
               << subdef_split.size() << " subgraph(s). " << std::endl;
 
-    vargas::osam out(out_file, sam_hdr);
+    if (rg::ends_with(out_file, ".bam")) add_contigs(gm, sam_hdr);
+    vargas::osam out(out_file, sam_hdr, threads, !ubam);
     if (!out.good()) throw std::invalid_argument("Error opening output file \"" + out_file + "\"");
 
     std::cerr << "Simulating... " << std::flush;
@@ -322,11 +399,22 @@ int sim_main(int argc, char *argv[]) {
         }
     }
 
-    const size_t num_tasks = task_list.size();
+    // Profiles are split into fixed size chunks so a single profile uses all threads
+    std::vector<std::pair<size_t, unsigned>> chunks;
+    for (size_t t = 0; t < task_list.size(); ++t) {
+        for (int r = 0; r < num_reads; r += SIM_CHUNK_SIZE) chunks.emplace_back(t, r);
+    }
+
+    if (threads < 1) threads = 1;
     rg::ForPool fp(threads);
     std::mutex mutex;
-    main_helper data{task_list, gm, num_reads, mutex, out};
-    fp.forpool(&main_helper_func, (void *)&data, num_tasks);
+    std::vector<std::unique_ptr<vargas::Sim>> sims(threads);
+    std::vector<std::string> sim_labels(threads);
+    std::vector<std::vector<vargas::SAM::Record>> done(chunks.size());
+    std::vector<char> ready(chunks.size(), 0);
+    size_t next_write = 0;
+    main_helper data{task_list, chunks, gm, num_reads, seed, sims, sim_labels, mutex, done, ready, next_write, out};
+    fp.forpool(&main_helper_func, (void *)&data, chunks.size());
 
     std::cerr << rg::chrono_duration(start_time) << " seconds." << std::endl;
 
@@ -336,11 +424,13 @@ int sim_main(int argc, char *argv[]) {
 int convert_main(int argc, char **argv) {
     std::string sam_file, format;
     std::vector<std::string> files;
+    unsigned threads;
     cxxopts::Options opts("vargas convert", "Export a SAM file as a CSV file.");
     try {
         opts.add_options()
         ("f,format", "<str> Output format.", cxxopts::value<std::string>(format))
-        ("files", "SAM files, default stdin.", cxxopts::value<std::vector<std::string>>(files))
+        ("j,threads", "<N> Number of threads.", cxxopts::value<unsigned>(threads)->default_value("1"))
+        ("files", "SAM or BAM files, default stdin.", cxxopts::value<std::vector<std::string>>(files))
         ("h,help", "Display this message.");
         opts.parse_positional(std::vector<std::string>{"files"});
         opts.parse(argc, argv);
@@ -360,31 +450,121 @@ int convert_main(int argc, char **argv) {
 
     format.erase(std::remove(format.begin(), format.end(), ' '), format.end());
     std::vector<std::string> fmt_split = rg::split(format, ',');
-    std::unordered_set<std::string> warned;
 
     if (files.empty()) files.resize(1);
+    vargas::convert_sam(files, fmt_split, threads, std::cout);
+
+    std::cerr << rg::chrono_duration(start_time) << " seconds." << std::endl;
 
+    return 0;
+}
+
+int merge_main(int argc, char *argv[]) {
+    std::string cl = "vargas ";
+    {
+        std::ostringstream ss;
+        for (int i = 0; i < argc; ++i) ss << std::string(argv[i]) << " ";
+        cl = ss.str();
+    }
+
+    std::string out_file;
+    unsigned threads;
+    bool ubam = false;
+    std::vector<std::string> files;
+    cxxopts::Options opts("vargas merge", "Merge the outputs of \"vargas align --shard\" back into read order.");
+    try {
+        opts.add_options()
+        ("S,sam", "<str> Output file, BAM if it ends in \".bam\". (default: stdout)", cxxopts::value(out_file))
+        ("ubam", "Write uncompressed BAM.", cxxopts::value(ubam)->implicit_value("1"))
+        ("j,threads", "<N> BAM compression threads.", cxxopts::value(threads)->default_value("1"))
+        ("files", "Shard SAM or BAM files.", cxxopts::value<std::vector<std::string>>(files))
+        ("h,help", "Display this message.");
+        opts.parse_positional(std::vector<std::string>{"files"});
+        opts.parse(argc, argv);
+    } catch (std::exception &e) {
+        throw std::invalid_argument("Error parsing options: " + std::string(e.what()));
+    }
+    if (opts.count("h")) {
+        merge_help(opts);
+        return 0;
+    }
+    if (files.empty()) {
+        merge_help(opts);
+        throw std::invalid_argument("No shard files provided.");
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Headers: union of sequences and read groups, one program line per distinct program
+    std::vector<std::unique_ptr<vargas::isam>> shards;
+    vargas::SAM::Header hdr;
     for (const auto &f : files) {
-        vargas::isam input(f);
-        std::string buff, val;
-        do {
-            if (files.size() > 1) buff = f + ",";
-            else buff = "";
-            for (auto &tag : fmt_split) {
-                val = "*";
-                if (!input.record().get(input.header(), tag, val) && warned.count(tag) == 0) {
-                    std::cerr << "WARN: Tag \"" << tag << "\" not present." << std::endl;
-                    warned.insert(tag);
-                }
-                buff += "\"" + val + "\",";
-            }
-            buff.resize(buff.size() - 1);
-            std::cout << buff << '\n'; // Crop trailing comma
-        } while (input.next());
+        shards.emplace_back(new vargas::isam(f));
+        const auto &h = shards.back()->header();
+        if (shards.size() == 1) {
+            hdr = h;
+            continue;
+        }
+        for (const auto &sq : h.sequences) if (!hdr.sequences.count(sq.first)) hdr.add(sq.second);
+        for (const auto &r : h.read_groups) if (!hdr.read_groups.count(r.first)) hdr.add(r.second);
+        for (const auto &pg : h.programs) {
+            bool dup = false;
+            for (const auto &have : hdr.programs) dup |= have.second.to_string() == pg.second.to_string();
+            if (!dup) hdr.add(pg.second);
+        }
+    }
+    vargas::SAM::Header::Program pg;
+    pg.command_line = cl;
+    pg.name = "vargas_merge";
+    pg.id = "VM";
+    pg.version = __DATE__;
+    std::replace_if(pg.version.begin(), pg.version.end(), isspace, ' ');
+    hdr.add(pg);
+
+    // K-way merge on the read index, each shard is in increasing order
+    using head_t = std::pair<uint64_t, size_t>; // read index, shard
+    std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+    std::vector<uint64_t> last(shards.size());
+    auto push = [&](size_t s) {
+        const auto &rec = shards[s]->record();
+        uint64_t index;
+        if (!rec.aux.get(ALIGN_SAM_READ_INDEX_TAG, index)) {
+            throw std::invalid_argument("\"" + files[s] + "\": record \"" + rec.query_name
+                                        + "\" has no read index, align with --shard.");
+        }
+        if (index < last[s]) throw std::invalid_argument("\"" + files[s] + "\" is not in read order.");
+        last[s] = index;
+        heads.emplace(index, s);
+    };
+    for (size_t s = 0; s < shards.size(); ++s) {
+        if (shards[s]->good()) push(s);
     }
 
-    std::cerr << rg::chrono_duration(start_time) << " seconds." << std::endl;
+    // A read aligned to several targets has one record per target, all in the same shard.
+    // Ties pop from the lower shard first, so a shard's records of one read stay together, in the order
+    // the shard wrote them: its task scheduling order, not the order of the targets.
+    vargas::osam out(out_file, hdr, threads, !ubam);
+    uint64_t count = 0, missing = 0, expected = 0;
+    size_t prev_shard = shards.size();
+    while (!heads.empty()) {
+        const head_t h = heads.top();
+        heads.pop();
+        if (h.first + 1 == expected && h.second != prev_shard) {
+            throw std::invalid_argument("Read index " + std::to_string(h.first) + " is in more than one shard.");
+        }
+        if (h.first >= expected) {
+            missing += h.first - expected;
+            expected = h.first + 1;
+        }
+        prev_shard = h.second;
+        out.add_record(shards[h.second]->record());
+        ++count;
+        if (shards[h.second]->next()) push(h.second);
+    }
 
+    std::cerr << "Merged " << count << " records from " << files.size() << " files in "
+              << rg::chrono_duration(start_time) << "s.\n";
+    if (missing) std::cerr << "[warn] " << missing << " read indices are missing, a shard may be absent.\n";
     return 0;
 }
 
@@ -418,54 +598,54 @@ int profile(int argc, char *argv[]) {
     gb.open_vcf(bcf);
     gb.set_region(region);
 
-    auto start = std::clock();
+    auto start = std::chrono::steady_clock::now();
 
     std::cerr << "Initial Graph Build:\n\t";
     vargas::Graph g;
     gb.build(g);
     std::vector<bool> filter;
     for (size_t i = 0; i < g.pop_size(); ++i) filter.push_back(rand() % 100 > 95); //TODO what is this doing?
-    std::cerr << (std::clock() - start) / (double) (CLOCKS_PER_SEC) << " s, " << "Nodes: " << g.node_map()->size()
+    std::cerr << rg::chrono_duration(start) << " s, " << "Nodes: " << g.node_map()->size()
               << std::endl;
 
     size_t num = 0;
 
     {
         std::cerr << "Insertion order traversal:\n\t";
-        start = std::clock();
+        start = std::chrono::steady_clock::now();
         for (auto i = g.begin(); i != g.end(); ++i) {
             ++num;
         }
-        std::cerr << (std::clock() - start) / (double) (CLOCKS_PER_SEC) << " s" << std::endl;
+        std::cerr << rg::chrono_duration(start) << " s" << std::endl;
     }
 
     {
         std::cerr << "Filter constructor (" << ingroup << "):\n\t";
         auto pop_filt = g.subset(ingroup);
-        start = std::clock();
+        start = std::chrono::steady_clock::now();
         vargas::Graph g2(g, pop_filt);
-        std::cerr << (std::clock() - start) / (double) (CLOCKS_PER_SEC) << " s" << std::endl;
+        std::cerr << rg::chrono_duration(start) << " s" << std::endl;
     }
 
     {
         std::cerr << "REF constructor:\n\t";
-        start = std::clock();
+        start = std::chrono::steady_clock::now();
         vargas::Graph g2(g, vargas::Graph::Type::REF);
-        std::cerr << (std::clock() - start) / (double) (CLOCKS_PER_SEC) << " s" << std::endl;
+        std::cerr << rg::chrono_duration(start) << " s" << std::endl;
     }
 
     {
         std::cerr << "MAXAF constructor:\n\t";
-        start = std::clock();
+        start = std::chrono::steady_clock::now();
         vargas::Graph g2(g, vargas::Graph::Type::MAXAF);
-        std::cerr << (std::clock() - start) / (double) (CLOCKS_PER_SEC) << " s" << std::endl;
+        std::cerr << rg::chrono_duration(start) << " s" << std::endl;
     }
 
     return 0;
 }
 
 int query_main(int argc, char *argv[]) {
-    std::string gdef, dot, stat, meta, out;
+    std::string gdef, dot, stat, meta, out, region;
 
     cxxopts::Options opts("vargas query", "Query a graph and export a DOT graph.");
     try {
@@ -473,6 +653,7 @@ int query_main(int argc, char *argv[]) {
         ("g,graph", "*<str> Graph file to query.", cxxopts::value(gdef))
         ("d,dot", "<str> Subgraph to export as a DOT graph.", cxxopts::value(dot))
         ("t,out", "<str> DOT output file.", cxxopts::value(out)->default_value("stdout"))
+        ("r,region", "<CHR[:MIN-MAX]> Only export nodes overlapping the region, 1 based.", cxxopts::value(region))
         ("a,stat", "<str> Print statistics about a subgraph \'-\' for all.", cxxopts::value(stat)->implicit_value("-"))
         ("h,help", "Display this message.");
         opts.parse(argc, argv);
@@ -494,8 +675,25 @@ int query_main(int argc, char *argv[]) {
     else gg.open(gdef);
 
     if (!dot.empty()) {
-        if (out == "stdout") std::cout << gg.at(dot)->to_DOT(dot);
-        else gg.at(dot)->to_DOT(out, dot);
+        std::shared_ptr<const vargas::Graph> g = gg.at(dot);
+        if (!region.empty()) {
+            // Contig coordinates to graph coordinates, then a range of the position index
+            const vargas::Region reg = vargas::parse_region(region);
+            rg::pos_t offset = 0;
+            unsigned len = 0;
+            for (const auto &c : gg.contigs()) {
+                if (c.first == reg.seq_name) {
+                    len = c.second;
+                    break;
+                }
+                offset += c.second;
+            }
+            if (len == 0) throw std::invalid_argument("Unknown contig: " + reg.seq_name);
+            const rg::pos_t min = std::max<rg::pos_t>(reg.min, 1), max = reg.max ? std::min(reg.max, len) : len;
+            g = std::make_shared<vargas::Graph>(g->subgraph(offset + min - 1, offset + max - 1));
+        }
+        if (out == "stdout") std::cout << g->to_DOT(dot);
+        else g->to_DOT(out, dot);
     }
 
     if (!stat.empty()) {
@@ -520,8 +718,11 @@ void main_help() {
     cerr << "\tdefine          Define a set of graphs for use with sim and align.\n";
     cerr << "\tsim             Simulate reads from a set of graphs.\n";
     cerr << "\talign           Align reads to a set of graphs.\n";
+    cerr << "\tserve           Keep graphs loaded and align reads sent over a socket.\n";
     cerr << "\tconvert         Convert a SAM file to a CSV file.\n";
+    cerr << "\tmerge           Merge sharded alignments back into read order.\n";
     cerr << "\tquery           Convert a graph to DOT format.\n";
+    cerr << "\tbench           Benchmark aligners, I/O, and simulation.\n";
     cerr << "\ttest            Run unit tests.\n\n";
 
 }
@@ -566,10 +767,20 @@ void convert_help(const cxxopts::Options &opts) {
     cerr << opts.help() << "\n\n";
     cerr << "Required column names:\n\tQNAME, FLAG, RNAME, POS, MAPQ, CIGAR, RNEXT, PNEXT, TLEN, SEQ, QUAL\n";
     cerr << "Prefix with \"RG:\" to obtain a value from the associated read group.\n";
-    cerr << "Ex. vargas convert -f \"RG:ID,ms\" a.sam b.sam" << endl;
+    cerr << "SAM files are split into blocks converted by -j threads, rows are written in input order.\n";
+    cerr << "Ex. vargas convert -f \"RG:ID,ms\" -j 8 a.sam b.sam" << endl;
 
 }
 
+void merge_help(const cxxopts::Options &opts) {
+    using std::cerr;
+    using std::endl;
+
+    cerr << opts.help() << "\n\n";
+    cerr << "Records are ordered by their " ALIGN_SAM_READ_INDEX_TAG " tag, set by align --shard.\n";
+    cerr << "Ex. vargas merge -S reads.sam shard0.sam shard1.sam shard2.sam" << endl;
+}
+
 TEST_CASE("Vargas CLI") {
     const std::string fa = R"(>chrA
 AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA
@@ -661,3 +872,225 @@ chrB	80	rs796688738	C	AC,<CN0>	.	.	.	.)";
     remove("tmpreads.vatmp");
     remove("tmpsam.vatmp");
 }
+
+TEST_CASE("Sharded alignment") {
+    const std::string left = "ACGTTGCAAGCTTACGGATCCATGACTGATCGTAGCTAGC";
+    const std::string right = "GGCTAGCTTAGCATCGATCGGATACGTACGATCGAACGTT";
+    const std::string ref = left + "A" + right;
+    {
+        std::ofstream g("tmpgdef.vatmp");
+        g << "@vgraph\ndate\tx\n\n@contigs\n0\tx\n\n@graphs\nbase\t0,1,2,3\t0:1,2;1:3;2:3;\nalt\t0,2,3\t0:2;2:3;\n\n@nodes\n"
+          << "0\t39\t1\t0\t1\t40\n" << left << "\n"
+          << "1\t40\t0.5\t0\t0\t1\nA\n"
+          << "2\t40\t0.5\t0\t1\t1\nC\n"
+          << "3\t80\t1\t0\t1\t40\n" << right << "\n";
+    }
+    const size_t num_reads = 40;
+    {
+        std::ofstream r("tmpreads.vatmp");
+        for (size_t i = 0; i < num_reads; ++i) r << ">r" << i << "\n" << ref.substr(i % 60, 20) << "\n";
+    }
+
+    CHECK_THROWS(parse_shard("3/3"));
+    CHECK_THROWS(parse_shard("1"));
+    CHECK_THROWS(parse_shard("a/2"));
+    CHECK(parse_shard("2/3").index == 2);
+
+    auto align_to = [](const char *out, const char *shard, const char *targets = nullptr,
+                       const char *reads = "tmpreads.vatmp") {
+        std::vector<const char *> argv = {"align", "-g", "tmpgdef.vatmp", "-U", reads, "-S", out,
+                                          "--maxonly", "-j", "2"};
+        if (shard) {
+            argv.push_back("--shard");
+            argv.push_back(shard);
+        }
+        if (targets) {
+            argv.push_back("-a");
+            argv.push_back(targets);
+        }
+        align_main(argv.size(), (char **) argv.data());
+    };
+    align_to("tmpsam.vatmp", nullptr);
+    align_to("tmpshard0.vatmp", "0/3");
+    align_to("tmpshard1.vatmp", "1/3");
+    align_to("tmpshard2.vatmp", "2/3");
+    {
+        const char *argv[] = {"merge", "-S", "tmpmerged.vatmp", "tmpshard2.vatmp", "tmpshard0.vatmp", "tmpshard1.vatmp"};
+        merge_main(6, (char **) argv);
+    }
+
+    std::map<std::string, std::pair<int, int>> full;
+    {
+        vargas::isam in("tmpsam.vatmp");
+        do {
+            int as, mp;
+            REQUIRE(in.record().aux.get("AS", as));
+            REQUIRE(in.record().aux.get(ALIGN_SAM_MAX_POS_TAG, mp));
+            full[in.record().query_name] = {as, mp};
+        } while (in.next());
+    }
+    REQUIRE(full.size() == num_reads);
+
+    vargas::isam merged("tmpmerged.vatmp");
+    CHECK(merged.header().programs.size() == 4);
+    CHECK(merged.header().programs.count("VM") == 1);
+    size_t n = 0;
+    do {
+        const auto &rec = merged.record();
+        CHECK(rec.query_name == "r" + std::to_string(n));
+        uint64_t index;
+        REQUIRE(rec.aux.get(ALIGN_SAM_READ_INDEX_TAG, index));
+        CHECK(index == n);
+        int as, mp;
+        REQUIRE(rec.aux.get("AS", as));
+        REQUIRE(rec.aux.get(ALIGN_SAM_MAX_POS_TAG, mp));
+        CHECK(full[rec.query_name] == std::make_pair(as, mp));
+        ++n;
+    } while (merged.next());
+    CHECK(n == num_reads);
+
+    {
+        // Several targets: each read has a record per target, all in the read's shard
+        {
+            std::ofstream r("tmpreads.sam.vatmp");
+            r << "@RG\tID:g\n";
+            for (size_t i = 0; i < num_reads; ++i) {
+                r << "r" << i << "\t4\t*\t0\t255\t*\t*\t0\t0\t" << ref.substr(i % 60, 20) << "\t*\tRG:Z:g\n";
+            }
+        }
+        const char *targets = "RG:ID:g,base;RG:ID:g,alt", *reads = "tmpreads.sam.vatmp";
+        align_to("tmpsam.vatmp", nullptr, targets, reads);
+        align_to("tmpshard0.vatmp", "0/2", targets, reads);
+        align_to("tmpshard1.vatmp", "1/2", targets, reads);
+        const char *argv[] = {"merge", "-S", "tmpmerged.vatmp", "tmpshard1.vatmp", "tmpshard0.vatmp"};
+        merge_main(5, (char **) argv);
+
+        std::multiset<std::string> all, got;
+        vargas::isam in("tmpsam.vatmp");
+        do {
+            all.insert(in.record().query_name + in.record().aux.to_string());
+        } while (in.next());
+
+        vargas::isam m("tmpmerged.vatmp");
+        std::vector<uint64_t> order;
+        do {
+            vargas::SAM::Record rec = m.record();
+            uint64_t index;
+            REQUIRE(rec.aux.get(ALIGN_SAM_READ_INDEX_TAG, index));
+            order.push_back(index);
+            CHECK(rec.query_name == "r" + std::to_string(index));
+            // Compare without the read index, which the unsharded run does not set
+            vargas::SAM::Record plain;
+            for (const auto &f : rec.aux) {
+                if (f.tag != vargas::SAM::Optional::tag_code(std::string(ALIGN_SAM_READ_INDEX_TAG))) {
+                    std::string field = std::string(1, char(f.tag & 0xFF)) + char(f.tag >> 8) + ":" + f.fmt + ":";
+                    f.append_value(field);
+                    plain.aux.add(field);
+                }
+            }
+            got.insert(rec.query_name + plain.aux.to_string());
+        } while (m.next());
+        REQUIRE(order.size() == 2 * num_reads);
+        for (size_t i = 0; i < order.size(); ++i) CHECK(order[i] == i / 2);
+        CHECK(got == all);
+    }
+
+    remove("tmpgdef.vatmp");
+    remove("tmpreads.vatmp");
+    remove("tmpreads.sam.vatmp");
+    remove("tmpsam.vatmp");
+    remove("tmpshard0.vatmp");
+    remove("tmpshard1.vatmp");
+    remove("tmpshard2.vatmp");
+    remove("tmpmerged.vatmp");
+}
+
+TEST_CASE("Extra profiles") {
+    const std::string left = "ACGTTGCAAGCTTACGGATCCATGACTGATCGTAGCTAGC";
+    const std::string right = "GGCTAGCTTAGCATCGATCGGATACGTACGATCGAACGTT";
+    const std::string ref = left + "A" + right;
+    {
+        std::ofstream g("tmpgdef.vatmp");
+        g << "@vgraph\ndate\tx\n\n@contigs\n0\tx\n\n@graphs\nbase\t0,1,2,3\t0:1,2;1:3;2:3;\n\n@nodes\n"
+          << "0\t39\t1\t0\t1\t40\n" << left << "\n"
+          << "1\t40\t0.5\t0\t0\t1\nA\n"
+          << "2\t40\t0.5\t0\t1\t1\nC\n"
+          << "3\t80\t1\t0\t1\t40\n" << right << "\n";
+    }
+    const size_t num_reads = 30;
+    {
+        std::ofstream r("tmpreads.sam.vatmp");
+        r << "@HD\tVN:1.0\n"
+          << "@PG\tID:bwa\tCL:bwa mem -A 1 -B 4\n"
+          << "@PG\tID:bt\tCL:bowtie2 -x g -U r.fq\n"
+          << "@PG\tID:bt2\tCL:bowtie2 --local --ma 3 -x g -U r.fq\n";
+        for (size_t i = 0; i < num_reads; ++i) {
+            std::string seq = ref.substr(i % 60, 20);
+            if (i % 2) seq[7] = seq[7] == 'T' ? 'G' : 'T';
+            r << "r" << i << "\t4\t*\t0\t255\t*\t*\t0\t0\t" << seq << "\t*\n";
+        }
+    }
+
+    auto align_to = [](const char *out, const std::vector<const char *> &extra) {
+        std::vector<const char *> argv = {"align", "-g", "tmpgdef.vatmp", "-U", "tmpreads.sam.vatmp", "-S", out,
+                                          "--maxonly", "-j", "2"};
+        argv.insert(argv.end(), extra.begin(), extra.end());
+        align_main(argv.size(), (char **) argv.data());
+    };
+
+    // The k-th profile scores as an alignment with only that profile, tags in order of --profiles
+    const std::vector<const char *> assess = {"--assess=bwa", "--assess=bt", "--assess=bt2"};
+    align_to("tmpsam.vatmp", {"--profiles", "bwa,bt,bt2"});
+    std::vector<std::vector<int>> separate(assess.size());
+    for (size_t k = 0; k < assess.size(); ++k) {
+        align_to("tmpshard0.vatmp", {assess[k]});
+        vargas::isam in("tmpshard0.vatmp");
+        do {
+            int as;
+            REQUIRE(in.record().aux.get("AS", as));
+            separate[k].push_back(as);
+        } while (in.next());
+        REQUIRE(separate[k].size() == num_reads);
+    }
+    CHECK(separate[0] != separate[2]);
+    std::vector<int> plain;
+    align_to("tmpshard0.vatmp", {});
+    {
+        vargas::isam in("tmpshard0.vatmp");
+        do {
+            int as;
+            REQUIRE(in.record().aux.get("AS", as));
+            plain.push_back(as);
+        } while (in.next());
+    }
+
+    vargas::isam in("tmpsam.vatmp");
+    size_t n = 0;
+    do {
+        const auto &rec = in.record();
+        const std::string aux = rec.aux.to_string();
+        int as;
+        REQUIRE(rec.aux.get("AS", as));
+        CHECK(as == plain[n]); // Main profile restored after the extra ones
+        size_t last = 0;
+        for (size_t k = 0; k < assess.size(); ++k) {
+            const std::string tag = ALIGN_SAM_PROFILE_SCORE_TAG + std::to_string(k + 1);
+            int score;
+            REQUIRE(rec.aux.get(tag, score));
+            CHECK(score == separate[k][n]);
+            const size_t at = aux.find(tag + ":");
+            CHECK(at > last);
+            last = at;
+        }
+        ++n;
+    } while (in.next());
+    CHECK(n == num_reads);
+
+    std::vector<const char *> too_many = {"--profiles", "bwa,bwa,bwa,bwa,bwa,bwa,bwa,bwa,bwa,bwa"};
+    CHECK_THROWS(align_to("tmpsam.vatmp", too_many));
+
+    remove("tmpgdef.vatmp");
+    remove("tmpreads.sam.vatmp");
+    remove("tmpsam.vatmp");
+    remove("tmpshard0.vatmp");
+}
@@ -0,0 +1,164 @@
+/**
+ * @brief
+ * NUMA aware placement of worker threads. Implementation.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#include "numa.h"
+#include "utils.h"
+#include "doctest.h"
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+std::vector<unsigned> vargas::numa::parse_cpulist(const std::string &list) {
+    std::vector<unsigned> ret;
+    for (const auto &range : rg::split(list, ',')) {
+        if (range.empty() || range == "\n") continue;
+        const auto ends = rg::split(range, '-');
+        try {
+            const unsigned lo = std::stoul(ends.at(0));
+            const unsigned hi = ends.size() > 1 ? std::stoul(ends[1]) : lo;
+            if (ends.size() > 2 || hi < lo) throw std::invalid_argument(range);
+            for (unsigned c = lo; c <= hi; ++c) ret.push_back(c);
+        } catch (std::exception &e) {
+            throw std::invalid_argument("Invalid CPU list: " + list);
+        }
+    }
+    return ret;
+}
+
+
+std::vector<std::vector<unsigned>> vargas::numa::nodes() {
+    std::vector<unsigned> allowed;
+    #ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (unsigned c = 0; c < CPU_SETSIZE; ++c) {
+            if (CPU_ISSET(c, &set)) allowed.push_back(c);
+        }
+    }
+    #endif
+    if (allowed.empty()) {
+        for (unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()); ++c) allowed.push_back(c);
+    }
+
+    std::vector<std::vector<unsigned>> ret;
+    #ifdef __linux__
+    std::vector<unsigned> ids;
+    if (DIR *dir = opendir("/sys/devices/system/node")) {
+        while (const dirent *ent = readdir(dir)) {
+            const std::string name = ent->d_name;
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0
+                && std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                ids.push_back(std::stoul(name.substr(4)));
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+    for (const unsigned id : ids) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+        std::string line;
+        if (!std::getline(in, line)) continue;
+        std::vector<unsigned> cpus;
+        for (const unsigned c : parse_cpulist(line)) {
+            if (std::binary_search(allowed.begin(), allowed.end(), c)) cpus.push_back(c);
+        }
+        if (!cpus.empty()) ret.push_back(std::move(cpus));
+    }
+    #endif
+    if (ret.empty()) ret.push_back(allowed);
+    return ret;
+}
+
+
+vargas::numa::Placement vargas::numa::place(const unsigned workers, const std::vector<std::vector<unsigned>> &nodes) {
+    if (nodes.empty()) throw std::invalid_argument("No NUMA nodes to place workers on.");
+    Placement ret;
+    ret.num_nodes = nodes.size();
+    for (unsigned w = 0; w < workers; ++w) {
+        const unsigned n = w % nodes.size();
+        ret.node.push_back(n);
+        ret.cpu.push_back(nodes[n][(w / nodes.size()) % nodes[n].size()]);
+    }
+    return ret;
+}
+
+
+bool vargas::numa::pin(const unsigned cpu) {
+    #ifdef __linux__
+    if (cpu >= CPU_SETSIZE) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    #else
+    (void) cpu;
+    return false;
+    #endif
+}
+
+
+void vargas::numa::run_each(const std::vector<unsigned> &cpus, const std::function<void(size_t)> &fn) {
+    std::mutex mut;
+    std::exception_ptr err;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            pin(cpus[i]);
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mut);
+                if (!err) err = std::current_exception();
+            }
+        });
+    }
+    for (auto &t : threads) t.join();
+    if (err) std::rethrow_exception(err);
+}
+
+TEST_SUITE("NUMA");
+
+TEST_CASE ("NUMA placement") {
+    using namespace vargas::numa;
+
+    CHECK((parse_cpulist("0-3,8,10-11\n") == std::vector<unsigned>{0, 1, 2, 3, 8, 10, 11}));
+    CHECK(parse_cpulist("").empty());
+    CHECK_THROWS(parse_cpulist("3-1"));
+    CHECK_THROWS(parse_cpulist("a"));
+
+    const std::vector<std::vector<unsigned>> two = {{0, 1}, {2, 3}};
+    const auto p = place(5, two);
+    CHECK(p.num_nodes == 2);
+    CHECK((p.cpu == std::vector<unsigned>{0, 2, 1, 3, 0}));
+    CHECK((p.node == std::vector<unsigned>{0, 1, 0, 1, 0}));
+
+    const auto local = nodes();
+    REQUIRE(local.size() > 0);
+    CHECK(local.front().size() > 0);
+
+    std::vector<int> ran(3, 0);
+    run_each({local[0][0], local[0][0], local[0][0]}, [&](size_t i) { ran[i] = i + 1; });
+    CHECK((ran == std::vector<int>{1, 2, 3}));
+    CHECK_THROWS(run_each({local[0][0]}, [](size_t) { throw std::runtime_error("fail"); }));
+}
+
+TEST_SUITE_END();
@@ -19,7 +19,9 @@
 #include "sam.h"
 #include "doctest.h"
 #include <assert.h>
-#include <numeric>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 const std::string vargas::SAM::Record::REQUIRED_POS = "POS";
 const std::string vargas::SAM::Record::REQUIRED_QNAME = "QNAME";
@@ -33,27 +35,80 @@ const std::string vargas::SAM::Record::REQUIRED_MAPQ = "MAPQ";
 const std::string vargas::SAM::Record::REQUIRED_TLEN = "TLEN";
 const std::string vargas::SAM::Record::REQUIRED_QUAL = "QUAL";
 
-void vargas::SAM::Optional::add(std::string a) {
-    const std::vector<std::string> s = rg::split(a, ':');
-    assert(s[0].length() == 2);
-    if (s.size() == 2) {
-        aux[s[0]] = s[1];
-        aux_fmt[s[0]] = 'Z';
-    } else if (s.size() >= 3) {
-        assert(s[1].length() == 1);
-        aux_fmt[s[0]] = s[1].at(0);
-        aux[s[0]] = a.substr(5);
-    } else throw std::invalid_argument("Invalid format: " + a);
+void vargas::SAM::Optional::add(rg::str_view a) {
+    // TAG:TYPE:VALUE or TAG:VALUE
+    const char *c1 = std::find(a.begin(), a.end(), ':');
+    if (c1 == a.end() || c1 - a.begin() != 2) throw std::invalid_argument("Invalid format: " + a.str());
+    const char *c2 = std::find(c1 + 1, a.end(), ':');
+
+    Field &f = _slot(tag_code(rg::str_view(a.begin(), c1)));
+    f.kind = Field::Kind::STR;
+    if (c2 == a.end()) {
+        f.fmt = 'Z';
+        f.val.assign(c1 + 1, a.end());
+    } else {
+        if (c2 - c1 != 2) throw std::invalid_argument("Invalid format: " + a.str());
+        f.fmt = c1[1];
+        if (f.fmt == 'i') {
+            // Integers are stored inline, floats keep their text so they round trip exactly
+            f.kind = Field::Kind::INT;
+            f.i = rg::parse_int(rg::str_view(c2 + 1, a.end()));
+        }
+        else f.val.assign(c2 + 1, a.end());
+    }
+}
+
+void vargas::SAM::Optional::Field::append_value(std::string &out) const {
+    switch (kind) {
+        case Kind::INT: {
+            // Format into a local buffer rather than through std::to_string
+            char buf[24];
+            char *e = buf + sizeof(buf), *b = e;
+            uint64_t u = i < 0 ? -uint64_t(i) : uint64_t(i);
+            do {
+                *--b = char('0' + u % 10);
+                u /= 10;
+            } while (u);
+            if (i < 0) *--b = '-';
+            out.append(b, e);
+            break;
+        }
+        case Kind::FLOAT:
+            out += std::to_string(f);
+            break;
+        case Kind::STR:
+            out += val;
+            break;
+    }
+}
+
+vargas::SAM::Optional::Field &vargas::SAM::Optional::_slot(uint16_t code) {
+    for (size_t i = 0; i < _n; ++i) {
+        if (_fields[i].tag == code) return _fields[i];
+    }
+    if (_n == _fields.size()) _fields.emplace_back();
+    Field &f = _fields[_n++];
+    f.tag = code;
+    return f;
 }
 
 std::string vargas::SAM::Optional::to_string() const {
-    std::ostringstream ss;
-    for (auto &pair : aux) {
-        ss << '\t' << pair.first
-           << ':' << aux_fmt.at(pair.first)
-           << ':' << pair.second;
+    std::string ret;
+    append_to(ret);
+    return ret;
+}
+
+void vargas::SAM::Optional::append_to(std::string &out) const {
+    for (size_t i = 0; i < _n; ++i) {
+        const Field &f = _fields[i];
+        out += '\t';
+        out += char(f.tag & 0xFF);
+        if (f.tag >> 8) out += char(f.tag >> 8);
+        out += ':';
+        out += f.fmt;
+        out += ':';
+        f.append_value(out);
     }
-    return ss.str();
 }
 
 std::string vargas::SAM::Header::Sequence::to_string() const {
@@ -314,29 +369,45 @@ std::string vargas::SAM::Record::to_string() const {
     return ss.str();
 }
 
-void vargas::SAM::Record::parse(std::string line) {
-    std::vector<std::string> cols = rg::split(line, '\t');
-    if (cols.size() < 11) throw std::invalid_argument("Record should have at least 11 columns");
+void vargas::SAM::Record::parse(rg::str_view line) {
+    if (std::count(line.begin(), line.end(), '\t') < 10)
+        throw std::invalid_argument("Record should have at least 11 columns");
+
+    // Walk the columns in place rather than splitting into strings
+    const char *p = line.begin();
+    bool more = true;
+    auto next_col = [&]() {
+        const char *e = std::find(p, line.end(), '\t');
+        rg::str_view col(p, e);
+        more = e != line.end();
+        p = more ? e + 1 : e;
+        return col;
+    };
+    auto assign = [](std::string &dest, rg::str_view col) {
+        dest.assign(col.begin(), col.end());
+    };
+
     try {
-        query_name = cols[0];
-        flag = std::stoi(cols[1]);
-        ref_name = cols[2];
-        pos = std::stoi(cols[3]);
-        mapq = std::stoi(cols[4]);
-        cigar = cols[5];
-        ref_next = cols[6];
-        pos_next = std::stoi(cols[7]);
-        tlen = std::stoi(cols[8]);
-        seq = cols[9];
-        qual = cols[10];
+        assign(query_name, next_col());
+        flag = rg::parse_int(next_col());
+        assign(ref_name, next_col());
+        pos = rg::parse_int(next_col());
+        mapq = rg::parse_int(next_col());
+        cigar.parse(next_col());
+        assign(ref_next, next_col());
+        pos_next = rg::parse_int(next_col());
+        tlen = rg::parse_int(next_col());
+        assign(seq, next_col());
+        assign(qual, next_col());
         aux.clear();
     } catch (std::exception &e) {
-        throw std::invalid_argument("Error parsing SAM record:\n" + line);
+        throw std::invalid_argument("Error parsing SAM record:\n" + line.str());
     }
 
     // Aux fields
-    for (size_t i = 11; i < cols.size(); ++i) {
-        aux.add(cols[i]);
+    while (more) {
+        const rg::str_view col = next_col();
+        if (!col.empty()) aux.add(col);
     }
 
 }
@@ -375,7 +446,7 @@ void vargas::isam::open(std::istream &is) {
     }
     if (hdr.str().length() > 0) _hdr << hdr.str();
 
-    _pprec << _curr_line;
+    _pprec.parse(_curr_line);
 }
 
 void vargas::isam::open(std::string file_name) {
@@ -384,6 +455,19 @@ void vargas::isam::open(std::string file_name) {
         _use_stdio = true;
         open(std::cin);
     }
+    else if (rg::ends_with(file_name, ".bam")) {
+        _use_stdio = false;
+        _hts = sam_open(file_name.c_str(), "r");
+        if (_hts == nullptr) throw std::invalid_argument("Error opening file \"" + file_name + "\"");
+        _bam_hdr = sam_hdr_read(_hts);
+        if (_bam_hdr == nullptr) {
+            close();
+            throw std::invalid_argument("Invalid BAM header in \"" + file_name + "\"");
+        }
+        if (_bam_hdr->l_text > 0) _hdr << std::string(_bam_hdr->text, _bam_hdr->l_text);
+        _bam = bam_init1();
+        _next_bam();
+    }
     else {
         _use_stdio = false;
         in.open(file_name);
@@ -392,26 +476,27 @@ void vargas::isam::open(std::string file_name) {
     }
 }
 
-void vargas::isam::subset(size_t n) {
+void vargas::isam::subset(size_t n, uint64_t seed) {
     if (!good()) throw std::invalid_argument("No records available.");
-    std::vector<Record> pending;
-    do { pending.push_back(_pprec); } while (next());
-    if (pending.size() == 0) throw std::invalid_argument("No records available.");
-
-    std::vector<size_t> idx(pending.size());
-    std::iota(idx.begin(), idx.end(), 0);
-    std::random_shuffle(idx.begin(), idx.begin());
-
-    if (n >= pending.size() || n == 0) {
-        _buff = pending;
-    } else {
-        for (size_t i = 0; i < n; ++i) {
-            _buff.push_back(pending[idx[i]]);
-        }
-    }
+    if (n == 0) return;
+    rg::Reservoir<Record> sample(n, seed);
+    do { sample.offer(_pprec); } while (next());
+    _buff = std::move(sample.items());
     next();
 }
 
+void vargas::isam::close() {
+    in.close();
+    if (_bam) bam_destroy1(_bam);
+    if (_bam_hdr) bam_hdr_destroy(_bam_hdr);
+    if (_hts) sam_close(_hts);
+    _bam = nullptr;
+    _bam_hdr = nullptr;
+    _hts = nullptr;
+    _hdr = SAM::Header();
+    _pprec = SAM::Record();
+}
+
 bool vargas::isam::next() {
     if (_buff.size() > 0) {
         _pprec = _buff.back();
@@ -419,14 +504,166 @@ bool vargas::isam::next() {
         return true;
     }
 
+    if (_hts) return _next_bam();
     if (!std::getline((_use_stdio ? std::cin : in), _curr_line)) return false;
     _pprec.parse(_curr_line);
     return true;
 }
 
+bool vargas::isam::skip() {
+    if (_buff.size() > 0) {
+        _buff.pop_back();
+        return true;
+    }
+    if (_hts) {
+        const int r = sam_read1(_hts, _bam_hdr, _bam);
+        if (r < -1) throw std::invalid_argument("Error reading BAM record.");
+        return r >= 0;
+    }
+    return bool(std::getline((_use_stdio ? std::cin : in), _curr_line));
+}
+
+bool vargas::isam::_next_bam() {
+    const int r = sam_read1(_hts, _bam_hdr, _bam);
+    if (r < -1) throw std::invalid_argument("Error reading BAM record.");
+    if (r == -1) {
+        // Release the file at EOF, the header stays available
+        bam_destroy1(_bam);
+        bam_hdr_destroy(_bam_hdr);
+        sam_close(_hts);
+        _bam = nullptr;
+        _bam_hdr = nullptr;
+        _hts = nullptr;
+        return false;
+    }
+
+    const bam1_core_t &c = _bam->core;
+    SAM::Record &rec = _pprec;
+
+    rec.query_name.assign(bam_get_qname(_bam));
+    rec.flag = c.flag;
+    rec.ref_name.assign(c.tid < 0 ? "*" : _bam_hdr->target_name[c.tid]);
+    rec.pos = c.pos + 1;
+    rec.mapq = c.qual;
+    rec.ref_next.assign(c.mtid < 0 ? "*" : c.mtid == c.tid ? "=" : _bam_hdr->target_name[c.mtid]);
+    rec.pos_next = c.mpos + 1;
+    rec.tlen = c.isize;
+
+    rec.cigar.clear();
+    const uint32_t *cigar = bam_get_cigar(_bam);
+    for (uint32_t i = 0; i < c.n_cigar; ++i) {
+        rec.cigar.push_back(bam_cigar_oplen(cigar[i]), bam_cigar_opchr(cigar[i]));
+    }
+
+    const uint8_t *seq = bam_get_seq(_bam), *qual = bam_get_qual(_bam);
+    if (c.l_qseq == 0) rec.seq.assign("*");
+    else {
+        rec.seq.resize(c.l_qseq);
+        for (int32_t i = 0; i < c.l_qseq; ++i) rec.seq[i] = seq_nt16_str[bam_seqi(seq, i)];
+    }
+    if (c.l_qseq == 0 || qual[0] == 0xff) rec.qual.assign("*");
+    else {
+        rec.qual.resize(c.l_qseq);
+        for (int32_t i = 0; i < c.l_qseq; ++i) rec.qual[i] = qual[i] + 33;
+    }
+
+    // Aux fields are formatted as TAG:TYPE:VALUE and go through Optional::add
+    rec.aux.clear();
+    const uint8_t *a = bam_get_aux(_bam), *end = a + bam_get_l_aux(_bam);
+    auto read_num = [](const uint8_t *&p, char type) -> double {
+        double v;
+        switch (type) {
+            case 'c': v = *(const int8_t *) p; p += 1; break;
+            case 'C': v = *p; p += 1; break;
+            case 's': { int16_t x; std::memcpy(&x, p, 2); v = x; p += 2; break; }
+            case 'S': { uint16_t x; std::memcpy(&x, p, 2); v = x; p += 2; break; }
+            case 'i': { int32_t x; std::memcpy(&x, p, 4); v = x; p += 4; break; }
+            case 'I': { uint32_t x; std::memcpy(&x, p, 4); v = x; p += 4; break; }
+            case 'f': { float x; std::memcpy(&x, p, 4); v = x; p += 4; break; }
+            case 'd': { double x; std::memcpy(&x, p, 8); v = x; p += 8; break; }
+            default: throw std::invalid_argument("Invalid BAM aux type: " + std::string(1, type));
+        }
+        return v;
+    };
+    auto append_num = [](std::string &out, double v, bool is_float) {
+        char buf[32];
+        // Enough digits for a float to read back to the same value
+        const int n = is_float ? std::snprintf(buf, sizeof(buf), "%.9g", v)
+                               : std::snprintf(buf, sizeof(buf), "%lld", (long long) v);
+        out.append(buf, n);
+    };
+    std::string &field = _curr_line; // Line buffer is unused for BAM input
+    while (a + 3 <= end) {
+        const char type = a[2];
+        field.assign((const char *) a, 2);
+        a += 3;
+        switch (type) {
+            case 'A':
+                field.append(":A:");
+                field += char(*a++);
+                break;
+            case 'Z':
+            case 'H': {
+                const uint8_t *e = (const uint8_t *) std::memchr(a, 0, end - a);
+                if (e == nullptr) throw std::invalid_argument("Unterminated BAM aux string.");
+                field += ':';
+                field += type;
+                field += ':';
+                field.append((const char *) a, e - a);
+                a = e + 1;
+                break;
+            }
+            case 'B': {
+                const char sub = a[0];
+                uint32_t n;
+                std::memcpy(&n, a + 1, 4);
+                a += 5;
+                field.append(":B:");
+                field += sub;
+                for (uint32_t i = 0; i < n; ++i) {
+                    field += ',';
+                    append_num(field, read_num(a, sub), sub == 'f');
+                }
+                break;
+            }
+            default: {
+                const bool is_float = type == 'f' || type == 'd';
+                field.append(is_float ? ":f:" : ":i:");
+                append_num(field, read_num(a, type), is_float);
+            }
+        }
+        rec.aux.add(field);
+    }
+    return true;
+}
+
 void vargas::osam::open(std::string file_name) {
     close();
     if (file_name.length() == 0) _use_stdio = true;
+    else if (rg::ends_with(file_name, ".bam")) {
+        _use_stdio = false;
+        _hts = sam_open(file_name.c_str(), _bam_compress ? "wb" : "wbu");
+        if (_hts == nullptr) throw std::invalid_argument("Error opening output file \"" + file_name + "\"");
+        if (_bam_threads > 1) hts_set_threads(_hts, _bam_threads);
+
+        const std::string text = _hdr.to_string();
+        _bam_hdr = sam_hdr_parse(text.size(), text.c_str());
+        if (_bam_hdr == nullptr) {
+            close();
+            throw std::invalid_argument("Unable to convert SAM header for \"" + file_name + "\"");
+        }
+        // sam_hdr_parse only builds the target dictionary, keep the full text as sam_hdr_read does
+        std::free(_bam_hdr->text);
+        _bam_hdr->l_text = text.size();
+        _bam_hdr->text = (char *) std::malloc(text.size() + 1);
+        std::memcpy(_bam_hdr->text, text.c_str(), text.size() + 1);
+        if (sam_hdr_write(_hts, _bam_hdr) < 0) {
+            close();
+            throw std::invalid_argument("Error writing BAM header to \"" + file_name + "\"");
+        }
+        _bam = bam_init1();
+        return;
+    }
     else {
         _use_stdio = false;
         out.open(file_name);
@@ -435,20 +672,188 @@ void vargas::osam::open(std::string file_name) {
     (_use_stdio ? std::cout : out) << _hdr.to_string() << std::flush;
 }
 
+void vargas::osam::close() {
+    if (out.is_open()) {
+        out.close();
+    }
+    if (_bam) bam_destroy1(_bam);
+    if (_bam_hdr) bam_hdr_destroy(_bam_hdr);
+    if (_hts) sam_close(_hts);
+    _bam = nullptr;
+    _bam_hdr = nullptr;
+    _hts = nullptr;
+}
+
+namespace {
+
+  template<typename T>
+  void put(std::vector<uint8_t> &out, const T v) {
+      const size_t n = out.size();
+      out.resize(n + sizeof(T));
+      std::memcpy(&out[n], &v, sizeof(T)); // BAM is little endian, as are the supported targets
+  }
+
+  /**
+   * @brief
+   * Append an integer in the smallest BAM type that holds it.
+   * @return BAM type character
+   * @throws std::invalid_argument if v does not fit in 32 bits
+   */
+  char put_int(std::vector<uint8_t> &out, const int64_t v) {
+      if (v < 0) {
+          if (v >= INT8_MIN) { put<int8_t>(out, v); return 'c'; }
+          if (v >= INT16_MIN) { put<int16_t>(out, v); return 's'; }
+          if (v >= INT32_MIN) { put<int32_t>(out, v); return 'i'; }
+      } else {
+          if (v <= UINT8_MAX) { put<uint8_t>(out, v); return 'C'; }
+          if (v <= UINT16_MAX) { put<uint16_t>(out, v); return 'S'; }
+          if (v <= UINT32_MAX) { put<uint32_t>(out, v); return 'I'; }
+      }
+      throw std::invalid_argument("Aux integer out of BAM range: " + std::to_string(v));
+  }
+
+  /**
+   * @brief
+   * Append a B array, "SUBTYPE,V1,V2,..."
+   */
+  void put_array(std::vector<uint8_t> &out, const std::string &val) {
+      if (val.empty()) throw std::invalid_argument("Empty B array.");
+      const char sub = val[0];
+      out.push_back(uint8_t(sub));
+      const size_t count_at = out.size();
+      put<uint32_t>(out, 0);
+      uint32_t n = 0;
+      for (size_t b = val.find(','); b != std::string::npos; ++n) {
+          const size_t e = val.find(',', b + 1);
+          const rg::str_view v(val.data() + b + 1, val.data() + (e == std::string::npos ? val.size() : e));
+          switch (sub) {
+              case 'c': put<int8_t>(out, rg::parse_int(v)); break;
+              case 'C': put<uint8_t>(out, rg::parse_int(v)); break;
+              case 's': put<int16_t>(out, rg::parse_int(v)); break;
+              case 'S': put<uint16_t>(out, rg::parse_int(v)); break;
+              case 'i': put<int32_t>(out, rg::parse_int(v)); break;
+              case 'I': put<uint32_t>(out, rg::parse_int(v)); break;
+              case 'f': put<float>(out, std::strtof(v.str().c_str(), nullptr)); break;
+              default: throw std::invalid_argument("Invalid B array type: " + std::string(1, sub));
+          }
+          b = e;
+      }
+      std::memcpy(&out[count_at], &n, 4);
+  }
+
+}
+
+void vargas::osam::_write_bam(const SAM::Record &r) {
+    // bam_set1 is newer than the htslib we build against, so lay out bam1_t::data as
+    // sam_parse1 does: qname, cigar, 4 bit seq, qual, aux
+    if (r.query_name.empty() || r.query_name.size() > 254) {
+        throw std::invalid_argument("Invalid BAM query name: " + r.query_name);
+    }
+    if (r.cigar.size() > 0xFFFF) throw std::invalid_argument("Too many CIGAR operations for BAM: " + r.query_name);
+    const bool has_seq = r.seq != "*";
+    const size_t l_seq = has_seq ? r.seq.size() : 0;
+    const bool has_qual = has_seq && r.qual != "*";
+    if (has_qual && r.qual.size() != l_seq) throw std::invalid_argument("SEQ and QUAL lengths differ: " + r.query_name);
+
+    _data.assign(r.query_name.begin(), r.query_name.end());
+    _data.push_back(0);
+
+    int64_t ref_len = 0;
+    for (const auto &op : r.cigar) {
+        const char *o = std::strchr(BAM_CIGAR_STR, op.second);
+        if (o == nullptr) throw std::invalid_argument("Unable to convert record to BAM: " + r.query_name);
+        put<uint32_t>(_data, uint32_t(op.first) << BAM_CIGAR_SHIFT | uint32_t(o - BAM_CIGAR_STR));
+        if (std::strchr("MDN=X", op.second)) ref_len += op.first;
+    }
+
+    const size_t seq_at = _data.size();
+    _data.resize(seq_at + (l_seq + 1) / 2, 0);
+    for (size_t i = 0; i < l_seq; ++i) {
+        _data[seq_at + i / 2] |= seq_nt16_table[uint8_t(r.seq[i])] << ((~i & 1) << 2);
+    }
+    for (size_t i = 0; i < l_seq; ++i) _data.push_back(has_qual ? uint8_t(r.qual[i] - 33) : 0xff);
+
+    for (const auto &f : r.aux) {
+        _data.push_back(uint8_t(f.tag & 0xFF));
+        _data.push_back(uint8_t(f.tag >> 8));
+        const size_t type_at = _data.size();
+        _data.push_back(uint8_t(f.fmt));
+        switch (f.fmt) {
+            case 'A':
+                if (f.val.size() != 1) throw std::invalid_argument("Invalid A aux value: " + f.val);
+                _data.push_back(uint8_t(f.val[0]));
+                break;
+            case 'Z':
+            case 'H':
+                _data.insert(_data.end(), f.val.begin(), f.val.end());
+                _data.push_back(0);
+                break;
+            case 'i':
+                _data[type_at] = uint8_t(put_int(_data, f.kind == Optional::Field::Kind::INT ? f.i : rg::parse_int(f.val)));
+                break;
+            case 'f':
+                put<float>(_data, f.kind == Optional::Field::Kind::FLOAT ? float(f.f) : std::strtof(f.val.c_str(), nullptr));
+                break;
+            case 'B':
+                put_array(_data, f.val);
+                break;
+            default:
+                throw std::invalid_argument("Invalid aux type: " + std::string(1, f.fmt));
+        }
+    }
+
+    uint16_t flag = uint16_t(r.flag.encode());
+    const int32_t tid = _tid(r.ref_name);
+    if (tid < 0 && r.ref_name != "*") flag |= 4; // As htslib, an unknown reference is unmapped
+    bam1_core_t &c = _bam->core;
+    c.tid = tid;
+    c.pos = r.pos - 1;
+    c.qual = r.mapq;
+    c.l_qname = r.query_name.size() + 1;
+    c.flag = flag;
+    c.n_cigar = r.cigar.size();
+    c.l_qseq = l_seq;
+    c.mtid = r.ref_next == "=" ? tid : _tid(r.ref_next);
+    c.mpos = r.pos_next - 1;
+    c.isize = r.tlen;
+    c.bin = hts_reg2bin(c.pos, c.pos + (ref_len > 0 ? ref_len : 1), 14, 5);
+
+    // bam_destroy1 frees the data, so it has to come from malloc
+    if (size_t(_bam->m_data) < _data.size()) {
+        uint8_t *d = (uint8_t *) std::realloc(_bam->data, _data.size());
+        if (d == nullptr) throw std::bad_alloc();
+        _bam->data = d;
+        _bam->m_data = _data.size();
+    }
+    std::memcpy(_bam->data, _data.data(), _data.size());
+    _bam->l_data = _data.size();
+
+    if (sam_write1(_hts, _bam_hdr, _bam) < 0) throw std::invalid_argument("Error writing BAM record: " + r.query_name);
+}
+
 vargas::Cigar vargas::Cigar::operator=(const std::string &s) {
     parse(s);
     return *this;
 }
 
-void vargas::Cigar::parse(const std::string &s) {
+void vargas::Cigar::parse(rg::str_view s) {
     _cigar.clear();
-    if (s.length() < 2) return;
-    size_t prev = 0, curr;
-    while (prev != s.length()) {
-        curr = s.find_first_of(CIGAR_OPERATORS, prev);
-        _cigar.push_back(std::pair<size_t, char>(prev == curr ? 1 : std::stoi(s.substr(prev, curr)), s[curr]));
-        prev = ++curr;
+    if (s.size() < 2) return;
+    size_t len = 0;
+    bool has_len = false;
+    for (const char c : s) {
+        if (c >= '0' && c <= '9') {
+            len = len * 10 + (c - '0');
+            has_len = true;
+        } else {
+            if (std::strchr(CIGAR_OPERATORS "=", c) == nullptr)
+                throw std::invalid_argument("Invalid CIGAR operator: " + s.str());
+            _cigar.emplace_back(has_len ? len : 1, c);
+            len = 0;
+            has_len = false;
+        }
     }
+    if (has_len) throw std::invalid_argument("CIGAR length without operator: " + s.str());
 }
 
 
@@ -484,6 +889,80 @@ TEST_CASE ("SAM Optional") {
         CHECK(o.get("d", val));
         CHECK(val == "DD");
     }
+
+    o.set("b", 2);
+    CHECK(o.size() == 4);
+    CHECK(o.to_string() == "\ta:Z:b\tb:i:2\tc:f:1.000000\td:Z:DD");
+    CHECK_THROWS(o.set("abc", 1));
+
+    o.clear();
+    CHECK(o.size() == 0);
+    int val;
+    CHECK_FALSE(o.get("b", val));
+    o.add("XT:A:U");
+    o.add("RG:Z:UM0098:1");
+    o.add("XS:abc");
+    CHECK(o.to_string() == "\tXT:A:U\tRG:Z:UM0098:1\tXS:Z:abc");
+    CHECK_THROWS(o.add("XTA"));
+
+    SUBCASE("Typed values") {
+        o.clear();
+        o.set("mp", uint32_t(4000000000));
+        o.set("ss", -12);
+        o.add("NM:i:-3");
+        o.add("XF:f:0.5");
+        std::string sv;
+        int64_t iv;
+        float fv;
+        CHECK(o.get("mp", iv));
+        CHECK(iv == 4000000000);
+        CHECK(o.get("ss", sv));
+        CHECK(sv == "-12");
+        CHECK(o.get("NM", iv));
+        CHECK(iv == -3);
+        CHECK(o.get("XF", fv));
+        CHECK(fv == 0.5);
+        CHECK(o.to_string() == "\tmp:i:4000000000\tss:i:-12\tNM:i:-3\tXF:f:0.5");
+
+        // Replace a number with a string in a reused slot
+        o.set("ss", "abc");
+        CHECK(o.get("ss", sv));
+        CHECK(sv == "abc");
+    }
+}
+
+TEST_CASE ("SAM Record") {
+    vargas::SAM::Record r;
+    r.parse("q1\t16\tchr1\t100\t37\t3M1I\t=\t200\t-50\tACGT\tIIII\tXT:A:U\tNM:i:1");
+    CHECK(r.query_name == "q1");
+    CHECK(r.flag.rev_complement);
+    CHECK(r.ref_name == "chr1");
+    CHECK(r.pos == 100);
+    CHECK(r.mapq == 37);
+    CHECK(r.cigar.to_string() == "3M1I");
+    CHECK(r.ref_next == "=");
+    CHECK(r.pos_next == 200);
+    CHECK(r.tlen == -50);
+    CHECK(r.seq == "ACGT");
+    CHECK(r.qual == "IIII");
+    CHECK(r.aux.size() == 2);
+
+    SUBCASE("Reuse") {
+        r.parse("q2\t0\t*\t0\t255\t*\t*\t0\t0\tA\t*");
+        CHECK(r.query_name == "q2");
+        CHECK_FALSE(r.flag.rev_complement);
+        CHECK(r.cigar.size() == 0);
+        CHECK(r.aux.size() == 0);
+        std::string v;
+        CHECK_FALSE(r.aux.get("XT", v));
+        CHECK(r.to_string() == "q2\t0\t*\t0\t255\t*\t*\t0\t0\tA\t*");
+    }
+
+    SUBCASE("Invalid") {
+        CHECK_THROWS(r.parse("q2\t0\t*\t0\t255\t*\t*\t0\t0\tA"));
+        CHECK_THROWS(r.parse("q2\tx\t*\t0\t255\t*\t*\t0\t0\tA\t*"));
+        CHECK_THROWS(r.parse("q2\t0\t*\t0\t255\t3Q\t*\t0\t0\tA\t*"));
+    }
 }
 
 TEST_CASE ("SAM File") {
@@ -609,6 +1088,44 @@ TEST_CASE ("SAM File") {
             }
         }
 
+        SUBCASE("BAM IO") {
+            const std::string xf = "0.123456789";
+            std::vector<vargas::SAM::Record> recs;
+            std::string hdr;
+            {
+                vargas::isam sf("tmp_s.sam");
+                hdr = sf.header().to_string();
+                vargas::osam os("osam.bam", sf.header());
+                do {
+                    recs.push_back(sf.record());
+                    auto &r = recs.back();
+                    r.aux.add("xf:f:" + xf);
+                    r.aux.add("xn:i:-70000");
+                    r.aux.add("xu:i:4000000000");
+                    r.aux.add("xz:Z:two words");
+                    r.aux.add("xb:B:s,-1,2,300");
+                    os.add_record(r);
+                } while (sf.next());
+            }
+
+            vargas::isam b("osam.bam");
+            CHECK(b.header().sequences.size() == 3);
+            CHECK(b.header().to_string() == hdr);
+            size_t n = 0;
+            do {
+                REQUIRE(n < recs.size());
+                vargas::SAM::Record br = b.record();
+                std::string v;
+                REQUIRE(br.aux.get("xf", v));
+                CHECK(std::strtof(v.c_str(), nullptr) == std::strtof(xf.c_str(), nullptr));
+                br.aux.add("xf:f:" + xf);
+                CHECK(br.to_string() == recs[n].to_string());
+                ++n;
+            } while (b.next());
+            CHECK(n == recs.size());
+            remove("osam.bam");
+        }
+
         SUBCASE("Subset") {
             {
                 vargas::isam orig("tmp_s.sam");
@@ -631,6 +1148,13 @@ TEST_CASE ("SAM File") {
                 CHECK(orig.record().query_name.length());
                 CHECK_FALSE(orig.next());
             }
+
+            {
+                vargas::isam a("tmp_s.sam"), b("tmp_s.sam");
+                a.subset(1, 3);
+                b.subset(1, 3);
+                CHECK(a.record().query_name == b.record().query_name);
+            }
         }
 
     }
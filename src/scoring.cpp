@@ -26,6 +26,12 @@ std::string vargas::ScoreProfile::to_string() const {
     return ss.str();
 }
 
+vargas::ScoreProfile::penalty_lut_t vargas::ScoreProfile::penalty_lut() const {
+    penalty_lut_t lut;
+    for (unsigned q = 0; q < lut.size(); ++q) lut[q] = penalty(q);
+    return lut;
+}
+
 void vargas::Results::resize(size_t size) {
     max_pos.resize(size);
     sub_pos.resize(size);
@@ -35,10 +41,6 @@ void vargas::Results::resize(size_t size) {
     sub_score.resize(size);
     max_strand.resize(size);
     sub_strand.resize(size);
-    max_last_pos.resize(size);
-    sub_last_pos.resize(size);
-    waiting_pos.resize(size);
-    waiting_last_pos.resize(size);
 }
 
 std::vector<std::string> vargas::tokenize_cl(std::string cl) {
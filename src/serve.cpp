@@ -0,0 +1,531 @@
+/**
+ * @brief
+ * Persistent alignment server over a Unix domain socket.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#include "serve.h"
+#include "align_main.h"
+#include "alignment.h"
+#include "doctest.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+  sockaddr_un socket_address(const std::string &path) {
+      sockaddr_un addr;
+      std::memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+          throw std::invalid_argument("Invalid socket path: \"" + path + "\"");
+      }
+      std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+      return addr;
+  }
+
+  /**
+   * @brief
+   * Remove a socket file left by a server that exited without cleaning up.
+   * @throws std::runtime_error if a server answers on the path, or the path is not a socket
+   */
+  void remove_stale_socket(const std::string &path, const sockaddr_un &addr) {
+      struct stat st;
+      if (::lstat(path.c_str(), &st)) return; // Nothing there
+      if (!S_ISSOCK(st.st_mode)) throw std::runtime_error("\"" + path + "\" exists and is not a socket.");
+      const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0) throw std::runtime_error("Unable to create socket: " + std::string(std::strerror(errno)));
+      const bool live = ::connect(fd, (const sockaddr *) &addr, sizeof(addr)) == 0 || errno != ECONNREFUSED;
+      ::close(fd);
+      if (live) throw std::runtime_error("A server is already listening on \"" + path + "\"");
+      ::unlink(path.c_str());
+  }
+
+  std::string read_all(int fd) {
+      std::string ret;
+      char buf[1 << 16];
+      for (;;) {
+          const ssize_t n = ::read(fd, buf, sizeof(buf));
+          if (n < 0 && errno == EINTR) continue;
+          if (n <= 0) break;
+          ret.append(buf, n);
+      }
+      return ret;
+  }
+
+  bool write_all(int fd, const std::string &s) {
+      size_t done = 0;
+      while (done < s.size()) {
+          const ssize_t n = ::send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+          if (n < 0 && errno == EINTR) continue;
+          if (n <= 0) return false;
+          done += n;
+      }
+      return true;
+  }
+
+  std::string file_name(const std::string &path) {
+      const auto slash = path.find_last_of('/');
+      return slash == std::string::npos ? path : path.substr(slash + 1);
+  }
+
+}
+
+vargas::AlignServer::AlignServer(const std::vector<std::string> &gdfs, const ScoreProfile &prof, unsigned threads)
+: _prof(prof) {
+    if (gdfs.empty()) throw std::invalid_argument("No graph definition files.");
+    for (const auto &gdf : gdfs) {
+        std::cerr << "Loading \"" << gdf << "\"...\n";
+        _graphs.emplace_back(new GraphMan(gdf));
+        _names.push_back(gdf);
+    }
+    if (threads == 0) threads = 1;
+    _aligners.resize(threads);
+    for (unsigned i = 0; i < threads; ++i) _workers.emplace_back(&AlignServer::_work, this, i);
+}
+
+vargas::AlignServer::~AlignServer() {
+    {
+        std::lock_guard<std::mutex> lock(_mut);
+        _shutdown = true;
+    }
+    _cv.notify_all();
+    for (auto &w : _workers) w.join();
+}
+
+void vargas::AlignServer::_work(unsigned tid) {
+    for (;;) {
+        std::function<void(unsigned)> job;
+        {
+            std::unique_lock<std::mutex> lock(_mut);
+            _cv.wait(lock, [this] { return _shutdown || !_jobs.empty(); });
+            if (_jobs.empty()) return;
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+        job(tid);
+    }
+}
+
+size_t vargas::AlignServer::_graph_index(const std::string &name) const {
+    if (name.empty()) return 0;
+    for (size_t i = 0; i < _names.size(); ++i) {
+        if (_names[i] == name || file_name(_names[i]) == name) return i;
+    }
+    throw std::invalid_argument("No graph named \"" + name + "\"");
+}
+
+size_t vargas::AlignServer::_length(size_t graph, const std::string &label) {
+    std::lock_guard<std::mutex> lock(_graph_len_mut);
+    const auto key = std::make_pair(graph, label);
+    auto it = _graph_len.find(key);
+    if (it != _graph_len.end()) return it->second;
+    const size_t len = graph_length(*_graphs[graph], label);
+    _graph_len[key] = len;
+    return len;
+}
+
+vargas::AlignerBase &vargas::AlignServer::_aligner(unsigned tid, size_t read_len, bool msonly, bool maxonly) {
+    const unsigned width = aligner_width(_prof, read_len);
+    auto &cache = _aligners[tid];
+    // An aligner built for longer reads is reused
+    auto it = cache.lower_bound(aligner_key(read_len, 0, false, false));
+    for (; it != cache.end(); ++it) {
+        if (std::get<1>(it->first) == width && std::get<2>(it->first) == msonly && std::get<3>(it->first) == maxonly) {
+            return *it->second;
+        }
+    }
+    auto &ret = cache[aligner_key(read_len, width, msonly, maxonly)];
+    ret = make_aligner(_prof, read_len, width, msonly, maxonly);
+    return *ret;
+}
+
+void vargas::AlignServer::handle(std::istream &in, std::ostream &out) {
+    try {
+        std::string line;
+        if (!std::getline(in, line) || line != VARGAS_SERVE_MAGIC) {
+            throw std::invalid_argument("Expected \"" VARGAS_SERVE_MAGIC "\"");
+        }
+
+        std::string graph, alignto;
+        bool fwdonly = false, msonly = false, maxonly = false, notraceback = false, p64 = false, contigs = false;
+        bool onepass = false;
+        while (std::getline(in, line) && !line.empty()) {
+            const auto eq = line.find('=');
+            if (eq == std::string::npos) throw std::invalid_argument("Malformed request line: " + line);
+            const std::string key = line.substr(0, eq), val = line.substr(eq + 1);
+            if (key == "graph") graph = val;
+            else if (key == "alignto") alignto = val;
+            else if (key == "flags") {
+                for (const auto &f : rg::split(val, ',')) {
+                    if (f == "fwdonly") fwdonly = true;
+                    else if (f == "msonly") msonly = true;
+                    else if (f == "maxonly") maxonly = true;
+                    else if (f == "notraceback") notraceback = true;
+                    else if (f == "phred64") p64 = true;
+                    else if (f == "contigs") contigs = true;
+                    else if (f == "onepass") onepass = true;
+                    else throw std::invalid_argument("Unknown flag: " + f);
+                }
+            } else throw std::invalid_argument("Unknown key: " + key);
+        }
+        if (msonly && maxonly) throw std::invalid_argument("At most one of msonly and maxonly can be specified.");
+
+        std::string hdr_text;
+        std::vector<SAM::Record> records;
+        while (std::getline(in, line)) {
+            if (line.empty()) continue;
+            if (line[0] == '@') hdr_text += line + '\n';
+            else records.emplace_back(line);
+        }
+        if (records.empty()) throw std::invalid_argument("No records available.");
+
+        const size_t g = _graph_index(graph);
+        GraphMan &gm = *_graphs[g];
+        if (gm.labels().size() != 1 && !maxonly && !msonly) {
+            throw std::invalid_argument("Cannot calculate 2nd-max score when the genome is a graph. Use msonly or maxonly.");
+        }
+
+        SAM::Header hdr;
+        if (!hdr_text.empty()) hdr.parse(hdr_text);
+        size_t read_len;
+        auto task_list = create_tasks(hdr, records, alignto, 0, read_len, false, threads(), onepass);
+        {
+            std::unordered_map<std::string, size_t> graph_len;
+            for (const auto &task : task_list) graph_len[task.first] = _length(g, task.first);
+            const unsigned lanes = aligner_lanes(aligner_width(_prof, read_len));
+            schedule_tasks(task_list, graph_len, lanes);
+        }
+
+        // Tasks of this request are queued behind those of other requests
+        std::mutex done_mut;
+        std::condition_variable done_cv;
+        size_t remaining = task_list.size();
+        std::string error;
+        const char phred_offset = p64 ? 64 : 33;
+        {
+            std::lock_guard<std::mutex> lock(_mut);
+            for (auto &task : task_list) {
+                auto *t = &task;
+                _jobs.emplace_back([&, t](unsigned tid) {
+                    std::string err;
+                    try {
+                        size_t len = 0;
+                        for (const auto &r : t->second) len = std::max(len, r.seq.size());
+                        align_task(gm, t->first, t->second, _aligner(tid, len, msonly, maxonly),
+                                   fwdonly, msonly, maxonly, notraceback, phred_offset);
+                    } catch (std::exception &e) {
+                        err = e.what();
+                    }
+                    std::lock_guard<std::mutex> lock(done_mut);
+                    if (!err.empty() && error.empty()) error = err;
+                    if (--remaining == 0) done_cv.notify_all();
+                });
+            }
+        }
+        _cv.notify_all();
+        {
+            std::unique_lock<std::mutex> lock(done_mut);
+            done_cv.wait(lock, [&] { return remaining == 0; });
+        }
+        if (!error.empty()) throw std::runtime_error(error);
+
+        if (contigs) add_contigs(gm, hdr);
+        out << "OK\n" << hdr.to_string();
+        for (const auto &task : task_list) {
+            for (const auto &r : task.second) out << r.to_string() << '\n';
+        }
+    } catch (std::exception &e) {
+        std::string msg = e.what();
+        std::replace(msg.begin(), msg.end(), '\n', ' ');
+        out << "ERR " << msg << '\n';
+    }
+}
+
+void vargas::AlignServer::listen(const std::string &path) {
+    const sockaddr_un addr = socket_address(path);
+    remove_stale_socket(path, addr);
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("Unable to create socket: " + std::string(std::strerror(errno)));
+    if (::bind(fd, (const sockaddr *) &addr, sizeof(addr)) || ::listen(fd, 64)) {
+        const std::string err = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("Unable to listen on \"" + path + "\": " + err);
+    }
+    _listen_fd = fd;
+    if (_stopping) ::shutdown(fd, SHUT_RDWR); // stop() before the descriptor was published
+
+    while (!_stopping) {
+        const int conn = ::accept(fd, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_conn_mut);
+            ++_connections;
+        }
+        std::thread(&AlignServer::_connection, this, conn).detach();
+    }
+
+    _listen_fd = -1;
+    ::close(fd);
+    ::unlink(path.c_str());
+    std::unique_lock<std::mutex> lock(_conn_mut);
+    _conn_cv.wait(lock, [this] { return _connections == 0; });
+}
+
+void vargas::AlignServer::stop() {
+    _stopping = true;
+    const int fd = _listen_fd;
+    if (fd >= 0) ::shutdown(fd, SHUT_RDWR);
+}
+
+void vargas::AlignServer::_connection(int fd) {
+    std::istringstream in(read_all(fd));
+    std::ostringstream out;
+    handle(in, out);
+    write_all(fd, out.str());
+    ::close(fd);
+    std::lock_guard<std::mutex> lock(_conn_mut);
+    if (--_connections == 0) _conn_cv.notify_all();
+}
+
+std::string vargas::serve_request(const std::string &path, const std::string &request) {
+    const sockaddr_un addr = socket_address(path);
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("Unable to create socket: " + std::string(std::strerror(errno)));
+    if (::connect(fd, (const sockaddr *) &addr, sizeof(addr))) {
+        const std::string err = std::strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("Unable to connect to \"" + path + "\": " + err);
+    }
+    if (!write_all(fd, request)) {
+        ::close(fd);
+        throw std::runtime_error("Error sending request to \"" + path + "\"");
+    }
+    ::shutdown(fd, SHUT_WR);
+    std::string ret = read_all(fd);
+    ::close(fd);
+    if (ret.empty()) throw std::runtime_error("No response from \"" + path + "\"");
+    return ret;
+}
+
+std::vector<vargas::SAM::Record>
+vargas::serve_align(const std::string &path, const std::string &keys, const SAM::Header &reads_hdr,
+                    const std::vector<std::pair<std::string, std::vector<SAM::Record>>> &task_list,
+                    SAM::Header &resp_hdr) {
+    std::string request = VARGAS_SERVE_MAGIC "\n" + keys + "\n" + reads_hdr.to_string();
+    for (const auto &task : task_list) {
+        for (const auto &r : task.second) request += r.to_string() + '\n';
+    }
+    const std::string resp = serve_request(path, request);
+
+    const auto eol = resp.find('\n');
+    if (resp.compare(0, 4, "ERR ") == 0) throw std::runtime_error("Server: " + resp.substr(4, eol - 4));
+    if (resp.compare(0, eol, "OK") != 0) throw std::runtime_error("Malformed response from \"" + path + "\"");
+
+    std::vector<SAM::Record> ret;
+    std::string hdr_text;
+    std::istringstream in(resp.substr(eol + 1));
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        if (line[0] == '@') hdr_text += line + '\n';
+        else ret.emplace_back(line);
+    }
+    if (!hdr_text.empty()) resp_hdr.parse(hdr_text);
+    return ret;
+}
+
+namespace {
+  vargas::AlignServer *running_server = nullptr;
+
+  extern "C" void stop_server(int) {
+      if (running_server) running_server->stop();
+  }
+}
+
+int serve_main(int argc, char *argv[]) {
+    unsigned match, npenalty, threads;
+    std::string gdfs, socket_path, mismatch, rdg, rfg, huge_pages;
+    bool end_to_end = false;
+
+    cxxopts::Options opts("vargas serve", "Keep graphs loaded and align requests from a Unix domain socket.");
+    try {
+        opts.add_options("Input")
+        ("g,gdef", "<str, ...> *Graph definition files. The first is the default.", cxxopts::value(gdfs))
+        ("socket", "<str> *Socket path.", cxxopts::value(socket_path));
+
+        opts.add_options("Scoring")
+        ("ete", "End to end alignment.", cxxopts::value(end_to_end))
+        ("ma", "<N> Match bonus.", cxxopts::value(match)->default_value("2"))
+        ("mp", "<MIN,MAX> Mismatch penalty. Lower qual=lower penalty.", cxxopts::value(mismatch)->default_value("2,6"))
+        ("np", "<N> Penalty for non-A/C/G/T.", cxxopts::value(npenalty)->default_value("1"))
+        ("rdg", "<GO,GEXT> Read gap open/extension penalty.", cxxopts::value(rdg)->default_value("3,1"))
+        ("rfg", "<GO,GEXT> Ref gap open/extension penalty.", cxxopts::value(rfg)->default_value("3,1"));
+
+        opts.add_options("Threading")
+        ("j,threads", "<N> Number of alignment workers shared by all requests.", cxxopts::value(threads)->default_value("1"))
+        ("hugepages", "<str> Back aligner memory with 2MB pages: none, thp (transparent), or explicit (hugetlbfs).", cxxopts::value(huge_pages)->default_value("none"));
+
+        opts.add_options()("h,help", "Display this message.");
+        opts.parse(argc, argv);
+    } catch (std::exception &e) {
+        throw std::invalid_argument("Error parsing options: " + std::string(e.what()));
+    }
+
+    if (opts.count("h")) {
+        serve_help(opts);
+        return 0;
+    }
+    if (!opts.count("gdef") || !opts.count("socket")) {
+        serve_help(opts);
+        throw std::invalid_argument("Graph definition files and socket path required.");
+    }
+
+    vargas::ScoreProfile prof = parse_score_profile(match, npenalty, mismatch, rdg, rfg);
+    prof.end_to_end = end_to_end;
+    vargas::Arena::set_default_pages(vargas::huge_pages_from_string(huge_pages));
+
+    vargas::AlignServer server(rg::split(gdfs, ','), prof, threads);
+    std::cerr << "Scoring profile: " << prof.to_string() << "\n";
+    std::cerr << "Listening on \"" << socket_path << "\" with " << server.threads() << " workers.\n";
+
+    running_server = &server;
+    std::signal(SIGINT, stop_server);
+    std::signal(SIGTERM, stop_server);
+    server.listen(socket_path);
+    running_server = nullptr;
+    std::cerr << "Stopped.\n";
+    return 0;
+}
+
+void serve_help(const cxxopts::Options &opts) {
+    using std::cerr;
+    using std::endl;
+
+    cerr << opts.help(opts.groups()) << "\n\n";
+    cerr << "Align with \"vargas align --server <socket>\". Scoring is fixed by the server.\n" << endl;
+}
+
+TEST_SUITE("Alignment server");
+
+TEST_CASE ("Alignment server") {
+    const std::string gdf = "tmp_serve.gdef", sock = "tmp_serve.sock";
+    const std::string left = "ACGTTGCAAGCTTACGGATCCATGACTGATCGTAGCTAGC";
+    const std::string right = "GGCTAGCTTAGCATCGATCGGATACGTACGATCGAACGTT";
+    {
+        std::ofstream g(gdf);
+        g << "@vgraph\ndate\tx\n\n@contigs\n0\tx\n\n@graphs\nbase\t0,1,2,3\t0:1,2;1:3;2:3;\n\n@nodes\n"
+          << "0\t39\t1\t0\t1\t40\n" << left << "\n"
+          << "1\t40\t0.5\t0\t0\t1\nA\n"
+          << "2\t40\t0.5\t0\t1\t1\nC\n"
+          << "3\t80\t1\t0\t1\t40\n" << right << "\n";
+    }
+
+    vargas::ScoreProfile prof(2, 2, 3, 1);
+    vargas::AlignServer server({gdf}, prof, 2);
+    CHECK(server.threads() == 2);
+
+    // Reads spanning the SNP, the first twice to fill a task
+    std::ostringstream req;
+    req << VARGAS_SERVE_MAGIC "\nflags=maxonly\n\n@HD\tVN:1.0\n";
+    for (int i = 0; i < 3; ++i) {
+        req << "r" << i << "\t4\t*\t0\t255\t*\t*\t0\t0\t" << left.substr(30) + "C" + right.substr(0, 9) << "\t*\n";
+    }
+    req << "r3\t4\t*\t0\t255\t*\t*\t0\t0\t" << left.substr(20, 20) << "\t*\n";
+
+    SUBCASE("Handle") {
+        std::istringstream in(req.str());
+        std::ostringstream out;
+        server.handle(in, out);
+        std::istringstream resp(out.str());
+        std::string line;
+        REQUIRE(std::getline(resp, line));
+        CHECK(line == "OK");
+        std::map<std::string, vargas::SAM::Record> recs;
+        while (std::getline(resp, line)) {
+            if (line.empty() || line[0] == '@') continue;
+            vargas::SAM::Record r(line);
+            recs[r.query_name] = r;
+        }
+        REQUIRE(recs.size() == 4);
+        int as, mp;
+        REQUIRE(recs["r0"].aux.get("AS", as));
+        CHECK(as == 40);
+        REQUIRE(recs["r0"].aux.get(ALIGN_SAM_MAX_POS_TAG, mp));
+        CHECK(mp == 50);
+        REQUIRE(recs["r3"].aux.get(ALIGN_SAM_MAX_POS_TAG, mp));
+        CHECK(mp == 40);
+    }
+
+    SUBCASE("Errors") {
+        std::istringstream in(VARGAS_SERVE_MAGIC "\nflags=fast\n\n");
+        std::ostringstream out;
+        server.handle(in, out);
+        CHECK(out.str() == "ERR Unknown flag: fast\n");
+
+        std::istringstream in2("hello\n");
+        std::ostringstream out2;
+        server.handle(in2, out2);
+        CHECK(out2.str().substr(0, 4) == "ERR ");
+
+        std::istringstream in3(VARGAS_SERVE_MAGIC "\ngraph=other.gdef\n\nr\t4\t*\t0\t255\t*\t*\t0\t0\tACGT\t*\n");
+        std::ostringstream out3;
+        server.handle(in3, out3);
+        CHECK(out3.str() == "ERR No graph named \"other.gdef\"\n");
+    }
+
+    SUBCASE("Socket") {
+        {
+            // Socket file of a server that did not clean up
+            const sockaddr_un addr = socket_address(sock);
+            const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            REQUIRE(fd >= 0);
+            REQUIRE(::bind(fd, (const sockaddr *) &addr, sizeof(addr)) == 0);
+            ::close(fd);
+        }
+        std::thread th([&] { server.listen(sock); });
+        std::string resp;
+        for (int tries = 0; tries < 100 && resp.empty(); ++tries) {
+            try {
+                resp = vargas::serve_request(sock, req.str());
+            } catch (std::runtime_error &) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        // A live server keeps its socket
+        vargas::AlignServer other({gdf}, prof, 1);
+        CHECK_THROWS(other.listen(sock));
+        CHECK(vargas::serve_request(sock, req.str()).substr(0, 3) == "OK\n");
+
+        server.stop();
+        th.join();
+        CHECK(resp.substr(0, 3) == "OK\n");
+        CHECK(std::count(resp.begin(), resp.end(), '\n') >= 5);
+        CHECK(std::ifstream(sock).good() == false);
+    }
+
+    remove(gdf.c_str());
+}
+
+TEST_SUITE_END();
@@ -17,56 +17,70 @@
 
 bool vargas::Sim::_update_read(const coordinate_resolver& resolver) {
 
-    uint32_t curr_indiv = 0, curr_node;
+    uint32_t curr_indiv = 0;
     const bool has_pop = _graph.pop_size() != 0;
 
     // Pick an individual
 
     if (has_pop) {
         do {
-            curr_indiv = rand() % _graph.pop_size();
+            curr_indiv = _rng() % _graph.pop_size();
         } while (!_graph.filter()[curr_indiv]);
     }
 
 
     // Pick random weighted node and position within the node
-    do {
-        curr_node = _random_node_id();
-    } while (has_pop && !_nodes.at(curr_node).belongs(curr_indiv));
-    rg::pos_t curr_pos = rand() % _nodes.at(curr_node).length();
+    unsigned curr = _random_node();
+    for (unsigned tries = 0; has_pop && !_node_ptrs[curr]->belongs(curr_indiv); ++tries) {
+        if (tries == _stratum->nodes.size()) return false; // Individual may not be in this stratum
+        curr = _random_node();
+    }
+    const vargas::Graph::Node *node = _node_ptrs[curr];
+    rg::pos_t curr_pos = _rng() % node->length();
 
 
     int var_bases = 0;
     int var_nodes = 0;
     std::string read_str;
+    read_str.reserve(_prof.len);
 
     while (true) {
         // Extract len subseq
         unsigned len = _prof.len - read_str.length();
-        if (len > _nodes.at(curr_node).length() - curr_pos) len = _nodes.at(curr_node).length() - curr_pos;
-        read_str += _nodes.at(curr_node).seq_str().substr(curr_pos, len);
+        if (len > node->length() - curr_pos) len = node->length() - curr_pos;
+        const auto seq_begin = node->seq().begin() + curr_pos;
+        for (auto b = seq_begin; b != seq_begin + len; ++b) read_str += rg::num_to_base(*b);
         curr_pos += len;
 
-        if (!_nodes.at(curr_node).is_ref()) {
+        if (!node->is_ref()) {
             ++var_nodes;
             var_bases += len;
+            // Counts only grow along the walk
+            if (_prof.var_nodes >= 0 && var_nodes > _prof.var_nodes) return false;
+            if (_prof.var_bases >= 0 && var_bases > _prof.var_bases) return false;
         }
 
         assert(read_str.length() <= _prof.len);
         if (read_str.length() == _prof.len) break; // Done
 
         // Pick random next node.
-        if (_next.find(curr_node) == _next.end()) return false; // End of graph
+        const size_t sb = _succ_begin[curr], se = _succ_begin[curr + 1];
+        if (sb == se) return false; // End of graph
 
-        std::vector<uint32_t> valid_next;
-        if (!has_pop) valid_next = _next.at(curr_node);
+        if (!has_pop) curr = _succ[sb + _rng() % (se - sb)];
         else {
-            for (const uint32_t n : _next.at(curr_node)) {
-                if (_nodes.at(n).belongs(curr_indiv)) valid_next.push_back(n);
+            unsigned valid = 0;
+            for (size_t i = sb; i < se; ++i) valid += _node_ptrs[_succ[i]]->belongs(curr_indiv);
+            if (valid == 0) return false;
+            unsigned pick = _rng() % valid;
+            for (size_t i = sb; i < se; ++i) {
+                if (_node_ptrs[_succ[i]]->belongs(curr_indiv) && pick-- == 0) {
+                    curr = _succ[i];
+                    break;
+                }
             }
         }
-        if (valid_next.empty()) return false;
-        curr_node = valid_next[rand() % valid_next.size()];
+        node = _node_ptrs[curr];
         curr_pos = 0;
     }
 
@@ -84,21 +98,21 @@ bool vargas::Sim::_update_read(const coordinate_resolver& resolver) {
         for (char i : read_str) {
             char m = i;
             // Mutation error
-            if (rand() % 10000 < 10000 * _prof.mut) {
+            if (_rng() % 10000 < 10000 * _prof.mut) {
                 do {
-                    m = rg::rand_base();
+                    m = _rand_base();
                 } while (m == i);
                 ++sub_err;
             }
 
                 // Insertion
-            else if (rand() % 10000 < 5000 * _prof.indel) {
-                read_mut += rg::rand_base();
+            else if (_rng() % 10000 < 5000 * _prof.indel) {
+                read_mut += _rand_base();
                 ++indel_err;
             }
 
                 // Deletion (if we don't enter)
-            else if (rand() % 10000 > 5000 * _prof.indel) {
+            else if (_rng() % 10000 > 5000 * _prof.indel) {
                 read_mut += m;
                 ++indel_err;
             }
@@ -115,13 +129,13 @@ bool vargas::Sim::_update_read(const coordinate_resolver& resolver) {
             unsigned loc;
             for (int j = 0; j < sub_err; ++j) {
                 do {
-                    loc = rand() % read_mut.length();
+                    loc = _rng() % read_mut.length();
                 } while (mut_sites.count(loc));
                 mut_sites.insert(loc);
             }
             for (int i = 0; i < indel_err; ++i) {
                 do {
-                    loc = rand() % read_mut.length();
+                    loc = _rng() % read_mut.length();
                 } while (indel_sites.count(loc) || mut_sites.count(loc));
                 indel_sites.insert(loc);
             }
@@ -129,14 +143,14 @@ bool vargas::Sim::_update_read(const coordinate_resolver& resolver) {
 
         for (unsigned m : mut_sites) {
             do {
-                read_mut[m] = rg::rand_base();
+                read_mut[m] = _rand_base();
             } while (read_mut[m] == read_str[m]);
         }
 
         for (unsigned i : indel_sites) {
-            if (rand() % 2) {
+            if (_rng() % 2) {
                 // Insertion
-                read_mut.insert(i, 1, rg::rand_base());
+                read_mut.insert(i, 1, _rand_base());
             } else {
                 // Deletion
                 read_mut.erase(i, 1);
@@ -156,7 +170,7 @@ bool vargas::Sim::_update_read(const coordinate_resolver& resolver) {
     _read.aux.set(SIM_SAM_SUB_ERR_TAG, sub_err);
 
     // +1 from length being 1 indexed but end() being zero indexed, +1 since POS is 1 indexed.
-    auto resolved = resolver.resolve(_nodes.at(curr_node).end_pos() - _nodes.at(curr_node).length() + 2 + curr_pos - _prof.len);
+    auto resolved = resolver.resolve(node->end_pos() - node->length() + 2 + curr_pos - _prof.len);
     _read.pos = resolved.second;
     if (!resolved.first.empty()) _read.ref_name = resolved.first;
 
@@ -166,6 +180,12 @@ bool vargas::Sim::_update_read(const coordinate_resolver& resolver) {
 }
 bool vargas::Sim::update_read(const coordinate_resolver& resolver) {
     // Call internal function. update_read is a wrapper to prevent stack overflow
+    _rng = rg::CounterRNG(_seed, _read_idx++);
+    if (!_stratum) _select_stratum();
+    if (_stratum->table.empty()) {
+        std::cerr << "No start positions can satisfy profile: " << _prof.to_string() << std::endl;
+        return false;
+    }
     unsigned counter = 0;
     while (!_update_read(resolver)) {
         ++counter;
@@ -188,15 +208,110 @@ const std::vector<vargas::SAM::Record> &vargas::Sim::get_batch(unsigned size, co
 }
 
 void vargas::Sim::_init() {
-    uint64_t total = 0;
+    std::unordered_map<unsigned, unsigned> idx;
     for (auto giter = _graph.begin(); giter != _graph.end(); ++giter) {
-        total += giter->length();
-        _node_weights.push_back(total);
-        _node_ids.push_back(giter->id());
+        idx.emplace(giter->id(), _node_ptrs.size());
+        _node_ptrs.push_back(&*giter);
+    }
+    _num_graph_nodes = _node_ptrs.size();
+
+    _succ_begin.push_back(0);
+    for (size_t i = 0; i < _node_ptrs.size(); ++i) {
+        const auto next = _next.find(_node_ptrs[i]->id());
+        if (next != _next.end()) {
+            for (const unsigned id : next->second) {
+                auto ins = idx.emplace(id, _node_ptrs.size());
+                // Reachable but not iterated, can be walked through but never started in
+                if (ins.second) _node_ptrs.push_back(&_nodes.at(id));
+                _succ.push_back(ins.first->second);
+            }
+        }
+        _succ_begin.push_back(_succ.size());
+    }
+    _seed = std::random_device()();
+}
+
+void vargas::Sim::_select_stratum() {
+    if (_prof.len != _bounds_len) {
+        _bounds.clear();
+        _strata.clear();
+    }
+    const auto key = std::make_pair(_prof.var_nodes, _prof.var_bases);
+    auto found = _strata.find(key);
+    if (found != _strata.end()) {
+        _stratum = &found->second;
+        return;
+    }
+
+    const bool constrained = _prof.var_nodes >= 0 || _prof.var_bases >= 0;
+    if (constrained && _bounds.empty() && _prof.len > 0) {
+        std::unordered_map<uint64_t, _Bounds> memo;
+        const unsigned len = _prof.len;
+        _bounds.resize(_num_graph_nodes);
+        for (unsigned i = 0; i < _num_graph_nodes; ++i) {
+            const auto &n = *_node_ptrs[i];
+            const int v = !n.is_ref();
+            // The read covers 1 to max_here bases of the start node, the rest from successors
+            const unsigned max_here = std::min<unsigned>(n.length(), len);
+            const unsigned r_min = len - max_here, r_max = len - 1;
+            const _Bounds lo = r_min ? _succ_bounds(i, r_min, memo) : _Bounds{0, 0, 0, 0};
+            const _Bounds hi = r_max ? _succ_bounds(i, r_max, memo) : _Bounds{0, 0, 0, 0};
+            _bounds[i] = {v + lo.min_vnodes, v + hi.max_vnodes,
+                          v + lo.min_vbases, v * int(max_here) + hi.max_vbases};
+        }
+        _bounds_len = len;
+    }
+
+    _Stratum &st = _strata[key];
+    std::vector<uint64_t> weights;
+    for (unsigned i = 0; i < _num_graph_nodes; ++i) {
+        if (_node_ptrs[i]->length() == 0) continue;
+        if (constrained) {
+            const _Bounds &b = _bounds[i];
+            if (_prof.var_nodes >= 0 && (_prof.var_nodes < b.min_vnodes || _prof.var_nodes > b.max_vnodes)) continue;
+            if (_prof.var_bases >= 0 && (_prof.var_bases < b.min_vbases || _prof.var_bases > b.max_vbases)) continue;
+        }
+        st.nodes.push_back(i);
+        weights.push_back(_node_ptrs[i]->length());
+    }
+    st.table = rg::AliasTable(weights);
+    _stratum = &st;
+}
+
+vargas::Sim::_Bounds
+vargas::Sim::_walk_bounds(unsigned idx, unsigned r, std::unordered_map<uint64_t, _Bounds> &memo) const {
+    const uint64_t key = uint64_t(idx) << 32 | r;
+    const auto found = memo.find(key);
+    if (found != memo.end()) return found->second;
+
+    const auto &n = *_node_ptrs[idx];
+    const int v = !n.is_ref();
+    const int here = v * int(std::min<unsigned>(r, n.length()));
+    _Bounds ret{v, v, here, here};
+    if (r > n.length()) {
+        const _Bounds rest = _succ_bounds(idx, r - n.length(), memo);
+        ret.min_vnodes += rest.min_vnodes;
+        ret.max_vnodes += rest.max_vnodes;
+        ret.min_vbases += rest.min_vbases;
+        ret.max_vbases += rest.max_vbases;
+    }
+    memo.emplace(key, ret);
+    return ret;
+}
+
+vargas::Sim::_Bounds
+vargas::Sim::_succ_bounds(unsigned idx, unsigned r, std::unordered_map<uint64_t, _Bounds> &memo) const {
+    const size_t sb = _succ_begin[idx], se = _succ_begin[idx + 1];
+    if (sb == se) return {0, 0, 0, 0};
+    _Bounds ret = _walk_bounds(_succ[sb], r, memo);
+    for (size_t i = sb + 1; i < se; ++i) {
+        const _Bounds b = _walk_bounds(_succ[i], r, memo);
+        ret.min_vnodes = std::min(ret.min_vnodes, b.min_vnodes);
+        ret.max_vnodes = std::max(ret.max_vnodes, b.max_vnodes);
+        ret.min_vbases = std::min(ret.min_vbases, b.min_vbases);
+        ret.max_vbases = std::max(ret.max_vbases, b.max_vbases);
     }
-    std::random_device rd;
-    _rand_generator = std::mt19937(rd());
-    _node_weight_dist = std::uniform_int_distribution<uint64_t>(0, total);
+    return ret;
 }
 
 
@@ -214,7 +329,6 @@ std::string vargas::Sim::Profile::to_string() const {
 TEST_SUITE("Read Simulator");
 
 TEST_CASE ("Read sim") {
-    srand(1);
     vargas::Graph::Node::_newID = 0;
     using std::endl;
     std::string tmpfa = "tmp_tc.fa";
@@ -284,4 +398,82 @@ TEST_CASE ("Read sim") {
     remove(tmpvcf.c_str());
 }
 
+TEST_CASE ("Read sim seeding") {
+    vargas::Graph::Node::_newID = 0;
+    vargas::Graph g;
+    {
+        vargas::Graph::Node n;
+        n.set_endpos(40);
+        n.set_as_ref();
+        n.set_seq("CAAATAAGGCTTGGAAATTTTCTGGAGTTCTATTATATTC");
+        g.add_node(n);
+    }
+    {
+        vargas::Graph::Node n;
+        n.set_endpos(41);
+        n.set_not_ref();
+        n.set_seq("G");
+        g.add_node(n);
+    }
+    {
+        vargas::Graph::Node n;
+        n.set_endpos(41);
+        n.set_as_ref();
+        n.set_seq("A");
+        g.add_node(n);
+    }
+    {
+        vargas::Graph::Node n;
+        n.set_endpos(80);
+        n.set_as_ref();
+        n.set_seq("CAACTCTCTGGTTCCTGGTGCTATGTGTAACTAGTAATGG");
+        g.add_node(n);
+    }
+    g.add_edge(0, 1);
+    g.add_edge(0, 2);
+    g.add_edge(1, 3);
+    g.add_edge(2, 3);
+    g.set_popsize(0);
+
+    vargas::Sim::Profile prof;
+    prof.len = 10;
+    prof.mut = 1;
+    prof.indel = 1;
+    vargas::Sim sim(g, prof);
+    sim.seed(7);
+    const auto whole = sim.get_batch(10, vargas::coordinate_resolver());
+    REQUIRE(whole.size() == 10);
+
+    // The same reads when the batch is split over two sims
+    vargas::Sim other(g, prof);
+    other.seed(7, 4);
+    const auto tail = other.get_batch(6, vargas::coordinate_resolver());
+    REQUIRE(tail.size() == 6);
+    for (size_t i = 0; i < 6; ++i) {
+        CHECK(whole[i + 4].seq == tail[i].seq);
+        CHECK(whole[i + 4].pos == tail[i].pos);
+    }
+
+    other.seed(8);
+    CHECK(other.get_batch(10, vargas::coordinate_resolver()).front().seq != whole.front().seq);
+
+    // Strata are sampled from start nodes that can reach them
+    prof.mut = 0;
+    prof.indel = 0;
+    prof.var_nodes = 1;
+    prof.var_bases = 1;
+    other.set_prof(prof);
+    for (const auto &r : other.get_batch(20, vargas::coordinate_resolver())) {
+        int vn = -1;
+        REQUIRE(r.aux.get(SIM_SAM_VAR_NODES_TAG, vn));
+        CHECK(vn == 1);
+        CHECK(r.seq.length() == 10);
+    }
+
+    prof.var_nodes = 2;
+    prof.var_bases = -1;
+    other.set_prof(prof);
+    CHECK_FALSE(other.update_read(vargas::coordinate_resolver()));
+}
+
 TEST_SUITE_END();
\ No newline at end of file
@@ -0,0 +1,196 @@
+/**
+ * @brief
+ * Opt in timeline tracing. Implementation.
+ *
+ * @copyright
+ * Distributed under the MIT Software License.
+ * See accompanying LICENSE or https://opensource.org/licenses/MIT
+ *
+ * @file
+ */
+
+#include "trace.h"
+#include "doctest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+std::atomic<bool> vargas::trace::detail::enabled{false};
+
+namespace {
+
+  struct Registry {
+      std::mutex mut;
+      std::vector<std::unique_ptr<vargas::trace::Buffer>> buffers;
+      std::vector<vargas::trace::Buffer *> free;
+      size_t capacity = VA_TRACE_DEFAULT_CAPACITY;
+      std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+      std::atomic<uint64_t> generation{0}; // Bumped by start(), invalidates thread slots
+  };
+
+  // Never destroyed, threads may exit after static destruction
+  Registry &registry() {
+      static Registry *r = new Registry;
+      return *r;
+  }
+
+  // A thread's buffer, returned to the free list when the thread exits
+  struct Slot {
+      vargas::trace::Buffer *buf = nullptr;
+      uint64_t gen = 0;
+
+      vargas::trace::Buffer &get() {
+          Registry &reg = registry();
+          const uint64_t g = reg.generation.load(std::memory_order_acquire);
+          if (buf && gen == g) return *buf;
+          std::lock_guard<std::mutex> lock(reg.mut);
+          if (reg.free.size()) {
+              buf = reg.free.back();
+              reg.free.pop_back();
+          } else {
+              reg.buffers.emplace_back(new vargas::trace::Buffer(reg.capacity, reg.buffers.size()));
+              buf = reg.buffers.back().get();
+          }
+          gen = g;
+          return *buf;
+      }
+
+      ~Slot() {
+          if (!buf) return;
+          Registry &reg = registry();
+          std::lock_guard<std::mutex> lock(reg.mut);
+          if (gen == reg.generation.load()) reg.free.push_back(buf);
+      }
+  };
+
+  thread_local Slot slot;
+}
+
+std::vector<vargas::trace::Event> vargas::trace::Buffer::events() const {
+    const uint64_t h = _head.load(std::memory_order_acquire);
+    const uint64_t n = std::min<uint64_t>(h, _events.size());
+    std::vector<Event> ret;
+    ret.reserve(n);
+    for (uint64_t i = h - n; i < h; ++i) ret.push_back(_events[i % _events.size()]);
+    return ret;
+}
+
+void vargas::trace::start(size_t capacity) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mut);
+    reg.buffers.clear();
+    reg.free.clear();
+    reg.capacity = capacity;
+    reg.epoch = std::chrono::steady_clock::now();
+    ++reg.generation;
+    detail::enabled.store(true, std::memory_order_release);
+}
+
+void vargas::trace::stop() {
+    detail::enabled.store(false, std::memory_order_release);
+}
+
+uint64_t vargas::trace::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()
+                                                                - registry().epoch).count();
+}
+
+void vargas::trace::record(const char *name, uint64_t begin, uint64_t end, int64_t arg) {
+    slot.get().push({name, begin, end > begin ? end - begin : 0, arg});
+}
+
+void vargas::trace::write_json(std::ostream &os) {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mut);
+    const auto flags = os.flags();
+    os << std::fixed << std::setprecision(3);
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    uint64_t dropped = 0;
+    for (const auto &b : reg.buffers) {
+        dropped += b->dropped();
+        if (!first) os << ",\n";
+        first = false;
+        os << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << b->tid()
+           << R"(,"args":{"name":"thread )" << b->tid() << "\"}}";
+        for (const Event &e : b->events()) {
+            // Chrome trace timestamps are in microseconds
+            os << ",\n{\"name\":\"" << e.name << R"(","ph":"X","pid":1,"tid":)" << b->tid()
+               << ",\"ts\":" << e.begin * 1e-3 << ",\"dur\":" << e.dur * 1e-3;
+            if (e.arg >= 0) os << ",\"args\":{\"n\":" << e.arg << '}';
+            os << '}';
+        }
+    }
+    os << "\n],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+    os.flags(flags);
+}
+
+vargas::trace::Session::Session(const std::string &file, size_t capacity) {
+    if (file.empty()) return;
+    _out.open(file);
+    if (!_out.good()) throw std::invalid_argument("Error opening file \"" + file + "\"");
+    start(capacity);
+}
+
+vargas::trace::Session::~Session() {
+    if (!_out.is_open()) return;
+    stop();
+    write_json(_out);
+}
+
+TEST_SUITE("Trace");
+
+TEST_CASE ("Trace events") {
+    using namespace vargas::trace;
+
+    SUBCASE("Ring buffer") {
+        Buffer b(3, 7);
+        for (int i = 0; i < 5; ++i) b.push({"e", uint64_t(i), 1, i});
+        auto ev = b.events();
+        REQUIRE(ev.size() == 3);
+        CHECK(ev[0].arg == 2);
+        CHECK(ev[2].arg == 4);
+        CHECK(b.dropped() == 2);
+        CHECK(b.tid() == 7);
+    }
+
+    SUBCASE("Recording") {
+        CHECK_FALSE(enabled());
+        { VA_TRACE_SCOPE("off"); }
+        start(16);
+        {
+            VA_TRACE_SCOPE("outer", 3);
+            std::thread([] { VA_TRACE_SCOPE("worker"); }).join();
+            { VA_TRACE_SCOPE("inner"); }
+        }
+        stop();
+        { VA_TRACE_SCOPE("off"); }
+
+        std::ostringstream ss;
+        write_json(ss);
+        const std::string js = ss.str();
+        CHECK(js.find("\"off\"") == std::string::npos);
+        CHECK(js.find(R"("name":"outer","ph":"X")") != std::string::npos);
+        CHECK(js.find(R"("args":{"n":3})") != std::string::npos);
+        CHECK(js.find("\"inner\"") != std::string::npos);
+        CHECK(js.find("\"worker\"") != std::string::npos);
+        // The worker exited before this thread recorded, so its buffer was reused
+        CHECK(js.find(R"("tid":1)") == std::string::npos);
+        CHECK(js.find("\"dropped_events\":0") != std::string::npos);
+
+        // Restart invalidates the old buffers
+        start(16);
+        stop();
+        std::ostringstream empty;
+        write_json(empty);
+        CHECK(empty.str().find("\"outer\"") == std::string::npos);
+    }
+}
+
+TEST_SUITE_END();
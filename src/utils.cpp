@@ -37,6 +37,51 @@ std::vector<std::string> rg::split(const std::string &str, const std::string &de
 }
 
 
+long rg::parse_int(str_view s) {
+    const char *p = s.begin();
+    bool neg = false;
+    if (p != s.end() && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    if (p == s.end()) throw std::invalid_argument("Expected an integer: \"" + s.str() + "\"");
+    long ret = 0;
+    for (; p != s.end(); ++p) {
+        if (*p < '0' || *p > '9') throw std::invalid_argument("Expected an integer: \"" + s.str() + "\"");
+        ret = ret * 10 + (*p - '0');
+    }
+    return neg ? -ret : ret;
+}
+
+
+rg::AliasTable::AliasTable(const std::vector<uint64_t> &weights) {
+    long double total = 0;
+    for (auto w : weights) total += w;
+    if (total == 0) return;
+
+    const size_t n = weights.size();
+    _prob.resize(n);
+    _alias.resize(n);
+    std::vector<long double> scaled(n);
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; ++i) {
+        scaled[i] = weights[i] * n / total;
+        (scaled[i] < 1 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const size_t s = small.back(), l = large.back();
+        small.pop_back();
+        _prob[s] = scaled[s];
+        _alias[s] = l;
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Leftovers are 1 up to rounding
+    for (size_t i : large) { _prob[i] = 1; _alias[i] = i; }
+    for (size_t i : small) { _prob[i] = 1; _alias[i] = i; }
+}
+
+
 char rg::guess_delim(const std::string &line) {
     static const std::string options = "\n\t:;,=|/";
     for (const char d : options) {
@@ -94,4 +139,73 @@ TEST_CASE ("Split strings") {
 
 }
 
+TEST_CASE ("Tokenize views") {
+    std::string s("a\tbb\t\t-12");
+    std::vector<rg::str_view> o;
+    rg::tokenize(s, '\t', o);
+    REQUIRE(o.size() == 4);
+    CHECK(o[0].str() == "a");
+    CHECK(o[1].str() == "bb");
+    CHECK(o[2].empty());
+    CHECK(rg::parse_int(o[3]) == -12);
+
+    rg::tokenize(rg::str_view(s.data(), s.data() + 1), '\t', o);
+    REQUIRE(o.size() == 1);
+    CHECK(o[0] == rg::str_view(std::string("a")));
+
+    CHECK(rg::parse_int(std::string("+7")) == 7);
+    CHECK_THROWS(rg::parse_int(std::string("")));
+    CHECK_THROWS(rg::parse_int(std::string("-")));
+    CHECK_THROWS(rg::parse_int(std::string("12a")));
+}
+
+TEST_CASE ("Alias table") {
+    CHECK(rg::AliasTable(std::vector<uint64_t>{0, 0}).empty());
+
+    const std::vector<uint64_t> w = {1, 0, 3, 6};
+    rg::AliasTable t(w);
+    rg::CounterRNG rng(1);
+    std::vector<unsigned> hits(w.size(), 0);
+    const unsigned n = 100000;
+    for (unsigned i = 0; i < n; ++i) ++hits[t(rng)];
+    CHECK(hits[1] == 0);
+    CHECK(std::abs(int(hits[0]) - 10000) < 500);
+    CHECK(std::abs(int(hits[2]) - 30000) < 500);
+    CHECK(std::abs(int(hits[3]) - 60000) < 500);
+}
+
+TEST_CASE ("Reservoir sampling") {
+    auto sample = [](size_t n, size_t total, uint64_t seed) {
+        rg::Reservoir<int> r(n, seed);
+        for (size_t i = 0; i < total; ++i) {
+            int v = i;
+            r.offer(v);
+        }
+        CHECK(r.seen() == total);
+        auto ret = r.items();
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    };
+
+    auto all = sample(10, 5, 1);
+    REQUIRE(all.size() == 5);
+    for (int i = 0; i < 5; ++i) CHECK(all[i] == i);
+
+    auto a = sample(10, 1000, 7);
+    REQUIRE(a.size() == 10);
+    CHECK(std::unique(a.begin(), a.end()) == a.end());
+    CHECK(a == sample(10, 1000, 7));
+    CHECK(a != sample(10, 1000, 8));
+
+    // Every position should be kept about n/total of the time
+    std::vector<unsigned> hits(100, 0);
+    for (uint64_t seed = 0; seed < 2000; ++seed) {
+        for (int v : sample(10, 100, seed)) ++hits[v];
+    }
+    for (unsigned h : hits) {
+        CHECK(h > 120);
+        CHECK(h < 280);
+    }
+}
+
 #endif
\ No newline at end of file